@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Allocation counting for --lock-memory, linked into the executable
+ * only: see memlock.c.
+ *
+ * This file interposes on malloc() and friends (the executable's
+ * definitions take precedence over libc's for every library in the
+ * process), counting each thread's allocations for
+ * GetThreadAllocations().
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "memlock.h"
+
+#if defined(__GLIBC__)
+
+/* glibc's allocator, under the names it exports for interposers. */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+/*
+ * The calling thread's allocation count.  The executable's own TLS
+ * needs no allocation to access, so counting cannot recurse.
+ */
+static __thread unsigned long threadAllocations;
+
+void *malloc(size_t size)
+{
+    threadAllocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    threadAllocations++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    threadAllocations++;
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    threadAllocations++;
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    threadAllocations++;
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **pPtr, size_t alignment, size_t size)
+{
+    void *ptr;
+
+    if ((alignment % sizeof(void *)) != 0 ||
+        (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+
+    threadAllocations++;
+    ptr = __libc_memalign(alignment, size);
+
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+
+    *pPtr = ptr;
+    return 0;
+}
+
+#endif /* __GLIBC__ */
+
+
+/*
+ * Return how many times the calling thread has allocated memory with
+ * malloc(), calloc(), realloc(), or an aligned allocation function;
+ * or -1 if this build can't count them.
+ */
+long GetThreadAllocations(void)
+{
+#if defined(__GLIBC__)
+    return (long) threadAllocations;
+#else
+    return -1;
+#endif
+}
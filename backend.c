@@ -0,0 +1,526 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <xf86drm.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "backend.h"
+#include "device.h"
+#include "egl.h"
+#include "kms.h"
+#include "probecache.h"
+
+/*
+ * Find the GPU and output to display on, as selected by the options.
+ * Return -1 on failure, with the probe released as far as it got.
+ */
+int ProbeDisplay(struct DisplayProbe *pProbe, const struct Options *pOptions)
+{
+    double probeStart;
+
+    pProbe->drmFd = -1;
+    pProbe->pKms = NULL;
+    pProbe->pCache = NULL;
+
+    /* Device discovery is part of the probe, cached or not. */
+    probeStart = GetTime();
+
+    if (pOptions->backendType == BACKEND_GBM) {
+        pProbe->eglDevice = EGL_NO_DEVICE_EXT;
+        pProbe->drmFd = OpenKmsDevice(pOptions);
+    } else {
+        pProbe->eglDevice = GetEglDevice(&pOptions->device);
+        if (pProbe->eglDevice == EGL_NO_DEVICE_EXT) {
+            return -1;
+        }
+        pProbe->drmFd = (pOptions->leaseFd >= 0) ? pOptions->leaseFd :
+            GetDrmFd(pProbe->eglDevice);
+    }
+
+    if (pProbe->drmFd < 0) {
+        return -1;
+    }
+
+    if (!pOptions->noProbeCache) {
+        pProbe->pCache = OpenProbeCache(pProbe->drmFd, pOptions,
+                                        &pProbe->pKms);
+    }
+
+    if (pProbe->pKms != NULL) {
+        printf("Probed the display from the cache in %.3f ms\n",
+               (GetTime() - probeStart) * 1000.0);
+    } else {
+        pProbe->pKms = CreateKmsDisplay(pProbe->drmFd,
+                                        pOptions->device.connectorName);
+        if (pProbe->pKms == NULL) {
+            goto fail;
+        }
+        StoreProbeCacheDisplay(pProbe->pCache, pProbe->pKms);
+        printf("Probed the display in %.3f ms\n",
+               (GetTime() - probeStart) * 1000.0);
+    }
+
+    if (pOptions->colorCorrection.set &&
+        (SetKmsDisplayColor(pProbe->pKms, &pOptions->colorCorrection) != 0)) {
+        goto fail;
+    }
+
+    memset(&pProbe->renderOrientation, 0, sizeof(pProbe->renderOrientation));
+
+    if (!SetKmsDisplayOrientation(pProbe->pKms, &pOptions->orientation)) {
+        Warning("The plane cannot rotate or reflect frames as requested; "
+                "rendering them rotated instead.\n");
+        pProbe->renderOrientation = pOptions->orientation;
+    }
+
+    return 0;
+
+fail:
+    ReleaseDisplayProbe(pProbe);
+    return -1;
+}
+
+
+/*
+ * Restore the display to its state before ProbeDisplay(), and close the
+ * DRM fd, giving up DRM master (or a lease).  Destroy the backends set
+ * up from the DisplayProbe first.  A probe that failed partway, with
+ * pKms NULL or drmFd -1, is released as far as it got.
+ */
+void ReleaseDisplayProbe(struct DisplayProbe *pProbe)
+{
+    if (pProbe->pKms != NULL) {
+        DestroyKmsDisplay(pProbe->pKms);
+    }
+
+    if (pProbe->drmFd >= 0) {
+        close(pProbe->drmFd);
+    }
+
+    CloseProbeCache(pProbe->pCache);
+
+    pProbe->pKms = NULL;
+    pProbe->drmFd = -1;
+    pProbe->pCache = NULL;
+}
+
+
+/*
+ * Set the probed display's mode, and get an EGLDisplay that can present
+ * to it, with its extension functions in 'pEgl'.  Return EGL_NO_DISPLAY
+ * on failure; ReleaseDisplayProbe() restores the mode.
+ */
+EGLDisplay SetUpDisplay(const struct DisplayProbe *pProbe,
+                        struct EglDispatch *pEgl,
+                        uint32_t *pPlaneID, int *pWidth, int *pHeight)
+{
+    EGLDisplay eglDpy;
+    int modesetFenceFd;
+
+    if (SetKmsDisplayMode(pProbe->pKms, &modesetFenceFd) != 0) {
+        return EGL_NO_DISPLAY;
+    }
+
+    /*
+     * Initialize EGL while the modeset completes, and wait for it only
+     * before the plane is handed to an EGLStream consumer.
+     */
+
+    eglDpy = GetEglDisplay(pProbe->eglDevice, pProbe->drmFd, pEgl);
+
+    if (modesetFenceFd >= 0) {
+        if ((eglDpy != EGL_NO_DISPLAY) && (WaitForFence(modesetFenceFd) != 0)) {
+            eglTerminate(eglDpy);
+            eglDpy = EGL_NO_DISPLAY;
+        }
+        close(modesetFenceFd);
+    }
+
+    if (eglDpy == EGL_NO_DISPLAY) {
+        return EGL_NO_DISPLAY;
+    }
+
+    GetKmsDisplayInfo(pProbe->pKms, pPlaneID, pWidth, pHeight);
+
+    return eglDpy;
+}
+
+
+/*
+ * The EGLStream backend: the EGLOutputLayer consumer displays each frame
+ * as it is produced, so presenting is just a swap.
+ *
+ * With flip events (see EnableEglStreamFlipEvents()), the backend
+ * acquires each frame for the consumer itself, asking for a DRM page
+ * flip event when the frame reaches the screen, and so knows when each
+ * one does, as the GBM backend does.
+ */
+
+/* A frame produced into the stream, for flip events. */
+struct StreamFrame {
+    uint64_t serial;
+    uint64_t frameId;
+    double swapEnd;             /* CLOCK_MONOTONIC, like flip events */
+};
+
+struct EglStreamBackend {
+    EGLStreamKHR eglStream;
+    EGLContext eglContext;
+
+    /*
+     * With flip events: the DRM fd they arrive on, the stream's FIFO
+     * length (0 for a mailbox), the frames in the stream not yet
+     * acquired, oldest first, and the frame whose flip is pending.
+     */
+    EGLBoolean flipEvents;
+    int drmFd;
+    EGLint fifoLength;
+    struct StreamFrame queue[MAX_FIFO_LENGTH + 1];
+    int queueLen;
+    struct StreamFrame flipping;
+    int flipPending;
+
+    /*
+     * Set when a frame could not be acquired from StreamFlipHandler(),
+     * which cannot return the error itself.
+     */
+    int acquireFailed;
+
+    /* The Backend presenting, whose statistics the flips go to. */
+    struct Backend *pPresenter;
+};
+
+static int AcquireStreamFrame(struct EglStreamBackend *pStream)
+{
+    struct Backend *pBackend = pStream->pPresenter;
+    EGLAttrib attribs[] = {
+        EGL_DRM_FLIP_EVENT_DATA_NV, (EGLAttrib) pStream,
+        EGL_NONE,
+    };
+    int i;
+
+    if (!pBackend->egl.StreamConsumerAcquireAttribEXT(pBackend->eglDpy,
+                                                      pStream->eglStream,
+                                                      attribs)) {
+        /*
+         * The EGLOutputLayer is still busy with the previous flip; the
+         * frame is acquired once that completes.
+         */
+        if (eglGetError() == EGL_RESOURCE_BUSY_EXT) {
+            return 0;
+        }
+        SetError("Unable to acquire a frame from the EGLStream.\n");
+        return -1;
+    }
+
+    pStream->flipping = pStream->queue[0];
+    pStream->flipPending = 1;
+
+    for (i = 1; i < pStream->queueLen; i++) {
+        pStream->queue[i - 1] = pStream->queue[i];
+    }
+
+    pStream->queueLen--;
+
+    return 0;
+}
+
+
+static void StreamFlipHandler(int fd, unsigned int sequence,
+                              unsigned int tv_sec, unsigned int tv_usec,
+                              void *userData)
+{
+    struct EglStreamBackend *pStream = userData;
+    struct Backend *pBackend = pStream->pPresenter;
+    double flipTime = tv_sec + tv_usec / 1000000.0;
+
+    (void) fd;
+    (void) sequence;
+
+    pStream->flipPending = 0;
+
+    if (pBackend->pStats != NULL) {
+        AddFlipLatencySample(pBackend->pStats, pStream->flipping.swapEnd,
+                             flipTime);
+    }
+
+    if (pBackend->pTelemetry != NULL) {
+        SetTelemetryFlipTime(pBackend->pTelemetry,
+                             pStream->flipping.frameId, flipTime);
+    }
+
+    if (pBackend->pInputLatency != NULL) {
+        SetFrameFlipTime(pBackend->pInputLatency, pStream->flipping.serial,
+                         flipTime);
+    }
+
+    if ((pStream->queueLen > 0) && (AcquireStreamFrame(pStream) != 0)) {
+        pStream->acquireFailed = 1;
+    }
+}
+
+
+/*
+ * Handle any page flip events that arrive within 'timeoutMs'
+ * milliseconds (-1 to wait indefinitely).  Return -1 if that fails, or
+ * if a flip handler could not acquire the next frame.
+ */
+static int DispatchStreamFlipEvents(struct EglStreamBackend *pStream,
+                                    int timeoutMs)
+{
+    drmEventContext eventContext = { 0 };
+    struct pollfd pfd;
+    int ret;
+
+    eventContext.version = 2;
+    eventContext.page_flip_handler = StreamFlipHandler;
+
+    pfd.fd = pStream->drmFd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    do {
+        ret = poll(&pfd, 1, timeoutMs);
+    } while ((ret < 0) && (errno == EINTR));
+
+    if (ret < 0) {
+        SetError("poll(2) on the DRM fd failed: %s.\n", strerror(errno));
+        return -1;
+    }
+
+    if (ret > 0) {
+        drmHandleEvent(pStream->drmFd, &eventContext);
+    }
+
+    if (pStream->acquireFailed) {
+        pStream->acquireFailed = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Make room in the stream's FIFO for another frame.  A full FIFO would
+ * block eglSwapBuffers() until the consumer acquires a frame, and with
+ * flip events, only this backend does that.
+ */
+static int WaitForStreamRoom(struct EglStreamBackend *pStream)
+{
+    while ((pStream->fifoLength > 0) &&
+           (pStream->queueLen >= pStream->fifoLength)) {
+        if (!pStream->flipPending && (AcquireStreamFrame(pStream) != 0)) {
+            return -1;
+        }
+        if (DispatchStreamFlipEvents(pStream,
+                                     pStream->flipPending ? -1 : 1) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int EglStreamPresent(struct Backend *pBackend,
+                            const struct Rect *pDamage)
+{
+    struct EglStreamBackend *pStream = pBackend->priv;
+    struct StreamFrame frame;
+
+    if (pStream->flipEvents) {
+        pStream->pPresenter = pBackend;
+        if ((DispatchStreamFlipEvents(pStream, 0) != 0) ||
+            (WaitForStreamRoom(pStream) != 0)) {
+            return -1;
+        }
+    }
+
+    if (pDamage != NULL) {
+        SwapBuffersWithDamage(&pBackend->egl, pBackend->eglDpy,
+                              pBackend->eglSurface, pDamage, 1);
+    } else {
+        eglSwapBuffers(pBackend->eglDpy, pBackend->eglSurface);
+    }
+
+    if (!pStream->flipEvents) {
+        return 0;
+    }
+
+    frame.serial = pBackend->presentSerial;
+    frame.frameId = pBackend->telemetryFrameId;
+    frame.swapEnd = GetMonotonicTime();
+
+    /* In a mailbox, the new frame replaces any not yet acquired. */
+
+    if ((pStream->fifoLength == 0) && (pStream->queueLen > 0)) {
+        pStream->queue[0] = frame;
+    } else {
+        pStream->queue[pStream->queueLen++] = frame;
+    }
+
+    if (!pStream->flipPending) {
+        return AcquireStreamFrame(pStream);
+    }
+
+    return 0;
+}
+
+
+static int EglStreamGetQueueDepth(struct Backend *pBackend)
+{
+    struct EglStreamBackend *pStream = pBackend->priv;
+
+    if (pStream->flipEvents) {
+        return pStream->queueLen + pStream->flipPending;
+    }
+
+    return GetStreamQueueDepth(&pBackend->egl, pBackend->eglDpy,
+                               pStream->eglStream);
+}
+
+
+static int EglStreamDispatchEvents(struct Backend *pBackend)
+{
+    struct EglStreamBackend *pStream = pBackend->priv;
+
+    pStream->pPresenter = pBackend;
+    return DispatchStreamFlipEvents(pStream, 0);
+}
+
+
+static void EglStreamDestroy(struct Backend *pBackend)
+{
+    struct EglStreamBackend *pStream = pBackend->priv;
+
+    /*
+     * Let the last flip complete, so that its event is not left over,
+     * unless the DRM fd has failed.
+     */
+
+    if (pStream->flipEvents) {
+        pStream->queueLen = 0;
+        while (pStream->flipPending &&
+               (DispatchStreamFlipEvents(pStream, -1) == 0)) {
+        }
+    }
+
+    eglMakeCurrent(pBackend->eglDpy, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                   EGL_NO_CONTEXT);
+    eglDestroySurface(pBackend->eglDpy, pBackend->eglSurface);
+    pBackend->egl.DestroyStreamKHR(pBackend->eglDpy, pStream->eglStream);
+    eglDestroyContext(pBackend->eglDpy, pStream->eglContext);
+    eglTerminate(pBackend->eglDpy);
+
+    free(pStream);
+}
+
+
+/*
+ * Wrap an EGLSurface that produces frames for 'eglStream', whether the
+ * stream's consumer is in this process or another.  The EGLSurface
+ * must be current.  Return -1 on failure, leaving the EGL objects to
+ * the caller.
+ */
+int InitEglStreamBackend(struct Backend *pBackend,
+                         const struct EglDispatch *pEgl,
+                         EGLDisplay eglDpy, EGLSurface eglSurface,
+                         EGLStreamKHR eglStream, int width, int height)
+{
+    struct EglStreamBackend *pStream = calloc(1, sizeof(*pStream));
+
+    if (pStream == NULL) {
+        SetError("Memory allocation failure.\n");
+        return -1;
+    }
+
+    pStream->eglStream = eglStream;
+    pStream->eglContext = eglGetCurrentContext();
+
+    pBackend->name = "eglstream";
+    pBackend->eglDpy = eglDpy;
+    pBackend->egl = *pEgl;
+    pBackend->eglSurface = eglSurface;
+    pBackend->width = width;
+    pBackend->height = height;
+    pBackend->drmFd = -1;
+    memset(&pBackend->kmsOutput, 0, sizeof(pBackend->kmsOutput));
+    pBackend->present = EglStreamPresent;
+    pBackend->getQueueDepth = EglStreamGetQueueDepth;
+    pBackend->eventFd = -1;
+    pBackend->dispatchEvents = NULL;
+    pBackend->destroy = EglStreamDestroy;
+    pBackend->pStats = NULL;
+    pBackend->pTelemetry = NULL;
+    pBackend->pInputLatency = NULL;
+    pBackend->priv = pStream;
+
+    return 0;
+}
+
+
+/*
+ * Have the EGLStream backend acquire frames itself, with page flip
+ * events on 'drmFd', the DRM fd the EGLDisplay was created with.  The
+ * stream must have been created with StreamFlipEventsSupported().
+ */
+void EnableEglStreamFlipEvents(struct Backend *pBackend, int drmFd)
+{
+    struct EglStreamBackend *pStream = pBackend->priv;
+
+    pStream->flipEvents = EGL_TRUE;
+    pStream->drmFd = drmFd;
+    pStream->fifoLength = 0;
+    pStream->pPresenter = pBackend;
+
+    pBackend->egl.QueryStreamKHR(pBackend->eglDpy, pStream->eglStream,
+                                 EGL_STREAM_FIFO_LENGTH_KHR,
+                                 &pStream->fifoLength);
+
+    pBackend->eventFd = drmFd;
+    pBackend->dispatchEvents = EglStreamDispatchEvents;
+}
+
+
+#if !defined(HAVE_GBM)
+int SetUpGbmBackend(struct Backend *pBackend, const struct Options *pOptions,
+                    const struct DisplayProbe *pProbe)
+{
+    (void) pBackend;
+    (void) pOptions;
+    (void) pProbe;
+
+    SetError("GBM support not built; rebuild with GBM=1.\n");
+    return -1;
+}
+#endif
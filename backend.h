@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#if !defined(BACKEND_H)
+#define BACKEND_H
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "kms.h"
+#include "latency.h"
+#include "options.h"
+#include "stats.h"
+#include "telemetry.h"
+#include "utils.h"
+
+/*
+ * What probing found: the display GPU, a DRM fd for it, and the
+ * connector, CRTC, and plane to display on, with what programming them
+ * takes.  Probing takes far longer than setting up a backend, so it is
+ * done once, and a backend can be destroyed and set up again from the
+ * same DisplayProbe.
+ */
+struct DisplayProbe {
+    /* EGL_NO_DEVICE_EXT for the gbm backend, which does not need it. */
+    EGLDeviceEXT eglDevice;
+    int drmFd;
+    struct KmsDisplay *pKms;
+
+    /* The probe cache for the display; NULL if it is not used. */
+    struct ProbeCache *pCache;
+
+    /*
+     * The part of --rotation and --reflect that the plane cannot do,
+     * and the renderer must: all zero if the plane does it all.
+     */
+    struct Orientation renderOrientation;
+};
+
+/*
+ * A way of getting frames rendered to an EGLSurface onto the display.
+ *
+ * After setup, the EGLSurface is current, and sized to the mode.  The
+ * render loop draws to it and calls present(), which replaces
+ * eglSwapBuffers().
+ */
+struct Backend {
+    const char *name;
+
+    EGLDisplay eglDpy;
+    struct EglDispatch egl;
+    EGLSurface eglSurface;
+    int width;
+    int height;
+
+    /*
+     * The DRM device and output presented to.  drmFd is -1 if this
+     * process has no DRM access, e.g., as a render client.
+     */
+    int drmFd;
+    struct KmsOutput kmsOutput;
+
+    /*
+     * Present the frame rendered to the EGLSurface.  If 'pDamage' is
+     * not NULL, only that area changed since the previous frame.
+     * Return -1, with the reason in GetError(), if the display pipeline
+     * has failed and the backend must be set up again.
+     */
+    int (*present)(struct Backend *pBackend, const struct Rect *pDamage);
+
+    /*
+     * Return the number of presented frames that are not yet on
+     * screen.
+     */
+    int (*getQueueDepth)(struct Backend *pBackend);
+
+    /*
+     * A file descriptor that becomes readable when the backend has
+     * events to handle, e.g., page flips completing, and the function
+     * that handles them without blocking; -1 and NULL if the backend
+     * has none.  Present() handles them too, so calling this is only
+     * needed to learn of the events sooner; see eventloop.c.  It fails
+     * as present() does.
+     */
+    int eventFd;
+    int (*dispatchEvents)(struct Backend *pBackend);
+
+    /*
+     * Release everything the backend set up, terminating its
+     * EGLDisplays.  What it was set up from, e.g., a DisplayProbe, is
+     * left intact.
+     */
+    void (*destroy)(struct Backend *pBackend);
+
+    /*
+     * If not NULL, backends that can observe when frames reach the
+     * screen record that here.
+     */
+    struct PresentStats *pStats;
+
+    /*
+     * If not NULL, backends that can observe when frames reach the
+     * screen report that here, for the frame being presented under the
+     * ID telemetryFrameId.
+     */
+    struct Telemetry *pTelemetry;
+    uint64_t telemetryFrameId;
+
+    /*
+     * If not NULL, backends that receive page flip events report the
+     * kernel's timestamp of each flip here, for the frame presented
+     * with the serial presentSerial; see latency.c.
+     */
+    struct InputLatency *pInputLatency;
+    uint64_t presentSerial;
+
+    void *priv;
+};
+
+int ProbeDisplay(struct DisplayProbe *pProbe, const struct Options *pOptions);
+void ReleaseDisplayProbe(struct DisplayProbe *pProbe);
+
+EGLDisplay SetUpDisplay(const struct DisplayProbe *pProbe,
+                        struct EglDispatch *pEgl,
+                        uint32_t *pPlaneID, int *pWidth, int *pHeight);
+
+int InitEglStreamBackend(struct Backend *pBackend,
+                         const struct EglDispatch *pEgl,
+                         EGLDisplay eglDpy, EGLSurface eglSurface,
+                         EGLStreamKHR eglStream, int width, int height);
+void EnableEglStreamFlipEvents(struct Backend *pBackend, int drmFd);
+
+int SetUpGbmBackend(struct Backend *pBackend, const struct Options *pOptions,
+                    const struct DisplayProbe *pProbe);
+
+int InitCrossGpuBackend(struct Backend *pBackend,
+                        const struct Backend *pDisplayBackend,
+                        const struct Options *pOptions);
+
+#endif /* BACKEND_H */
@@ -0,0 +1,26 @@
+#!/bin/sh
+#
+# Compare the EGLStream and GBM/atomic backends: for each backend and
+# present mode, render a fixed number of frames and print throughput,
+# latency, and CPU time statistics.  Requires a GBM=1 build.
+#
+# Run as root from a console, without an X server running, e.g.:
+#
+#   ./benchmarks/backends.sh [FRAMES] [BACKENDS]
+#
+# BACKENDS defaults to "eglstream gbm"; use "gbm" alone on systems
+# without EGLStreams, e.g., Mesa llvmpipe with vkms.
+
+set -e
+
+EXAMPLE="$(dirname "$0")/../eglstreams-kms-example"
+FRAMES="${1:-600}"
+BACKENDS="${2:-eglstream gbm}"
+
+for BACKEND in $BACKENDS; do
+    for MODE in latency balanced throughput; do
+        "$EXAMPLE" --backend="$BACKEND" --present-mode="$MODE" \
+                   --benchmark="$FRAMES"
+        echo
+    done
+done
@@ -0,0 +1,27 @@
+#!/bin/sh
+#
+# Measure the cost of recording frames with --capture: run the present
+# benchmark without capturing, then capturing every INTERVAL-th frame
+# to a temporary file, and compare the two reports.  The capture run
+# also reports its per-frame overhead on the render thread, and how
+# many frames it skipped because every readback buffer was busy.
+#
+# Run as root from a console, without an X server running, e.g.:
+#
+#   ./benchmarks/capture.sh [FRAMES] [INTERVAL] [PRESENT_MODE]
+
+set -e
+
+EXAMPLE="$(dirname "$0")/../eglstreams-kms-example"
+FRAMES="${1:-600}"
+INTERVAL="${2:-1}"
+MODE="${3:-latency}"
+CAPTURE_FILE="$(mktemp)"
+
+trap 'rm -f "$CAPTURE_FILE"' EXIT
+
+"$EXAMPLE" --present-mode="$MODE" --benchmark="$FRAMES"
+echo
+
+"$EXAMPLE" --present-mode="$MODE" --benchmark="$FRAMES" \
+    --capture="$CAPTURE_FILE" --capture-interval="$INTERVAL"
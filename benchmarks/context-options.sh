@@ -0,0 +1,31 @@
+#!/bin/sh
+#
+# Compare the CPU cost per frame of the rendering context options: for
+# each combination, render a fixed number of frames and print the time
+# spent issuing OpenGL commands and the process's CPU time per frame.
+#
+# Run as root from a console, without an X server running, e.g.:
+#
+#   ./benchmarks/context-options.sh [FRAMES] [EXTRA_OPTIONS...]
+#
+# EXTRA_OPTIONS are passed to every run, e.g., --backend=gbm.
+
+set -e
+
+EXAMPLE="$(dirname "$0")/../eglstreams-kms-example"
+FRAMES="${1:-600}"
+[ $# -gt 0 ] && shift
+
+for CONTEXT_OPTIONS in \
+    "" \
+    "--no-error" \
+    "--context-priority=high" \
+    "--context-priority=high --no-error" \
+    "--gpu-animation" \
+    "--core-profile"; do
+
+    echo "Context options: ${CONTEXT_OPTIONS:-(none)}"
+    # shellcheck disable=SC2086
+    "$EXAMPLE" $CONTEXT_OPTIONS --benchmark="$FRAMES" "$@"
+    echo
+done
@@ -0,0 +1,22 @@
+#!/bin/sh
+#
+# Measure the cost of rendering on one GPU and displaying on another:
+# run the present benchmark on the display GPU alone, then again
+# rendering on RENDER_DEVICE, and compare the two reports.
+#
+# Run as root from a console, without an X server running, e.g.:
+#
+#   ./benchmarks/cross-gpu.sh bus:01:00.0 [FRAMES] [PRESENT_MODE]
+
+set -e
+
+EXAMPLE="$(dirname "$0")/../eglstreams-kms-example"
+RENDER_DEVICE="${1:?usage: $0 RENDER_DEVICE [FRAMES] [PRESENT_MODE]}"
+FRAMES="${2:-600}"
+MODE="${3:-latency}"
+
+"$EXAMPLE" --present-mode="$MODE" --benchmark="$FRAMES"
+echo
+
+"$EXAMPLE" --present-mode="$MODE" --benchmark="$FRAMES" \
+    --render-device="$RENDER_DEVICE"
@@ -0,0 +1,29 @@
+#!/bin/sh
+#
+# Measure the cost of splitting the renderer and the display owner into
+# separate processes: run the present benchmark standalone, then again
+# as a render client of a display server, and compare the two reports.
+#
+# Run as root from a console, without an X server running, e.g.:
+#
+#   ./benchmarks/cross-process.sh [FRAMES] [PRESENT_MODE]
+
+set -e
+
+EXAMPLE="$(dirname "$0")/../eglstreams-kms-example"
+FRAMES="${1:-600}"
+MODE="${2:-latency}"
+SOCKET="${XDG_RUNTIME_DIR:-/tmp}/eglstreams-kms-example.sock"
+
+"$EXAMPLE" --present-mode="$MODE" --benchmark="$FRAMES"
+echo
+
+"$EXAMPLE" --present-mode="$MODE" --server="$SOCKET" &
+SERVER=$!
+trap 'kill $SERVER 2>/dev/null' EXIT
+
+while [ ! -S "$SOCKET" ]; do
+    sleep 0.1
+done
+
+"$EXAMPLE" --client="$SOCKET" --benchmark="$FRAMES"
@@ -0,0 +1,24 @@
+#!/bin/sh
+#
+# Measure what --event-loop saves: run the present benchmark in the
+# mailbox (latency) present mode with each backend, with and without
+# it.  Compare the CPU time each reports, and the frame rate: without
+# the event loop, frames are rendered as fast as the GPU allows, most
+# of them never shown; with it, about one per refresh.
+#
+# Run from a console, without an X server running, e.g.:
+#
+#   ./benchmarks/event-loop.sh [FRAMES]
+
+set -e
+
+EXAMPLE="$(dirname "$0")/../eglstreams-kms-example"
+FRAMES="${1:-600}"
+
+for backend in eglstream gbm; do
+    for loop in "" --event-loop; do
+        "$EXAMPLE" --backend="$backend" --present-mode=latency \
+            --benchmark="$FRAMES" $loop
+        echo
+    done
+done
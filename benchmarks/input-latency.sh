@@ -0,0 +1,25 @@
+#!/bin/sh
+#
+# Measure input-to-photon latency with each backend and present mode:
+# a virtual uinput keyboard presses a key RATE times a second, and each
+# run reports the time from each press to the page flip that first
+# shows it.
+#
+# Run as root (for /dev/uinput) from a console, without an X server
+# running, e.g.:
+#
+#   ./benchmarks/input-latency.sh [FRAMES] [RATE]
+
+set -e
+
+EXAMPLE="$(dirname "$0")/../eglstreams-kms-example"
+FRAMES="${1:-1200}"
+RATE="${2:-10}"
+
+for backend in eglstream gbm; do
+    for mode in latency balanced throughput; do
+        "$EXAMPLE" --backend="$backend" --present-mode="$mode" \
+            --benchmark="$FRAMES" --virtual-input="$RATE"
+        echo
+    done
+done
@@ -0,0 +1,27 @@
+#!/bin/sh
+#
+# Measure how much input-to-photon latency --late-latch saves: a
+# virtual uinput keyboard presses a key RATE times a second, and each
+# backend runs with and without late latching, reporting the time from
+# each press to the page flip that first shows it, and how many presses
+# were late-latched, arriving after the frame's draw calls were
+# submitted but before the GPU reached them.
+#
+# Run as root (for /dev/uinput) from a console, without an X server
+# running, e.g.:
+#
+#   ./benchmarks/late-latch.sh [FRAMES] [RATE]
+
+set -e
+
+EXAMPLE="$(dirname "$0")/../eglstreams-kms-example"
+FRAMES="${1:-1200}"
+RATE="${2:-10}"
+
+for backend in eglstream gbm; do
+    for latch in "" --late-latch; do
+        "$EXAMPLE" --backend="$backend" --core-profile \
+            --benchmark="$FRAMES" --virtual-input="$RATE" $latch
+        echo
+    done
+done
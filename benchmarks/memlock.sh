@@ -0,0 +1,27 @@
+#!/bin/sh
+#
+# Measure what --lock-memory buys the render loop: run the present
+# benchmark with each backend, with and without it, dropping the page
+# cache before each run so that code and data the loop has not touched
+# yet must be faulted back in.  Compare the frame interval maxima, and
+# the allocations, page faults, and over-budget frames that each
+# reports.
+#
+# Run as root (for drop_caches and mlockall()) from a console, without
+# an X server running, e.g.:
+#
+#   ./benchmarks/memlock.sh [FRAMES]
+
+set -e
+
+EXAMPLE="$(dirname "$0")/../eglstreams-kms-example"
+FRAMES="${1:-600}"
+
+for backend in eglstream gbm; do
+    for lock in "" --lock-memory; do
+        sync
+        echo 3 > /proc/sys/vm/drop_caches
+        "$EXAMPLE" --backend="$backend" --benchmark="$FRAMES" $lock
+        echo
+    done
+done
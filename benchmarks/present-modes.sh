@@ -0,0 +1,20 @@
+#!/bin/sh
+#
+# Compare the EGLStream present modes: for each mode, render a fixed
+# number of frames and print throughput and latency statistics.
+#
+# Run as root from a console, without an X server running, e.g.:
+#
+#   ./benchmarks/present-modes.sh [FRAMES] [THROUGHPUT_FIFO_LENGTH]
+
+set -e
+
+EXAMPLE="$(dirname "$0")/../eglstreams-kms-example"
+FRAMES="${1:-600}"
+FIFO_LENGTH="${2:-3}"
+
+for MODE in latency balanced throughput; do
+    "$EXAMPLE" --present-mode="$MODE" --fifo-length="$FIFO_LENGTH" \
+               --benchmark="$FRAMES"
+    echo
+done
@@ -0,0 +1,35 @@
+#!/bin/sh
+#
+# Measure how much real-time scheduling and CPU pinning protect the
+# render loop from background load: run the present benchmark while a
+# CPU hog runs on every CPU, first at normal priority, then pinned to
+# RENDER_CPUS with SCHED_FIFO and everything else on HELPER_CPUS.
+# Compare the frame interval maxima, and the involuntary context
+# switches and preempted frames that each report counts.
+#
+# For the best results, boot with RENDER_CPUS isolated (e.g.,
+# isolcpus=3).  Run as root from a console, without an X server
+# running, e.g.:
+#
+#   ./benchmarks/realtime.sh [FRAMES] [RENDER_CPUS] [HELPER_CPUS]
+
+set -e
+
+EXAMPLE="$(dirname "$0")/../eglstreams-kms-example"
+FRAMES="${1:-600}"
+RENDER_CPUS="${2:-3}"
+HELPER_CPUS="${3:-0-2}"
+HOGS=""
+
+trap 'kill $HOGS 2>/dev/null' EXIT
+
+for i in $(seq "$(nproc)"); do
+    sh -c 'while :; do :; done' &
+    HOGS="$HOGS $!"
+done
+
+"$EXAMPLE" --benchmark="$FRAMES"
+echo
+
+"$EXAMPLE" --benchmark="$FRAMES" --render-cpus="$RENDER_CPUS" \
+    --helper-cpus="$HELPER_CPUS" --sched=fifo
@@ -0,0 +1,570 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Asynchronous frame capture.
+ *
+ * Reading a frame back with glReadPixels() into client memory waits
+ * for the GPU to finish rendering it, which drains the pipeline every
+ * captured frame.  Instead, each captured frame is read into a pixel
+ * buffer object (PBO), which only queues a copy on the GPU, followed
+ * by a fence:
+ *
+ *   FREE --glReadPixels()--> READING --fence signaled, mapped--> MAPPED
+ *     ^                                                            |
+ *     +------ unmapped <------ WRITTEN <-- copied by the writer ---+
+ *
+ * Each frame, CaptureFrame() polls the fences of earlier readbacks
+ * without blocking, maps the PBOs whose copies are done, and hands the
+ * mappings to a writer thread, which copies them into the output file
+ * through a shared mapping of it; once written, the render thread
+ * unmaps them.  The slots are used in order, as a ring.  If every slot
+ * is busy when a frame is due, because the GPU or the writer is
+ * behind, that frame is skipped rather than waited for.
+ *
+ * A frame that cannot be mapped, or written once the file cannot grow,
+ * is lost with a warning; capturing never ends the render loop.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* PBOs and fences are OpenGL 3.2 entry points, which libOpenGL exports. */
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include "capture.h"
+#include "stats.h"
+#include "utils.h"
+
+/* Readbacks that may be in progress at once. */
+#define CAPTURE_RING_SIZE 4
+
+/* How much of the output file to map at a time. */
+#define CAPTURE_MAP_WINDOW (64 * 1024 * 1024)
+
+enum CaptureSlotState {
+    CAPTURE_SLOT_FREE,
+    CAPTURE_SLOT_READING,       /* glReadPixels() queued; 'fence' pending */
+    CAPTURE_SLOT_MAPPED,        /* mapped, and queued for the writer */
+    CAPTURE_SLOT_WRITTEN,       /* in the file; waiting to be unmapped */
+};
+
+struct CaptureSlot {
+    enum CaptureSlotState state;
+    GLuint pbo;
+    GLsync fence;
+    const void *pixels;
+    struct CaptureRecordHeader header;
+};
+
+struct Capture {
+    const char *path;
+    int interval;
+
+    /* The PBO ring, for the current context; see AttachCapture(). */
+    int attached;
+    int width, height;
+    struct CaptureSlot slots[CAPTURE_RING_SIZE];
+    int oldest;                 /* the oldest slot in use */
+    int inUse;                  /* slots in use, from 'oldest' on */
+
+    /*
+     * The writer thread, and the state it shares with the render
+     * thread: 'state' of each slot, from MAPPED on, and 'stopping'.
+     */
+    pthread_t writer;
+    pthread_mutex_t mutex;
+    pthread_cond_t mappedCond;
+    pthread_cond_t writtenCond;
+    int writeNext;              /* the next slot the writer copies */
+    int stopping;
+
+    /* The output file; only the writer uses these after StartCapture(). */
+    int fd;
+    size_t fileSize;            /* bytes of records written */
+    char *pMap;                 /* mapping of [mapStart, mapEnd) */
+    size_t mapStart;
+    size_t mapEnd;
+
+    int captured;
+    int skipped;
+    int lost;                   /* by the writer, once 'writeFailed' */
+    int writeFailed;
+    struct Stat overhead;       /* CaptureFrame() time per frame, in ms */
+};
+
+
+/*
+ * Return a pointer to 'size' bytes at the end of the output file,
+ * growing the file and moving the mapping window as needed; NULL on
+ * failure.
+ */
+static char *ReserveFileSpace(struct Capture *pCapture, size_t size)
+{
+    size_t offset = pCapture->fileSize;
+    size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    size_t start, length;
+
+    if (offset + size <= pCapture->mapEnd) {
+        return pCapture->pMap + (offset - pCapture->mapStart);
+    }
+
+    if (pCapture->pMap != NULL) {
+        munmap(pCapture->pMap, pCapture->mapEnd - pCapture->mapStart);
+        pCapture->pMap = NULL;
+    }
+
+    start = offset & ~(pageSize - 1);
+    length = offset + size - start;
+
+    if (length < CAPTURE_MAP_WINDOW) {
+        length = CAPTURE_MAP_WINDOW;
+    }
+    length = (length + pageSize - 1) & ~(pageSize - 1);
+
+    if (ftruncate(pCapture->fd, start + length) != 0) {
+        Warning("Unable to grow %s: %s.\n", pCapture->path, strerror(errno));
+        return NULL;
+    }
+
+    pCapture->pMap = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED,
+                          pCapture->fd, start);
+
+    if (pCapture->pMap == MAP_FAILED) {
+        Warning("Unable to map %s: %s.\n", pCapture->path, strerror(errno));
+        pCapture->pMap = NULL;
+        pCapture->mapStart = pCapture->mapEnd = 0;
+        return NULL;
+    }
+
+    pCapture->mapStart = start;
+    pCapture->mapEnd = start + length;
+
+    return pCapture->pMap + (offset - start);
+}
+
+
+/*
+ * Append the slot's frame to the output file.  A slot that could not be
+ * mapped, or any slot once the file could not grow, is counted as lost
+ * instead.
+ */
+static void WriteRecord(struct Capture *pCapture,
+                        const struct CaptureSlot *pSlot)
+{
+    size_t imageSize = (size_t) pSlot->header.stride * pSlot->header.height;
+    char *pDst = NULL;
+
+    if ((pSlot->pixels != NULL) && !pCapture->writeFailed) {
+        pDst = ReserveFileSpace(pCapture, sizeof(pSlot->header) + imageSize);
+
+        if (pDst == NULL) {
+            Warning("Frame capture stopped; frames from %u on are lost.\n",
+                    pSlot->header.frame);
+            pCapture->writeFailed = 1;
+        }
+    }
+
+    if (pDst == NULL) {
+        pCapture->lost++;
+        return;
+    }
+
+    memcpy(pDst, &pSlot->header, sizeof(pSlot->header));
+    memcpy(pDst + sizeof(pSlot->header), pSlot->pixels, imageSize);
+
+    pCapture->fileSize += sizeof(pSlot->header) + imageSize;
+}
+
+
+/*
+ * Copy mapped slots into the output file, in ring order, until
+ * StopCapture() is called and every mapped slot is written.
+ */
+static void *CaptureWriterThread(void *data)
+{
+    struct Capture *pCapture = data;
+
+    pthread_mutex_lock(&pCapture->mutex);
+
+    while (1) {
+        struct CaptureSlot *pSlot = &pCapture->slots[pCapture->writeNext];
+
+        if (pSlot->state != CAPTURE_SLOT_MAPPED) {
+            if (pCapture->stopping) {
+                break;
+            }
+            pthread_cond_wait(&pCapture->mappedCond, &pCapture->mutex);
+            continue;
+        }
+
+        pthread_mutex_unlock(&pCapture->mutex);
+
+        WriteRecord(pCapture, pSlot);
+
+        pthread_mutex_lock(&pCapture->mutex);
+
+        pSlot->state = CAPTURE_SLOT_WRITTEN;
+        pCapture->writeNext = (pCapture->writeNext + 1) % CAPTURE_RING_SIZE;
+
+        pthread_cond_signal(&pCapture->writtenCond);
+    }
+
+    pthread_mutex_unlock(&pCapture->mutex);
+
+    return NULL;
+}
+
+
+/*
+ * Create the output file, and start the writer thread.  Call
+ * AttachCapture() once a context is current to capture from it.
+ * Return NULL on failure.
+ */
+struct Capture *StartCapture(const char *path, int interval)
+{
+    struct Capture *pCapture = calloc(1, sizeof(*pCapture));
+
+    if (pCapture == NULL) {
+        SetError("Memory allocation failure.\n");
+        return NULL;
+    }
+
+    pCapture->path = path;
+    pCapture->interval = interval;
+    ResetStat(&pCapture->overhead);
+
+    pCapture->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (pCapture->fd < 0) {
+        SetError("Unable to create %s: %s.\n", path, strerror(errno));
+        free(pCapture);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pCapture->mutex, NULL);
+    pthread_cond_init(&pCapture->mappedCond, NULL);
+    pthread_cond_init(&pCapture->writtenCond, NULL);
+
+    if (pthread_create(&pCapture->writer, NULL,
+                       CaptureWriterThread, pCapture) != 0) {
+        SetError("Unable to start the capture writer thread.\n");
+        pthread_mutex_destroy(&pCapture->mutex);
+        pthread_cond_destroy(&pCapture->mappedCond);
+        pthread_cond_destroy(&pCapture->writtenCond);
+        close(pCapture->fd);
+        free(pCapture);
+        return NULL;
+    }
+
+    return pCapture;
+}
+
+
+/*
+ * PBOs need OpenGL 2.1, and fences OpenGL 3.2 or ARB_sync; a
+ * compatibility context of a lower version may still have both, but
+ * the version is the portable test.
+ */
+static int CaptureSupported(void)
+{
+    const char *version = (const char *) glGetString(GL_VERSION);
+    int major, minor;
+
+    if ((version == NULL) || (sscanf(version, "%d.%d", &major, &minor) != 2)) {
+        return 0;
+    }
+
+    return (major > 3) || ((major == 3) && (minor >= 2));
+}
+
+
+/*
+ * Create the PBO ring in the current context, for frames of the given
+ * size.
+ */
+void AttachCapture(struct Capture *pCapture, int width, int height)
+{
+    GLsizeiptr imageSize = (GLsizeiptr) width * height * 4;
+    int i;
+
+    if (!CaptureSupported()) {
+        Warning("Frame capture requires OpenGL 3.2; not capturing.\n");
+        return;
+    }
+
+    pCapture->width = width;
+    pCapture->height = height;
+    pCapture->oldest = 0;
+    pCapture->inUse = 0;
+
+    pthread_mutex_lock(&pCapture->mutex);
+    pCapture->writeNext = 0;
+    pthread_mutex_unlock(&pCapture->mutex);
+
+    for (i = 0; i < CAPTURE_RING_SIZE; i++) {
+        struct CaptureSlot *pSlot = &pCapture->slots[i];
+
+        pSlot->state = CAPTURE_SLOT_FREE;
+
+        glGenBuffers(1, &pSlot->pbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pSlot->pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, imageSize, NULL, GL_STREAM_READ);
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    pCapture->attached = 1;
+}
+
+
+/*
+ * Map a slot whose readback is complete, and queue it for the writer.
+ * If it cannot be mapped, the writer still takes it, as lost.
+ */
+static void MapSlot(struct Capture *pCapture, struct CaptureSlot *pSlot)
+{
+    size_t imageSize = (size_t) pSlot->header.stride * pSlot->header.height;
+    const void *pixels;
+
+    glDeleteSync(pSlot->fence);
+    pSlot->fence = NULL;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pSlot->pbo);
+    pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, imageSize,
+                              GL_MAP_READ_BIT);
+
+    if (pixels == NULL) {
+        Warning("Unable to map the capture of frame %u; it is lost.\n",
+                pSlot->header.frame);
+    }
+
+    pthread_mutex_lock(&pCapture->mutex);
+    pSlot->pixels = pixels;
+    pSlot->state = CAPTURE_SLOT_MAPPED;
+    pthread_cond_signal(&pCapture->mappedCond);
+    pthread_mutex_unlock(&pCapture->mutex);
+}
+
+
+/*
+ * Advance the ring without blocking: map the slots whose readbacks are
+ * done, and unmap, from the oldest on, the slots already written.
+ * The PIXEL_PACK_BUFFER binding is left to the caller to restore.
+ */
+static void PollSlots(struct Capture *pCapture)
+{
+    int i;
+
+    for (i = 0; i < pCapture->inUse; i++) {
+        struct CaptureSlot *pSlot =
+            &pCapture->slots[(pCapture->oldest + i) % CAPTURE_RING_SIZE];
+        GLenum status;
+
+        if (pSlot->state != CAPTURE_SLOT_READING) {
+            continue;
+        }
+
+        /* Readbacks complete in order, so stop at the first pending. */
+        status = glClientWaitSync(pSlot->fence, 0, 0);
+
+        if ((status != GL_ALREADY_SIGNALED) &&
+            (status != GL_CONDITION_SATISFIED)) {
+            break;
+        }
+
+        MapSlot(pCapture, pSlot);
+    }
+
+    while (pCapture->inUse > 0) {
+        struct CaptureSlot *pSlot = &pCapture->slots[pCapture->oldest];
+        enum CaptureSlotState state;
+
+        pthread_mutex_lock(&pCapture->mutex);
+        state = pSlot->state;
+        pthread_mutex_unlock(&pCapture->mutex);
+
+        if (state != CAPTURE_SLOT_WRITTEN) {
+            break;
+        }
+
+        if (pSlot->pixels != NULL) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pSlot->pbo);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+
+        pSlot->pixels = NULL;
+        pSlot->state = CAPTURE_SLOT_FREE;
+
+        pCapture->oldest = (pCapture->oldest + 1) % CAPTURE_RING_SIZE;
+        pCapture->inUse--;
+    }
+}
+
+
+/*
+ * Call once per frame, after drawing it and before presenting it: poll
+ * earlier readbacks, and, every 'interval' frames, queue a readback of
+ * the back buffer.  Never waits for the GPU or the writer.
+ */
+void CaptureFrame(struct Capture *pCapture, int frame)
+{
+    double start = GetTime();
+
+    if (!pCapture->attached) {
+        return;
+    }
+
+    PollSlots(pCapture);
+
+    if ((frame % pCapture->interval) == 0) {
+        if (pCapture->inUse < CAPTURE_RING_SIZE) {
+            struct CaptureSlot *pSlot =
+                &pCapture->slots[(pCapture->oldest + pCapture->inUse) %
+                                 CAPTURE_RING_SIZE];
+
+            memcpy(pSlot->header.magic, CAPTURE_MAGIC,
+                   sizeof(pSlot->header.magic));
+            pSlot->header.headerSize = sizeof(pSlot->header);
+            pSlot->header.frame = frame;
+            pSlot->header.width = pCapture->width;
+            pSlot->header.height = pCapture->height;
+            pSlot->header.stride = pCapture->width * 4;
+            pSlot->header.timeNs = (uint64_t) (start * 1e9);
+
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pSlot->pbo);
+            glReadPixels(0, 0, pCapture->width, pCapture->height,
+                         GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+            pSlot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            pSlot->state = CAPTURE_SLOT_READING;
+
+            pCapture->inUse++;
+            pCapture->captured++;
+        } else {
+            pCapture->skipped++;
+        }
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    AddStatSample(&pCapture->overhead, (GetTime() - start) * 1000.0);
+}
+
+
+/*
+ * Finish the readbacks in progress, wait for the writer to write them,
+ * and delete the PBO ring.  Call with the context passed to
+ * AttachCapture() current, before destroying it.
+ */
+void DetachCapture(struct Capture *pCapture)
+{
+    int i;
+
+    if (!pCapture->attached) {
+        return;
+    }
+
+    for (i = 0; i < pCapture->inUse; i++) {
+        struct CaptureSlot *pSlot =
+            &pCapture->slots[(pCapture->oldest + i) % CAPTURE_RING_SIZE];
+
+        if (pSlot->state == CAPTURE_SLOT_READING) {
+            glClientWaitSync(pSlot->fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                             GL_TIMEOUT_IGNORED);
+            MapSlot(pCapture, pSlot);
+        }
+    }
+
+    pthread_mutex_lock(&pCapture->mutex);
+    for (i = 0; i < pCapture->inUse; i++) {
+        struct CaptureSlot *pSlot =
+            &pCapture->slots[(pCapture->oldest + i) % CAPTURE_RING_SIZE];
+
+        while (pSlot->state == CAPTURE_SLOT_MAPPED) {
+            pthread_cond_wait(&pCapture->writtenCond, &pCapture->mutex);
+        }
+    }
+    pthread_mutex_unlock(&pCapture->mutex);
+
+    PollSlots(pCapture);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    for (i = 0; i < CAPTURE_RING_SIZE; i++) {
+        glDeleteBuffers(1, &pCapture->slots[i].pbo);
+        pCapture->slots[i].pbo = 0;
+    }
+
+    pCapture->attached = 0;
+}
+
+
+/*
+ * Stop the writer thread, truncate the output file to the records
+ * written, and report what was captured and what it cost the render
+ * loop.
+ */
+void StopCapture(struct Capture *pCapture)
+{
+    pthread_mutex_lock(&pCapture->mutex);
+    pCapture->stopping = 1;
+    pthread_cond_signal(&pCapture->mappedCond);
+    pthread_mutex_unlock(&pCapture->mutex);
+
+    pthread_join(pCapture->writer, NULL);
+
+    if (pCapture->pMap != NULL) {
+        munmap(pCapture->pMap, pCapture->mapEnd - pCapture->mapStart);
+    }
+
+    if (ftruncate(pCapture->fd, pCapture->fileSize) != 0) {
+        Warning("Unable to truncate %s: %s.\n", pCapture->path,
+                strerror(errno));
+    }
+
+    close(pCapture->fd);
+
+    printf("Captured %d frames to %s (%zu bytes); skipped %d with all "
+           "%d buffers busy\n", pCapture->captured - pCapture->lost,
+           pCapture->path, pCapture->fileSize, pCapture->skipped,
+           CAPTURE_RING_SIZE);
+
+    if (pCapture->lost > 0) {
+        Warning("%d captured frames were lost.\n", pCapture->lost);
+    }
+    PrintStat("capture overhead", &pCapture->overhead, "ms/frame");
+    fflush(stdout);
+
+    pthread_mutex_destroy(&pCapture->mutex);
+    pthread_cond_destroy(&pCapture->mappedCond);
+    pthread_cond_destroy(&pCapture->writtenCond);
+
+    free(pCapture);
+}
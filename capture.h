@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#if !defined(CAPTURE_H)
+#define CAPTURE_H
+
+#include <stdint.h>
+
+/*
+ * Record every Nth displayed frame to a file, without stalling the
+ * render loop; see capture.c.
+ *
+ * The file is a sequence of records, each a CaptureRecordHeader
+ * followed by the frame's pixels: 'height' rows of 'stride' bytes, in
+ * BGRA order with 8 bits per channel, bottom row first (as
+ * glReadPixels() returns them).
+ */
+
+#define CAPTURE_MAGIC "EKCF"
+
+struct CaptureRecordHeader {
+    char magic[4];              /* CAPTURE_MAGIC */
+    uint32_t headerSize;        /* sizeof(struct CaptureRecordHeader) */
+    uint32_t frame;             /* frame number within the render loop */
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;            /* bytes per row */
+    uint64_t timeNs;            /* GetTime() when the frame was drawn */
+};
+
+struct Capture;
+
+struct Capture *StartCapture(const char *path, int interval);
+void AttachCapture(struct Capture *pCapture, int width, int height);
+void CaptureFrame(struct Capture *pCapture, int frame);
+void DetachCapture(struct Capture *pCapture);
+void StopCapture(struct Capture *pCapture);
+
+#endif /* CAPTURE_H */
@@ -0,0 +1,1624 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * A minimal Wayland compositor for EGLStream clients.
+ *
+ * With EGL_WL_bind_wayland_display, the EGL implementation provides the
+ * Wayland protocol through which clients create EGLStream-backed
+ * wl_buffers.  EGL_WL_wayland_eglstream then lets the compositor create
+ * the consumer end of a client's EGLStream from the wl_buffer's
+ * wl_resource, through eglCreateStreamAttribNV().
+ *
+ * Each client stream gets one of two consumers:
+ *
+ * - If the client's surface covers the whole mode and a KMS overlay
+ *   plane is free, the stream is consumed by that plane's
+ *   EGLOutputLayer: client frames go straight to scanout, and the
+ *   compositor does no per-frame GPU work for them.
+ *
+ * - Otherwise, the stream is consumed as an external GL texture, and
+ *   the compositor draws it into its own EGLStream on the primary
+ *   plane.
+ *
+ * The consumer is chosen when the client attaches the buffer, and
+ * kept for the buffer's lifetime.
+ *
+ * With EGL_EXT_stream_acquire_mode and EGL_NV_output_drm_flip_event,
+ * the compositor acquires the frames of every EGLOutputLayer consumer
+ * itself, its own and direct-scanout clients', with a DRM page flip
+ * event for each.  A surface's frame callbacks are completed, and its
+ * commit-to-present latency measured, when the flip that shows its
+ * commit does.  So clients are throttled to the refresh rate either
+ * way.  Without those extensions, frame callbacks are completed once
+ * the commit has been handed to the display, and no latency is
+ * measured.
+ *
+ * Only the core wl_compositor and xdg_wm_base toplevels are
+ * implemented; there is no input, and surface damage is ignored, as
+ * every frame is composited or scanned out whole.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <wayland-server.h>
+
+#include <xf86drm.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <GL/gl.h>
+
+#include "xdg-shell-server-protocol.h"
+
+#include "compositor.h"
+#include "egl.h"
+#include "kms.h"
+#include "stats.h"
+#include "utils.h"
+
+/* XXX khronos eglext.h does not yet have EGL_WL_bind_wayland_display */
+#if !defined(EGL_WL_bind_wayland_display)
+#define EGL_WAYLAND_BUFFER_WL                   0x31D5
+#define EGL_TEXTURE_EXTERNAL_WL                 0x31DA
+#define EGL_WAYLAND_Y_INVERTED_WL               0x31DB
+typedef EGLBoolean (EGLAPIENTRYP PFNEGLBINDWAYLANDDISPLAYWLPROC)
+    (EGLDisplay dpy, struct wl_display *display);
+typedef EGLBoolean (EGLAPIENTRYP PFNEGLQUERYWAYLANDBUFFERWLPROC)
+    (EGLDisplay dpy, struct wl_resource *buffer,
+     EGLint attribute, EGLint *value);
+#endif
+
+/* XXX khronos eglext.h does not yet have EGL_NV_stream_attrib */
+#if !defined(EGL_NV_stream_attrib)
+typedef EGLStreamKHR (EGLAPIENTRYP PFNEGLCREATESTREAMATTRIBNVPROC)
+    (EGLDisplay dpy, const EGLAttrib *attrib_list);
+#endif
+
+/* XXX khronos eglext.h does not yet have EGL_WL_wayland_eglstream */
+#if !defined(EGL_WAYLAND_EGLSTREAM_WL)
+#define EGL_WAYLAND_EGLSTREAM_WL                0x334B
+#endif
+
+#if !defined(GL_TEXTURE_EXTERNAL_OES)
+#define GL_TEXTURE_EXTERNAL_OES                 0x8D65
+#endif
+
+#define MAX_OVERLAY_PLANES 4
+
+/* Offset between successive composited windows. */
+#define WINDOW_CASCADE_STEP 32
+
+/* How often to print each client's present latency, in seconds. */
+#define LATENCY_REPORT_INTERVAL 5.0
+
+struct Compositor;
+struct Surface;
+
+/*
+ * The user data of a page flip event: the direct-scanout surface whose
+ * frame flipped, or NULL for the compositor's own frame, and whether
+ * that flip is still to come.
+ */
+struct FlipTarget {
+    struct Compositor *pCompositor;
+    struct Surface *pSurface;
+    int pending;
+};
+
+struct Compositor {
+    const struct Options *pOptions;
+    int drmFd;
+
+    struct wl_display *wlDisplay;
+
+    EGLDisplay eglDpy;
+    struct EglDispatch egl;
+    EGLSurface eglSurface;
+    EGLStreamKHR eglStream;
+    uint32_t primaryPlaneID;
+
+    /* The extension functions only the compositor uses. */
+    PFNEGLBINDWAYLANDDISPLAYWLPROC pEglBindWaylandDisplayWL;
+    PFNEGLQUERYWAYLANDBUFFERWLPROC pEglQueryWaylandBufferWL;
+    PFNEGLCREATESTREAMATTRIBNVPROC pEglCreateStreamAttribNV;
+    PFNEGLSTREAMCONSUMERGLTEXTUREEXTERNALKHRPROC
+        pEglStreamConsumerGLTextureExternalKHR;
+    PFNEGLSTREAMCONSUMERACQUIREKHRPROC pEglStreamConsumerAcquireKHR;
+    PFNEGLQUERYSTREAMKHRPROC pEglQueryStreamKHR;
+    int width;
+    int height;
+
+    uint32_t overlayPlaneIDs[MAX_OVERLAY_PLANES];
+    int overlayPlaneInUse[MAX_OVERLAY_PLANES];
+    uint32_t overlayBlankFbs[MAX_OVERLAY_PLANES];
+    int numOverlayPlanes;
+
+    struct wl_list surfaces;
+    int numSurfacesCreated;
+    int needsRedraw;
+    double lastLatencyReport;
+
+    /*
+     * Whether frames are acquired with flip events on drmFd; the flip
+     * of the compositor's own frame; and whether a redraw waits for a
+     * flip to complete.
+     */
+    EGLBoolean flipEvents;
+    struct FlipTarget flip;
+    int redrawDeferred;
+};
+
+struct Surface {
+    struct Compositor *pCompositor;
+    struct wl_resource *resource;
+    struct wl_resource *xdgSurface;
+    struct wl_resource *xdgToplevel;
+    struct wl_list link;
+
+    /* State set by requests, applied on wl_surface.commit. */
+    struct {
+        int attached;
+        struct wl_resource *buffer;
+        struct wl_list frameCallbacks;
+    } pending;
+
+    /* The committed buffer and the stream consuming it. */
+    struct wl_resource *buffer;
+    struct wl_listener bufferDestroyListener;
+    EGLStreamKHR eglStream;
+    int width;
+    int height;
+    int yInverted;
+    int overlayIndex;
+    GLuint texture;
+    int hasFrame;
+
+    int x;
+    int y;
+
+    /* Committed frame callbacks, for the next frame to show. */
+    struct wl_list frameCallbacks;
+
+    /*
+     * Time (CLOCK_MONOTONIC) of the first commit not yet in a frame on
+     * its way to the screen, or negative if there is none.
+     */
+    double commitTime;
+
+    /*
+     * The frame callbacks, and time of the first commit, of the frame
+     * on its way to the screen; see QueueFrameCallbacks().  The
+     * commit time is negative if the frame's latency is not measured.
+     */
+    struct wl_list flipCallbacks;
+    double flipCommitTime;
+
+    /* With flip events, the flip of a direct-scanout frame. */
+    struct FlipTarget flip;
+
+    struct Stat latency;
+    pid_t pid;
+};
+
+static void GetCompositorFunctionPointers(struct Compositor *pCompositor)
+{
+    const char *extensionString =
+        eglQueryString(pCompositor->eglDpy, EGL_EXTENSIONS);
+
+    /*
+     * EGL_WL_bind_wayland_display provides the client-facing Wayland
+     * protocol, EGL_WL_wayland_eglstream and EGL_NV_stream_attrib turn
+     * a client's wl_buffer into an EGLStream, and
+     * EGL_KHR_stream_consumer_gltexture lets us composite it.
+     */
+
+    if (!ExtensionIsSupported(extensionString,
+                              "EGL_WL_bind_wayland_display")) {
+        Fatal("EGL_WL_bind_wayland_display not found.\n");
+    }
+
+    if (!ExtensionIsSupported(extensionString, "EGL_WL_wayland_eglstream")) {
+        Fatal("EGL_WL_wayland_eglstream not found.\n");
+    }
+
+    if (!ExtensionIsSupported(extensionString, "EGL_NV_stream_attrib")) {
+        Fatal("EGL_NV_stream_attrib not found.\n");
+    }
+
+    if (!ExtensionIsSupported(extensionString,
+                              "EGL_KHR_stream_consumer_gltexture")) {
+        Fatal("EGL_KHR_stream_consumer_gltexture not found.\n");
+    }
+
+    pCompositor->pEglBindWaylandDisplayWL = (PFNEGLBINDWAYLANDDISPLAYWLPROC)
+        GetProcAddress("eglBindWaylandDisplayWL");
+
+    pCompositor->pEglQueryWaylandBufferWL = (PFNEGLQUERYWAYLANDBUFFERWLPROC)
+        GetProcAddress("eglQueryWaylandBufferWL");
+
+    pCompositor->pEglCreateStreamAttribNV = (PFNEGLCREATESTREAMATTRIBNVPROC)
+        GetProcAddress("eglCreateStreamAttribNV");
+
+    pCompositor->pEglStreamConsumerGLTextureExternalKHR =
+        (PFNEGLSTREAMCONSUMERGLTEXTUREEXTERNALKHRPROC)
+        GetProcAddress("eglStreamConsumerGLTextureExternalKHR");
+
+    pCompositor->pEglStreamConsumerAcquireKHR =
+        (PFNEGLSTREAMCONSUMERACQUIREKHRPROC)
+        GetProcAddress("eglStreamConsumerAcquireKHR");
+
+    pCompositor->pEglQueryStreamKHR = (PFNEGLQUERYSTREAMKHRPROC)
+        GetProcAddress("eglQueryStreamKHR");
+
+    if ((pCompositor->pEglBindWaylandDisplayWL == NULL) ||
+        (pCompositor->pEglQueryWaylandBufferWL == NULL) ||
+        (pCompositor->pEglCreateStreamAttribNV == NULL) ||
+        (pCompositor->pEglStreamConsumerGLTextureExternalKHR == NULL) ||
+        (pCompositor->pEglStreamConsumerAcquireKHR == NULL) ||
+        (pCompositor->pEglQueryStreamKHR == NULL)) {
+        Fatal("%s", GetError());
+    }
+}
+
+
+/*
+ * Hold the surface's committed frame callbacks, and the time of its
+ * first commit since the last frame, for the frame now on its way to
+ * the screen.  The frame's latency is only measured if 'timed'.
+ */
+static void QueueFrameCallbacks(struct Surface *pSurface, int timed)
+{
+    wl_list_insert_list(pSurface->flipCallbacks.prev,
+                        &pSurface->frameCallbacks);
+    wl_list_init(&pSurface->frameCallbacks);
+
+    if (timed && (pSurface->flipCommitTime < 0.0)) {
+        pSurface->flipCommitTime = pSurface->commitTime;
+    }
+
+    pSurface->commitTime = -1.0;
+}
+
+
+/*
+ * The frame that QueueFrameCallbacks() held the surface's callbacks
+ * for reached the screen at 'flipTime' (CLOCK_MONOTONIC, in seconds):
+ * complete them, and record the frame's commit-to-present latency.
+ */
+static void CompleteFrameCallbacks(struct Surface *pSurface,
+                                   double flipTime)
+{
+    struct wl_resource *callback, *tmp;
+    uint32_t msec = (uint32_t) (flipTime * 1000.0);
+
+    wl_resource_for_each_safe(callback, tmp, &pSurface->flipCallbacks) {
+        wl_callback_send_done(callback, msec);
+        wl_resource_destroy(callback);
+    }
+
+    if (pSurface->flipCommitTime >= 0.0) {
+        AddStatSample(&pSurface->latency,
+                      (flipTime - pSurface->flipCommitTime) * 1000.0);
+        pSurface->flipCommitTime = -1.0;
+    }
+}
+
+
+/*
+ * A frame acquired with a flip event reached the screen.  The
+ * compositor's own frame shows every surface not scanned out
+ * directly; while a direct-scanout surface hides those, their frame
+ * callbacks are paced by its flips instead.
+ */
+static void CompositorFlipHandler(int fd, unsigned int sequence,
+                                  unsigned int tv_sec, unsigned int tv_usec,
+                                  void *userData)
+{
+    struct FlipTarget *pFlip = userData;
+    struct Compositor *pCompositor = pFlip->pCompositor;
+    double flipTime = tv_sec + tv_usec / 1000000.0;
+    struct Surface *pSurface;
+
+    (void) fd;
+    (void) sequence;
+
+    pFlip->pending = 0;
+
+    wl_list_for_each(pSurface, &pCompositor->surfaces, link) {
+        if ((pSurface == pFlip->pSurface) || (pSurface->overlayIndex < 0)) {
+            CompleteFrameCallbacks(pSurface, flipTime);
+        }
+    }
+
+    if (pCompositor->redrawDeferred) {
+        pCompositor->redrawDeferred = 0;
+        pCompositor->needsRedraw = 1;
+    }
+}
+
+
+/*
+ * Handle any page flip events that arrive within 'timeoutMs'
+ * milliseconds (-1 to wait indefinitely).  Return 0, or -1 if the DRM
+ * fd could not be polled.
+ */
+static int DispatchFlipEvents(struct Compositor *pCompositor, int timeoutMs)
+{
+    drmEventContext eventContext = { 0 };
+    struct pollfd pfd;
+    int ret;
+
+    eventContext.version = 2;
+    eventContext.page_flip_handler = CompositorFlipHandler;
+
+    pfd.fd = pCompositor->drmFd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    do {
+        ret = poll(&pfd, 1, timeoutMs);
+    } while ((ret < 0) && (errno == EINTR));
+
+    if (ret < 0) {
+        Warning("poll(2) on the DRM fd failed: %s.\n", strerror(errno));
+        return -1;
+    }
+
+    if (ret > 0) {
+        drmHandleEvent(pCompositor->drmFd, &eventContext);
+    }
+
+    return 0;
+}
+
+
+static int HandleDrmEvents(int fd, uint32_t mask, void *data)
+{
+    (void) fd;
+    (void) mask;
+
+    DispatchFlipEvents(data, 0);
+
+    return 0;
+}
+
+
+/*
+ * Destroy the stream for the surface's committed buffer, and free
+ * whichever consumer it had.
+ */
+static void ReleaseSurfaceStream(struct Surface *pSurface)
+{
+    struct Compositor *pCompositor = pSurface->pCompositor;
+
+    if (pSurface->buffer == NULL) {
+        return;
+    }
+
+    wl_list_remove(&pSurface->bufferDestroyListener.link);
+
+    /*
+     * The flip event of the last frame refers to the surface.  If the
+     * DRM fd cannot be polled, the event cannot be handled either.
+     */
+    while (pSurface->flip.pending) {
+        if (DispatchFlipEvents(pCompositor, -1) != 0) {
+            break;
+        }
+    }
+
+    if (pSurface->eglStream != EGL_NO_STREAM_KHR) {
+        pCompositor->egl.DestroyStreamKHR(pCompositor->eglDpy,
+                                          pSurface->eglStream);
+    }
+
+    if (pSurface->overlayIndex >= 0) {
+        uint32_t planeID =
+            pCompositor->overlayPlaneIDs[pSurface->overlayIndex];
+        uint32_t blankFb =
+            pCompositor->overlayBlankFbs[pSurface->overlayIndex];
+
+        if (DisableOverlayPlane(pCompositor->drmFd, planeID,
+                                blankFb) != 0) {
+            Warning("%s", GetError());
+        }
+
+        pCompositor->overlayPlaneInUse[pSurface->overlayIndex] = 0;
+    }
+
+    if (pSurface->texture != 0) {
+        glDeleteTextures(1, &pSurface->texture);
+    }
+
+    pSurface->buffer = NULL;
+    pSurface->eglStream = EGL_NO_STREAM_KHR;
+    pSurface->overlayIndex = -1;
+    pSurface->texture = 0;
+    pSurface->hasFrame = 0;
+
+    pCompositor->needsRedraw = 1;
+}
+
+
+static void HandleBufferDestroy(struct wl_listener *listener, void *data)
+{
+    struct Surface *pSurface =
+        wl_container_of(listener, pSurface, bufferDestroyListener);
+
+    (void) data;
+
+    ReleaseSurfaceStream(pSurface);
+}
+
+
+/*
+ * Try to connect the stream to a free overlay plane.  Only surfaces
+ * that cover the whole mode qualify: the plane is positioned over the
+ * whole CRTC.
+ */
+static EGLBoolean ConsumeToOverlay(struct Surface *pSurface)
+{
+    struct Compositor *pCompositor = pSurface->pCompositor;
+    EGLOutputLayerEXT eglLayer;
+    EGLint n = 0;
+    int i;
+
+    if ((pSurface->width != pCompositor->width) ||
+        (pSurface->height != pCompositor->height)) {
+        return EGL_FALSE;
+    }
+
+    for (i = 0; i < pCompositor->numOverlayPlanes; i++) {
+
+        EGLAttrib layerAttribs[] = {
+            EGL_DRM_PLANE_EXT,
+            pCompositor->overlayPlaneIDs[i],
+            EGL_NONE,
+        };
+
+        if (pCompositor->overlayPlaneInUse[i]) {
+            continue;
+        }
+
+        if (!pCompositor->egl.GetOutputLayersEXT(pCompositor->eglDpy,
+                                                 layerAttribs,
+                                                 &eglLayer, 1, &n) || !n) {
+            continue;
+        }
+
+        if (EnableOverlayPlane(pCompositor->drmFd,
+                               pCompositor->primaryPlaneID,
+                               pCompositor->overlayPlaneIDs[i],
+                               &pCompositor->overlayBlankFbs[i]) != 0) {
+            Warning("%s", GetError());
+            continue;
+        }
+
+        if (!pCompositor->egl.StreamConsumerOutputEXT(pCompositor->eglDpy,
+                                                      pSurface->eglStream,
+                                                      eglLayer)) {
+            if (DisableOverlayPlane(pCompositor->drmFd,
+                                    pCompositor->overlayPlaneIDs[i],
+                                    pCompositor->overlayBlankFbs[i]) != 0) {
+                Warning("%s", GetError());
+            }
+            continue;
+        }
+
+        pCompositor->overlayPlaneInUse[i] = 1;
+        pSurface->overlayIndex = i;
+
+        return EGL_TRUE;
+    }
+
+    return EGL_FALSE;
+}
+
+
+/*
+ * Connect the stream to an external GL texture, for compositing.  The
+ * texture is bound to the compositor's context, which is always
+ * current.
+ */
+static EGLBoolean ConsumeToTexture(struct Surface *pSurface)
+{
+    struct Compositor *pCompositor = pSurface->pCompositor;
+
+    glGenTextures(1, &pSurface->texture);
+    glBindTexture(GL_TEXTURE_EXTERNAL_OES, pSurface->texture);
+    glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    if (!pCompositor->pEglStreamConsumerGLTextureExternalKHR(
+            pCompositor->eglDpy, pSurface->eglStream)) {
+        Warning("Unable to create GL texture stream consumer.\n");
+        glBindTexture(GL_TEXTURE_EXTERNAL_OES, 0);
+        return EGL_FALSE;
+    }
+
+    glBindTexture(GL_TEXTURE_EXTERNAL_OES, 0);
+
+    return EGL_TRUE;
+}
+
+
+/*
+ * Create the consumer end of the EGLStream behind a newly committed
+ * client buffer.
+ */
+static void AttachSurfaceStream(struct Surface *pSurface,
+                                struct wl_resource *buffer)
+{
+    struct Compositor *pCompositor = pSurface->pCompositor;
+    EGLint format = 0, width = 0, height = 0, yInverted = EGL_TRUE;
+
+    EGLAttrib streamAttribs[] = {
+        EGL_WAYLAND_EGLSTREAM_WL, (EGLAttrib) buffer,
+        EGL_NONE, EGL_NONE,
+        EGL_NONE,
+    };
+
+    /* A direct-scanout consumer's frames are acquired with flip events. */
+    if (pCompositor->flipEvents) {
+        streamAttribs[2] = EGL_CONSUMER_AUTO_ACQUIRE_EXT;
+        streamAttribs[3] = EGL_FALSE;
+    }
+
+    if (!pCompositor->pEglQueryWaylandBufferWL(pCompositor->eglDpy, buffer,
+                                               EGL_TEXTURE_FORMAT, &format) ||
+        (format != EGL_TEXTURE_EXTERNAL_WL)) {
+        Warning("Ignoring a buffer that is not backed by an EGLStream.\n");
+        return;
+    }
+
+    pCompositor->pEglQueryWaylandBufferWL(pCompositor->eglDpy, buffer,
+                                          EGL_WIDTH, &width);
+    pCompositor->pEglQueryWaylandBufferWL(pCompositor->eglDpy, buffer,
+                                          EGL_HEIGHT, &height);
+
+    /* The query fails if the implementation does not report it. */
+    pCompositor->pEglQueryWaylandBufferWL(pCompositor->eglDpy, buffer,
+                                          EGL_WAYLAND_Y_INVERTED_WL,
+                                          &yInverted);
+
+    pSurface->eglStream =
+        pCompositor->pEglCreateStreamAttribNV(pCompositor->eglDpy,
+                                              streamAttribs);
+
+    if (pSurface->eglStream == EGL_NO_STREAM_KHR) {
+        Warning("Unable to create EGLStream for client buffer.\n");
+        return;
+    }
+
+    pSurface->buffer = buffer;
+    pSurface->bufferDestroyListener.notify = HandleBufferDestroy;
+    wl_resource_add_destroy_listener(buffer, &pSurface->bufferDestroyListener);
+
+    pSurface->width = width;
+    pSurface->height = height;
+    pSurface->yInverted = yInverted;
+
+    if (ConsumeToOverlay(pSurface)) {
+        pSurface->x = 0;
+        pSurface->y = 0;
+        printf("Client %d: %dx%d, direct scanout on plane 0x%08x\n",
+               (int) pSurface->pid, width, height,
+               pCompositor->overlayPlaneIDs[pSurface->overlayIndex]);
+    } else if (ConsumeToTexture(pSurface)) {
+        printf("Client %d: %dx%d, composited\n",
+               (int) pSurface->pid, width, height);
+    } else {
+        /* Drop the stream; the client's buffers are not shown. */
+        ReleaseSurfaceStream(pSurface);
+        return;
+    }
+
+    fflush(stdout);
+}
+
+
+static void DestroyResource(struct wl_client *client,
+                            struct wl_resource *resource)
+{
+    (void) client;
+
+    wl_resource_destroy(resource);
+}
+
+
+static void DestroyFrameCallback(struct wl_resource *resource)
+{
+    wl_list_remove(wl_resource_get_link(resource));
+}
+
+
+static void SurfaceAttach(struct wl_client *client,
+                          struct wl_resource *resource,
+                          struct wl_resource *buffer,
+                          int32_t x, int32_t y)
+{
+    struct Surface *pSurface = wl_resource_get_user_data(resource);
+
+    (void) client;
+    (void) x;
+    (void) y;
+
+    pSurface->pending.attached = 1;
+    pSurface->pending.buffer = buffer;
+}
+
+
+/*
+ * Damage, in surface or buffer coordinates, is ignored: a composited
+ * frame redraws every surface, and a direct-scanout frame is scanned
+ * out whole.
+ */
+static void SurfaceDamage(struct wl_client *client,
+                          struct wl_resource *resource,
+                          int32_t x, int32_t y,
+                          int32_t width, int32_t height)
+{
+    (void) client;
+    (void) resource;
+    (void) x;
+    (void) y;
+    (void) width;
+    (void) height;
+}
+
+
+static void SurfaceFrame(struct wl_client *client,
+                         struct wl_resource *resource,
+                         uint32_t id)
+{
+    struct Surface *pSurface = wl_resource_get_user_data(resource);
+    struct wl_resource *callback =
+        wl_resource_create(client, &wl_callback_interface, 1, id);
+
+    if (callback == NULL) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    wl_resource_set_implementation(callback, NULL, NULL,
+                                   DestroyFrameCallback);
+
+    wl_list_insert(pSurface->pending.frameCallbacks.prev,
+                   wl_resource_get_link(callback));
+}
+
+
+static void SurfaceSetRegion(struct wl_client *client,
+                             struct wl_resource *resource,
+                             struct wl_resource *region)
+{
+    (void) client;
+    (void) resource;
+    (void) region;
+}
+
+
+static void SurfaceCommit(struct wl_client *client,
+                          struct wl_resource *resource)
+{
+    struct Surface *pSurface = wl_resource_get_user_data(resource);
+    struct Compositor *pCompositor = pSurface->pCompositor;
+
+    (void) client;
+
+    if (pSurface->pending.attached &&
+        (pSurface->pending.buffer != pSurface->buffer)) {
+
+        ReleaseSurfaceStream(pSurface);
+
+        if (pSurface->pending.buffer != NULL) {
+            AttachSurfaceStream(pSurface, pSurface->pending.buffer);
+        }
+    }
+
+    pSurface->pending.attached = 0;
+    pSurface->pending.buffer = NULL;
+
+    wl_list_insert_list(pSurface->frameCallbacks.prev,
+                        &pSurface->pending.frameCallbacks);
+    wl_list_init(&pSurface->pending.frameCallbacks);
+
+    if (pSurface->commitTime < 0.0) {
+        pSurface->commitTime = GetMonotonicTime();
+    }
+
+    pCompositor->needsRedraw = 1;
+}
+
+
+static void SurfaceSetBufferTransform(struct wl_client *client,
+                                      struct wl_resource *resource,
+                                      int32_t transform)
+{
+    (void) client;
+    (void) resource;
+    (void) transform;
+}
+
+
+static void SurfaceSetBufferScale(struct wl_client *client,
+                                  struct wl_resource *resource,
+                                  int32_t scale)
+{
+    (void) client;
+    (void) resource;
+    (void) scale;
+}
+
+
+static const struct wl_surface_interface surfaceImplementation = {
+    .destroy = DestroyResource,
+    .attach = SurfaceAttach,
+    .damage = SurfaceDamage,
+    .frame = SurfaceFrame,
+    .set_opaque_region = SurfaceSetRegion,
+    .set_input_region = SurfaceSetRegion,
+    .commit = SurfaceCommit,
+    .set_buffer_transform = SurfaceSetBufferTransform,
+    .set_buffer_scale = SurfaceSetBufferScale,
+    .damage_buffer = SurfaceDamage,
+};
+
+
+static void PrintSurfaceLatency(struct Surface *pSurface)
+{
+    char name[64];
+
+    if (pSurface->latency.count == 0) {
+        return;
+    }
+
+    snprintf(name, sizeof(name), "client %d %s", (int) pSurface->pid,
+             (pSurface->overlayIndex >= 0) ? "(direct)" : "(composited)");
+
+    PrintStat(name, &pSurface->latency, "ms commit-to-present");
+}
+
+
+static void DestroySurface(struct wl_resource *resource)
+{
+    struct Surface *pSurface = wl_resource_get_user_data(resource);
+    struct wl_resource *callback, *tmp;
+
+    PrintSurfaceLatency(pSurface);
+
+    ReleaseSurfaceStream(pSurface);
+
+    wl_resource_for_each_safe(callback, tmp, &pSurface->pending.frameCallbacks) {
+        wl_resource_destroy(callback);
+    }
+
+    wl_resource_for_each_safe(callback, tmp, &pSurface->frameCallbacks) {
+        wl_resource_destroy(callback);
+    }
+
+    wl_resource_for_each_safe(callback, tmp, &pSurface->flipCallbacks) {
+        wl_resource_destroy(callback);
+    }
+
+    if (pSurface->xdgSurface != NULL) {
+        wl_resource_set_user_data(pSurface->xdgSurface, NULL);
+    }
+
+    if (pSurface->xdgToplevel != NULL) {
+        wl_resource_set_user_data(pSurface->xdgToplevel, NULL);
+    }
+
+    wl_list_remove(&pSurface->link);
+
+    pSurface->pCompositor->needsRedraw = 1;
+
+    free(pSurface);
+}
+
+
+static void CompositorCreateSurface(struct wl_client *client,
+                                    struct wl_resource *resource,
+                                    uint32_t id)
+{
+    struct Compositor *pCompositor = wl_resource_get_user_data(resource);
+    struct Surface *pSurface = calloc(1, sizeof(*pSurface));
+    int cascade;
+
+    if (pSurface == NULL) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    pSurface->resource =
+        wl_resource_create(client, &wl_surface_interface,
+                           wl_resource_get_version(resource), id);
+
+    if (pSurface->resource == NULL) {
+        free(pSurface);
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    wl_resource_set_implementation(pSurface->resource, &surfaceImplementation,
+                                   pSurface, DestroySurface);
+
+    pSurface->pCompositor = pCompositor;
+    pSurface->eglStream = EGL_NO_STREAM_KHR;
+    pSurface->overlayIndex = -1;
+    pSurface->commitTime = -1.0;
+    pSurface->flipCommitTime = -1.0;
+    pSurface->flip.pCompositor = pCompositor;
+    pSurface->flip.pSurface = pSurface;
+    wl_list_init(&pSurface->pending.frameCallbacks);
+    wl_list_init(&pSurface->frameCallbacks);
+    wl_list_init(&pSurface->flipCallbacks);
+    ResetStat(&pSurface->latency);
+
+    wl_client_get_credentials(client, &pSurface->pid, NULL, NULL);
+
+    cascade = (pCompositor->numSurfacesCreated++ % 8) * WINDOW_CASCADE_STEP;
+    pSurface->x = cascade;
+    pSurface->y = cascade;
+
+    wl_list_insert(pCompositor->surfaces.prev, &pSurface->link);
+}
+
+
+static void RegionAdd(struct wl_client *client,
+                      struct wl_resource *resource,
+                      int32_t x, int32_t y, int32_t width, int32_t height)
+{
+    (void) client;
+    (void) resource;
+    (void) x;
+    (void) y;
+    (void) width;
+    (void) height;
+}
+
+
+static const struct wl_region_interface regionImplementation = {
+    .destroy = DestroyResource,
+    .add = RegionAdd,
+    .subtract = RegionAdd,
+};
+
+
+static void CompositorCreateRegion(struct wl_client *client,
+                                   struct wl_resource *resource,
+                                   uint32_t id)
+{
+    struct wl_resource *region =
+        wl_resource_create(client, &wl_region_interface, 1, id);
+
+    (void) resource;
+
+    if (region == NULL) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    wl_resource_set_implementation(region, &regionImplementation, NULL, NULL);
+}
+
+
+static const struct wl_compositor_interface compositorImplementation = {
+    .create_surface = CompositorCreateSurface,
+    .create_region = CompositorCreateRegion,
+};
+
+
+static void BindCompositor(struct wl_client *client, void *data,
+                           uint32_t version, uint32_t id)
+{
+    struct wl_resource *resource =
+        wl_resource_create(client, &wl_compositor_interface, version, id);
+
+    if (resource == NULL) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    wl_resource_set_implementation(resource, &compositorImplementation,
+                                   data, NULL);
+}
+
+
+/*
+ * Send a toplevel configure event, followed by the xdg_surface
+ * configure event that completes it.  Fullscreen toplevels are asked
+ * for the mode size, which makes them eligible for direct scanout.
+ */
+static void ConfigureToplevel(struct Surface *pSurface, int fullscreen)
+{
+    struct Compositor *pCompositor = pSurface->pCompositor;
+    struct wl_array states;
+    uint32_t *pState;
+
+    wl_array_init(&states);
+
+    pState = wl_array_add(&states, sizeof(*pState));
+    if (pState != NULL) {
+        *pState = XDG_TOPLEVEL_STATE_ACTIVATED;
+    }
+
+    if (fullscreen) {
+        pState = wl_array_add(&states, sizeof(*pState));
+        if (pState != NULL) {
+            *pState = XDG_TOPLEVEL_STATE_FULLSCREEN;
+        }
+    }
+
+    xdg_toplevel_send_configure(pSurface->xdgToplevel,
+                                fullscreen ? pCompositor->width : 0,
+                                fullscreen ? pCompositor->height : 0,
+                                &states);
+
+    wl_array_release(&states);
+
+    xdg_surface_send_configure(pSurface->xdgSurface,
+                               wl_display_next_serial(pCompositor->wlDisplay));
+}
+
+
+static void ToplevelSetParent(struct wl_client *client,
+                              struct wl_resource *resource,
+                              struct wl_resource *parent)
+{
+    (void) client;
+    (void) resource;
+    (void) parent;
+}
+
+
+static void ToplevelSetString(struct wl_client *client,
+                              struct wl_resource *resource,
+                              const char *string)
+{
+    (void) client;
+    (void) resource;
+    (void) string;
+}
+
+
+static void ToplevelShowWindowMenu(struct wl_client *client,
+                                   struct wl_resource *resource,
+                                   struct wl_resource *seat,
+                                   uint32_t serial, int32_t x, int32_t y)
+{
+    (void) client;
+    (void) resource;
+    (void) seat;
+    (void) serial;
+    (void) x;
+    (void) y;
+}
+
+
+static void ToplevelMove(struct wl_client *client,
+                         struct wl_resource *resource,
+                         struct wl_resource *seat, uint32_t serial)
+{
+    (void) client;
+    (void) resource;
+    (void) seat;
+    (void) serial;
+}
+
+
+static void ToplevelResize(struct wl_client *client,
+                           struct wl_resource *resource,
+                           struct wl_resource *seat, uint32_t serial,
+                           uint32_t edges)
+{
+    (void) client;
+    (void) resource;
+    (void) seat;
+    (void) serial;
+    (void) edges;
+}
+
+
+static void ToplevelSetSize(struct wl_client *client,
+                            struct wl_resource *resource,
+                            int32_t width, int32_t height)
+{
+    (void) client;
+    (void) resource;
+    (void) width;
+    (void) height;
+}
+
+
+static void ToplevelNoop(struct wl_client *client,
+                         struct wl_resource *resource)
+{
+    (void) client;
+    (void) resource;
+}
+
+
+static void ToplevelSetFullscreen(struct wl_client *client,
+                                  struct wl_resource *resource,
+                                  struct wl_resource *output)
+{
+    struct Surface *pSurface = wl_resource_get_user_data(resource);
+
+    (void) client;
+    (void) output;
+
+    if (pSurface != NULL) {
+        ConfigureToplevel(pSurface, 1);
+    }
+}
+
+
+static void ToplevelUnsetFullscreen(struct wl_client *client,
+                                    struct wl_resource *resource)
+{
+    struct Surface *pSurface = wl_resource_get_user_data(resource);
+
+    (void) client;
+
+    if (pSurface != NULL) {
+        ConfigureToplevel(pSurface, 0);
+    }
+}
+
+
+static const struct xdg_toplevel_interface toplevelImplementation = {
+    .destroy = DestroyResource,
+    .set_parent = ToplevelSetParent,
+    .set_title = ToplevelSetString,
+    .set_app_id = ToplevelSetString,
+    .show_window_menu = ToplevelShowWindowMenu,
+    .move = ToplevelMove,
+    .resize = ToplevelResize,
+    .set_max_size = ToplevelSetSize,
+    .set_min_size = ToplevelSetSize,
+    .set_maximized = ToplevelNoop,
+    .unset_maximized = ToplevelNoop,
+    .set_fullscreen = ToplevelSetFullscreen,
+    .unset_fullscreen = ToplevelUnsetFullscreen,
+    .set_minimized = ToplevelNoop,
+};
+
+
+static void DestroyToplevel(struct wl_resource *resource)
+{
+    struct Surface *pSurface = wl_resource_get_user_data(resource);
+
+    if (pSurface != NULL) {
+        pSurface->xdgToplevel = NULL;
+    }
+}
+
+
+static void XdgSurfaceGetToplevel(struct wl_client *client,
+                                  struct wl_resource *resource,
+                                  uint32_t id)
+{
+    struct Surface *pSurface = wl_resource_get_user_data(resource);
+    struct wl_resource *toplevel =
+        wl_resource_create(client, &xdg_toplevel_interface,
+                           wl_resource_get_version(resource), id);
+
+    if (toplevel == NULL) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    wl_resource_set_implementation(toplevel, &toplevelImplementation,
+                                   pSurface, DestroyToplevel);
+
+    if (pSurface != NULL) {
+        pSurface->xdgToplevel = toplevel;
+        ConfigureToplevel(pSurface, 0);
+    }
+}
+
+
+static void XdgSurfaceGetPopup(struct wl_client *client,
+                               struct wl_resource *resource,
+                               uint32_t id,
+                               struct wl_resource *parent,
+                               struct wl_resource *positioner)
+{
+    (void) client;
+    (void) id;
+    (void) parent;
+    (void) positioner;
+
+    wl_resource_post_error(resource, XDG_WM_BASE_ERROR_ROLE,
+                           "popups are not supported");
+}
+
+
+static void XdgSurfaceSetWindowGeometry(struct wl_client *client,
+                                        struct wl_resource *resource,
+                                        int32_t x, int32_t y,
+                                        int32_t width, int32_t height)
+{
+    (void) client;
+    (void) resource;
+    (void) x;
+    (void) y;
+    (void) width;
+    (void) height;
+}
+
+
+static void XdgSurfaceAckConfigure(struct wl_client *client,
+                                   struct wl_resource *resource,
+                                   uint32_t serial)
+{
+    (void) client;
+    (void) resource;
+    (void) serial;
+}
+
+
+static const struct xdg_surface_interface xdgSurfaceImplementation = {
+    .destroy = DestroyResource,
+    .get_toplevel = XdgSurfaceGetToplevel,
+    .get_popup = XdgSurfaceGetPopup,
+    .set_window_geometry = XdgSurfaceSetWindowGeometry,
+    .ack_configure = XdgSurfaceAckConfigure,
+};
+
+
+static void DestroyXdgSurface(struct wl_resource *resource)
+{
+    struct Surface *pSurface = wl_resource_get_user_data(resource);
+
+    if (pSurface != NULL) {
+        pSurface->xdgSurface = NULL;
+    }
+}
+
+
+static void WmBaseCreatePositioner(struct wl_client *client,
+                                   struct wl_resource *resource,
+                                   uint32_t id)
+{
+    (void) client;
+    (void) id;
+
+    wl_resource_post_error(resource, XDG_WM_BASE_ERROR_ROLE,
+                           "positioners are not supported");
+}
+
+
+static void WmBaseGetXdgSurface(struct wl_client *client,
+                                struct wl_resource *resource,
+                                uint32_t id,
+                                struct wl_resource *surface)
+{
+    struct Surface *pSurface = wl_resource_get_user_data(surface);
+    struct wl_resource *xdgSurface =
+        wl_resource_create(client, &xdg_surface_interface,
+                           wl_resource_get_version(resource), id);
+
+    if (xdgSurface == NULL) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    wl_resource_set_implementation(xdgSurface, &xdgSurfaceImplementation,
+                                   pSurface, DestroyXdgSurface);
+
+    pSurface->xdgSurface = xdgSurface;
+}
+
+
+static void WmBasePong(struct wl_client *client,
+                       struct wl_resource *resource,
+                       uint32_t serial)
+{
+    (void) client;
+    (void) resource;
+    (void) serial;
+}
+
+
+static const struct xdg_wm_base_interface wmBaseImplementation = {
+    .destroy = DestroyResource,
+    .create_positioner = WmBaseCreatePositioner,
+    .get_xdg_surface = WmBaseGetXdgSurface,
+    .pong = WmBasePong,
+};
+
+
+static void BindWmBase(struct wl_client *client, void *data,
+                       uint32_t version, uint32_t id)
+{
+    struct wl_resource *resource =
+        wl_resource_create(client, &xdg_wm_base_interface, version, id);
+
+    if (resource == NULL) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    wl_resource_set_implementation(resource, &wmBaseImplementation,
+                                   data, NULL);
+}
+
+
+/*
+ * Latch the newest frame from the stream into the surface's texture.
+ * The previously acquired frame stays latched if there is none.
+ */
+static void AcquireSurfaceFrame(struct Surface *pSurface)
+{
+    struct Compositor *pCompositor = pSurface->pCompositor;
+    EGLint state = 0;
+
+    if (!pCompositor->pEglQueryStreamKHR(pCompositor->eglDpy,
+                                         pSurface->eglStream,
+                                         EGL_STREAM_STATE_KHR, &state)) {
+        return;
+    }
+
+    if (state == EGL_STREAM_STATE_NEW_FRAME_AVAILABLE_KHR) {
+        glBindTexture(GL_TEXTURE_EXTERNAL_OES, pSurface->texture);
+
+        if (pCompositor->pEglStreamConsumerAcquireKHR(pCompositor->eglDpy,
+                                                      pSurface->eglStream)) {
+            pSurface->hasFrame = 1;
+        }
+    }
+}
+
+
+static void DrawSurface(const struct Surface *pSurface)
+{
+    GLfloat x0 = pSurface->x;
+    GLfloat y0 = pSurface->y;
+    GLfloat x1 = x0 + pSurface->width;
+    GLfloat y1 = y0 + pSurface->height;
+    GLfloat t0 = pSurface->yInverted ? 0.0f : 1.0f;
+    GLfloat t1 = 1.0f - t0;
+
+    glBindTexture(GL_TEXTURE_EXTERNAL_OES, pSurface->texture);
+
+    glBegin(GL_QUADS);
+    glTexCoord2f(0.0f, t0); glVertex2f(x0, y0);
+    glTexCoord2f(0.0f, t1); glVertex2f(x0, y1);
+    glTexCoord2f(1.0f, t1); glVertex2f(x1, y1);
+    glTexCoord2f(1.0f, t0); glVertex2f(x1, y0);
+    glEnd();
+}
+
+
+/*
+ * Draw every composited surface into the compositor's own EGLStream,
+ * bottom to top in creation order.
+ */
+static void Composite(struct Compositor *pCompositor)
+{
+    struct Surface *pSurface;
+
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    glEnable(GL_TEXTURE_EXTERNAL_OES);
+
+    wl_list_for_each(pSurface, &pCompositor->surfaces, link) {
+        if (pSurface->texture == 0) {
+            continue;
+        }
+
+        AcquireSurfaceFrame(pSurface);
+
+        if (pSurface->hasFrame) {
+            DrawSurface(pSurface);
+        }
+    }
+
+    glDisable(GL_TEXTURE_EXTERNAL_OES);
+    glBindTexture(GL_TEXTURE_EXTERNAL_OES, 0);
+
+    eglSwapBuffers(pCompositor->eglDpy, pCompositor->eglSurface);
+}
+
+
+/*
+ * Acquire a frame for an EGLOutputLayer consumer, with a page flip
+ * event for 'pFlip'.  Return whether there was one to acquire.
+ */
+static EGLBoolean AcquireFlipFrame(struct Compositor *pCompositor,
+                                   EGLStreamKHR eglStream,
+                                   struct FlipTarget *pFlip)
+{
+    EGLAttrib attribs[] = {
+        EGL_DRM_FLIP_EVENT_DATA_NV, (EGLAttrib) pFlip,
+        EGL_NONE,
+    };
+    EGLint state = 0;
+
+    if (!pCompositor->pEglQueryStreamKHR(pCompositor->eglDpy, eglStream,
+                                         EGL_STREAM_STATE_KHR, &state) ||
+        (state != EGL_STREAM_STATE_NEW_FRAME_AVAILABLE_KHR)) {
+        return EGL_FALSE;
+    }
+
+    if (!pCompositor->egl.StreamConsumerAcquireAttribEXT(pCompositor->eglDpy,
+                                                         eglStream,
+                                                         attribs)) {
+        return EGL_FALSE;
+    }
+
+    pFlip->pending = 1;
+
+    return EGL_TRUE;
+}
+
+
+/*
+ * Show what clients committed since the last redraw, with flip events:
+ * acquire each direct-scanout surface's new frame, and composite the
+ * other surfaces unless a direct-scanout surface hides them.  Frame
+ * callbacks complete when the frame showing their commit flips; a
+ * frame still flipping defers the next one until it has.
+ */
+static void RedrawWithFlipEvents(struct Compositor *pCompositor)
+{
+    struct Surface *pSurface;
+    int direct = 0;
+
+    wl_list_for_each(pSurface, &pCompositor->surfaces, link) {
+        if (pSurface->overlayIndex < 0) {
+            continue;
+        }
+
+        direct = 1;
+
+        if (pSurface->flip.pending) {
+            pCompositor->redrawDeferred = 1;
+        } else if (AcquireFlipFrame(pCompositor, pSurface->eglStream,
+                                    &pSurface->flip)) {
+            QueueFrameCallbacks(pSurface, 1);
+        } else {
+            /* A commit without a new frame shows nothing new. */
+            QueueFrameCallbacks(pSurface, 0);
+            CompleteFrameCallbacks(pSurface, GetMonotonicTime());
+        }
+    }
+
+    if (direct) {
+        wl_list_for_each(pSurface, &pCompositor->surfaces, link) {
+            if (pSurface->overlayIndex < 0) {
+                QueueFrameCallbacks(pSurface, 0);
+            }
+        }
+        return;
+    }
+
+    if (pCompositor->flip.pending) {
+        pCompositor->redrawDeferred = 1;
+        return;
+    }
+
+    Composite(pCompositor);
+
+    wl_list_for_each(pSurface, &pCompositor->surfaces, link) {
+        QueueFrameCallbacks(pSurface, 1);
+    }
+
+    if (!AcquireFlipFrame(pCompositor, pCompositor->eglStream,
+                          &pCompositor->flip)) {
+        Warning("Unable to acquire the composited frame.\n");
+
+        wl_list_for_each(pSurface, &pCompositor->surfaces, link) {
+            pSurface->flipCommitTime = -1.0;
+            CompleteFrameCallbacks(pSurface, GetMonotonicTime());
+        }
+    }
+}
+
+
+/*
+ * Show what clients committed since the last redraw, without flip
+ * events: direct-scanout frames are acquired by their EGLOutputLayers
+ * as they are produced, and the other surfaces are composited unless
+ * one hides them.  Frame callbacks complete right away.
+ */
+static void Redraw(struct Compositor *pCompositor)
+{
+    struct Surface *pSurface;
+    int direct = 0;
+
+    if (pCompositor->flipEvents) {
+        RedrawWithFlipEvents(pCompositor);
+        return;
+    }
+
+    wl_list_for_each(pSurface, &pCompositor->surfaces, link) {
+        if (pSurface->overlayIndex >= 0) {
+            direct = 1;
+        }
+    }
+
+    if (!direct) {
+        Composite(pCompositor);
+    }
+
+    wl_list_for_each(pSurface, &pCompositor->surfaces, link) {
+        QueueFrameCallbacks(pSurface, 0);
+        CompleteFrameCallbacks(pSurface, GetMonotonicTime());
+    }
+}
+
+
+/*
+ * Every LATENCY_REPORT_INTERVAL seconds, print each surface's
+ * commit-to-present latency since the last report.
+ */
+static void ReportLatency(struct Compositor *pCompositor)
+{
+    struct Surface *pSurface;
+    double now = GetTime();
+
+    if (now - pCompositor->lastLatencyReport <= LATENCY_REPORT_INTERVAL) {
+        return;
+    }
+
+    wl_list_for_each(pSurface, &pCompositor->surfaces, link) {
+        PrintSurfaceLatency(pSurface);
+        ResetStat(&pSurface->latency);
+    }
+    fflush(stdout);
+    pCompositor->lastLatencyReport = now;
+}
+
+
+/*
+ * Run a Wayland compositor on the given plane.  The display has
+ * already been set up by the caller, which probed it with 'pCache'.
+ */
+void RunCompositor(const struct Options *pOptions, int drmFd,
+                   struct ProbeCache *pCache,
+                   EGLDisplay eglDpy, const struct EglDispatch *pEgl,
+                   uint32_t planeID,
+                   int width, int height)
+{
+    struct Compositor compositor = { 0 };
+    struct wl_event_loop *loop;
+    const char *socketName;
+
+    compositor.pOptions = pOptions;
+    compositor.drmFd = drmFd;
+    compositor.eglDpy = eglDpy;
+    compositor.egl = *pEgl;
+    compositor.primaryPlaneID = planeID;
+    compositor.width = width;
+    compositor.height = height;
+    compositor.lastLatencyReport = GetTime();
+    compositor.flip.pCompositor = &compositor;
+    wl_list_init(&compositor.surfaces);
+
+    GetCompositorFunctionPointers(&compositor);
+
+    compositor.flipEvents =
+        StreamFlipEventsSupported(eglQueryString(eglDpy, EGL_EXTENSIONS),
+                                  pOptions);
+
+    if (!compositor.flipEvents) {
+        Warning("EGL_EXT_stream_acquire_mode or "
+                "EGL_NV_output_drm_flip_event not found; clients are not "
+                "throttled to page flips, and latency is not measured.\n");
+    }
+
+    compositor.eglSurface = SetUpEgl(pEgl, eglDpy, planeID, width, height,
+                                     pOptions, pCache, &compositor.eglStream);
+
+    if (compositor.eglSurface == EGL_NO_SURFACE) {
+        Fatal("%s", GetError());
+    }
+
+    compositor.numOverlayPlanes =
+        GetOverlayPlanes(drmFd, planeID, compositor.overlayPlaneIDs,
+                         MAX_OVERLAY_PLANES);
+
+    if (compositor.numOverlayPlanes < 0) {
+        Warning("%s", GetError());
+        Warning("Not placing clients on overlay planes.\n");
+        compositor.numOverlayPlanes = 0;
+    }
+
+    /* Map surface coordinates to the mode, with the origin at top left. */
+
+    glViewport(0, 0, width, height);
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    glOrtho(0.0, width, height, 0.0, -1.0, 1.0);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+    compositor.wlDisplay = wl_display_create();
+
+    if (compositor.wlDisplay == NULL) {
+        Fatal("Unable to create Wayland display.\n");
+    }
+
+    if (!compositor.pEglBindWaylandDisplayWL(eglDpy, compositor.wlDisplay)) {
+        Fatal("eglBindWaylandDisplayWL() failed.\n");
+    }
+
+    if (wl_global_create(compositor.wlDisplay, &wl_compositor_interface, 4,
+                         &compositor, BindCompositor) == NULL) {
+        Fatal("Unable to create wl_compositor global.\n");
+    }
+
+    if (wl_global_create(compositor.wlDisplay, &xdg_wm_base_interface, 1,
+                         &compositor, BindWmBase) == NULL) {
+        Fatal("Unable to create xdg_wm_base global.\n");
+    }
+
+    socketName = wl_display_add_socket_auto(compositor.wlDisplay);
+
+    if (socketName == NULL) {
+        Fatal("Unable to add Wayland socket.\n");
+    }
+
+    printf("Wayland compositor running on WAYLAND_DISPLAY=%s, "
+           "%d overlay plane(s) for direct scanout\n",
+           socketName, compositor.numOverlayPlanes);
+    fflush(stdout);
+
+    loop = wl_display_get_event_loop(compositor.wlDisplay);
+
+    if (compositor.flipEvents &&
+        (wl_event_loop_add_fd(loop, drmFd, WL_EVENT_READABLE,
+                              HandleDrmEvents, &compositor) == NULL)) {
+        Fatal("Unable to watch the DRM fd for page flip events.\n");
+    }
+
+    /*
+     * Only redraw in response to a client commit; otherwise, sleep
+     * until a client sends a request.
+     */
+
+    compositor.needsRedraw = 1;
+
+    while (1) {
+        wl_display_flush_clients(compositor.wlDisplay);
+
+        wl_event_loop_dispatch(loop, compositor.needsRedraw ? 0 : -1);
+
+        if (compositor.needsRedraw) {
+            compositor.needsRedraw = 0;
+            Redraw(&compositor);
+        }
+
+        ReportLatency(&compositor);
+    }
+}
@@ -0,0 +1,785 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * A backend that renders on one GPU and displays on another, e.g., to
+ * render on a discrete GPU while an integrated GPU drives the displays.
+ *
+ * An EGLDisplay binds to a single device, and an EGLStream's producer
+ * and consumer must be on the same EGLDisplay, so the frame has to be
+ * copied between the GPUs.  The render GPU draws into a pbuffer; on
+ * present, the frame is copied to the display GPU, which blits it into
+ * the EGLSurface of the display backend (EGLStream or GBM) and presents
+ * that.  The copy uses, in order of preference:
+ *
+ *  - dma-buf: the render GPU resolves the frame into a texture it has
+ *    exported with EGL_MESA_image_dma_buf_export, which the display GPU
+ *    has imported with EGL_EXT_image_dma_buf_import.  The display GPU
+ *    reads the render GPU's memory directly over PCIe.
+ *
+ *  - CPU: glReadPixels() on the render GPU, and glTexSubImage2D() on
+ *    the display GPU.  Works anywhere, at the cost of two copies
+ *    through system memory.
+ *
+ * The time from the start of present until the frame is handed to the
+ * display backend is reported as the cross-GPU transfer cost.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <drm_fourcc.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+/* The blits use OpenGL 3.0 entry points, which libOpenGL exports. */
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include "backend.h"
+#include "egl.h"
+#include "utils.h"
+
+/* XXX khronos eglext.h does not yet have EGL_EXT_image_dma_buf_import_modifiers */
+#if !defined(EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT)
+#define EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT      0x3443
+#define EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT      0x3444
+#endif
+
+/*
+ * Frames copied to the display GPU that may be in use at once: while
+ * the display GPU still reads one, the render GPU can fill the other.
+ */
+#define NUM_TRANSFER_SLOTS 2
+
+enum TransferMethod {
+    TRANSFER_DMA_BUF,
+    TRANSFER_CPU,
+};
+
+struct TransferSlot {
+    /* On the render GPU (dma-buf only). */
+    GLuint renderTexture;
+    GLuint renderFbo;
+    EGLImageKHR renderImage;
+
+    /* On the display GPU. */
+    GLuint displayTexture;
+    GLuint displayFbo;
+    EGLImageKHR displayImage;
+
+    /*
+     * Sync file that signals once the display GPU has read the slot,
+     * or -1.
+     */
+    int releaseFenceFd;
+};
+
+struct CrossGpuBackend {
+    /* The backend that presents, on the display GPU. */
+    struct Backend display;
+    EGLContext displayContext;
+
+    EGLDisplay renderDpy;
+    struct EglDispatch renderEgl;
+    EGLSurface renderSurface;
+    EGLContext renderContext;
+
+    enum TransferMethod method;
+    struct TransferSlot slots[NUM_TRANSFER_SLOTS];
+    int nextSlot;
+
+    /* The frame in system memory, for TRANSFER_CPU. */
+    void *pixels;
+
+    /* For TRANSFER_DMA_BUF; pEglCreateImageKHR is NULL without it. */
+    PFNEGLCREATEIMAGEKHRPROC pEglCreateImageKHR;
+    PFNEGLDESTROYIMAGEKHRPROC pEglDestroyImageKHR;
+    PFNEGLEXPORTDMABUFIMAGEQUERYMESAPROC pEglExportDMABUFImageQueryMESA;
+    PFNEGLEXPORTDMABUFIMAGEMESAPROC pEglExportDMABUFImageMESA;
+    PFNGLEGLIMAGETARGETTEXTURE2DOESPROC pGlEGLImageTargetTexture2DOES;
+
+    char name[64];
+};
+
+static int MakeCurrent(EGLDisplay eglDpy, EGLSurface eglSurface,
+                       EGLContext eglContext)
+{
+    if (!eglMakeCurrent(eglDpy, eglSurface, eglSurface, eglContext)) {
+        SetError("Unable to make context current.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int MakeRenderCurrent(struct CrossGpuBackend *pCross)
+{
+    return MakeCurrent(pCross->renderDpy, pCross->renderSurface,
+                       pCross->renderContext);
+}
+
+
+static int MakeDisplayCurrent(struct CrossGpuBackend *pCross)
+{
+    return MakeCurrent(pCross->display.eglDpy, pCross->display.eglSurface,
+                       pCross->displayContext);
+}
+
+
+/*
+ * Return whether the current context supports the OpenGL extension.
+ * The context is OpenGL 3.0 or later, where glGetString(GL_EXTENSIONS)
+ * is deprecated (and absent from core profiles).
+ */
+static int GlExtensionIsSupported(const char *extension)
+{
+    GLint count = 0, i;
+
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+
+    for (i = 0; i < count; i++) {
+        if (strcmp((const char *) glGetStringi(GL_EXTENSIONS, i),
+                   extension) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/* Fail unless the current context is OpenGL 3.0 or later. */
+static int RequireGl30(const char *gpu)
+{
+    int major = 0;
+
+    sscanf((const char *) glGetString(GL_VERSION), "%d", &major);
+
+    if (major < 3) {
+        SetError("--render-device requires OpenGL 3.0 on the %s GPU.\n",
+                 gpu);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static GLuint CreateTexture(int width, int height)
+{
+    GLuint texture;
+
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    return texture;
+}
+
+
+/*
+ * Return a framebuffer object that renders to 'texture', or 0 if the
+ * texture cannot be rendered to.
+ */
+static GLuint CreateFramebuffer(GLuint texture)
+{
+    GLuint fbo;
+    GLenum status;
+
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, texture, 0);
+    status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        glDeleteFramebuffers(1, &fbo);
+        return 0;
+    }
+
+    return fbo;
+}
+
+
+static void DestroySlots(struct CrossGpuBackend *pCross)
+{
+    int i;
+
+    MakeRenderCurrent(pCross);
+
+    for (i = 0; i < NUM_TRANSFER_SLOTS; i++) {
+        struct TransferSlot *pSlot = &pCross->slots[i];
+
+        glDeleteFramebuffers(1, &pSlot->renderFbo);
+        glDeleteTextures(1, &pSlot->renderTexture);
+        if (pSlot->renderImage != EGL_NO_IMAGE_KHR) {
+            pCross->pEglDestroyImageKHR(pCross->renderDpy,
+                                        pSlot->renderImage);
+        }
+    }
+
+    MakeDisplayCurrent(pCross);
+
+    for (i = 0; i < NUM_TRANSFER_SLOTS; i++) {
+        struct TransferSlot *pSlot = &pCross->slots[i];
+
+        glDeleteFramebuffers(1, &pSlot->displayFbo);
+        glDeleteTextures(1, &pSlot->displayTexture);
+        if (pSlot->displayImage != EGL_NO_IMAGE_KHR) {
+            pCross->pEglDestroyImageKHR(pCross->display.eglDpy,
+                                        pSlot->displayImage);
+        }
+        if (pSlot->releaseFenceFd >= 0) {
+            close(pSlot->releaseFenceFd);
+        }
+
+        memset(pSlot, 0, sizeof(*pSlot));
+        pSlot->renderImage = EGL_NO_IMAGE_KHR;
+        pSlot->displayImage = EGL_NO_IMAGE_KHR;
+        pSlot->releaseFenceFd = -1;
+    }
+}
+
+
+/*
+ * Export a texture from the render GPU as a dma-buf, and import it as
+ * a texture on the display GPU.  Return whether that worked; e.g., the
+ * display GPU may not be able to read the render GPU's tiling layout.
+ *
+ * Without EGL_EXT_image_dma_buf_import_modifiers, the display GPU
+ * cannot be told the layout, and would read a tiled buffer as linear;
+ * only buffers that are linear, or whose layout is implicit, are
+ * shared then.
+ */
+static EGLBoolean SetUpDmaBufSlot(struct CrossGpuBackend *pCross,
+                                  struct TransferSlot *pSlot,
+                                  EGLBoolean importModifiers)
+{
+    int width = pCross->display.width;
+    int height = pCross->display.height;
+    int fourcc, numPlanes, fd;
+    EGLuint64KHR modifier;
+    EGLint stride, offset;
+    EGLint attribs[20];
+    int n = 0;
+
+    if (MakeRenderCurrent(pCross) != 0) {
+        return EGL_FALSE;
+    }
+
+    pSlot->renderTexture = CreateTexture(width, height);
+    pSlot->renderFbo = CreateFramebuffer(pSlot->renderTexture);
+
+    if (pSlot->renderFbo == 0) {
+        return EGL_FALSE;
+    }
+
+    pSlot->renderImage =
+        pCross->pEglCreateImageKHR(pCross->renderDpy, pCross->renderContext,
+                                   EGL_GL_TEXTURE_2D_KHR,
+                                   (EGLClientBuffer) (uintptr_t)
+                                   pSlot->renderTexture,
+                                   NULL);
+
+    if ((pSlot->renderImage == EGL_NO_IMAGE_KHR) ||
+        !pCross->pEglExportDMABUFImageQueryMESA(pCross->renderDpy,
+                                                pSlot->renderImage,
+                                                &fourcc, &numPlanes,
+                                                &modifier) ||
+        (numPlanes != 1)) {
+        return EGL_FALSE;
+    }
+
+    if (!importModifiers &&
+        (modifier != DRM_FORMAT_MOD_LINEAR) &&
+        (modifier != DRM_FORMAT_MOD_INVALID)) {
+        return EGL_FALSE;
+    }
+
+    if (!pCross->pEglExportDMABUFImageMESA(pCross->renderDpy,
+                                           pSlot->renderImage,
+                                           &fd, &stride, &offset)) {
+        return EGL_FALSE;
+    }
+
+    attribs[n++] = EGL_WIDTH;
+    attribs[n++] = width;
+    attribs[n++] = EGL_HEIGHT;
+    attribs[n++] = height;
+    attribs[n++] = EGL_LINUX_DRM_FOURCC_EXT;
+    attribs[n++] = fourcc;
+    attribs[n++] = EGL_DMA_BUF_PLANE0_FD_EXT;
+    attribs[n++] = fd;
+    attribs[n++] = EGL_DMA_BUF_PLANE0_OFFSET_EXT;
+    attribs[n++] = offset;
+    attribs[n++] = EGL_DMA_BUF_PLANE0_PITCH_EXT;
+    attribs[n++] = stride;
+
+    if (importModifiers && (modifier != DRM_FORMAT_MOD_INVALID)) {
+        attribs[n++] = EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT;
+        attribs[n++] = (EGLint) (modifier & 0xffffffff);
+        attribs[n++] = EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT;
+        attribs[n++] = (EGLint) (modifier >> 32);
+    }
+
+    attribs[n] = EGL_NONE;
+
+    if (MakeDisplayCurrent(pCross) != 0) {
+        close(fd);
+        return EGL_FALSE;
+    }
+
+    pSlot->displayImage =
+        pCross->pEglCreateImageKHR(pCross->display.eglDpy, EGL_NO_CONTEXT,
+                                   EGL_LINUX_DMA_BUF_EXT, NULL, attribs);
+
+    /* The EGLImage holds its own reference to the dma-buf. */
+    close(fd);
+
+    if (pSlot->displayImage == EGL_NO_IMAGE_KHR) {
+        return EGL_FALSE;
+    }
+
+    glGenTextures(1, &pSlot->displayTexture);
+    glBindTexture(GL_TEXTURE_2D, pSlot->displayTexture);
+    pCross->pGlEGLImageTargetTexture2DOES(GL_TEXTURE_2D, pSlot->displayImage);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    pSlot->displayFbo = CreateFramebuffer(pSlot->displayTexture);
+
+    if (pSlot == &pCross->slots[0]) {
+        snprintf(pCross->name, sizeof(pCross->name),
+                 "%s via dma-buf", pCross->display.name);
+        printf("Cross-GPU transfer: dma-buf, format %.4s, "
+               "modifier 0x%016llx\n", (const char *) &fourcc,
+               (unsigned long long) modifier);
+    }
+
+    return pSlot->displayFbo != 0;
+}
+
+
+static EGLBoolean SetUpDmaBufTransfer(struct CrossGpuBackend *pCross)
+{
+    const char *renderExtensionString =
+        eglQueryString(pCross->renderDpy, EGL_EXTENSIONS);
+    const char *displayExtensionString =
+        eglQueryString(pCross->display.eglDpy, EGL_EXTENSIONS);
+    EGLBoolean importModifiers;
+    int i;
+
+    if (!ExtensionIsSupported(renderExtensionString,
+                              "EGL_MESA_image_dma_buf_export") ||
+        !ExtensionIsSupported(renderExtensionString,
+                              "EGL_KHR_gl_texture_2D_image") ||
+        !ExtensionIsSupported(displayExtensionString,
+                              "EGL_EXT_image_dma_buf_import")) {
+        return EGL_FALSE;
+    }
+
+    if ((MakeDisplayCurrent(pCross) != 0) ||
+        !GlExtensionIsSupported("GL_OES_EGL_image")) {
+        return EGL_FALSE;
+    }
+
+    pCross->pEglExportDMABUFImageQueryMESA =
+        (PFNEGLEXPORTDMABUFIMAGEQUERYMESAPROC)
+        GetProcAddress("eglExportDMABUFImageQueryMESA");
+    pCross->pEglExportDMABUFImageMESA = (PFNEGLEXPORTDMABUFIMAGEMESAPROC)
+        GetProcAddress("eglExportDMABUFImageMESA");
+    pCross->pGlEGLImageTargetTexture2DOES =
+        (PFNGLEGLIMAGETARGETTEXTURE2DOESPROC)
+        GetProcAddress("glEGLImageTargetTexture2DOES");
+
+    if ((pCross->pEglExportDMABUFImageQueryMESA == NULL) ||
+        (pCross->pEglExportDMABUFImageMESA == NULL) ||
+        (pCross->pGlEGLImageTargetTexture2DOES == NULL)) {
+        return EGL_FALSE;
+    }
+
+    importModifiers =
+        ExtensionIsSupported(displayExtensionString,
+                             "EGL_EXT_image_dma_buf_import_modifiers");
+
+    for (i = 0; i < NUM_TRANSFER_SLOTS; i++) {
+        if (!SetUpDmaBufSlot(pCross, &pCross->slots[i], importModifiers)) {
+            Warning("Unable to share a dma-buf between the GPUs; "
+                    "copying frames through the CPU.\n");
+            DestroySlots(pCross);
+            return EGL_FALSE;
+        }
+    }
+
+    pCross->method = TRANSFER_DMA_BUF;
+
+    return EGL_TRUE;
+}
+
+
+static int SetUpCpuTransfer(struct CrossGpuBackend *pCross)
+{
+    int width = pCross->display.width;
+    int height = pCross->display.height;
+    int i;
+
+    pCross->pixels = malloc((size_t) width * height * 4);
+
+    if (pCross->pixels == NULL) {
+        SetError("Memory allocation failure.\n");
+        return -1;
+    }
+
+    if (MakeDisplayCurrent(pCross) != 0) {
+        return -1;
+    }
+
+    for (i = 0; i < NUM_TRANSFER_SLOTS; i++) {
+        struct TransferSlot *pSlot = &pCross->slots[i];
+
+        pSlot->displayTexture = CreateTexture(width, height);
+        pSlot->displayFbo = CreateFramebuffer(pSlot->displayTexture);
+
+        if (pSlot->displayFbo == 0) {
+            SetError("Unable to render to a texture on the display GPU.\n");
+            return -1;
+        }
+    }
+
+    snprintf(pCross->name, sizeof(pCross->name),
+             "%s via CPU copy", pCross->display.name);
+    printf("Cross-GPU transfer: CPU copy\n");
+
+    pCross->method = TRANSFER_CPU;
+
+    return 0;
+}
+
+
+/*
+ * Wait for the GPU commands issued so far in the current context,
+ * through a sync file if the EGLDisplay supports them.
+ */
+static int FinishGpu(const struct EglDispatch *pEgl, EGLDisplay eglDpy)
+{
+    if (GpuFencesSupported(eglDpy)) {
+        int fd = CreateGpuFence(pEgl, eglDpy);
+        int ret;
+
+        if (fd < 0) {
+            return -1;
+        }
+
+        ret = WaitForFence(fd);
+        close(fd);
+
+        return ret;
+    }
+
+    glFinish();
+
+    return 0;
+}
+
+
+static int CrossGpuPresent(struct Backend *pBackend,
+                           const struct Rect *pDamage)
+{
+    struct CrossGpuBackend *pCross = pBackend->priv;
+    struct TransferSlot *pSlot = &pCross->slots[pCross->nextSlot];
+    int width = pBackend->width;
+    int height = pBackend->height;
+    double transferStart = GetTime();
+
+    (void) pDamage;
+
+    pCross->nextSlot = (pCross->nextSlot + 1) % NUM_TRANSFER_SLOTS;
+
+    /* Wait until the display GPU has finished reading the slot. */
+    if (pSlot->releaseFenceFd >= 0) {
+        int ret = WaitForFence(pSlot->releaseFenceFd);
+
+        close(pSlot->releaseFenceFd);
+        pSlot->releaseFenceFd = -1;
+
+        if (ret != 0) {
+            return -1;
+        }
+    }
+
+    /*
+     * On the render GPU: resolve the frame into the shared texture, and
+     * wait for that, or read it back.
+     */
+    if (pCross->method == TRANSFER_DMA_BUF) {
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, pSlot->renderFbo);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height,
+                          GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        if (FinishGpu(&pCross->renderEgl, pCross->renderDpy) != 0) {
+            return -1;
+        }
+    } else {
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE,
+                     pCross->pixels);
+    }
+
+    /* On the display GPU: copy the frame to the EGLSurface. */
+    if (MakeDisplayCurrent(pCross) != 0) {
+        return -1;
+    }
+
+    if (pCross->method == TRANSFER_CPU) {
+        glBindTexture(GL_TEXTURE_2D, pSlot->displayTexture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height,
+                        GL_RGBA, GL_UNSIGNED_BYTE, pCross->pixels);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, pSlot->displayFbo);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height,
+                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    /*
+     * A dma-buf slot is rendered to again by the render GPU; make sure
+     * the display GPU is done reading it by then.
+     */
+    if (pCross->method == TRANSFER_DMA_BUF) {
+        if (GpuFencesSupported(pCross->display.eglDpy)) {
+            pSlot->releaseFenceFd = CreateGpuFence(&pCross->display.egl,
+                                                   pCross->display.eglDpy);
+            if (pSlot->releaseFenceFd < 0) {
+                return -1;
+            }
+        } else {
+            glFinish();
+        }
+    }
+
+    if (pBackend->pStats != NULL) {
+        AddTransferSample(pBackend->pStats, transferStart, GetTime());
+    }
+
+    pCross->display.pStats = pBackend->pStats;
+    pCross->display.pTelemetry = pBackend->pTelemetry;
+    pCross->display.telemetryFrameId = pBackend->telemetryFrameId;
+    pCross->display.pInputLatency = pBackend->pInputLatency;
+    pCross->display.presentSerial = pBackend->presentSerial;
+    if (pCross->display.present(&pCross->display, NULL) != 0) {
+        return -1;
+    }
+
+    return MakeRenderCurrent(pCross);
+}
+
+
+static int CrossGpuGetQueueDepth(struct Backend *pBackend)
+{
+    struct CrossGpuBackend *pCross = pBackend->priv;
+
+    return pCross->display.getQueueDepth(&pCross->display);
+}
+
+
+static int CrossGpuDispatchEvents(struct Backend *pBackend)
+{
+    struct CrossGpuBackend *pCross = pBackend->priv;
+
+    return pCross->display.dispatchEvents(&pCross->display);
+}
+
+
+static void CrossGpuDestroy(struct Backend *pBackend)
+{
+    struct CrossGpuBackend *pCross = pBackend->priv;
+
+    DestroySlots(pCross);
+    free(pCross->pixels);
+
+    eglMakeCurrent(pCross->renderDpy, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                   EGL_NO_CONTEXT);
+    eglDestroySurface(pCross->renderDpy, pCross->renderSurface);
+    eglDestroyContext(pCross->renderDpy, pCross->renderContext);
+    eglTerminate(pCross->renderDpy);
+
+    pCross->display.destroy(&pCross->display);
+
+    free(pCross);
+}
+
+
+/*
+ * Render on the GPU selected by --render-device, and present through
+ * 'pDisplayBackend', whose EGLSurface is current on the display GPU.
+ * On return, a pbuffer of the display's size on the render GPU is
+ * current, and presenting copies it to the display GPU.
+ *
+ * Return -1 on failure, having destroyed whatever was created, with
+ * 'pDisplayBackend' still the caller's to destroy.
+ */
+int InitCrossGpuBackend(struct Backend *pBackend,
+                        const struct Backend *pDisplayBackend,
+                        const struct Options *pOptions)
+{
+    struct CrossGpuBackend *pCross = calloc(1, sizeof(*pCross));
+    EGLDeviceEXT eglDevice;
+    EGLConfig eglConfig;
+    int i;
+
+    if (pCross == NULL) {
+        SetError("Memory allocation failure.\n");
+        return -1;
+    }
+
+    pCross->display = *pDisplayBackend;
+    pCross->displayContext = eglGetCurrentContext();
+
+    for (i = 0; i < NUM_TRANSFER_SLOTS; i++) {
+        pCross->slots[i].renderImage = EGL_NO_IMAGE_KHR;
+        pCross->slots[i].displayImage = EGL_NO_IMAGE_KHR;
+        pCross->slots[i].releaseFenceFd = -1;
+    }
+
+    if (RequireGl30("display") != 0) {
+        goto failFree;
+    }
+
+    eglDevice = GetEglDevice(&pOptions->renderDevice);
+
+    if (eglDevice == EGL_NO_DEVICE_EXT) {
+        goto failFree;
+    }
+
+    pCross->renderDpy = GetEglDisplay(eglDevice, -1, &pCross->renderEgl);
+
+    if (pCross->renderDpy == EGL_NO_DISPLAY) {
+        goto failFree;
+    }
+
+    /* The probe cache describes the display GPU, not this one. */
+    eglConfig = ChooseConfig(pCross->renderDpy, EGL_PBUFFER_BIT, 0, pOptions,
+                             NULL);
+
+    if (eglConfig == NULL) {
+        SetError("No EGLConfig on the render GPU matches the options.\n");
+        goto failDisplay;
+    }
+
+    pCross->renderContext = CreateContext(pCross->renderDpy, eglConfig,
+                                          pOptions);
+
+    if (pCross->renderContext == EGL_NO_CONTEXT) {
+        goto failDisplay;
+    }
+
+    {
+        EGLint surfaceAttribs[] = {
+            EGL_WIDTH, pDisplayBackend->width,
+            EGL_HEIGHT, pDisplayBackend->height,
+            EGL_NONE
+        };
+
+        pCross->renderSurface = eglCreatePbufferSurface(pCross->renderDpy,
+                                                        eglConfig,
+                                                        surfaceAttribs);
+    }
+
+    if (pCross->renderSurface == EGL_NO_SURFACE) {
+        SetError("Unable to create a pbuffer on the render GPU.\n");
+        goto failContext;
+    }
+
+    if ((MakeRenderCurrent(pCross) != 0) || (RequireGl30("render") != 0)) {
+        goto failSurface;
+    }
+
+    if (ExtensionIsSupported(eglQueryString(pCross->renderDpy,
+                                            EGL_EXTENSIONS),
+                             "EGL_KHR_image_base")) {
+        pCross->pEglCreateImageKHR = (PFNEGLCREATEIMAGEKHRPROC)
+            GetProcAddress("eglCreateImageKHR");
+        pCross->pEglDestroyImageKHR = (PFNEGLDESTROYIMAGEKHRPROC)
+            GetProcAddress("eglDestroyImageKHR");
+    }
+
+    if (((pCross->pEglCreateImageKHR == NULL) ||
+         (pCross->pEglDestroyImageKHR == NULL) ||
+         !SetUpDmaBufTransfer(pCross)) &&
+        (SetUpCpuTransfer(pCross) != 0)) {
+        goto failSlots;
+    }
+
+    if (MakeRenderCurrent(pCross) != 0) {
+        goto failSlots;
+    }
+
+    pBackend->name = pCross->name;
+    pBackend->eglDpy = pCross->renderDpy;
+    pBackend->egl = pCross->renderEgl;
+    pBackend->eglSurface = pCross->renderSurface;
+    pBackend->width = pDisplayBackend->width;
+    pBackend->height = pDisplayBackend->height;
+    pBackend->drmFd = pDisplayBackend->drmFd;
+    pBackend->kmsOutput = pDisplayBackend->kmsOutput;
+    pBackend->present = CrossGpuPresent;
+    pBackend->getQueueDepth = CrossGpuGetQueueDepth;
+    pBackend->eventFd = pDisplayBackend->eventFd;
+    pBackend->dispatchEvents = (pDisplayBackend->dispatchEvents != NULL) ?
+        CrossGpuDispatchEvents : NULL;
+    pBackend->destroy = CrossGpuDestroy;
+    pBackend->pStats = NULL;
+    pBackend->pTelemetry = NULL;
+    pBackend->pInputLatency = NULL;
+    pBackend->priv = pCross;
+
+    return 0;
+
+failSlots:
+    DestroySlots(pCross);
+    free(pCross->pixels);
+failSurface:
+    eglMakeCurrent(pCross->renderDpy, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                   EGL_NO_CONTEXT);
+    eglDestroySurface(pCross->renderDpy, pCross->renderSurface);
+failContext:
+    eglDestroyContext(pCross->renderDpy, pCross->renderContext);
+failDisplay:
+    eglTerminate(pCross->renderDpy);
+failFree:
+    eglMakeCurrent(pCross->display.eglDpy, pCross->display.eglSurface,
+                   pCross->display.eglSurface, pCross->displayContext);
+    free(pCross);
+    return -1;
+}
@@ -0,0 +1,593 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include <GL/gl.h>
+
+#include "device.h"
+#include "kms.h"
+#include "utils.h"
+
+/*
+ * The workload --device=fastest renders on each GPU: this many frames
+ * of this many blended full-screen layers, into a square offscreen
+ * surface of this size.  It is fill-bound, like most rendering that
+ * ends up on a display, and takes a few milliseconds on a discrete GPU.
+ */
+#define BENCHMARK_SIZE   1024
+#define BENCHMARK_LAYERS 32
+#define BENCHMARK_FRAMES 16
+
+
+static void AddOutput(struct GpuDevice *pDevice, const char *name)
+{
+    size_t len = strlen(pDevice->outputs);
+
+    snprintf(pDevice->outputs + len, sizeof(pDevice->outputs) - len,
+             "%s%s", (len > 0) ? " " : "", name);
+
+    pDevice->numOutputs++;
+}
+
+
+/*
+ * Record whether the device can display, and the names of its
+ * connected connectors.  This does not require DRM master.
+ *
+ * This runs on every launch, for every GPU, so it reads what the kernel
+ * last found with drmModeGetConnectorCurrent() rather than probing each
+ * connector again, which reads its display's EDID over DDC; see
+ * HashKmsTopology().
+ */
+static void QueryOutputs(struct GpuDevice *pDevice)
+{
+    drmModeResPtr pModeRes;
+    int fd, i;
+
+    fd = open(pDevice->primaryNode, O_RDWR | O_CLOEXEC);
+
+    if (fd < 0) {
+        return;
+    }
+
+    pModeRes = drmModeGetResources(fd);
+
+    if (pModeRes != NULL) {
+
+        pDevice->hasKms = (pModeRes->count_crtcs > 0) &&
+                          (pModeRes->count_connectors > 0);
+
+        for (i = 0; i < pModeRes->count_connectors; i++) {
+
+            drmModeConnectorPtr pConnector =
+                drmModeGetConnectorCurrent(fd, pModeRes->connectors[i]);
+            char name[32];
+
+            if (pConnector == NULL) {
+                continue;
+            }
+
+            if (pConnector->connection == DRM_MODE_CONNECTED) {
+                GetConnectorName(pConnector->connector_type,
+                                 pConnector->connector_type_id,
+                                 name, sizeof(name));
+                AddOutput(pDevice, name);
+            }
+
+            drmModeFreeConnector(pConnector);
+        }
+
+        drmModeFreeResources(pModeRes);
+    }
+
+    close(fd);
+}
+
+
+/*
+ * Match the EGLDeviceEXTs that support EGL_EXT_device_drm to the DRM
+ * devices, by their DRM device files.
+ */
+static void FindEglDevices(struct GpuDevice *pDevices, int count)
+{
+    EGLDeviceEXT eglDevices[MAX_GPU_DEVICES];
+    EGLint numEglDevices, i;
+    struct EglDispatch egl;
+    int j;
+
+    const char *clientExtensionString =
+        eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+
+    if (!ExtensionIsSupported(clientExtensionString,
+                              "EGL_EXT_device_base") &&
+        (!ExtensionIsSupported(clientExtensionString,
+                               "EGL_EXT_device_enumeration") ||
+         !ExtensionIsSupported(clientExtensionString,
+                               "EGL_EXT_device_query"))) {
+        return;
+    }
+
+    if (LoadEglDispatch(&egl, EGL_NO_DISPLAY) != 0) {
+        return;
+    }
+
+    if (!egl.QueryDevicesEXT(ARRAY_LEN(eglDevices), eglDevices,
+                             &numEglDevices)) {
+        return;
+    }
+
+    for (i = 0; i < numEglDevices; i++) {
+
+        const char *deviceExtensionString =
+            egl.QueryDeviceStringEXT(eglDevices[i], EGL_EXTENSIONS);
+        const char *drmDeviceFile;
+
+        if (!ExtensionIsSupported(deviceExtensionString,
+                                  "EGL_EXT_device_drm")) {
+            continue;
+        }
+
+        drmDeviceFile = egl.QueryDeviceStringEXT(eglDevices[i],
+                                                 EGL_DRM_DEVICE_FILE_EXT);
+
+        if (drmDeviceFile == NULL) {
+            continue;
+        }
+
+        for (j = 0; j < count; j++) {
+            if (strcmp(drmDeviceFile, pDevices[j].primaryNode) == 0) {
+                pDevices[j].eglDevice = eglDevices[i];
+            }
+        }
+    }
+}
+
+
+/*
+ * Write the PCI bus ID of a PCI device in the form lspci prints.
+ */
+static void GetBusId(drmDevicePtr pDrmDevice, char *busId, size_t size)
+{
+    snprintf(busId, size, "%04x:%02x:%02x.%x",
+             pDrmDevice->businfo.pci->domain,
+             pDrmDevice->businfo.pci->bus,
+             pDrmDevice->businfo.pci->dev,
+             pDrmDevice->businfo.pci->func);
+}
+
+
+/*
+ * Fill 'pDevices' with the GPUs in the system that have a DRM primary
+ * node, and return how many there are.
+ */
+int DiscoverGpuDevices(struct GpuDevice *pDevices, int maxDevices)
+{
+    drmDevicePtr drmDevices[MAX_GPU_DEVICES];
+    int numDrmDevices, count = 0, i;
+
+    numDrmDevices = drmGetDevices2(0, drmDevices, ARRAY_LEN(drmDevices));
+
+    if (numDrmDevices < 0) {
+        numDrmDevices = 0;
+    }
+
+    for (i = 0; (i < numDrmDevices) && (count < maxDevices); i++) {
+
+        drmDevicePtr pDrmDevice = drmDevices[i];
+        struct GpuDevice *pDevice = &pDevices[count];
+
+        if ((pDrmDevice->available_nodes & (1 << DRM_NODE_PRIMARY)) == 0) {
+            continue;
+        }
+
+        memset(pDevice, 0, sizeof(*pDevice));
+        pDevice->eglDevice = EGL_NO_DEVICE_EXT;
+
+        snprintf(pDevice->primaryNode, sizeof(pDevice->primaryNode), "%s",
+                 pDrmDevice->nodes[DRM_NODE_PRIMARY]);
+
+        if (pDrmDevice->available_nodes & (1 << DRM_NODE_RENDER)) {
+            snprintf(pDevice->renderNode, sizeof(pDevice->renderNode), "%s",
+                     pDrmDevice->nodes[DRM_NODE_RENDER]);
+        }
+
+        if (pDrmDevice->bustype == DRM_BUS_PCI) {
+            GetBusId(pDrmDevice, pDevice->busId, sizeof(pDevice->busId));
+            pDevice->vendorID = pDrmDevice->deviceinfo.pci->vendor_id;
+            pDevice->deviceID = pDrmDevice->deviceinfo.pci->device_id;
+        }
+
+        QueryOutputs(pDevice);
+
+        count++;
+    }
+
+    if (numDrmDevices > 0) {
+        drmFreeDevices(drmDevices, numDrmDevices);
+    }
+
+    FindEglDevices(pDevices, count);
+
+    return count;
+}
+
+
+/*
+ * Open the primary node of the DRM device chosen by the --device
+ * policy, without going through EGL; by default, the first that drives
+ * a connected output, e.g., a GPU's card node or vkms.  With --lease,
+ * return the leased fd instead.  Return -1 on failure.
+ */
+int OpenKmsDevice(const struct Options *pOptions)
+{
+    struct GpuDevice devices[MAX_GPU_DEVICES];
+    const struct GpuDevice *pDevice;
+    int count, fd;
+
+    if (pOptions->leaseFd >= 0) {
+        return pOptions->leaseFd;
+    }
+
+    count = DiscoverGpuDevices(devices, ARRAY_LEN(devices));
+
+    pDevice = SelectGpuDevice(devices, count, 0 /* requireEgl */,
+                              &pOptions->device);
+
+    if (pDevice == NULL) {
+        return -1;
+    }
+
+    if (!pDevice->hasKms) {
+        SetError("%s cannot drive a display.\n", pDevice->primaryNode);
+        return -1;
+    }
+
+    fd = open(pDevice->primaryNode, O_RDWR | O_CLOEXEC);
+
+    if (fd < 0) {
+        SetError("Unable to open %s.\n", pDevice->primaryNode);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+/*
+ * Make 'pSelection' select the GPU that 'drmFd' is open on, e.g., a
+ * DRM lease from another process, so that EGL uses the same GPU.
+ */
+void SelectDeviceOfFd(int drmFd, struct DeviceSelection *pSelection)
+{
+    drmDevicePtr pDrmDevice;
+
+    if (drmGetDevice2(drmFd, 0, &pDrmDevice) != 0) {
+        Warning("Unable to identify the GPU of DRM fd %d.\n", drmFd);
+        return;
+    }
+
+    if (pDrmDevice->bustype == DRM_BUS_PCI) {
+        pSelection->policy = DEVICE_POLICY_BUS_ID;
+        GetBusId(pDrmDevice, pSelection->busId, sizeof(pSelection->busId));
+    } else {
+        Warning("The GPU of DRM fd %d is not a PCI device; using the "
+                "--device policy.\n", drmFd);
+    }
+
+    drmFreeDevice(&pDrmDevice);
+}
+
+
+/*
+ * Render the benchmark workload on the device, offscreen, and return
+ * how long it took in seconds, or a negative value if the device
+ * cannot render offscreen.
+ */
+static double MeasureRenderTime(EGLDeviceEXT eglDevice)
+{
+    static const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_NONE
+    };
+    static const EGLint surfaceAttribs[] = {
+        EGL_WIDTH, BENCHMARK_SIZE,
+        EGL_HEIGHT, BENCHMARK_SIZE,
+        EGL_NONE
+    };
+
+    struct EglDispatch egl;
+    EGLDisplay eglDpy;
+    EGLConfig eglConfig;
+    EGLSurface eglSurface = EGL_NO_SURFACE;
+    EGLContext eglContext = EGL_NO_CONTEXT;
+    EGLint n = 0;
+    double startTime = 0.0, elapsed = -1.0;
+    int frame, layer;
+
+    if (LoadEglDispatch(&egl, EGL_NO_DISPLAY) != 0) {
+        return -1.0;
+    }
+
+    eglDpy = egl.GetPlatformDisplayEXT(EGL_PLATFORM_DEVICE_EXT,
+                                       (void *) eglDevice, NULL);
+
+    if ((eglDpy == EGL_NO_DISPLAY) || !eglInitialize(eglDpy, NULL, NULL)) {
+        return -1.0;
+    }
+
+    if (eglBindAPI(EGL_OPENGL_API) &&
+        eglChooseConfig(eglDpy, configAttribs, &eglConfig, 1, &n) &&
+        (n == 1)) {
+        eglSurface = eglCreatePbufferSurface(eglDpy, eglConfig,
+                                             surfaceAttribs);
+        eglContext = eglCreateContext(eglDpy, eglConfig, EGL_NO_CONTEXT,
+                                      NULL);
+    }
+
+    if ((eglSurface != EGL_NO_SURFACE) &&
+        (eglContext != EGL_NO_CONTEXT) &&
+        eglMakeCurrent(eglDpy, eglSurface, eglSurface, eglContext)) {
+
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+        /* Frame -1 absorbs one-time costs, and is not timed. */
+        for (frame = -1; frame < BENCHMARK_FRAMES; frame++) {
+
+            if (frame == 0) {
+                glFinish();
+                startTime = GetTime();
+            }
+
+            glClear(GL_COLOR_BUFFER_BIT);
+
+            glBegin(GL_QUADS);
+            for (layer = 0; layer < BENCHMARK_LAYERS; layer++) {
+                glColor4f((GLfloat) layer / BENCHMARK_LAYERS, 0.5, 0.5, 0.5);
+                glVertex2f(-1.0, -1.0);
+                glVertex2f( 1.0, -1.0);
+                glVertex2f( 1.0,  1.0);
+                glVertex2f(-1.0,  1.0);
+            }
+            glEnd();
+        }
+
+        glFinish();
+        elapsed = GetTime() - startTime;
+
+        eglMakeCurrent(eglDpy, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                       EGL_NO_CONTEXT);
+    }
+
+    if (eglContext != EGL_NO_CONTEXT) {
+        eglDestroyContext(eglDpy, eglContext);
+    }
+
+    if (eglSurface != EGL_NO_SURFACE) {
+        eglDestroySurface(eglDpy, eglSurface);
+    }
+
+    eglTerminate(eglDpy);
+
+    return elapsed;
+}
+
+
+/* Whether 'name' is one of the device's connected outputs. */
+static int HasOutput(const struct GpuDevice *pDevice, const char *name)
+{
+    char outputs[sizeof(pDevice->outputs)];
+    char *output, *saveptr;
+
+    snprintf(outputs, sizeof(outputs), "%s", pDevice->outputs);
+
+    for (output = strtok_r(outputs, " ", &saveptr); output != NULL;
+         output = strtok_r(NULL, " ", &saveptr)) {
+        if (strcasecmp(output, name) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * How well the device suits DEVICE_POLICY_DISPLAY: best if it drives a
+ * connected output, then if it can display at all.
+ */
+static int DisplayRank(const struct GpuDevice *pDevice)
+{
+    return (pDevice->numOutputs > 0) ? 2 : (pDevice->hasKms ? 1 : 0);
+}
+
+
+static void DescribeGpuDevice(const struct GpuDevice *pDevice, char *str,
+                              size_t size)
+{
+    snprintf(str, size, "%s%s%s%s%s", pDevice->primaryNode,
+             pDevice->busId[0] ? ", PCI " : "", pDevice->busId,
+             pDevice->numOutputs ? ", outputs " : "", pDevice->outputs);
+}
+
+
+/*
+ * Choose one of 'pDevices' by a --device policy; if 'requireEgl',
+ * only consider devices that EGL exposes as EGLDeviceEXTs.  Return NULL
+ * if no device fits.
+ */
+const struct GpuDevice *SelectGpuDevice(
+    const struct GpuDevice *pDevices, int count, int requireEgl,
+    const struct DeviceSelection *pSelection)
+{
+    const struct GpuDevice *pSelected = NULL;
+    double bestTime = 0.0;
+    char description[256];
+    int i;
+
+    for (i = 0; i < count; i++) {
+
+        const struct GpuDevice *pDevice = &pDevices[i];
+        double time;
+
+        if (requireEgl && (pDevice->eglDevice == EGL_NO_DEVICE_EXT)) {
+            continue;
+        }
+
+        switch (pSelection->policy) {
+        case DEVICE_POLICY_DISPLAY:
+            if ((pSelected == NULL) ||
+                (DisplayRank(pDevice) > DisplayRank(pSelected))) {
+                pSelected = pDevice;
+            }
+            break;
+
+        case DEVICE_POLICY_CONNECTOR:
+            if ((pSelected == NULL) &&
+                HasOutput(pDevice, pSelection->connectorName)) {
+                pSelected = pDevice;
+            }
+            break;
+
+        case DEVICE_POLICY_BUS_ID:
+            if ((pSelected == NULL) &&
+                (strcmp(pDevice->busId, pSelection->busId) == 0)) {
+                pSelected = pDevice;
+            }
+            break;
+
+        case DEVICE_POLICY_FASTEST:
+            if (pDevice->eglDevice == EGL_NO_DEVICE_EXT) {
+                break;
+            }
+
+            time = MeasureRenderTime(pDevice->eglDevice);
+
+            if (time < 0.0) {
+                printf("%s: unable to render offscreen\n",
+                       pDevice->primaryNode);
+                break;
+            }
+
+            printf("%s: %.2f ms for the device benchmark\n",
+                   pDevice->primaryNode, time * 1000.0);
+
+            if ((pSelected == NULL) || (time < bestTime)) {
+                pSelected = pDevice;
+                bestTime = time;
+            }
+            break;
+        }
+    }
+
+    if (pSelected == NULL) {
+        switch (pSelection->policy) {
+        case DEVICE_POLICY_DISPLAY:
+            SetError("No %sGPU found.\n",
+                  requireEgl ? "EGL_EXT_device_drm-capable " : "");
+            break;
+        case DEVICE_POLICY_CONNECTOR:
+            SetError("No %sGPU has a connected output named %s.\n",
+                  requireEgl ? "EGL_EXT_device_drm-capable " : "",
+                  pSelection->connectorName);
+            break;
+        case DEVICE_POLICY_BUS_ID:
+            SetError("No %sGPU has PCI bus ID %s.\n",
+                  requireEgl ? "EGL_EXT_device_drm-capable " : "",
+                  pSelection->busId);
+            break;
+        case DEVICE_POLICY_FASTEST:
+            SetError("No GPU could run the device benchmark.\n");
+            break;
+        }
+        return NULL;
+    }
+
+    DescribeGpuDevice(pSelected, description, sizeof(description));
+    printf("Using GPU %s\n", description);
+
+    return pSelected;
+}
+
+
+/*
+ * Print the GPUs in the system, and the ones the --device and
+ * --render-device policies select.
+ */
+void ListGpuDevices(const struct Options *pOptions)
+{
+    struct GpuDevice devices[MAX_GPU_DEVICES];
+    int count, i;
+
+    count = DiscoverGpuDevices(devices, ARRAY_LEN(devices));
+
+    for (i = 0; i < count; i++) {
+        printf("GPU %d: %s\n", i, devices[i].primaryNode);
+        printf("    Render node: %s\n",
+               devices[i].renderNode[0] ? devices[i].renderNode : "none");
+
+        if (devices[i].busId[0]) {
+            printf("    PCI bus ID:  %s (vendor 0x%04x, device 0x%04x)\n",
+                   devices[i].busId, devices[i].vendorID,
+                   devices[i].deviceID);
+        } else {
+            printf("    PCI bus ID:  none\n");
+        }
+
+        printf("    EGL device:  %s\n",
+               (devices[i].eglDevice != EGL_NO_DEVICE_EXT) ? "yes" : "no");
+        printf("    Outputs:     %s\n",
+               !devices[i].hasKms ? "none (cannot display)" :
+               devices[i].numOutputs ? devices[i].outputs : "none connected");
+    }
+
+    if (count == 0) {
+        printf("No GPUs found.\n");
+        return;
+    }
+
+    if (SelectGpuDevice(devices, count,
+                        pOptions->backendType == BACKEND_EGLSTREAM,
+                        &pOptions->device) == NULL) {
+        Warning("%s", GetError());
+    }
+
+    if (pOptions->renderDeviceSet) {
+        printf("Rendering with:\n");
+        if (SelectGpuDevice(devices, count, 1 /* requireEgl */,
+                            &pOptions->renderDevice) == NULL) {
+            Warning("%s", GetError());
+        }
+    }
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#if !defined(DEVICE_H)
+#define DEVICE_H
+
+#include <stdint.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "options.h"
+
+#define MAX_GPU_DEVICES 16
+
+/*
+ * A GPU, as seen through DRM and, if EGL can enumerate it, EGL.
+ */
+struct GpuDevice {
+    char primaryNode[64];       /* e.g., /dev/dri/card0 */
+    char renderNode[64];        /* e.g., /dev/dri/renderD128; may be empty */
+    char busId[16];             /* e.g., 0000:01:00.0; empty if not PCI */
+    uint16_t vendorID;
+    uint16_t deviceID;
+
+    /* Whether the device has CRTCs and connectors, i.e., can display. */
+    int hasKms;
+
+    /* Names of the connected connectors, e.g., "DP-1 HDMI-A-1". */
+    int numOutputs;
+    char outputs[128];
+
+    /* EGL_NO_DEVICE_EXT if EGL does not expose the device. */
+    EGLDeviceEXT eglDevice;
+};
+
+int DiscoverGpuDevices(struct GpuDevice *pDevices, int maxDevices);
+
+const struct GpuDevice *SelectGpuDevice(
+    const struct GpuDevice *pDevices, int count, int requireEgl,
+    const struct DeviceSelection *pSelection);
+
+int OpenKmsDevice(const struct Options *pOptions);
+
+void SelectDeviceOfFd(int drmFd, struct DeviceSelection *pSelection);
+
+void ListGpuDevices(const struct Options *pOptions);
+
+#endif /* DEVICE_H */
@@ -20,6 +20,7 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -31,7 +32,9 @@
 #include <GL/gl.h>
 
 #include "utils.h"
+#include "device.h"
 #include "egl.h"
+#include "probecache.h"
 
 /* XXX khronos eglext.h does not yet have EGL_DRM_MASTER_FD_EXT */
 #if !defined(EGL_DRM_MASTER_FD_EXT)
@@ -42,13 +45,21 @@
 /*
  * The EGL_EXT_device_base extension (or EGL_EXT_device_enumeration
  * and EGL_EXT_device_query) let you enumerate the GPUs in the system.
+ *
+ * EGL_EXT_device_query lets you query properties of EGLDeviceEXTs,
+ * defined by separate extensions.  E.g., EGL_EXT_device_drm lets you
+ * query the DRM device file (EGL_DRM_DEVICE_FILE_EXT) of an
+ * EGLDeviceEXT; from that, DiscoverGpuDevices() finds the device's PCI
+ * bus ID, render node, and connected outputs through libdrm.
+ *
+ * Choose among the EGL_EXT_device_drm-capable devices by a --device
+ * policy; see SelectGpuDevice().  Return EGL_NO_DEVICE_EXT on failure.
  */
-EGLDeviceEXT GetEglDevice(void)
+EGLDeviceEXT GetEglDevice(const struct DeviceSelection *pSelection)
 {
-    EGLint numDevices, i;
-    EGLDeviceEXT *devices = NULL;
-    EGLDeviceEXT device = EGL_NO_DEVICE_EXT;
-    EGLBoolean ret;
+    struct GpuDevice devices[MAX_GPU_DEVICES];
+    const struct GpuDevice *pDevice;
+    int count;
 
     const char *clientExtensionString =
         eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
@@ -59,105 +70,53 @@ EGLDeviceEXT GetEglDevice(void)
                                "EGL_EXT_device_enumeration") ||
          !ExtensionIsSupported(clientExtensionString,
                                "EGL_EXT_device_query"))) {
-        Fatal("EGL_EXT_device base extensions not found.\n");
-    }
-
-    /* Query how many devices are present. */
-    ret = pEglQueryDevicesEXT(0, NULL, &numDevices);
-
-    if (!ret) {
-        Fatal("Failed to query EGL devices.\n");
-    }
-
-    if (numDevices < 1) {
-        Fatal("No EGL devices found.\n");
-    }
-
-    /* Allocate memory to store that many EGLDeviceEXTs. */
-    devices = calloc(numDevices, sizeof(EGLDeviceEXT));
-
-    if (devices == NULL) {
-        Fatal("Memory allocation failure.\n");
-    }
-
-    /* Query the EGLDeviceEXTs. */
-    ret = pEglQueryDevicesEXT(numDevices, devices, &numDevices);
-
-    if (!ret) {
-        Fatal("Failed to query EGL devices.\n");
+        SetError("EGL_EXT_device base extensions not found.\n");
+        return EGL_NO_DEVICE_EXT;
     }
 
-    /*
-     * Select which EGLDeviceEXT to use.
-     *
-     * The EGL_EXT_device_query extension defines the functions:
-     *
-     *   eglQueryDeviceAttribEXT()
-     *   eglQueryDeviceStringEXT()
-     *
-     * as ways to generically query properties of EGLDeviceEXTs, and
-     * separate EGL extensions define EGLDeviceEXT attributes that can
-     * be queried through those functions.  E.g.,
-     *
-     * - EGL_NV_device_cuda lets you query the CUDA device ID
-     *   (EGL_CUDA_DEVICE_NV of an EGLDeviceEXT.
-     *
-     * - EGL_EXT_device_drm lets you query the DRM device file
-     *   (EGL_DRM_DEVICE_FILE_EXT) of an EGLDeviceEXT.
-     *
-     * Future extensions could define other EGLDeviceEXT attributes
-     * such as PCI BusID.
-     *
-     * For now, just choose the first device that supports EGL_EXT_device_drm.
-     */
-
-    for (i = 0; i < numDevices; i++) {
+    count = DiscoverGpuDevices(devices, ARRAY_LEN(devices));
 
-        const char *deviceExtensionString =
-            pEglQueryDeviceStringEXT(devices[i], EGL_EXTENSIONS);
+    pDevice = SelectGpuDevice(devices, count, EGL_TRUE, pSelection);
 
-        if (ExtensionIsSupported(deviceExtensionString, "EGL_EXT_device_drm")) {
-            device = devices[i];
-            break;
-        }
-    }
-
-    free(devices);
-
-    if (device == EGL_NO_DEVICE_EXT) {
-        Fatal("No EGL_EXT_device_drm-capable EGL device found.\n");
-    }
-
-    return device;
+    return (pDevice != NULL) ? pDevice->eglDevice : EGL_NO_DEVICE_EXT;
 }
 
 
 /*
  * Use the EGL_EXT_device_drm extension to query the DRM device file
- * corresponding to the EGLDeviceEXT.
+ * corresponding to the EGLDeviceEXT, and open it.  Return -1 on
+ * failure.
  */
 int GetDrmFd(EGLDeviceEXT device)
 {
-    const char *deviceExtensionString =
-        pEglQueryDeviceStringEXT(device, EGL_EXTENSIONS);
-
+    struct EglDispatch egl;
+    const char *deviceExtensionString;
     const char *drmDeviceFile;
     int fd;
 
+    if (LoadEglDispatch(&egl, EGL_NO_DISPLAY) != 0) {
+        return -1;
+    }
+
+    deviceExtensionString = egl.QueryDeviceStringEXT(device, EGL_EXTENSIONS);
+
     if (!ExtensionIsSupported(deviceExtensionString, "EGL_EXT_device_drm")) {
-        Fatal("EGL_EXT_device_drm extension not found.\n");
+        SetError("EGL_EXT_device_drm extension not found.\n");
+        return -1;
     }
 
-    drmDeviceFile = pEglQueryDeviceStringEXT(device, EGL_DRM_DEVICE_FILE_EXT);
+    drmDeviceFile = egl.QueryDeviceStringEXT(device, EGL_DRM_DEVICE_FILE_EXT);
 
     if (drmDeviceFile == NULL) {
-        Fatal("No DRM device file found for EGL device.\n");
+        SetError("No DRM device file found for EGL device.\n");
+        return -1;
     }
 
     fd = open(drmDeviceFile, O_RDWR, 0);
 
     if (fd < 0) {
-        Fatal("Unable to open DRM device file.\n");
+        SetError("Unable to open DRM device file.\n");
+        return -1;
     }
 
     return fd;
@@ -165,18 +124,25 @@ int GetDrmFd(EGLDeviceEXT device)
 
 
 /*
- * Create an EGLDisplay from the given EGL device.
+ * Create an EGLDisplay from the given EGL device, and load its
+ * extension functions into 'pEgl'.
+ *
+ * If 'drmFd' is negative, the EGLDisplay is created without a DRM
+ * master fd.  Such an EGLDisplay can render, e.g., as the producer of
+ * an EGLStream whose consumer lives in another process, but cannot
+ * use EGLOutput.
+ *
+ * Return EGL_NO_DISPLAY on failure.
  */
-EGLDisplay GetEglDisplay(EGLDeviceEXT device, int drmFd)
+EGLDisplay GetEglDisplay(EGLDeviceEXT device, int drmFd,
+                         struct EglDispatch *pEgl)
 {
     EGLDisplay eglDpy;
+    const char *deviceExtensionString;
 
     const char *clientExtensionString =
         eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
 
-    const char *deviceExtensionString =
-        pEglQueryDeviceStringEXT(device, EGL_EXTENSIONS);
-
     /*
      * Provide the DRM fd when creating the EGLDisplay, so that the
      * EGL implementation can make any necessary DRM calls using the
@@ -188,12 +154,23 @@ EGLDisplay GetEglDisplay(EGLDeviceEXT device, int drmFd)
         EGL_NONE
     };
 
+    if (drmFd < 0) {
+        attribs[0] = EGL_NONE;
+    }
+
+    if (LoadEglDispatch(pEgl, EGL_NO_DISPLAY) != 0) {
+        return EGL_NO_DISPLAY;
+    }
+
+    deviceExtensionString = pEgl->QueryDeviceStringEXT(device, EGL_EXTENSIONS);
+
     /*
      * eglGetPlatformDisplayEXT requires EGL client extension
      * EGL_EXT_platform_base.
      */
     if (!ExtensionIsSupported(clientExtensionString, "EGL_EXT_platform_base")) {
-        Fatal("EGL_EXT_platform_base not found.\n");
+        SetError("EGL_EXT_platform_base not found.\n");
+        return EGL_NO_DISPLAY;
     }
 
     /*
@@ -203,27 +180,37 @@ EGLDisplay GetEglDisplay(EGLDeviceEXT device, int drmFd)
 
     if (!ExtensionIsSupported(clientExtensionString,
                               "EGL_EXT_platform_device")) {
-        Fatal("EGL_EXT_platform_device not found.\n");
+        SetError("EGL_EXT_platform_device not found.\n");
+        return EGL_NO_DISPLAY;
     }
 
     /*
      * Providing a DRM fd during EGLDisplay creation requires
      * EGL_EXT_device_drm.
      */
-    if (!ExtensionIsSupported(deviceExtensionString, "EGL_EXT_device_drm")) {
-        Fatal("EGL_EXT_device_drm not found.\n");
+    if ((drmFd >= 0) &&
+        !ExtensionIsSupported(deviceExtensionString, "EGL_EXT_device_drm")) {
+        SetError("EGL_EXT_device_drm not found.\n");
+        return EGL_NO_DISPLAY;
     }
 
     /* Get an EGLDisplay from the EGLDeviceEXT. */
-    eglDpy = pEglGetPlatformDisplayEXT(EGL_PLATFORM_DEVICE_EXT,
-                                       (void*)device, attribs);
+    eglDpy = pEgl->GetPlatformDisplayEXT(EGL_PLATFORM_DEVICE_EXT,
+                                         (void*)device, attribs);
 
     if (eglDpy == EGL_NO_DISPLAY) {
-        Fatal("Failed to get EGLDisplay from EGLDevice.");
+        SetError("Failed to get EGLDisplay from EGLDevice.\n");
+        return EGL_NO_DISPLAY;
     }
 
     if (!eglInitialize(eglDpy, NULL, NULL)) {
-        Fatal("Failed to initialize EGLDisplay.");
+        SetError("Failed to initialize EGLDisplay.\n");
+        return EGL_NO_DISPLAY;
+    }
+
+    if (LoadEglDispatch(pEgl, eglDpy) != 0) {
+        eglTerminate(eglDpy);
+        return EGL_NO_DISPLAY;
     }
 
     return eglDpy;
@@ -231,44 +218,139 @@ EGLDisplay GetEglDisplay(EGLDeviceEXT device, int drmFd)
 
 
 /*
- * Set up EGL to present to a DRM KMS plane through an EGLStream.
+ * Return whether EGLStreams consumed by an EGLOutputLayer of the
+ * EGLDisplay with these extensions should deliver page flip events,
+ * for --input-latency, or for the compositor to pace its clients.
  */
-EGLSurface SetUpEgl(EGLDisplay eglDpy, uint32_t planeID, int width, int height)
+EGLBoolean StreamFlipEventsSupported(const char *extensionString,
+                                     const struct Options *pOptions)
 {
-    EGLint configAttribs[] = {
-        EGL_SURFACE_TYPE, EGL_STREAM_BIT_KHR,
-        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
-        EGL_RED_SIZE, 1,
-        EGL_GREEN_SIZE, 1,
-        EGL_BLUE_SIZE, 1,
-        EGL_ALPHA_SIZE, 0,
-        EGL_DEPTH_SIZE, 1,
-        EGL_NONE,
-    };
+    return (pOptions->inputLatency ||
+            (pOptions->role == ROLE_COMPOSITOR)) &&
+        ExtensionIsSupported(extensionString,
+                             "EGL_EXT_stream_acquire_mode") &&
+        ExtensionIsSupported(extensionString,
+                             "EGL_NV_output_drm_flip_event");
+}
+
+
+/*
+ * Fill 'streamAttribs' with the EGLStream attributes that implement
+ * the requested present mode.
+ *
+ * By default, an EGLStream behaves as a mailbox: a newly produced
+ * frame replaces any frame the consumer has not yet acquired, so
+ * eglSwapBuffers() never blocks on the display.  EGL_KHR_stream_fifo
+ * lets the stream instead hold a queue of EGL_STREAM_FIFO_LENGTH_KHR
+ * frames, so that eglSwapBuffers() blocks only once the queue is full.
+ * A longer queue absorbs more variation in frame time at the cost of
+ * more frames of latency.
+ */
+static int GetStreamAttribs(const char *extensionString,
+                            const struct Options *pOptions,
+                            EGLint *streamAttribs, size_t streamAttribsLen)
+{
+    EGLint fifoLength = 0;
+    size_t n = 0;
+
+    switch (pOptions->presentMode) {
+    case PRESENT_MODE_LATENCY:
+        fifoLength = 0;
+        break;
+    case PRESENT_MODE_BALANCED:
+        fifoLength = 1;
+        break;
+    case PRESENT_MODE_THROUGHPUT:
+        fifoLength = pOptions->fifoLength;
+        break;
+    }
+
+    if ((fifoLength > 0) &&
+        !ExtensionIsSupported(extensionString, "EGL_KHR_stream_fifo")) {
+        Warning("EGL_KHR_stream_fifo not found; "
+                "falling back to the latency present mode.\n");
+        fifoLength = 0;
+    }
+
+    if (fifoLength > 0) {
+        streamAttribs[n++] = EGL_STREAM_FIFO_LENGTH_KHR;
+        streamAttribs[n++] = fifoLength;
+    }
+
+    /*
+     * For --input-latency and the compositor, the EGLOutputLayer must
+     * report when each frame reaches the screen.  It does, with a DRM
+     * page flip event, for frames acquired with
+     * EGL_DRM_FLIP_EVENT_DATA_NV; that needs the application to acquire
+     * frames itself.  See EnableEglStreamFlipEvents() and compositor.c.
+     */
+    if (StreamFlipEventsSupported(extensionString, pOptions)) {
+        streamAttribs[n++] = EGL_CONSUMER_AUTO_ACQUIRE_EXT;
+        streamAttribs[n++] = EGL_FALSE;
+    }
+
+    if (n >= streamAttribsLen) {
+        SetError("Too many EGLStream attributes.\n");
+        return -1;
+    }
 
-    EGLint contextAttribs[] = { EGL_NONE };
+    streamAttribs[n] = EGL_NONE;
 
+    printf("Present mode: %s (EGLStream FIFO length %d)\n",
+           PresentModeName(pOptions->presentMode), fifoLength);
+
+    return 0;
+}
+
+
+/*
+ * Return the number of frames that the producer has inserted into the
+ * stream but the consumer has not yet acquired.  Frames in
+ * the stream are numbered by EGL_PRODUCER_FRAME_KHR and
+ * EGL_CONSUMER_FRAME_KHR as they are inserted and acquired.
+ */
+EGLint GetStreamQueueDepth(const struct EglDispatch *pEgl,
+                           EGLDisplay eglDpy, EGLStreamKHR eglStream)
+{
+    EGLuint64KHR producerFrame = 0, consumerFrame = 0;
+
+    if (!pEgl->QueryStreamu64KHR(eglDpy, eglStream,
+                                 EGL_PRODUCER_FRAME_KHR, &producerFrame) ||
+        !pEgl->QueryStreamu64KHR(eglDpy, eglStream,
+                                 EGL_CONSUMER_FRAME_KHR, &consumerFrame)) {
+        return 0;
+    }
+
+    if (producerFrame <= consumerFrame) {
+        return 0;
+    }
+
+    return (EGLint) (producerFrame - consumerFrame);
+}
+
+
+/*
+ * Create an EGLStream whose consumer is the EGLOutputLayer for the
+ * given DRM KMS plane.  The stream is configured for the requested
+ * present mode, and is ready to be connected to a producer.  Return
+ * EGL_NO_STREAM_KHR on failure.
+ */
+EGLStreamKHR CreateOutputStream(const struct EglDispatch *pEgl,
+                                EGLDisplay eglDpy, uint32_t planeID,
+                                const struct Options *pOptions)
+{
     EGLAttrib layerAttribs[] = {
         EGL_DRM_PLANE_EXT,
         planeID,
         EGL_NONE,
     };
 
-    EGLint streamAttribs[] = { EGL_NONE };
+    EGLint streamAttribs[8];
 
-    EGLint surfaceAttribs[] = {
-        EGL_WIDTH, width,
-        EGL_HEIGHT, height,
-        EGL_NONE
-    };
-
-    EGLConfig eglConfig;
-    EGLContext eglContext;
     EGLint n = 0;
     EGLBoolean ret;
     EGLOutputLayerEXT eglLayer;
     EGLStreamKHR eglStream;
-    EGLSurface eglSurface;
 
     const char *extensionString = eglQueryString(eglDpy, EGL_EXTENSIONS);
 
@@ -278,76 +360,62 @@ EGLSurface SetUpEgl(EGLDisplay eglDpy, uint32_t planeID, int width, int height)
      */
 
     if (!ExtensionIsSupported(extensionString, "EGL_EXT_output_base")) {
-        Fatal("EGL_EXT_output_base not found.\n");
+        SetError("EGL_EXT_output_base not found.\n");
+        return EGL_NO_STREAM_KHR;
     }
 
     if (!ExtensionIsSupported(extensionString, "EGL_EXT_output_drm")) {
-        Fatal("EGL_EXT_output_drm not found.\n");
+        SetError("EGL_EXT_output_drm not found.\n");
+        return EGL_NO_STREAM_KHR;
     }
 
     /*
-     * EGL_KHR_stream, EGL_EXT_stream_consumer_egloutput, and
-     * EGL_KHR_stream_producer_eglsurface are needed to create an
-     * EGLStream connecting an EGLSurface and an EGLOutputLayer.
+     * EGL_KHR_stream and EGL_EXT_stream_consumer_egloutput are needed
+     * to create an EGLStream consumed by an EGLOutputLayer.
      */
 
     if (!ExtensionIsSupported(extensionString, "EGL_KHR_stream")) {
-        Fatal("EGL_KHR_stream not found.\n");
+        SetError("EGL_KHR_stream not found.\n");
+        return EGL_NO_STREAM_KHR;
     }
 
     if (!ExtensionIsSupported(extensionString,
                               "EGL_EXT_stream_consumer_egloutput")) {
-        Fatal("EGL_EXT_stream_consumer_egloutput not found.\n");
-    }
-
-    if (!ExtensionIsSupported(extensionString,
-                              "EGL_KHR_stream_producer_eglsurface")) {
-        Fatal("EGL_KHR_stream_producer_eglsurface not found.\n");
+        SetError("EGL_EXT_stream_consumer_egloutput not found.\n");
+        return EGL_NO_STREAM_KHR;
     }
 
-    /* Bind full OpenGL as EGL's client API. */
-
-    eglBindAPI(EGL_OPENGL_API);
-
-    /* Find a suitable EGL config. */
+    /* Find the EGLOutputLayer that corresponds to the DRM KMS plane. */
 
-    ret = eglChooseConfig(eglDpy, configAttribs, &eglConfig, 1, &n);
+    ret = pEgl->GetOutputLayersEXT(eglDpy, layerAttribs, &eglLayer, 1, &n);
 
     if (!ret || !n) {
-        Fatal("eglChooseConfig() failed.\n");
+        SetError("Unable to get EGLOutputLayer for plane 0x%08x\n", planeID);
+        return EGL_NO_STREAM_KHR;
     }
 
-    /* Create an EGL context using the EGL config. */
-
-    eglContext =
-        eglCreateContext(eglDpy, eglConfig, EGL_NO_CONTEXT, contextAttribs);
-
-    if (eglContext == NULL) {
-        Fatal("eglCreateContext() failed.\n");
-    }
-
-    /* Find the EGLOutputLayer that corresponds to the DRM KMS plane. */
-
-    ret = pEglGetOutputLayersEXT(eglDpy, layerAttribs, &eglLayer, 1, &n);
+    /* Create an EGLStream, configured for the requested present mode. */
 
-    if (!ret || !n) {
-        Fatal("Unable to get EGLOutputLayer for plane 0x%08x\n", planeID);
+    if (GetStreamAttribs(extensionString, pOptions,
+                         streamAttribs, ARRAY_LEN(streamAttribs)) != 0) {
+        return EGL_NO_STREAM_KHR;
     }
 
-    /* Create an EGLStream. */
-
-    eglStream = pEglCreateStreamKHR(eglDpy, streamAttribs);
+    eglStream = pEgl->CreateStreamKHR(eglDpy, streamAttribs);
 
     if (eglStream == EGL_NO_STREAM_KHR) {
-        Fatal("Unable to create stream.\n");
+        SetError("Unable to create stream.\n");
+        return EGL_NO_STREAM_KHR;
     }
 
     /* Set the EGLOutputLayer as the consumer of the EGLStream. */
 
-    ret = pEglStreamConsumerOutputEXT(eglDpy, eglStream, eglLayer);
+    ret = pEgl->StreamConsumerOutputEXT(eglDpy, eglStream, eglLayer);
 
     if (!ret) {
-        Fatal("Unable to create EGLOutput stream consumer.\n");
+        SetError("Unable to create EGLOutput stream consumer.\n");
+        pEgl->DestroyStreamKHR(eglDpy, eglStream);
+        return EGL_NO_STREAM_KHR;
     }
 
     /*
@@ -369,9 +437,459 @@ EGLSurface SetUpEgl(EGLDisplay eglDpy, uint32_t planeID, int width, int height)
      *
      * So, eglSwapBuffers() (to produce new frames) is sufficient for
      * the frames to be displayed.  That behavior can be altered with
-     * the EGL_EXT_stream_acquire_mode extension.
+     * the EGL_EXT_stream_acquire_mode extension, as GetStreamAttribs()
+     * does for --input-latency.
      */
 
+    return eglStream;
+}
+
+
+/*
+ * The attributes of an EGLConfig that matter for the config policy.
+ */
+struct ConfigInfo {
+    EGLint id;
+    EGLint red, green, blue, alpha;
+    EGLint depth, stencil;
+    EGLint samples;
+};
+
+
+static void GetConfigInfo(EGLDisplay eglDpy, EGLConfig eglConfig,
+                          struct ConfigInfo *pInfo)
+{
+    eglGetConfigAttrib(eglDpy, eglConfig, EGL_CONFIG_ID, &pInfo->id);
+    eglGetConfigAttrib(eglDpy, eglConfig, EGL_RED_SIZE, &pInfo->red);
+    eglGetConfigAttrib(eglDpy, eglConfig, EGL_GREEN_SIZE, &pInfo->green);
+    eglGetConfigAttrib(eglDpy, eglConfig, EGL_BLUE_SIZE, &pInfo->blue);
+    eglGetConfigAttrib(eglDpy, eglConfig, EGL_ALPHA_SIZE, &pInfo->alpha);
+    eglGetConfigAttrib(eglDpy, eglConfig, EGL_DEPTH_SIZE, &pInfo->depth);
+    eglGetConfigAttrib(eglDpy, eglConfig, EGL_STENCIL_SIZE, &pInfo->stencil);
+    eglGetConfigAttrib(eglDpy, eglConfig, EGL_SAMPLES, &pInfo->samples);
+}
+
+
+/*
+ * Return the bits of framebuffer memory that each pixel of the config
+ * costs, counting every sample of the color, depth, and stencil
+ * buffers.  Most of the per-pixel memory bandwidth of rendering and
+ * resolving scales with this.
+ */
+static int ConfigBitsPerPixel(const struct ConfigInfo *pInfo)
+{
+    int bits = pInfo->red + pInfo->green + pInfo->blue + pInfo->alpha +
+               pInfo->depth + pInfo->stencil;
+
+    return bits * ((pInfo->samples > 1) ? pInfo->samples : 1);
+}
+
+
+/*
+ * Return whether the config satisfies the options' config policy.  If
+ * 'exactColor', the color channels must match the requested color
+ * format exactly; otherwise, they must be at least as large.
+ */
+static EGLBoolean ConfigMeetsPolicy(const struct ConfigInfo *pInfo,
+                                    const struct Options *pOptions,
+                                    EGLBoolean exactColor)
+{
+    EGLint red = 8, green = 8, blue = 8;
+
+    if (pOptions->colorFormat == COLOR_FORMAT_RGB565) {
+        red = 5;
+        green = 6;
+        blue = 5;
+    }
+
+    if (exactColor) {
+        if ((pInfo->red != red) || (pInfo->green != green) ||
+            (pInfo->blue != blue)) {
+            return EGL_FALSE;
+        }
+    } else if ((pInfo->red < red) || (pInfo->green < green) ||
+               (pInfo->blue < blue)) {
+        return EGL_FALSE;
+    }
+
+    return (pInfo->depth >= pOptions->depthBits) &&
+           (pInfo->samples >= pOptions->msaaSamples);
+}
+
+
+/*
+ * Return the EGLConfig that ChooseConfig() chose for these arguments in
+ * an earlier launch (see probecache.c), with its attributes in
+ * *pInfo, if it still qualifies; otherwise return NULL.  Looking up one
+ * config by EGL_CONFIG_ID is much cheaper than querying them all.
+ */
+static EGLConfig FindCachedConfig(EGLDisplay eglDpy, EGLint surfaceType,
+                                  EGLint nativeVisualID,
+                                  const struct Options *pOptions,
+                                  const struct ProbeCache *pCache,
+                                  struct ConfigInfo *pInfo)
+{
+    EGLint configID = LookUpCachedConfig(pCache, surfaceType,
+                                         nativeVisualID);
+    EGLint configAttribs[] = {
+        EGL_CONFIG_ID, configID,
+        EGL_NONE,
+    };
+
+    EGLConfig eglConfig;
+    EGLint n = 0, surfaceTypes = 0, renderableTypes = 0, visualID = 0;
+
+    if (configID == 0) {
+        return NULL;
+    }
+
+    if (!eglChooseConfig(eglDpy, configAttribs, &eglConfig, 1, &n) ||
+        (n != 1)) {
+        return NULL;
+    }
+
+    eglGetConfigAttrib(eglDpy, eglConfig, EGL_SURFACE_TYPE, &surfaceTypes);
+    eglGetConfigAttrib(eglDpy, eglConfig, EGL_RENDERABLE_TYPE,
+                       &renderableTypes);
+    eglGetConfigAttrib(eglDpy, eglConfig, EGL_NATIVE_VISUAL_ID, &visualID);
+
+    if (((surfaceTypes & surfaceType) != surfaceType) ||
+        ((renderableTypes & EGL_OPENGL_BIT) == 0) ||
+        ((nativeVisualID != 0) && (visualID != nativeVisualID))) {
+        return NULL;
+    }
+
+    GetConfigInfo(eglDpy, eglConfig, pInfo);
+
+    return ConfigMeetsPolicy(pInfo, pOptions, EGL_FALSE) ? eglConfig : NULL;
+}
+
+
+/*
+ * Consider every OpenGL config with the given surface type (and, if
+ * 'nativeVisualID' is not 0, that native visual), keep those that meet
+ * the options' policy, and return the one with the fewest bits per
+ * pixel, with its attributes in *pInfo.  If no config has the exact
+ * color format, accept larger color channels.  Return NULL if no
+ * config qualifies.
+ */
+static EGLConfig SearchConfigs(EGLDisplay eglDpy, EGLint surfaceType,
+                               EGLint nativeVisualID,
+                               const struct Options *pOptions,
+                               struct ConfigInfo *pInfo)
+{
+    EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, surfaceType,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE,
+    };
+
+    EGLConfig *configs = NULL;
+    EGLConfig bestConfig = NULL;
+    EGLint n = 0, i;
+    int pass;
+
+    if (!eglChooseConfig(eglDpy, configAttribs, NULL, 0, &n) || (n == 0)) {
+        return NULL;
+    }
+
+    configs = calloc(n, sizeof(EGLConfig));
+
+    if (configs == NULL) {
+        return NULL;
+    }
+
+    if (!eglChooseConfig(eglDpy, configAttribs, configs, n, &n)) {
+        free(configs);
+        return NULL;
+    }
+
+    for (pass = 0; (pass < 2) && (bestConfig == NULL); pass++) {
+        EGLBoolean exactColor = (pass == 0);
+
+        for (i = 0; i < n; i++) {
+            struct ConfigInfo info;
+
+            GetConfigInfo(eglDpy, configs[i], &info);
+
+            if (nativeVisualID != 0) {
+                EGLint visualID = 0;
+
+                eglGetConfigAttrib(eglDpy, configs[i], EGL_NATIVE_VISUAL_ID,
+                                   &visualID);
+                if (visualID != nativeVisualID) {
+                    continue;
+                }
+            }
+
+            if (!ConfigMeetsPolicy(&info, pOptions, exactColor)) {
+                continue;
+            }
+
+            if ((bestConfig == NULL) ||
+                (ConfigBitsPerPixel(&info) < ConfigBitsPerPixel(pInfo))) {
+                bestConfig = configs[i];
+                *pInfo = info;
+            }
+        }
+
+        if ((bestConfig != NULL) && !exactColor) {
+            Warning("No EGLConfig is exactly %s; using a larger one.\n",
+                    ColorFormatName(pOptions->colorFormat));
+        }
+    }
+
+    free(configs);
+
+    return bestConfig;
+}
+
+
+/*
+ * Choose the EGLConfig for rendering.
+ *
+ * eglChooseConfig() sorts by its own rules, which favor larger color
+ * buffers and ignore the cost of depth and multisample buffers, so its
+ * first config can use much more memory bandwidth than needed.
+ * Instead, take the config with the fewest bits per pixel that meets
+ * the options' policy (--color-format, --depth-bits, --msaa); see
+ * SearchConfigs().  The choice is kept in the probe cache 'pCache'
+ * (NULL for none), so later launches on the same hardware skip the
+ * search.
+ *
+ * Return NULL if no config qualifies.
+ */
+EGLConfig ChooseConfig(EGLDisplay eglDpy, EGLint surfaceType,
+                       EGLint nativeVisualID, const struct Options *pOptions,
+                       struct ProbeCache *pCache)
+{
+    struct ConfigInfo bestInfo;
+    EGLConfig bestConfig = FindCachedConfig(eglDpy, surfaceType,
+                                            nativeVisualID, pOptions,
+                                            pCache, &bestInfo);
+
+    if (bestConfig == NULL) {
+        bestConfig = SearchConfigs(eglDpy, surfaceType, nativeVisualID,
+                                   pOptions, &bestInfo);
+        if (bestConfig != NULL) {
+            StoreCachedConfig(pCache, surfaceType, nativeVisualID,
+                              bestInfo.id);
+        }
+    }
+
+    if (bestConfig != NULL) {
+        printf("EGLConfig 0x%x: R%dG%dB%dA%d, depth %d, stencil %d, "
+               "%d samples; %.1f bytes per pixel\n",
+               bestInfo.id, bestInfo.red, bestInfo.green, bestInfo.blue,
+               bestInfo.alpha, bestInfo.depth, bestInfo.stencil,
+               bestInfo.samples, ConfigBitsPerPixel(&bestInfo) / 8.0);
+    }
+
+    return bestConfig;
+}
+
+
+/*
+ * Create the OpenGL context for rendering, with the options' context
+ * attributes:
+ *
+ * - EGL_IMG_context_priority requests a GPU scheduling priority, so
+ *   that, e.g., a high-priority context's frames are not queued behind
+ *   other clients' work.
+ *
+ * - EGL_KHR_create_context_no_error creates a context that skips
+ *   OpenGL error checking, and so some CPU cost in every call.  Errors
+ *   have undefined results, so only use this with a renderer known to
+ *   be correct.
+ *
+ * - EGL_KHR_create_context (or EGL 1.5) selects the OpenGL version and
+ *   profile.
+ *
+ * Options whose extension is missing are skipped with a warning.  If the
+ * implementation rejects the context anyway, drop the optional
+ * attributes, least essential first, until it succeeds.  Return
+ * EGL_NO_CONTEXT if even the plainest context fails.
+ */
+EGLContext CreateContext(EGLDisplay eglDpy, EGLConfig eglConfig,
+                         const struct Options *pOptions)
+{
+    const char *extensionString = eglQueryString(eglDpy, EGL_EXTENSIONS);
+    const char *versionString = eglQueryString(eglDpy, EGL_VERSION);
+    EGLBoolean priority =
+        (pOptions->contextPriority != CONTEXT_PRIORITY_DEFAULT);
+    EGLBoolean noError = pOptions->noError;
+    EGLBoolean version = (pOptions->glMajor > 0);
+    EGLContext eglContext = EGL_NO_CONTEXT;
+    int eglMajor = 0, eglMinor = 0;
+    EGLint value;
+
+    if (versionString != NULL) {
+        sscanf(versionString, "%d.%d", &eglMajor, &eglMinor);
+    }
+
+    if (priority &&
+        !ExtensionIsSupported(extensionString, "EGL_IMG_context_priority")) {
+        Warning("EGL_IMG_context_priority not found; "
+                "using the default context priority.\n");
+        priority = EGL_FALSE;
+    }
+
+    if (noError &&
+        !ExtensionIsSupported(extensionString,
+                              "EGL_KHR_create_context_no_error")) {
+        Warning("EGL_KHR_create_context_no_error not found; "
+                "OpenGL errors will be checked.\n");
+        noError = EGL_FALSE;
+    }
+
+    if (version &&
+        !ExtensionIsSupported(extensionString, "EGL_KHR_create_context") &&
+        ((eglMajor < 1) || ((eglMajor == 1) && (eglMinor < 5)))) {
+        Warning("EGL_KHR_create_context not found; "
+                "using the default OpenGL version.\n");
+        version = EGL_FALSE;
+    }
+
+    while (1) {
+        EGLint contextAttribs[16];
+        int n = 0;
+
+        if (priority) {
+            contextAttribs[n++] = EGL_CONTEXT_PRIORITY_LEVEL_IMG;
+            switch (pOptions->contextPriority) {
+            case CONTEXT_PRIORITY_LOW:
+                contextAttribs[n++] = EGL_CONTEXT_PRIORITY_LOW_IMG;
+                break;
+            case CONTEXT_PRIORITY_MEDIUM:
+            case CONTEXT_PRIORITY_DEFAULT:
+                contextAttribs[n++] = EGL_CONTEXT_PRIORITY_MEDIUM_IMG;
+                break;
+            case CONTEXT_PRIORITY_HIGH:
+                contextAttribs[n++] = EGL_CONTEXT_PRIORITY_HIGH_IMG;
+                break;
+            }
+        }
+
+        if (noError) {
+            contextAttribs[n++] = EGL_CONTEXT_OPENGL_NO_ERROR_KHR;
+            contextAttribs[n++] = EGL_TRUE;
+        }
+
+        if (version) {
+            contextAttribs[n++] = EGL_CONTEXT_MAJOR_VERSION_KHR;
+            contextAttribs[n++] = pOptions->glMajor;
+            contextAttribs[n++] = EGL_CONTEXT_MINOR_VERSION_KHR;
+            contextAttribs[n++] = pOptions->glMinor;
+            contextAttribs[n++] = EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR;
+            contextAttribs[n++] = pOptions->coreProfile ?
+                EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR :
+                EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT_KHR;
+        }
+
+        contextAttribs[n] = EGL_NONE;
+
+        eglContext = eglCreateContext(eglDpy, eglConfig, EGL_NO_CONTEXT,
+                                      contextAttribs);
+
+        if (eglContext != EGL_NO_CONTEXT) {
+            break;
+        }
+
+        if (noError) {
+            Warning("Unable to create a no-error context; "
+                    "OpenGL errors will be checked.\n");
+            noError = EGL_FALSE;
+        } else if (priority) {
+            Warning("Unable to create a context with %s priority; "
+                    "using the default priority.\n",
+                    ContextPriorityName(pOptions->contextPriority));
+            priority = EGL_FALSE;
+        } else if (version) {
+            Warning("Unable to create an OpenGL %d.%d context; "
+                    "using the default version.\n",
+                    pOptions->glMajor, pOptions->glMinor);
+            version = EGL_FALSE;
+        } else {
+            SetError("eglCreateContext() failed.\n");
+            return EGL_NO_CONTEXT;
+        }
+    }
+
+    /*
+     * The implementation may grant a different priority than requested,
+     * e.g., if the process lacks the privilege for high priority.
+     */
+
+    if (priority &&
+        eglQueryContext(eglDpy, eglContext,
+                        EGL_CONTEXT_PRIORITY_LEVEL_IMG, &value)) {
+        printf("Context priority: %s\n",
+               (value == EGL_CONTEXT_PRIORITY_HIGH_IMG) ? "high" :
+               (value == EGL_CONTEXT_PRIORITY_LOW_IMG) ? "low" : "medium");
+    }
+
+    return eglContext;
+}
+
+
+/*
+ * Create an OpenGL context and an EGLSurface producer for the given
+ * EGLStream, and make them current, with the config from 'pCache' if
+ * it has one; see ChooseConfig().  Return EGL_NO_SURFACE on failure,
+ * having destroyed whatever was created.
+ */
+EGLSurface CreateProducerSurface(const struct EglDispatch *pEgl,
+                                 EGLDisplay eglDpy, EGLStreamKHR eglStream,
+                                 int width, int height,
+                                 const struct Options *pOptions,
+                                 struct ProbeCache *pCache)
+{
+    EGLint surfaceAttribs[] = {
+        EGL_WIDTH, width,
+        EGL_HEIGHT, height,
+        EGL_NONE
+    };
+
+    EGLConfig eglConfig;
+    EGLContext eglContext;
+    EGLBoolean ret;
+    EGLSurface eglSurface;
+
+    const char *extensionString = eglQueryString(eglDpy, EGL_EXTENSIONS);
+
+    /*
+     * EGL_KHR_stream_producer_eglsurface is needed to create an
+     * EGLSurface that produces frames for an EGLStream.
+     */
+
+    if (!ExtensionIsSupported(extensionString,
+                              "EGL_KHR_stream_producer_eglsurface")) {
+        SetError("EGL_KHR_stream_producer_eglsurface not found.\n");
+        return EGL_NO_SURFACE;
+    }
+
+    /* Bind full OpenGL as EGL's client API. */
+
+    eglBindAPI(EGL_OPENGL_API);
+
+    /* Find a suitable EGL config. */
+
+    eglConfig = ChooseConfig(eglDpy, EGL_STREAM_BIT_KHR,
+                             0 /* nativeVisualID */, pOptions, pCache);
+
+    if (eglConfig == NULL) {
+        SetError("No suitable EGLConfig found.\n");
+        return EGL_NO_SURFACE;
+    }
+
+    /* Create an EGL context using the EGL config. */
+
+    eglContext = CreateContext(eglDpy, eglConfig, pOptions);
+
+    if (eglContext == EGL_NO_CONTEXT) {
+        return EGL_NO_SURFACE;
+    }
+
     /*
      * Create an EGLSurface as the producer of the EGLStream.  Once
      * the stream's producer and consumer are defined, the stream is
@@ -380,10 +898,13 @@ EGLSurface SetUpEgl(EGLDisplay eglDpy, uint32_t planeID, int width, int height)
      * corresponding to the EGLOutputLayer.
      */
 
-    eglSurface = pEglCreateStreamProducerSurfaceKHR(eglDpy, eglConfig,
-                                                    eglStream, surfaceAttribs);
+    eglSurface = pEgl->CreateStreamProducerSurfaceKHR(eglDpy, eglConfig,
+                                                      eglStream,
+                                                      surfaceAttribs);
     if (eglSurface == EGL_NO_SURFACE) {
-        Fatal("Unable to create EGLSurface stream producer.\n");
+        SetError("Unable to create EGLSurface stream producer.\n");
+        eglDestroyContext(eglDpy, eglContext);
+        return EGL_NO_SURFACE;
     }
 
     /*
@@ -394,8 +915,263 @@ EGLSurface SetUpEgl(EGLDisplay eglDpy, uint32_t planeID, int width, int height)
     ret = eglMakeCurrent(eglDpy, eglSurface, eglSurface, eglContext);
 
     if (!ret) {
-        Fatal("Unable to make context and surface current.\n");
+        SetError("Unable to make context and surface current.\n");
+        eglDestroySurface(eglDpy, eglSurface);
+        eglDestroyContext(eglDpy, eglContext);
+        return EGL_NO_SURFACE;
     }
 
     return eglSurface;
 }
+
+
+/*
+ * Set up EGL to present to a DRM KMS plane through an EGLStream.
+ * Return EGL_NO_SURFACE on failure, with no stream left behind.
+ */
+EGLSurface SetUpEgl(const struct EglDispatch *pEgl,
+                    EGLDisplay eglDpy, uint32_t planeID, int width, int height,
+                    const struct Options *pOptions, struct ProbeCache *pCache,
+                    EGLStreamKHR *pStream)
+{
+    EGLSurface eglSurface;
+
+    *pStream = CreateOutputStream(pEgl, eglDpy, planeID, pOptions);
+
+    if (*pStream == EGL_NO_STREAM_KHR) {
+        return EGL_NO_SURFACE;
+    }
+
+    eglSurface = CreateProducerSurface(pEgl, eglDpy, *pStream, width, height,
+                                       pOptions, pCache);
+
+    if (eglSurface == EGL_NO_SURFACE) {
+        pEgl->DestroyStreamKHR(eglDpy, *pStream);
+        *pStream = EGL_NO_STREAM_KHR;
+    }
+
+    return eglSurface;
+}
+
+
+/*
+ * EGL_KHR_stream_cross_process_fd lets an EGLStream be shared with
+ * another process: the process that created the stream gets a file
+ * descriptor for it, passes that over a Unix socket, and the receiving
+ * process creates its own handle to the same stream from it.  Frames
+ * move between the processes without a copy.
+ */
+static int CheckCrossProcessSupport(EGLDisplay eglDpy)
+{
+    const char *extensionString = eglQueryString(eglDpy, EGL_EXTENSIONS);
+
+    if (!ExtensionIsSupported(extensionString,
+                              "EGL_KHR_stream_cross_process_fd")) {
+        SetError("EGL_KHR_stream_cross_process_fd not found.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Get a file descriptor for the EGLStream that can be sent to another
+ * process.  The caller owns the returned file descriptor.  Return -1
+ * on failure.
+ */
+int GetStreamFd(const struct EglDispatch *pEgl,
+                EGLDisplay eglDpy, EGLStreamKHR eglStream)
+{
+    EGLNativeFileDescriptorKHR fd;
+
+    if (CheckCrossProcessSupport(eglDpy) != 0) {
+        return -1;
+    }
+
+    fd = pEgl->GetStreamFileDescriptorKHR(eglDpy, eglStream);
+
+    if (fd == EGL_NO_FILE_DESCRIPTOR_KHR) {
+        SetError("Unable to get file descriptor for EGLStream.\n");
+        return -1;
+    }
+
+    return fd;
+}
+
+
+/*
+ * Create an EGLStream from a file descriptor received from the process
+ * that created the stream.  Return EGL_NO_STREAM_KHR on failure.
+ */
+EGLStreamKHR CreateStreamFromFd(const struct EglDispatch *pEgl,
+                                EGLDisplay eglDpy, int fd)
+{
+    EGLStreamKHR eglStream;
+
+    if (CheckCrossProcessSupport(eglDpy) != 0) {
+        return EGL_NO_STREAM_KHR;
+    }
+
+    eglStream = pEgl->CreateStreamFromFileDescriptorKHR(eglDpy, fd);
+
+    if (eglStream == EGL_NO_STREAM_KHR) {
+        SetError("Unable to create EGLStream from file descriptor.\n");
+    }
+
+    return eglStream;
+}
+
+
+/*
+ * Return whether CreateGpuFence() can be used with the EGLDisplay.
+ */
+EGLBoolean GpuFencesSupported(EGLDisplay eglDpy)
+{
+    const char *extensionString = eglQueryString(eglDpy, EGL_EXTENSIONS);
+
+    return ExtensionIsSupported(extensionString,
+                                "EGL_ANDROID_native_fence_sync");
+}
+
+
+/*
+ * Insert a fence after the OpenGL commands issued so far in the current
+ * context, and return a sync file that signals when the GPU has
+ * executed them.  The caller owns the returned file descriptor.  Return
+ * -1 on failure.
+ *
+ * EGL_ANDROID_native_fence_sync only creates the sync file once the
+ * fence has been flushed to the GPU, hence the glFlush().
+ */
+int CreateGpuFence(const struct EglDispatch *pEgl, EGLDisplay eglDpy)
+{
+    EGLint attribs[] = {
+        EGL_SYNC_NATIVE_FENCE_FD_ANDROID, EGL_NO_NATIVE_FENCE_FD_ANDROID,
+        EGL_NONE,
+    };
+
+    EGLSyncKHR sync;
+    int fd;
+
+    sync = pEgl->CreateSyncKHR(eglDpy, EGL_SYNC_NATIVE_FENCE_ANDROID, attribs);
+
+    if (sync == EGL_NO_SYNC_KHR) {
+        SetError("Unable to create native fence sync.\n");
+        return -1;
+    }
+
+    glFlush();
+
+    fd = pEgl->DupNativeFenceFDANDROID(eglDpy, sync);
+
+    pEgl->DestroySyncKHR(eglDpy, sync);
+
+    if (fd == EGL_NO_NATIVE_FENCE_FD_ANDROID) {
+        SetError("Unable to get native fence file descriptor.\n");
+        return -1;
+    }
+
+    return fd;
+}
+
+
+/*
+ * Prepare the EGLSurface for partial updates, where each frame repaints
+ * only the area that changed and reports that area to the consumer.
+ *
+ * Repainting part of a frame requires knowing what the back buffer
+ * already contains: EGL_EXT_buffer_age reports how many frames old its
+ * contents are, or failing that, EGL_BUFFER_PRESERVED swap behavior
+ * keeps the previous frame.  Reporting the damage requires
+ * EGL_KHR_swap_buffers_with_damage (or the EXT version), which lets the
+ * implementation limit the update to the plane, e.g., through KMS
+ * FB_DAMAGE_CLIPS, so that panels with self-refresh or partial update
+ * only fetch what changed.
+ *
+ * The result is recorded in 'pPartial', which QueryBufferAge() reads
+ * for each frame.  Return whether partial updates can be used.
+ */
+EGLBoolean SetUpPartialUpdates(const struct EglDispatch *pEgl,
+                               EGLDisplay eglDpy, EGLSurface eglSurface,
+                               struct PartialUpdates *pPartial)
+{
+    const char *extensionString = eglQueryString(eglDpy, EGL_EXTENSIONS);
+
+    pPartial->bufferAgeSource = BUFFER_AGE_UNKNOWN;
+    pPartial->firstFrame = EGL_TRUE;
+
+    if (pEgl->SwapBuffersWithDamage == NULL) {
+        Warning("EGL_KHR_swap_buffers_with_damage not found; "
+                "not using partial updates.\n");
+        return EGL_FALSE;
+    }
+
+    if (ExtensionIsSupported(extensionString, "EGL_EXT_buffer_age")) {
+        pPartial->bufferAgeSource = BUFFER_AGE_QUERY;
+    } else if (eglSurfaceAttrib(eglDpy, eglSurface, EGL_SWAP_BEHAVIOR,
+                                EGL_BUFFER_PRESERVED)) {
+        pPartial->bufferAgeSource = BUFFER_AGE_PRESERVED;
+    } else {
+        Warning("Neither EGL_EXT_buffer_age nor preserved swaps are "
+                "available; every frame will be fully repainted.\n");
+    }
+
+    return EGL_TRUE;
+}
+
+
+/*
+ * Return how many frames old the contents of the back buffer are, or 0
+ * if they are undefined.
+ */
+EGLint QueryBufferAge(EGLDisplay eglDpy, EGLSurface eglSurface,
+                      struct PartialUpdates *pPartial)
+{
+    EGLint age = 0;
+
+    switch (pPartial->bufferAgeSource) {
+    case BUFFER_AGE_QUERY:
+        if (!eglQuerySurface(eglDpy, eglSurface, EGL_BUFFER_AGE_EXT, &age)) {
+            age = 0;
+        }
+        break;
+    case BUFFER_AGE_PRESERVED:
+        age = pPartial->firstFrame ? 0 : 1;
+        pPartial->firstFrame = EGL_FALSE;
+        break;
+    case BUFFER_AGE_UNKNOWN:
+        age = 0;
+        break;
+    }
+
+    return age;
+}
+
+
+/*
+ * Present the frame, telling the consumer that only the given
+ * rectangles changed since the previous frame.
+ */
+void SwapBuffersWithDamage(const struct EglDispatch *pEgl,
+                           EGLDisplay eglDpy, EGLSurface eglSurface,
+                           const struct Rect *pRects, int count)
+{
+    EGLint rects[4 * 4];
+    int i;
+
+    if ((pEgl->SwapBuffersWithDamage == NULL) ||
+        (count > (int) (ARRAY_LEN(rects) / 4))) {
+        eglSwapBuffers(eglDpy, eglSurface);
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        rects[4 * i + 0] = pRects[i].x;
+        rects[4 * i + 1] = pRects[i].y;
+        rects[4 * i + 2] = pRects[i].width;
+        rects[4 * i + 3] = pRects[i].height;
+    }
+
+    pEgl->SwapBuffersWithDamage(eglDpy, eglSurface, rects, count);
+}
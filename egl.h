@@ -26,12 +26,80 @@
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 
-EGLDeviceEXT GetEglDevice(void);
+#include "options.h"
+#include "utils.h"
+
+EGLDeviceEXT GetEglDevice(const struct DeviceSelection *pSelection);
 
 int GetDrmFd(EGLDeviceEXT device);
 
-EGLDisplay GetEglDisplay(EGLDeviceEXT device, int drmFd);
+EGLDisplay GetEglDisplay(EGLDeviceEXT device, int drmFd,
+                         struct EglDispatch *pEgl);
+
+EGLStreamKHR CreateOutputStream(const struct EglDispatch *pEgl,
+                                EGLDisplay eglDpy, uint32_t planeID,
+                                const struct Options *pOptions);
+
+struct ProbeCache;
+
+EGLConfig ChooseConfig(EGLDisplay eglDpy, EGLint surfaceType,
+                       EGLint nativeVisualID, const struct Options *pOptions,
+                       struct ProbeCache *pCache);
+
+EGLContext CreateContext(EGLDisplay eglDpy, EGLConfig eglConfig,
+                         const struct Options *pOptions);
+
+EGLSurface CreateProducerSurface(const struct EglDispatch *pEgl,
+                                 EGLDisplay eglDpy, EGLStreamKHR eglStream,
+                                 int width, int height,
+                                 const struct Options *pOptions,
+                                 struct ProbeCache *pCache);
+
+EGLSurface SetUpEgl(const struct EglDispatch *pEgl,
+                    EGLDisplay eglDpy, uint32_t planeID, int width, int height,
+                    const struct Options *pOptions, struct ProbeCache *pCache,
+                    EGLStreamKHR *pStream);
+
+EGLBoolean StreamFlipEventsSupported(const char *extensionString,
+                                     const struct Options *pOptions);
+
+EGLint GetStreamQueueDepth(const struct EglDispatch *pEgl,
+                           EGLDisplay eglDpy, EGLStreamKHR eglStream);
+
+int GetStreamFd(const struct EglDispatch *pEgl,
+                EGLDisplay eglDpy, EGLStreamKHR eglStream);
+
+EGLStreamKHR CreateStreamFromFd(const struct EglDispatch *pEgl,
+                                EGLDisplay eglDpy, int fd);
+
+EGLBoolean GpuFencesSupported(EGLDisplay eglDpy);
+
+int CreateGpuFence(const struct EglDispatch *pEgl, EGLDisplay eglDpy);
+
+/*
+ * How one EGLSurface learns the age of its back buffer for partial
+ * updates; see SetUpPartialUpdates().
+ */
+struct PartialUpdates {
+    enum {
+        BUFFER_AGE_UNKNOWN,
+        BUFFER_AGE_QUERY,
+        BUFFER_AGE_PRESERVED,
+    } bufferAgeSource;
+
+    /* For BUFFER_AGE_PRESERVED: nothing has been swapped yet. */
+    EGLBoolean firstFrame;
+};
+
+EGLBoolean SetUpPartialUpdates(const struct EglDispatch *pEgl,
+                               EGLDisplay eglDpy, EGLSurface eglSurface,
+                               struct PartialUpdates *pPartial);
+
+EGLint QueryBufferAge(EGLDisplay eglDpy, EGLSurface eglSurface,
+                      struct PartialUpdates *pPartial);
 
-EGLSurface SetUpEgl(EGLDisplay eglDpy, uint32_t planeID, int width, int height);
+void SwapBuffersWithDamage(const struct EglDispatch *pEgl,
+                           EGLDisplay eglDpy, EGLSurface eglSurface,
+                           const struct Rect *pRects, int count);
 
 #endif /* EGL_H */
@@ -27,19 +27,278 @@
  * eglstreams-kms-example by Andy Ritger, March 2016.
  */
 
+
 #include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
 
+/*
+ * The shader path calls OpenGL 2.0 and 3.0 entry points directly, and
+ * late latching 4.4 ones; libOpenGL exports all of them.
+ */
+#define GL_GLEXT_PROTOTYPES
 #include "GL/gl.h"
+#include "GL/glext.h"
 #include "utils.h"
+#include "eglgears.h"
+
+/* Oldest buffer age for which partial redraws are tracked. */
+#define MAX_BUFFER_AGE 4
+
+/*
+ * How many views the late-latch buffer holds; see latch_view().  The
+ * vertex shader's LATE_LATCH prefix declares as many.
+ */
+#define LATCH_VIEWS 3
+
+/* How fast the big gear turns. */
+#define DEGREES_PER_SECOND 70.0
+
+/*
+ * The shape of each gear (see gear()), its color, where it sits in
+ * the scene, and how it turns: by 'speed' times 'angle', plus 'phase'
+ * degrees, about its own axis.
+ */
+static const struct {
+   GLfloat inner_radius, outer_radius, width;
+   GLint teeth;
+   GLfloat tooth_depth;
+   GLfloat color[4];
+   GLfloat x, y;
+   GLfloat speed, phase;
+} gears[3] = {
+   { 1.0, 4.0, 1.0, 20, 0.7, { 0.8, 0.1, 0.0, 1.0 }, -3.0, -2.0,  1.0,   0.0 },
+   { 0.5, 2.0, 2.0, 10, 0.7, { 0.0, 0.8, 0.2, 1.0 },  3.1, -2.0, -2.0,  -9.0 },
+   { 1.3, 2.0, 0.5, 10, 0.7, { 0.2, 0.2, 1.0, 1.0 }, -3.1,  4.2, -2.0, -25.0 },
+};
+
+/*
+ * A vertex of the shader path: its position and normal relative to its
+ * gear's center, its gear's center, rotation rate in degrees per
+ * second, and phase in degrees, and its gear's color.
+ */
+struct gear_vertex {
+   GLfloat position[3];
+   GLfloat normal[3];
+   GLfloat motion[4];
+   GLfloat color[3];
+};
+
+struct vertex_array {
+   struct gear_vertex *vertices;
+   int count, size;
+};
+
+/*
+ * What the late-latching vertex shader reads the view from, laid out
+ * as its std140 uniform block: views[latest] is the newest view.
+ */
+struct latch_block {
+   GLfloat views[LATCH_VIEWS][16];
+   GLuint latest;
+};
+
+/*
+ * Everything one instance of the gears keeps between frames; each
+ * output renders its own.
+ */
+struct Gears {
+   GLfloat view_rotx, view_roty, view_rotz;
+   GLint gear_lists[3];
+   GLfloat angle;
+
+   /* The time of the last frame, and the shader path's animation time. */
+   double t0;
+   double elapsed;
+
+   GLint viewport_width, viewport_height;
+
+   /* Column-major projection and view matrices, set by reshape(). */
+   GLfloat projection_matrix[16];
+   GLfloat view_matrix[16];
+
+   /*
+    * How to turn the frame for a panel the plane cannot turn it for:
+    * the Orientation that InitGears() was given, and that as a clip
+    * space transform, applied after the projection.
+    */
+   struct Orientation orientation;
+   GLfloat orientation_matrix[16];
+
+   /*
+    * The window area the gears can touch.  The gears only turn about
+    * their own axes, so this only changes if the view does.
+    */
+   struct Rect gears_bounds;
+   GLboolean gears_bounds_valid;
+
+   /*
+    * damage_history[i] is the area that changed between the frames
+    * i + 1 and i frames ago; damage_history[0] is this frame's damage.
+    */
+   struct Rect damage_history[MAX_BUFFER_AGE];
+
+   /*
+    * The shader path: all gears are in one vertex buffer, and the
+    * vertex shader turns each vertex about its gear's axis, given the
+    * time.  0 if the gears are drawn with fixed-function display lists
+    * instead.
+    */
+   GLuint gear_program;
+   GLuint gear_buffer, gear_vao;
+   GLint time_location;
+   GLsizei gear_vertex_count;
+
+   /*
+    * Late latching (shader path, core profile only): the vertex shader
+    * reads the view from view_buffer, a uniform block that the GPU
+    * fills, as it reaches each frame, with a copy of latch_buffer.
+    * latch_buffer is persistently mapped at latch_block, and the view
+    * is written there whenever it turns, including after the frame's
+    * draw calls have been submitted; latch_fence signals once the GPU
+    * has reached the copy.  0 if the view is a plain uniform.
+    */
+   GLuint view_buffer, latch_buffer;
+   struct latch_block *latch_block;
+   GLuint latch_latest;
+   GLsync latch_fence;
+
+   /*
+    * While building the vertex buffer for the shader path, gear()'s
+    * immediate-mode calls are recorded here instead of going to
+    * OpenGL; quads and quad strips are broken into triangles, which
+    * carry the normal of the provoking vertex when flat shaded.
+    * capture_failed is set if an array could not grow.
+    */
+   GLboolean capturing;
+   GLboolean capture_failed;
+   struct vertex_array captured_triangles;
+   struct vertex_array captured_primitive;
+   struct gear_vertex captured_state;
+   GLenum captured_mode;
+   GLenum captured_shade_model;
+};
+
+static void
+push_vertex(struct Gears *gs, struct vertex_array *array,
+            const struct gear_vertex *v)
+{
+   if (array->count == array->size) {
+      int size = array->size ? array->size * 2 : 256;
+      struct gear_vertex *vertices =
+         realloc(array->vertices, size * sizeof(*array->vertices));
+
+      if (vertices == NULL) {
+         gs->capture_failed = GL_TRUE;
+         return;
+      }
+      array->vertices = vertices;
+      array->size = size;
+   }
+
+   array->vertices[array->count++] = *v;
+}
+
+/*
+ * Record the quad a, b, c, d (in winding order) as two triangles.
+ */
+static void
+capture_quad(struct Gears *gs,
+             const struct gear_vertex *a, const struct gear_vertex *b,
+             const struct gear_vertex *c, const struct gear_vertex *d,
+             const struct gear_vertex *provoking)
+{
+   const struct gear_vertex *corners[6] = { a, b, c, a, c, d };
+   int i;
+
+   for (i = 0; i < 6; i++) {
+      struct gear_vertex v = *corners[i];
+
+      if (gs->captured_shade_model == GL_FLAT) {
+         memcpy(v.normal, provoking->normal, sizeof(v.normal));
+      }
+      push_vertex(gs, &gs->captured_triangles, &v);
+   }
+}
+
+static void
+set_shade_model(struct Gears *gs, GLenum mode)
+{
+   if (gs->capturing)
+      gs->captured_shade_model = mode;
+   else
+      glShadeModel(mode);
+}
 
-static GLfloat view_rotx = 20.0, view_roty = 30.0, view_rotz = 0.0;
-static GLint gear1, gear2, gear3;
-static GLfloat angle = 0.0;
+static void
+set_normal(struct Gears *gs, GLfloat x, GLfloat y, GLfloat z)
+{
+   if (gs->capturing) {
+      gs->captured_state.normal[0] = x;
+      gs->captured_state.normal[1] = y;
+      gs->captured_state.normal[2] = z;
+   } else {
+      glNormal3f(x, y, z);
+   }
+}
+
+static void
+add_vertex(struct Gears *gs, GLfloat x, GLfloat y, GLfloat z)
+{
+   if (gs->capturing) {
+      gs->captured_state.position[0] = x;
+      gs->captured_state.position[1] = y;
+      gs->captured_state.position[2] = z;
+      push_vertex(gs, &gs->captured_primitive, &gs->captured_state);
+   } else {
+      glVertex3f(x, y, z);
+   }
+}
+
+static void
+begin_primitive(struct Gears *gs, GLenum mode)
+{
+   if (gs->capturing) {
+      gs->captured_mode = mode;
+      gs->captured_primitive.count = 0;
+   } else {
+      glBegin(mode);
+   }
+}
+
+static void
+end_primitive(struct Gears *gs)
+{
+   const struct gear_vertex *v = gs->captured_primitive.vertices;
+   int i, n = gs->captured_primitive.count;
+
+   if (!gs->capturing) {
+      glEnd();
+      return;
+   }
+
+   /*
+    * Quad strip quad i is v[2i], v[2i+1], v[2i+3], v[2i+2], flat shaded
+    * with v[2i+3]; a quad is flat shaded with its last vertex.
+    */
+   if (gs->captured_mode == GL_QUAD_STRIP) {
+      for (i = 0; i + 3 < n; i += 2)
+         capture_quad(gs, &v[i], &v[i + 1], &v[i + 3], &v[i + 2], &v[i + 3]);
+   } else {
+      for (i = 0; i + 3 < n; i += 4)
+         capture_quad(gs, &v[i], &v[i + 1], &v[i + 2], &v[i + 3], &v[i + 3]);
+   }
+
+   gs->captured_primitive.count = 0;
+}
 
 /*
  *
  *  Draw a gear wheel.  You'll probably want to call this function when
- *  building a display list since we do a lot of trig here.
+ *  building a display list since we do a lot of trig here.  (Or when
+ *  capturing the vertex buffer for the shader path.)
  *
  *  Input:  inner_radius - radius of hole at center
  *          outer_radius - radius at center of teeth
@@ -48,8 +307,8 @@ static GLfloat angle = 0.0;
  *          tooth_depth - depth of tooth
  */
 static void
-gear(GLfloat inner_radius, GLfloat outer_radius, GLfloat width,
-     GLint teeth, GLfloat tooth_depth)
+gear(struct Gears *gs, GLfloat inner_radius, GLfloat outer_radius,
+     GLfloat width, GLint teeth, GLfloat tooth_depth)
 {
    GLint i;
    GLfloat r0, r1, r2;
@@ -62,223 +321,1010 @@ gear(GLfloat inner_radius, GLfloat outer_radius, GLfloat width,
 
    da = 2.0 * M_PI / teeth / 4.0;
 
-   glShadeModel(GL_FLAT);
+   set_shade_model(gs, GL_FLAT);
 
-   glNormal3f(0.0, 0.0, 1.0);
+   set_normal(gs, 0.0, 0.0, 1.0);
 
    /* draw front face */
-   glBegin(GL_QUAD_STRIP);
+   begin_primitive(gs, GL_QUAD_STRIP);
    for (i = 0; i <= teeth; i++) {
       angle = i * 2.0 * M_PI / teeth;
-      glVertex3f(r0 * cos(angle), r0 * sin(angle), width * 0.5);
-      glVertex3f(r1 * cos(angle), r1 * sin(angle), width * 0.5);
+      add_vertex(gs, r0 * cos(angle), r0 * sin(angle), width * 0.5);
+      add_vertex(gs, r1 * cos(angle), r1 * sin(angle), width * 0.5);
       if (i < teeth) {
-	 glVertex3f(r0 * cos(angle), r0 * sin(angle), width * 0.5);
-	 glVertex3f(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da),
+	 add_vertex(gs, r0 * cos(angle), r0 * sin(angle), width * 0.5);
+	 add_vertex(gs, r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da),
 		    width * 0.5);
       }
    }
-   glEnd();
+   end_primitive(gs);
 
    /* draw front sides of teeth */
-   glBegin(GL_QUADS);
+   begin_primitive(gs, GL_QUADS);
    da = 2.0 * M_PI / teeth / 4.0;
    for (i = 0; i < teeth; i++) {
       angle = i * 2.0 * M_PI / teeth;
 
-      glVertex3f(r1 * cos(angle), r1 * sin(angle), width * 0.5);
-      glVertex3f(r2 * cos(angle + da), r2 * sin(angle + da), width * 0.5);
-      glVertex3f(r2 * cos(angle + 2 * da), r2 * sin(angle + 2 * da),
+      add_vertex(gs, r1 * cos(angle), r1 * sin(angle), width * 0.5);
+      add_vertex(gs, r2 * cos(angle + da), r2 * sin(angle + da), width * 0.5);
+      add_vertex(gs, r2 * cos(angle + 2 * da), r2 * sin(angle + 2 * da),
 		 width * 0.5);
-      glVertex3f(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da),
+      add_vertex(gs, r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da),
 		 width * 0.5);
    }
-   glEnd();
+   end_primitive(gs);
 
-   glNormal3f(0.0, 0.0, -1.0);
+   set_normal(gs, 0.0, 0.0, -1.0);
 
    /* draw back face */
-   glBegin(GL_QUAD_STRIP);
+   begin_primitive(gs, GL_QUAD_STRIP);
    for (i = 0; i <= teeth; i++) {
       angle = i * 2.0 * M_PI / teeth;
-      glVertex3f(r1 * cos(angle), r1 * sin(angle), -width * 0.5);
-      glVertex3f(r0 * cos(angle), r0 * sin(angle), -width * 0.5);
+      add_vertex(gs, r1 * cos(angle), r1 * sin(angle), -width * 0.5);
+      add_vertex(gs, r0 * cos(angle), r0 * sin(angle), -width * 0.5);
       if (i < teeth) {
-	 glVertex3f(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da),
+	 add_vertex(gs, r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da),
 		    -width * 0.5);
-	 glVertex3f(r0 * cos(angle), r0 * sin(angle), -width * 0.5);
+	 add_vertex(gs, r0 * cos(angle), r0 * sin(angle), -width * 0.5);
       }
    }
-   glEnd();
+   end_primitive(gs);
 
    /* draw back sides of teeth */
-   glBegin(GL_QUADS);
+   begin_primitive(gs, GL_QUADS);
    da = 2.0 * M_PI / teeth / 4.0;
    for (i = 0; i < teeth; i++) {
       angle = i * 2.0 * M_PI / teeth;
 
-      glVertex3f(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da),
+      add_vertex(gs, r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da),
 		 -width * 0.5);
-      glVertex3f(r2 * cos(angle + 2 * da), r2 * sin(angle + 2 * da),
+      add_vertex(gs, r2 * cos(angle + 2 * da), r2 * sin(angle + 2 * da),
 		 -width * 0.5);
-      glVertex3f(r2 * cos(angle + da), r2 * sin(angle + da), -width * 0.5);
-      glVertex3f(r1 * cos(angle), r1 * sin(angle), -width * 0.5);
+      add_vertex(gs, r2 * cos(angle + da), r2 * sin(angle + da), -width * 0.5);
+      add_vertex(gs, r1 * cos(angle), r1 * sin(angle), -width * 0.5);
    }
-   glEnd();
+   end_primitive(gs);
 
    /* draw outward faces of teeth */
-   glBegin(GL_QUAD_STRIP);
+   begin_primitive(gs, GL_QUAD_STRIP);
    for (i = 0; i < teeth; i++) {
       angle = i * 2.0 * M_PI / teeth;
 
-      glVertex3f(r1 * cos(angle), r1 * sin(angle), width * 0.5);
-      glVertex3f(r1 * cos(angle), r1 * sin(angle), -width * 0.5);
+      add_vertex(gs, r1 * cos(angle), r1 * sin(angle), width * 0.5);
+      add_vertex(gs, r1 * cos(angle), r1 * sin(angle), -width * 0.5);
       u = r2 * cos(angle + da) - r1 * cos(angle);
       v = r2 * sin(angle + da) - r1 * sin(angle);
       len = sqrt(u * u + v * v);
       u /= len;
       v /= len;
-      glNormal3f(v, -u, 0.0);
-      glVertex3f(r2 * cos(angle + da), r2 * sin(angle + da), width * 0.5);
-      glVertex3f(r2 * cos(angle + da), r2 * sin(angle + da), -width * 0.5);
-      glNormal3f(cos(angle), sin(angle), 0.0);
-      glVertex3f(r2 * cos(angle + 2 * da), r2 * sin(angle + 2 * da),
+      set_normal(gs, v, -u, 0.0);
+      add_vertex(gs, r2 * cos(angle + da), r2 * sin(angle + da), width * 0.5);
+      add_vertex(gs, r2 * cos(angle + da), r2 * sin(angle + da), -width * 0.5);
+      set_normal(gs, cos(angle), sin(angle), 0.0);
+      add_vertex(gs, r2 * cos(angle + 2 * da), r2 * sin(angle + 2 * da),
 		 width * 0.5);
-      glVertex3f(r2 * cos(angle + 2 * da), r2 * sin(angle + 2 * da),
+      add_vertex(gs, r2 * cos(angle + 2 * da), r2 * sin(angle + 2 * da),
 		 -width * 0.5);
       u = r1 * cos(angle + 3 * da) - r2 * cos(angle + 2 * da);
       v = r1 * sin(angle + 3 * da) - r2 * sin(angle + 2 * da);
-      glNormal3f(v, -u, 0.0);
-      glVertex3f(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da),
+      set_normal(gs, v, -u, 0.0);
+      add_vertex(gs, r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da),
 		 width * 0.5);
-      glVertex3f(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da),
+      add_vertex(gs, r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da),
 		 -width * 0.5);
-      glNormal3f(cos(angle), sin(angle), 0.0);
+      set_normal(gs, cos(angle), sin(angle), 0.0);
    }
 
-   glVertex3f(r1 * cos(0), r1 * sin(0), width * 0.5);
-   glVertex3f(r1 * cos(0), r1 * sin(0), -width * 0.5);
+   add_vertex(gs, r1 * cos(0), r1 * sin(0), width * 0.5);
+   add_vertex(gs, r1 * cos(0), r1 * sin(0), -width * 0.5);
 
-   glEnd();
+   end_primitive(gs);
 
-   glShadeModel(GL_SMOOTH);
+   set_shade_model(gs, GL_SMOOTH);
 
    /* draw inside radius cylinder */
-   glBegin(GL_QUAD_STRIP);
+   begin_primitive(gs, GL_QUAD_STRIP);
    for (i = 0; i <= teeth; i++) {
       angle = i * 2.0 * M_PI / teeth;
-      glNormal3f(-cos(angle), -sin(angle), 0.0);
-      glVertex3f(r0 * cos(angle), r0 * sin(angle), -width * 0.5);
-      glVertex3f(r0 * cos(angle), r0 * sin(angle), width * 0.5);
+      set_normal(gs, -cos(angle), -sin(angle), 0.0);
+      add_vertex(gs, r0 * cos(angle), r0 * sin(angle), -width * 0.5);
+      add_vertex(gs, r0 * cos(angle), r0 * sin(angle), width * 0.5);
    }
-   glEnd();
+   end_primitive(gs);
 }
 
+/*
+ * With late latching, write the view to the latch block.  The GPU may
+ * be copying the block meanwhile, so the view goes to one of the
+ * LATCH_VIEWS that 'latest' names neither now nor named last, and only
+ * then is 'latest' pointed at it: a copy that races the write still
+ * gets a whole view, unless the view turns twice while it runs.
+ */
+static void
+latch_view(struct Gears *gs)
+{
+   struct latch_block *block = gs->latch_block;
+   GLuint next = (gs->latch_latest + 1) % LATCH_VIEWS;
+
+   memcpy(block->views[next], gs->view_matrix, sizeof(gs->view_matrix));
+   __sync_synchronize();
+   block->latest = next;
+   __sync_synchronize();
+
+   gs->latch_latest = next;
+}
 
 static void
-draw(void)
+draw(struct Gears *gs)
 {
+   int g;
+
    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-   glPushMatrix();
-   glRotatef(view_rotx, 1.0, 0.0, 0.0);
-   glRotatef(view_roty, 0.0, 1.0, 0.0);
-   glRotatef(view_rotz, 0.0, 0.0, 1.0);
+   if (gs->gear_program) {
+      /*
+       * When late latching, the view is copied into the uniform block
+       * when the GPU gets here, not now; latch_fence tells the CPU
+       * when that is, and the flush lets the GPU get here without
+       * waiting for the swap.
+       */
+      if (gs->view_buffer) {
+         if (gs->latch_fence)
+            glDeleteSync(gs->latch_fence);
+         gs->latch_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+         glBindBuffer(GL_COPY_READ_BUFFER, gs->latch_buffer);
+         glBindBuffer(GL_COPY_WRITE_BUFFER, gs->view_buffer);
+         glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                             0, 0, sizeof(struct latch_block));
+      }
 
-   glPushMatrix();
-   glTranslatef(-3.0, -2.0, 0.0);
-   glRotatef(angle, 0.0, 0.0, 1.0);
-   glCallList(gear1);
-   glPopMatrix();
+      glDrawArrays(GL_TRIANGLES, 0, gs->gear_vertex_count);
 
-   glPushMatrix();
-   glTranslatef(3.1, -2.0, 0.0);
-   glRotatef(-2.0 * angle - 9.0, 0.0, 0.0, 1.0);
-   glCallList(gear2);
-   glPopMatrix();
+      if (gs->view_buffer)
+         glFlush();
+      return;
+   }
 
    glPushMatrix();
-   glTranslatef(-3.1, 4.2, 0.0);
-   glRotatef(-2.0 * angle - 25.0, 0.0, 0.0, 1.0);
-   glCallList(gear3);
-   glPopMatrix();
+   glRotatef(gs->view_rotx, 1.0, 0.0, 0.0);
+   glRotatef(gs->view_roty, 0.0, 1.0, 0.0);
+   glRotatef(gs->view_rotz, 0.0, 0.0, 1.0);
+
+   for (g = 0; g < 3; g++) {
+      glPushMatrix();
+      glTranslatef(gears[g].x, gears[g].y, 0.0);
+      glRotatef(gears[g].speed * gs->angle + gears[g].phase, 0.0, 0.0, 1.0);
+      glCallList(gs->gear_lists[g]);
+      glPopMatrix();
+   }
 
    glPopMatrix();
 }
 
 static void
-idle(void)
+idle(struct Gears *gs)
 {
-  static double t0 = -1.;
   double dt, t = GetTime();
 
-  if (t0 < 0.0)
-    t0 = t;
-  dt = t - t0;
-  t0 = t;
+  if (gs->t0 < 0.0)
+    gs->t0 = t;
+  dt = t - gs->t0;
+  gs->t0 = t;
+
+  if (gs->gear_program) {
+    /*
+     * The shader path only needs the time.  Wrap it each turn of the
+     * big gear, after which all gears are back where they started, so
+     * that single precision keeps its accuracy.
+     */
+    gs->elapsed = fmod(gs->elapsed + dt, 360.0 / DEGREES_PER_SECOND);
+    glUniform1f(gs->time_location, gs->elapsed);
+    return;
+  }
+
+  gs->angle += DEGREES_PER_SECOND * dt;
+  gs->angle = fmod(gs->angle, 360.0); /* prevents eventual overflow */
+}
+
+/* m = m * n, for column-major 4x4 matrices */
+static void
+multiply_matrix(GLfloat m[16], const GLfloat n[16])
+{
+   GLfloat r[16];
+   int i, j;
+
+   for (i = 0; i < 4; i++)
+      for (j = 0; j < 4; j++)
+         r[4 * i + j] = m[j] * n[4 * i] + m[4 + j] * n[4 * i + 1] +
+                        m[8 + j] * n[4 * i + 2] + m[12 + j] * n[4 * i + 3];
+
+   memcpy(m, r, sizeof(r));
+}
+
+/* The matrix equivalents of glTranslatef() and glRotatef(). */
+static void
+translate_matrix(GLfloat m[16], GLfloat x, GLfloat y, GLfloat z)
+{
+   GLfloat t[16] = { 1, 0, 0, 0,  0, 1, 0, 0,  0, 0, 1, 0,  x, y, z, 1 };
+
+   multiply_matrix(m, t);
+}
+
+static void
+rotate_matrix(GLfloat m[16], GLfloat degrees, GLfloat x, GLfloat y, GLfloat z)
+{
+   GLfloat len = sqrt(x * x + y * y + z * z);
+   GLfloat c = cos(degrees * M_PI / 180.0);
+   GLfloat s = sin(degrees * M_PI / 180.0);
+   GLfloat r[16];
+
+   x /= len;
+   y /= len;
+   z /= len;
+
+   r[0] = x * x * (1 - c) + c;
+   r[1] = y * x * (1 - c) + z * s;
+   r[2] = x * z * (1 - c) - y * s;
+   r[3] = 0;
+   r[4] = x * y * (1 - c) - z * s;
+   r[5] = y * y * (1 - c) + c;
+   r[6] = y * z * (1 - c) + x * s;
+   r[7] = 0;
+   r[8] = x * z * (1 - c) + y * s;
+   r[9] = y * z * (1 - c) - x * s;
+   r[10] = z * z * (1 - c) + c;
+   r[11] = 0;
+   r[12] = 0;
+   r[13] = 0;
+   r[14] = 0;
+   r[15] = 1;
+
+   multiply_matrix(m, r);
+}
+
+/* The matrix equivalent of glFrustum() on an identity matrix. */
+static void
+frustum_matrix(GLfloat m[16], GLfloat left, GLfloat right, GLfloat bottom,
+               GLfloat top, GLfloat near, GLfloat far)
+{
+   memset(m, 0, 16 * sizeof(GLfloat));
+
+   m[0] = 2.0 * near / (right - left);
+   m[5] = 2.0 * near / (top - bottom);
+   m[8] = (right + left) / (right - left);
+   m[9] = (top + bottom) / (top - bottom);
+   m[10] = -(far + near) / (far - near);
+   m[11] = -1.0;
+   m[14] = -2.0 * far * near / (far - near);
+}
+
+/*
+ * Grow 'bounds' to include the window position of the object space
+ * point (x, y, z), given column-major modelview and projection
+ * matrices.
+ */
+static void
+project_point(const struct Gears *gs, const GLfloat mv[16],
+              const GLfloat proj[16],
+              GLfloat x, GLfloat y, GLfloat z, struct Rect *bounds)
+{
+   GLfloat eye[4], clip[4];
+   struct Rect point;
+   int i;
+
+   for (i = 0; i < 4; i++)
+      eye[i] = mv[i] * x + mv[4 + i] * y + mv[8 + i] * z + mv[12 + i];
+
+   for (i = 0; i < 4; i++)
+      clip[i] = proj[i] * eye[0] + proj[4 + i] * eye[1] +
+                proj[8 + i] * eye[2] + proj[12 + i] * eye[3];
+
+   point.x = (int) floor((clip[0] / clip[3] + 1.0) * 0.5 *
+                         gs->viewport_width);
+   point.y = (int) floor((clip[1] / clip[3] + 1.0) * 0.5 *
+                         gs->viewport_height);
+   point.width = 1;
+   point.height = 1;
+
+   UnionRect(bounds, &point);
+}
+
+
+/*
+ * Compute the window area covered by the gears' swept cylinders under
+ * the current view, padded by a pixel on each side for rasterization,
+ * and clipped to the viewport.
+ */
+static void
+compute_gears_bounds(struct Gears *gs)
+{
+   struct Rect bounds = { 0, 0, 0, 0 };
+   int g, i, x1, y1;
+
+   for (g = 0; g < 3; g++) {
+      GLfloat mv[16];
+      GLfloat r = gears[g].outer_radius + gears[g].tooth_depth / 2.0;
+      GLfloat z = gears[g].width * 0.5;
+
+      memcpy(mv, gs->view_matrix, sizeof(mv));
+      translate_matrix(mv, gears[g].x, gears[g].y, 0.0);
+
+      /* Bound the circle with a 16-gon that encloses it. */
+      r /= cos(M_PI / 16.0);
+
+      for (i = 0; i < 16; i++) {
+         GLfloat a = i * 2.0 * M_PI / 16.0;
+         project_point(gs, mv, gs->projection_matrix,
+                       r * cos(a), r * sin(a), z, &bounds);
+         project_point(gs, mv, gs->projection_matrix,
+                       r * cos(a), r * sin(a), -z, &bounds);
+      }
+   }
+
+   x1 = bounds.x + bounds.width + 1;
+   y1 = bounds.y + bounds.height + 1;
+   bounds.x = (bounds.x > 1) ? bounds.x - 1 : 0;
+   bounds.y = (bounds.y > 1) ? bounds.y - 1 : 0;
+   if (x1 > gs->viewport_width)
+      x1 = gs->viewport_width;
+   if (y1 > gs->viewport_height)
+      y1 = gs->viewport_height;
+   bounds.width = (x1 > bounds.x) ? x1 - bounds.x : 0;
+   bounds.height = (y1 > bounds.y) ? y1 - bounds.y : 0;
+
+   gs->gears_bounds = bounds;
+   gs->gears_bounds_valid = GL_TRUE;
+}
+
+/*
+ * Set orientation_matrix to reflect, then rotate counter-clockwise,
+ * as 'o' says.  A single reflection reverses the winding of every
+ * triangle, so front faces become clockwise.
+ */
+static void
+init_orientation(struct Gears *gs, const struct Orientation *o)
+{
+   int i;
+
+   if (o)
+      gs->orientation = *o;
+   else
+      memset(&gs->orientation, 0, sizeof(gs->orientation));
+
+   memset(gs->orientation_matrix, 0, sizeof(gs->orientation_matrix));
+   gs->orientation_matrix[0] = gs->orientation_matrix[5] = 1.0;
+   gs->orientation_matrix[10] = gs->orientation_matrix[15] = 1.0;
+   rotate_matrix(gs->orientation_matrix, gs->orientation.degrees,
+                 0.0, 0.0, 1.0);
+
+   for (i = 0; i < 4; i++) {
+      if (gs->orientation.reflectX)
+         gs->orientation_matrix[i] = -gs->orientation_matrix[i];
+      if (gs->orientation.reflectY)
+         gs->orientation_matrix[4 + i] = -gs->orientation_matrix[4 + i];
+   }
+
+   glFrontFace(gs->orientation.reflectX != gs->orientation.reflectY ?
+               GL_CW : GL_CCW);
+}
+
+/*
+ * Set view_matrix from view_rotx/roty/rotz, and pass it to the vertex
+ * shader, if any; the fixed-function path applies the rotations in
+ * draw().
+ */
+static void
+update_view(struct Gears *gs)
+{
+   memset(gs->view_matrix, 0, sizeof(gs->view_matrix));
+   gs->view_matrix[0] = gs->view_matrix[5] = 1.0;
+   gs->view_matrix[10] = gs->view_matrix[15] = 1.0;
+   translate_matrix(gs->view_matrix, 0.0, 0.0, -40.0);
+   rotate_matrix(gs->view_matrix, gs->view_rotx, 1.0, 0.0, 0.0);
+   rotate_matrix(gs->view_matrix, gs->view_roty, 0.0, 1.0, 0.0);
+   rotate_matrix(gs->view_matrix, gs->view_rotz, 0.0, 0.0, 1.0);
 
-  angle += 70.0 * dt;  /* 70 degrees per second */
-  angle = fmod(angle, 360.0); /* prevents eventual overflow */
+   if (gs->view_buffer) {
+      latch_view(gs);
+   } else if (gs->gear_program) {
+      glUniformMatrix4fv(glGetUniformLocation(gs->gear_program, "view"),
+                         1, GL_FALSE, gs->view_matrix);
+   }
 }
 
 /* new window size or exposure */
 static void
-reshape(int width, int height)
+reshape(struct Gears *gs, int width, int height)
 {
-   GLfloat h = (GLfloat) height / (GLfloat) width;
+   /* The aspect ratio of the scene, which is on its side at 90 or 270. */
+   GLfloat h = (gs->orientation.degrees % 180) ?
+      (GLfloat) width / (GLfloat) height :
+      (GLfloat) height / (GLfloat) width;
+   GLfloat m[16];
+   int i;
 
    glViewport(0, 0, (GLint) width, (GLint) height);
 
-   glMatrixMode(GL_PROJECTION);
-   glLoadIdentity();
-   glFrustum(-1.0, 1.0, -h, h, 5.0, 60.0);
-   
-   glMatrixMode(GL_MODELVIEW);
-   glLoadIdentity();
-   glTranslatef(0.0, 0.0, -40.0);
+   frustum_matrix(gs->projection_matrix, -1.0, 1.0, -h, h, 5.0, 60.0);
+   memcpy(m, gs->orientation_matrix, sizeof(m));
+   multiply_matrix(m, gs->projection_matrix);
+   memcpy(gs->projection_matrix, m, sizeof(m));
+
+   update_view(gs);
+
+   if (gs->gear_program) {
+      glUniformMatrix4fv(glGetUniformLocation(gs->gear_program, "projection"),
+                         1, GL_FALSE, gs->projection_matrix);
+   } else {
+      glMatrixMode(GL_PROJECTION);
+      glLoadMatrixf(gs->projection_matrix);
+
+      glMatrixMode(GL_MODELVIEW);
+      glLoadIdentity();
+      glTranslatef(0.0, 0.0, -40.0);
+   }
+
+   gs->viewport_width = width;
+   gs->viewport_height = height;
+
+   /* Every buffer needs a full redraw after a reshape. */
+   for (i = 0; i < MAX_BUFFER_AGE; i++) {
+      gs->damage_history[i].x = 0;
+      gs->damage_history[i].y = 0;
+      gs->damage_history[i].width = width;
+      gs->damage_history[i].height = height;
+   }
+
+   gs->gears_bounds_valid = GL_FALSE;
+}
+
+/*
+ * The shaders are written for both GLSL 1.20 (OpenGL 2.1) and GLSL
+ * 1.50 (core profile OpenGL 3.2); the prefixes below select one, and
+ * whether the view is late-latched, from a uniform block laid out as a
+ * struct latch_block.  The
+ * lighting matches the fixed-function path: light 0 from (5, 5, 10)
+ * in eye space, plus the default 0.2 ambient light.
+ */
+static const char vertex_shader_source[] =
+   "uniform mat4 projection;\n"
+   "#ifdef LATE_LATCH\n"
+   "layout(std140) uniform View { mat4 views[3]; uint latest; };\n"
+   "#define view views[latest]\n"
+   "#else\n"
+   "uniform mat4 view;\n"
+   "#endif\n"
+   "uniform float time;\n"
+   "IN vec3 position;\n"
+   "IN vec3 normal;\n"
+   "IN vec4 motion;\n"
+   "IN vec3 color;\n"
+   "OUT vec3 lit_color;\n"
+   "void main()\n"
+   "{\n"
+   "   float a = radians(motion.z * time + motion.w);\n"
+   "   mat2 turn = mat2(cos(a), sin(a), -sin(a), cos(a));\n"
+   "   vec4 p = vec4(motion.xy + turn * position.xy, position.z, 1.0);\n"
+   "   vec3 n = mat3(view) * vec3(turn * normal.xy, normal.z);\n"
+   "   float diffuse = max(dot(normalize(n),\n"
+   "                           normalize(vec3(5.0, 5.0, 10.0))), 0.0);\n"
+   "   lit_color = color * (0.2 + diffuse);\n"
+   "   gl_Position = projection * view * p;\n"
+   "}\n";
+
+static const char fragment_shader_source[] =
+   "IN vec3 lit_color;\n"
+   "void main()\n"
+   "{\n"
+   "   FRAG_COLOR = vec4(lit_color, 1.0);\n"
+   "}\n";
+
+static const char *const vertex_shader_prefix[2] = {
+   "#version 120\n#define IN attribute\n#define OUT varying\n",
+   "#version 150\n#define IN in\n#define OUT out\n",
+};
+
+static const char late_latch_vertex_shader_prefix[] =
+   "#version 150\n#define IN in\n#define OUT out\n#define LATE_LATCH\n";
+
+static const char *const fragment_shader_prefix[2] = {
+   "#version 120\n#define IN varying\n#define FRAG_COLOR gl_FragColor\n",
+   "#version 150\n#define IN in\nout vec4 frag_color;\n"
+   "#define FRAG_COLOR frag_color\n",
+};
+
+/* Return 0 if the shader does not compile. */
+static GLuint
+compile_shader(GLenum type, const char *prefix, const char *source)
+{
+   const char *strings[2] = { prefix, source };
+   GLuint shader = glCreateShader(type);
+   GLint status;
+
+   glShaderSource(shader, 2, strings, NULL);
+   glCompileShader(shader);
+   glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+
+   if (!status) {
+      char log[1024];
+
+      glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+      SetError("Unable to compile the gears shader:\n%s\n", log);
+      glDeleteShader(shader);
+      return 0;
+   }
+
+   return shader;
+}
+
+/* Return 0 if the program does not compile or link. */
+static GLuint
+link_gear_program(const char *vertex_prefix, const char *fragment_prefix)
+{
+   GLuint program, vs, fs;
+   GLint status;
+
+   vs = compile_shader(GL_VERTEX_SHADER, vertex_prefix,
+                       vertex_shader_source);
+   if (!vs)
+      return 0;
+
+   fs = compile_shader(GL_FRAGMENT_SHADER, fragment_prefix,
+                       fragment_shader_source);
+   if (!fs) {
+      glDeleteShader(vs);
+      return 0;
+   }
+
+   program = glCreateProgram();
+   glAttachShader(program, vs);
+   glAttachShader(program, fs);
+   glBindAttribLocation(program, 0, "position");
+   glBindAttribLocation(program, 1, "normal");
+   glBindAttribLocation(program, 2, "motion");
+   glBindAttribLocation(program, 3, "color");
+   glLinkProgram(program);
+   glGetProgramiv(program, GL_LINK_STATUS, &status);
+
+   if (!status) {
+      char log[1024];
+
+      glGetProgramInfoLog(program, sizeof(log), NULL, log);
+      SetError("Unable to link the gears shader:\n%s\n", log);
+      glDeleteProgram(program);
+      program = 0;
+   }
+
+   glDeleteShader(vs);
+   glDeleteShader(fs);
+
+   return program;
 }
 
-void InitGears(int width, int height)
+/*
+ * Build the shader path: capture the geometry of all gears into one
+ * vertex buffer, and compile the program that animates it.  After
+ * this, a frame only costs a time uniform and a draw call, whatever
+ * the number of gears.  Return -1, having deleted what it created, on
+ * failure.
+ */
+static int
+init_gear_program(struct Gears *gs)
+{
+   struct gear_vertex *v;
+   int major = 0, minor = 0, core = 0;
+   int g;
+
+   /*
+    * A core profile is only possible from OpenGL 3.2, and lacks the
+    * GLSL 1.20 built-ins and client-side vertex state.
+    */
+   sscanf((const char *) glGetString(GL_VERSION), "%d.%d", &major, &minor);
+   if ((major > 3) || ((major == 3) && (minor >= 2))) {
+      GLint mask = 0;
+
+      glGetIntegerv(GL_CONTEXT_PROFILE_MASK, &mask);
+      core = (mask & GL_CONTEXT_CORE_PROFILE_BIT) != 0;
+   } else if ((major < 2) || ((major == 2) && (minor < 1))) {
+      SetError("GPU gear animation requires OpenGL 2.1; found %d.%d.\n",
+               major, minor);
+      return -1;
+   }
+
+   gs->capturing = GL_TRUE;
+   for (g = 0; g < 3; g++) {
+      gs->captured_state.motion[0] = gears[g].x;
+      gs->captured_state.motion[1] = gears[g].y;
+      gs->captured_state.motion[2] = gears[g].speed * DEGREES_PER_SECOND;
+      gs->captured_state.motion[3] = gears[g].phase;
+      memcpy(gs->captured_state.color, gears[g].color,
+             sizeof(gs->captured_state.color));
+      gear(gs, gears[g].inner_radius, gears[g].outer_radius,
+           gears[g].width, gears[g].teeth, gears[g].tooth_depth);
+   }
+   gs->capturing = GL_FALSE;
+
+   if (gs->capture_failed) {
+      SetError("Memory allocation failure.\n");
+      free(gs->captured_triangles.vertices);
+      free(gs->captured_primitive.vertices);
+      memset(&gs->captured_triangles, 0, sizeof(gs->captured_triangles));
+      memset(&gs->captured_primitive, 0, sizeof(gs->captured_primitive));
+      gs->capture_failed = GL_FALSE;
+      return -1;
+   }
+
+   v = gs->captured_triangles.vertices;
+   gs->gear_vertex_count = gs->captured_triangles.count;
+
+   if (core) {
+      glGenVertexArrays(1, &gs->gear_vao);
+      glBindVertexArray(gs->gear_vao);
+   }
+
+   glGenBuffers(1, &gs->gear_buffer);
+   glBindBuffer(GL_ARRAY_BUFFER, gs->gear_buffer);
+   glBufferData(GL_ARRAY_BUFFER, gs->gear_vertex_count * sizeof(*v), v,
+                GL_STATIC_DRAW);
+
+   free(gs->captured_triangles.vertices);
+   free(gs->captured_primitive.vertices);
+   memset(&gs->captured_triangles, 0, sizeof(gs->captured_triangles));
+   memset(&gs->captured_primitive, 0, sizeof(gs->captured_primitive));
+
+   glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(*v),
+                         (void *) offsetof(struct gear_vertex, position));
+   glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(*v),
+                         (void *) offsetof(struct gear_vertex, normal));
+   glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(*v),
+                         (void *) offsetof(struct gear_vertex, motion));
+   glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(*v),
+                         (void *) offsetof(struct gear_vertex, color));
+   glEnableVertexAttribArray(0);
+   glEnableVertexAttribArray(1);
+   glEnableVertexAttribArray(2);
+   glEnableVertexAttribArray(3);
+
+   gs->gear_program = link_gear_program(vertex_shader_prefix[core],
+                                        fragment_shader_prefix[core]);
+   if (!gs->gear_program) {
+      glDeleteBuffers(1, &gs->gear_buffer);
+      if (gs->gear_vao)
+         glDeleteVertexArrays(1, &gs->gear_vao);
+      gs->gear_buffer = 0;
+      gs->gear_vao = 0;
+      return -1;
+   }
+
+   glUseProgram(gs->gear_program);
+   gs->time_location = glGetUniformLocation(gs->gear_program, "time");
+
+   return 0;
+}
+
+/*
+ * Allocate an instance of the gears, at the start of their animation.
+ * It holds no OpenGL objects until InitGears().  Return NULL on
+ * failure.
+ */
+struct Gears *CreateGears(void)
+{
+   struct Gears *gs = calloc(1, sizeof(*gs));
+
+   if (gs == NULL) {
+      SetError("Memory allocation failure.\n");
+      return NULL;
+   }
+
+   gs->view_rotx = 20.0;
+   gs->view_roty = 30.0;
+   gs->view_rotz = 0.0;
+   gs->t0 = -1.0;
+   gs->captured_shade_model = GL_SMOOTH;
+
+   return gs;
+}
+
+/*
+ * Free an instance of the gears, after DestroyGears().
+ */
+void FreeGears(struct Gears *gs)
+{
+   free(gs);
+}
+
+/*
+ * Set up the gears' OpenGL objects in the current context.  Return -1
+ * if the shader path cannot be set up, with nothing left to destroy.
+ */
+int InitGears(struct Gears *gs, int width, int height, int gpuAnimation,
+              const struct Orientation *pOrientation)
 {
    static GLfloat pos[4] = { 5.0, 5.0, 10.0, 0.0 };
-   static GLfloat red[4] = { 0.8, 0.1, 0.0, 1.0 };
-   static GLfloat green[4] = { 0.0, 0.8, 0.2, 1.0 };
-   static GLfloat blue[4] = { 0.2, 0.2, 1.0, 1.0 };
+   int g;
 
-   glLightfv(GL_LIGHT0, GL_POSITION, pos);
    glEnable(GL_CULL_FACE);
-   glEnable(GL_LIGHTING);
-   glEnable(GL_LIGHT0);
    glEnable(GL_DEPTH_TEST);
+   init_orientation(gs, pOrientation);
 
-   /* make the gears */
-   gear1 = glGenLists(1);
-   glNewList(gear1, GL_COMPILE);
-   glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, red);
-   gear(1.0, 4.0, 1.0, 20, 0.7);
-   glEndList();
+   if (gpuAnimation) {
+      if (init_gear_program(gs) != 0)
+         return -1;
+   } else {
+      glLightfv(GL_LIGHT0, GL_POSITION, pos);
+      glEnable(GL_LIGHTING);
+      glEnable(GL_LIGHT0);
 
-   gear2 = glGenLists(1);
-   glNewList(gear2, GL_COMPILE);
-   glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, green);
-   gear(0.5, 2.0, 2.0, 10, 0.7);
-   glEndList();
-
-   gear3 = glGenLists(1);
-   glNewList(gear3, GL_COMPILE);
-   glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, blue);
-   gear(1.3, 2.0, 0.5, 10, 0.7);
-   glEndList();
+      /* make the gears */
+      for (g = 0; g < 3; g++) {
+         gs->gear_lists[g] = glGenLists(1);
+         glNewList(gs->gear_lists[g], GL_COMPILE);
+         glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, gears[g].color);
+         gear(gs, gears[g].inner_radius, gears[g].outer_radius,
+              gears[g].width, gears[g].teeth, gears[g].tooth_depth);
+         glEndList();
+      }
 
-   glEnable(GL_NORMALIZE);
+      glEnable(GL_NORMALIZE);
+   }
 
    glDrawBuffer(GL_BACK);
 
-   reshape(width, height);
+   reshape(gs, width, height);
+
+   return 0;
+}
+
+/*
+ * Delete the late-latch buffers, and go back to a plain view uniform
+ * once a program without the uniform block is linked.
+ */
+static void
+free_late_latch(struct Gears *gs)
+{
+   if (gs->latch_fence)
+      glDeleteSync(gs->latch_fence);
+   if (gs->latch_block) {
+      glBindBuffer(GL_COPY_READ_BUFFER, gs->latch_buffer);
+      glUnmapBuffer(GL_COPY_READ_BUFFER);
+      glBindBuffer(GL_COPY_READ_BUFFER, 0);
+   }
+   glDeleteBuffers(1, &gs->latch_buffer);
+   glDeleteBuffers(1, &gs->view_buffer);
+
+   gs->latch_fence = NULL;
+   gs->latch_block = NULL;
+   gs->latch_buffer = 0;
+   gs->view_buffer = 0;
+}
+
+/*
+ * Delete the gears' OpenGL objects, while the context that InitGears()
+ * set up is still current, so that InitGears() can start over in a new
+ * context.  The animation carries on where it left off.
+ */
+void DestroyGears(struct Gears *gs)
+{
+   int g;
+
+   if (gs->view_buffer) {
+      free_late_latch(gs);
+   }
+
+   if (gs->gear_program) {
+      glUseProgram(0);
+      glDeleteProgram(gs->gear_program);
+      glDeleteBuffers(1, &gs->gear_buffer);
+      if (gs->gear_vao)
+         glDeleteVertexArrays(1, &gs->gear_vao);
+      gs->gear_program = 0;
+      gs->gear_buffer = 0;
+      gs->gear_vao = 0;
+   } else {
+      for (g = 0; g < 3; g++) {
+         glDeleteLists(gs->gear_lists[g], 1);
+         gs->gear_lists[g] = 0;
+      }
+   }
+
+   gs->gears_bounds_valid = GL_FALSE;
+}
+
+void DrawGears(struct Gears *gs)
+{
+    idle(gs);
+    draw(gs);
+}
+
+/*
+ * Turn the view by the given angles, in degrees, as glxgears' arrow
+ * and z keys do.
+ */
+void RotateGearsView(struct Gears *gs, float dx, float dy, float dz)
+{
+    gs->view_rotx += dx;
+    gs->view_roty += dy;
+    gs->view_rotz += dz;
+
+    update_view(gs);
+
+    gs->gears_bounds_valid = GL_FALSE;
+}
+
+/*
+ * Return whether the current context supports the OpenGL extension;
+ * it is a core profile, which lacks glGetString(GL_EXTENSIONS).
+ */
+static GLboolean
+gl_extension_supported(const char *extension)
+{
+   GLint count = 0, i;
+
+   glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+
+   for (i = 0; i < count; i++) {
+      if (strcmp((const char *) glGetStringi(GL_EXTENSIONS, i),
+                 extension) == 0)
+         return GL_TRUE;
+   }
+
+   return GL_FALSE;
 }
 
-void DrawGears(void)
+/*
+ * Have the shader path read the view from a uniform block that the GPU
+ * copies, as it reaches each frame, from a persistently mapped buffer
+ * that RotateGearsView() writes; so the view can still be turned after
+ * DrawGears() has submitted the frame, until GearsFrameStarted().  That
+ * needs a core profile, for uniform blocks, and OpenGL 4.4 or
+ * ARB_buffer_storage; return 0, with a warning, without them.
+ * DestroyGears() turns late latching off.
+ */
+int EnableGearsLateLatch(struct Gears *gs)
 {
-    idle();
-    draw();
+    GLint major = 0, minor = 0;
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+                       GL_MAP_COHERENT_BIT;
+    GLuint program;
+
+    if (gs->view_buffer) {
+        return 1;
+    }
+
+    /* Only the shader path in a core profile has a vertex array. */
+    if (!gs->gear_vao) {
+        Warning("Late latching needs a core profile context; "
+                "not late latching.\n");
+        return 0;
+    }
+
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+
+    if (((major < 4) || ((major == 4) && (minor < 4))) &&
+        !gl_extension_supported("GL_ARB_buffer_storage")) {
+        Warning("Late latching needs OpenGL 4.4 or GL_ARB_buffer_storage; "
+                "not late latching.\n");
+        return 0;
+    }
+
+    glGenBuffers(1, &gs->latch_buffer);
+    glBindBuffer(GL_COPY_READ_BUFFER, gs->latch_buffer);
+    glBufferStorage(GL_COPY_READ_BUFFER, sizeof(struct latch_block), NULL,
+                    flags);
+    gs->latch_block = glMapBufferRange(GL_COPY_READ_BUFFER, 0,
+                                       sizeof(struct latch_block), flags);
+
+    glGenBuffers(1, &gs->view_buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, gs->view_buffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(struct latch_block), NULL,
+                 GL_DYNAMIC_COPY);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, gs->view_buffer);
+
+    program = (gs->latch_block != NULL) ?
+        link_gear_program(late_latch_vertex_shader_prefix,
+                          fragment_shader_prefix[1]) : 0;
+
+    if (program == 0) {
+        Warning("%s", (gs->latch_block == NULL) ?
+                "Unable to map the late-latch buffer.\n" : GetError());
+        Warning("Not late latching.\n");
+        free_late_latch(gs);
+        return 0;
+    }
+    glUniformBlockBinding(program, glGetUniformBlockIndex(program, "View"),
+                          0);
+
+    glUseProgram(program);
+    glDeleteProgram(gs->gear_program);
+    gs->gear_program = program;
+    gs->time_location = glGetUniformLocation(program, "time");
+
+    /* Set the new program's projection, and latch the current view. */
+    gs->latch_latest = 0;
+    reshape(gs, gs->viewport_width, gs->viewport_height);
+
+    return 1;
+}
+
+/*
+ * Return whether the GPU has reached the frame that DrawGears() last
+ * submitted, and copied its view.  Until then, RotateGearsView() still
+ * turns that frame.  Without late latching, the view is fixed when the
+ * frame is drawn, so this is always true.
+ */
+int GearsFrameStarted(struct Gears *gs)
+{
+    GLenum status;
+
+    if (gs->latch_fence == NULL) {
+        return 1;
+    }
+
+    status = glClientWaitSync(gs->latch_fence, 0, 0);
+
+    if (status == GL_TIMEOUT_EXPIRED) {
+        return 0;
+    }
+
+    glDeleteSync(gs->latch_fence);
+    gs->latch_fence = NULL;
+
+    return 1;
+}
+
+/*
+ * Draw the next frame, repainting only what differs from the contents
+ * of a back buffer 'bufferAge' frames old (as reported by
+ * EGL_EXT_buffer_age; 0 means the contents are undefined).  Return in
+ * 'pDamage' the area that differs from the previous frame, for
+ * eglSwapBuffersWithDamage() or KMS FB_DAMAGE_CLIPS.
+ *
+ * Only the gears change from frame to frame, and only within the
+ * cylinders they sweep, so everything else on screen is painted once.
+ */
+void DrawGearsPartial(struct Gears *gs, int bufferAge, struct Rect *pDamage)
+{
+    struct Rect change = gs->gears_bounds;
+    struct Rect repaint;
+    int i;
+
+    idle(gs);
+
+    /*
+     * After a reshape or a change of view, the gears bounds must be
+     * recomputed, and the whole frame has changed.
+     */
+    if (!gs->gears_bounds_valid) {
+        compute_gears_bounds(gs);
+        change.x = 0;
+        change.y = 0;
+        change.width = gs->viewport_width;
+        change.height = gs->viewport_height;
+    }
+
+    for (i = MAX_BUFFER_AGE - 1; i > 0; i--) {
+        gs->damage_history[i] = gs->damage_history[i - 1];
+    }
+
+    gs->damage_history[0] = change;
+
+    if ((bufferAge < 1) || (bufferAge > MAX_BUFFER_AGE)) {
+        repaint.x = 0;
+        repaint.y = 0;
+        repaint.width = gs->viewport_width;
+        repaint.height = gs->viewport_height;
+    } else {
+        repaint = gs->damage_history[0];
+        for (i = 1; i < bufferAge; i++) {
+            UnionRect(&repaint, &gs->damage_history[i]);
+        }
+    }
+
+    glScissor(repaint.x, repaint.y, repaint.width, repaint.height);
+    glEnable(GL_SCISSOR_TEST);
+    draw(gs);
+    glDisable(GL_SCISSOR_TEST);
+
+    *pDamage = gs->damage_history[0];
 }
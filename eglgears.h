@@ -23,7 +23,20 @@
 #if !defined(EGLGEARS_H)
 #define EGLGEARS_H
 
-void InitGears(int width, int height);
-void DrawGears(void);
+#include "utils.h"
+
+struct Gears;
+
+struct Gears *CreateGears(void);
+void FreeGears(struct Gears *pGears);
+int InitGears(struct Gears *pGears, int width, int height, int gpuAnimation,
+              const struct Orientation *pOrientation);
+void DestroyGears(struct Gears *pGears);
+void DrawGears(struct Gears *pGears);
+void DrawGearsPartial(struct Gears *pGears, int bufferAge,
+                      struct Rect *pDamage);
+void RotateGearsView(struct Gears *pGears, float dx, float dy, float dz);
+int EnableGearsLateLatch(struct Gears *pGears);
+int GearsFrameStarted(struct Gears *pGears);
 
 #endif /* EGLGEARS_H */
@@ -0,0 +1,334 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * An epoll reactor for the render loop (--event-loop).
+ *
+ * Without it, the render loop runs flat out: each iteration renders a
+ * frame, and only blocks, if at all, inside the driver when the
+ * display falls behind.  In the mailbox present mode, that means
+ * rendering frames that are never shown, and a CPU that never sleeps.
+ *
+ * With it, the loop sleeps in epoll_wait() on every file descriptor
+ * that can make a frame worth rendering, or end the loop:
+ *
+ * - a timerfd, from CreateFrameTimer(), that expires once per refresh
+ *   period and paces rendering;
+ * - the backend's event fd, e.g., the DRM fd for page flip events
+ *   (drmHandleEvent()), so that a frame held back until the display
+ *   took the previous one starts as soon as it does;
+ * - a signalfd, from CreateSignalFd(), for SIGINT, SIGTERM, and
+ *   SIGHUP, which then arrive as events rather than interrupting
+ *   whatever the thread happens to be doing;
+ * - evdev input devices; see input.c.
+ *
+ * The sources live in a fixed array, so nothing is allocated once the
+ * loop runs (--lock-memory).
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "eventloop.h"
+#include "utils.h"
+
+/* The refresh rate to pace frames at when the display's is unknown. */
+#define DEFAULT_REFRESH_RATE 60.0
+
+struct EventSource {
+    /* -1 for a free slot. */
+    int fd;
+    EventCallback callback;
+    void *data;
+};
+
+struct EventLoop {
+    int epollFd;
+    struct EventSource sources[MAX_EVENT_SOURCES];
+};
+
+
+/*
+ * Return a new, empty loop, or NULL on failure.
+ */
+struct EventLoop *CreateEventLoop(void)
+{
+    struct EventLoop *pLoop = calloc(1, sizeof(*pLoop));
+    int i;
+
+    if (pLoop == NULL) {
+        SetError("Memory allocation failure.\n");
+        return NULL;
+    }
+
+    pLoop->epollFd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (pLoop->epollFd < 0) {
+        SetError("Unable to create an epoll instance: %s.\n",
+                 strerror(errno));
+        free(pLoop);
+        return NULL;
+    }
+
+    for (i = 0; i < MAX_EVENT_SOURCES; i++) {
+        pLoop->sources[i].fd = -1;
+    }
+
+    return pLoop;
+}
+
+
+/*
+ * Free the loop.  The file descriptors it watched are left open.
+ */
+void DestroyEventLoop(struct EventLoop *pLoop)
+{
+    close(pLoop->epollFd);
+    free(pLoop);
+}
+
+
+/*
+ * Call 'callback' from DispatchEvents() whenever 'fd' is readable (or
+ * has failed, so that the callback's read can find out why).  Return
+ * -1 on failure.
+ */
+int AddEventSource(struct EventLoop *pLoop, int fd,
+                   EventCallback callback, void *data)
+{
+    struct epoll_event event;
+    int i;
+
+    for (i = 0; i < MAX_EVENT_SOURCES; i++) {
+        if (pLoop->sources[i].fd < 0) {
+            break;
+        }
+    }
+
+    if (i == MAX_EVENT_SOURCES) {
+        SetError("Too many event sources (the maximum is %d).\n",
+                 MAX_EVENT_SOURCES);
+        return -1;
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u32 = i;
+
+    if (epoll_ctl(pLoop->epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        SetError("Unable to watch fd %d: %s.\n", fd, strerror(errno));
+        return -1;
+    }
+
+    pLoop->sources[i].fd = fd;
+    pLoop->sources[i].callback = callback;
+    pLoop->sources[i].data = data;
+
+    return 0;
+}
+
+
+/*
+ * Stop watching 'fd'.  This may be called from a callback, including
+ * the fd's own.
+ */
+void RemoveEventSource(struct EventLoop *pLoop, int fd)
+{
+    int i;
+
+    for (i = 0; i < MAX_EVENT_SOURCES; i++) {
+        if (pLoop->sources[i].fd == fd) {
+            epoll_ctl(pLoop->epollFd, EPOLL_CTL_DEL, fd, NULL);
+            pLoop->sources[i].fd = -1;
+            return;
+        }
+    }
+}
+
+
+/*
+ * Sleep until at least one source is readable, or for 'timeoutMs'
+ * milliseconds (-1 to wait indefinitely, 0 not to wait), and call the
+ * callback of each readable source.  Return how many were called, or
+ * -1 if waiting failed.
+ */
+int DispatchEvents(struct EventLoop *pLoop, int timeoutMs)
+{
+    struct epoll_event events[MAX_EVENT_SOURCES];
+    int count, dispatched = 0, i;
+
+    count = epoll_wait(pLoop->epollFd, events, MAX_EVENT_SOURCES,
+                       timeoutMs);
+
+    if (count < 0) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        SetError("epoll_wait(2) failed: %s.\n", strerror(errno));
+        return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        struct EventSource *pSource = &pLoop->sources[events[i].data.u32];
+
+        /* An earlier callback may have removed this source. */
+
+        if (pSource->fd < 0) {
+            continue;
+        }
+
+        pSource->callback(pSource->fd, pSource->data);
+        dispatched++;
+    }
+
+    return dispatched;
+}
+
+
+/*
+ * Return a non-blocking timerfd that expires every refresh period,
+ * starting one period from now.  A 'refreshRate' of 0 means unknown.
+ * Return -1 on failure.
+ */
+int CreateFrameTimer(double refreshRate)
+{
+    struct itimerspec spec;
+    long periodNs;
+    int timerFd;
+
+    if (refreshRate <= 0.0) {
+        refreshRate = DEFAULT_REFRESH_RATE;
+    }
+
+    periodNs = (long) (1000000000.0 / refreshRate);
+
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if (timerFd < 0) {
+        SetError("Unable to create a timerfd: %s.\n", strerror(errno));
+        return -1;
+    }
+
+    memset(&spec, 0, sizeof(spec));
+    spec.it_interval.tv_sec = periodNs / 1000000000;
+    spec.it_interval.tv_nsec = periodNs % 1000000000;
+    spec.it_value = spec.it_interval;
+
+    if (timerfd_settime(timerFd, 0, &spec, NULL) != 0) {
+        SetError("Unable to arm the frame timer: %s.\n", strerror(errno));
+        close(timerFd);
+        return -1;
+    }
+
+    return timerFd;
+}
+
+
+/*
+ * Return how many times the frame timer expired since the last read;
+ * 0 if it has not.
+ */
+uint64_t ReadFrameTimer(int timerFd)
+{
+    uint64_t expirations;
+
+    if (read(timerFd, &expirations, sizeof(expirations)) !=
+        sizeof(expirations)) {
+        return 0;
+    }
+
+    return expirations;
+}
+
+
+static void GetLoopSignals(sigset_t *pSet)
+{
+    sigemptyset(pSet);
+    sigaddset(pSet, SIGINT);
+    sigaddset(pSet, SIGTERM);
+    sigaddset(pSet, SIGHUP);
+}
+
+
+/*
+ * Block SIGINT, SIGTERM, and SIGHUP, so that they are only received
+ * through a signalfd.  This must be called before any other thread is
+ * created: threads inherit the mask, and a thread that does not block
+ * the signals would be interrupted by them instead.  Return -1 on
+ * failure.
+ */
+int BlockLoopSignals(void)
+{
+    sigset_t set;
+
+    GetLoopSignals(&set);
+
+    if (sigprocmask(SIG_BLOCK, &set, NULL) != 0) {
+        SetError("Unable to block signals: %s.\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Return a non-blocking signalfd for the signals BlockLoopSignals()
+ * blocked, or -1 on failure.
+ */
+int CreateSignalFd(void)
+{
+    sigset_t set;
+    int signalFd;
+
+    GetLoopSignals(&set);
+
+    signalFd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    if (signalFd < 0) {
+        SetError("Unable to create a signalfd: %s.\n", strerror(errno));
+    }
+
+    return signalFd;
+}
+
+
+/*
+ * Return the next signal received through the signalfd; 0 if there is
+ * none.
+ */
+int ReadSignalFd(int signalFd)
+{
+    struct signalfd_siginfo info;
+
+    if (read(signalFd, &info, sizeof(info)) != sizeof(info)) {
+        return 0;
+    }
+
+    return info.ssi_signo;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#if !defined(EVENTLOOP_H)
+#define EVENTLOOP_H
+
+#include <stdint.h>
+
+/* How many file descriptors one EventLoop can watch. */
+#define MAX_EVENT_SOURCES 16
+
+/*
+ * Called by DispatchEvents() when 'fd' is readable, with the 'data'
+ * it was added with.
+ */
+typedef void (*EventCallback)(int fd, void *data);
+
+struct EventLoop;
+
+struct EventLoop *CreateEventLoop(void);
+void DestroyEventLoop(struct EventLoop *pLoop);
+int AddEventSource(struct EventLoop *pLoop, int fd,
+                   EventCallback callback, void *data);
+void RemoveEventSource(struct EventLoop *pLoop, int fd);
+int DispatchEvents(struct EventLoop *pLoop, int timeoutMs);
+
+int CreateFrameTimer(double refreshRate);
+uint64_t ReadFrameTimer(int timerFd);
+
+int BlockLoopSignals(void);
+int CreateSignalFd(void);
+int ReadSignalFd(int signalFd);
+
+#endif /* EVENTLOOP_H */
@@ -0,0 +1,720 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * A backend that presents through GBM and DRM KMS atomic commits, the
+ * way Mesa-based compositors do, for comparison with EGLStreams.
+ *
+ * EGL renders into the buffers of a gbm_surface.  After each swap, the
+ * application locks the new front buffer, wraps it in a DRM fb, and
+ * flips the plane to it with a nonblocking atomic commit; the buffer
+ * returns to the gbm_surface once the page flip event reports that a
+ * newer frame replaced it.  So the application, not the EGL
+ * implementation, implements the present mode:
+ *
+ *  - latency: while a flip is pending, a newer frame replaces any frame
+ *    still waiting for it (mailbox).
+ *  - balanced: at most one frame waits for the pending flip.
+ *  - throughput: up to --fifo-length frames wait.
+ *
+ * The gbm_surface's own buffer count also limits the queue.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+#include <gbm.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "backend.h"
+#include "egl.h"
+#include "kms.h"
+#include "stats.h"
+#include "telemetry.h"
+#include "utils.h"
+
+/* Upper bound on the scanout modifiers considered for one format. */
+#define MAX_SCANOUT_MODIFIERS 64
+
+/*
+ * Scanout formats for each --color-format, most preferred first.  The
+ * gears need no alpha.
+ */
+static const uint32_t rgb888ScanoutFormats[] = {
+    DRM_FORMAT_XRGB8888,
+    DRM_FORMAT_XBGR8888,
+    0,
+};
+
+static const uint32_t rgb565ScanoutFormats[] = {
+    DRM_FORMAT_RGB565,
+    0,
+};
+
+/*
+ * A presented frame: the locked gbm_bo holding it, and what its atomic
+ * commit needs.
+ */
+struct GbmFrame {
+    struct gbm_bo *bo;
+    uint32_t fb;
+    int inFenceFd;
+    int hasDamage;
+    struct Rect damage;
+    double swapEnd;             /* CLOCK_MONOTONIC, like flip events */
+    uint64_t frameId;
+    uint64_t serial;
+};
+
+struct GbmBackend {
+    /* From the DisplayProbe; not owned by the backend. */
+    int drmFd;
+    struct KmsDisplay *pKms;
+
+    struct gbm_device *gbmDevice;
+    struct gbm_surface *gbmSurface;
+    EGLContext eglContext;
+
+    EGLBoolean gpuFences;
+
+    /* How many frames may wait for the pending flip; 0 means mailbox. */
+    int maxQueued;
+
+    struct GbmFrame queue[MAX_FIFO_LENGTH];
+    int queueLen;
+
+    /* The frame whose commit has been made, but not yet flipped to. */
+    struct GbmFrame pending;
+    int flipPending;
+
+    /* The frame on screen. */
+    struct GbmFrame scanout;
+    int haveScanout;
+
+    /*
+     * Set when PageFlipHandler() could not commit the next frame, as it
+     * cannot return the error itself.
+     */
+    int commitFailed;
+
+    struct Backend *pBackend;
+};
+
+
+static void DestroyBoFb(struct gbm_bo *bo, void *data)
+{
+    int drmFd = gbm_device_get_fd(gbm_bo_get_device(bo));
+    uint32_t fb = (uint32_t) (uintptr_t) data;
+
+    drmModeRmFB(drmFd, fb);
+}
+
+
+/*
+ * Return the DRM fb for a gbm_bo, creating it the first time the bo is
+ * presented.  A gbm_surface cycles through a few bos, so the fb is
+ * cached on the bo, and removed when the bo is destroyed.  Return 0 on
+ * failure.
+ */
+static uint32_t GetBoFb(int drmFd, struct gbm_bo *bo)
+{
+    uint32_t handles[4] = { 0 }, pitches[4] = { 0 }, offsets[4] = { 0 };
+    uint64_t modifiers[4] = { 0 };
+    uint64_t modifier;
+    uint32_t fb = (uint32_t) (uintptr_t) gbm_bo_get_user_data(bo);
+    uint32_t flags = 0;
+    int planes, i, ret;
+
+    if (fb != 0) {
+        return fb;
+    }
+
+    modifier = gbm_bo_get_modifier(bo);
+    planes = gbm_bo_get_plane_count(bo);
+
+    for (i = 0; (i < planes) && (i < 4); i++) {
+        handles[i] = gbm_bo_get_handle_for_plane(bo, i).u32;
+        pitches[i] = gbm_bo_get_stride_for_plane(bo, i);
+        offsets[i] = gbm_bo_get_offset(bo, i);
+        modifiers[i] = modifier;
+    }
+
+    /*
+     * An implementation that cannot report the modifier allocated the
+     * bo with an implicit layout, which the driver knows from the bo.
+     */
+    if (modifier != DRM_FORMAT_MOD_INVALID) {
+        flags |= DRM_MODE_FB_MODIFIERS;
+    }
+
+    ret = drmModeAddFB2WithModifiers(drmFd,
+                                     gbm_bo_get_width(bo),
+                                     gbm_bo_get_height(bo),
+                                     gbm_bo_get_format(bo),
+                                     handles, pitches, offsets,
+                                     (flags != 0) ? modifiers : NULL,
+                                     &fb, flags);
+    if (ret != 0) {
+        SetError("Unable to add fb for GBM buffer: %s.\n", strerror(-ret));
+        return 0;
+    }
+
+    gbm_bo_set_user_data(bo, (void *) (uintptr_t) fb, DestroyBoFb);
+
+    return fb;
+}
+
+
+/*
+ * Give a frame's buffer back to the gbm_surface.
+ */
+static void ReleaseFrame(struct GbmBackend *pGbm, struct GbmFrame *pFrame)
+{
+    gbm_surface_release_buffer(pGbm->gbmSurface, pFrame->bo);
+
+    if (pFrame->inFenceFd >= 0) {
+        close(pFrame->inFenceFd);
+    }
+
+    pFrame->bo = NULL;
+    pFrame->inFenceFd = -1;
+}
+
+
+/*
+ * Commit the oldest queued frame.  The previous flip must be complete.
+ * If the commit fails, the frame is released and -1 returned.
+ */
+static int CommitNextFrame(struct GbmBackend *pGbm)
+{
+    struct GbmFrame frame = pGbm->queue[0];
+    uint32_t damageBlob = 0;
+    int i, ret;
+
+    for (i = 1; i < pGbm->queueLen; i++) {
+        pGbm->queue[i - 1] = pGbm->queue[i];
+    }
+
+    pGbm->queueLen--;
+
+    if (frame.hasDamage) {
+        damageBlob = CreateDamageClipsBlob(pGbm->drmFd, &frame.damage, 1,
+                                           pGbm->pBackend->height);
+    }
+
+    ret = CommitKmsFrame(pGbm->pKms, frame.fb, frame.inFenceFd,
+                         damageBlob, pGbm);
+
+    if (damageBlob != 0) {
+        drmModeDestroyPropertyBlob(pGbm->drmFd, damageBlob);
+    }
+
+    if (ret != 0) {
+        SetError("Atomic commit failed: %s\n", strerror(-ret));
+        ReleaseFrame(pGbm, &frame);
+        return -1;
+    }
+
+    /* The kernel holds its own reference to the in fence. */
+
+    if (frame.inFenceFd >= 0) {
+        close(frame.inFenceFd);
+        frame.inFenceFd = -1;
+    }
+
+    pGbm->pending = frame;
+    pGbm->flipPending = 1;
+
+    return 0;
+}
+
+
+static void PageFlipHandler(int fd, unsigned int sequence,
+                            unsigned int tv_sec, unsigned int tv_usec,
+                            void *userData)
+{
+    struct GbmBackend *pGbm = userData;
+    double flipTime = tv_sec + tv_usec / 1000000.0;
+
+    (void) fd;
+    (void) sequence;
+
+    if (pGbm->haveScanout) {
+        ReleaseFrame(pGbm, &pGbm->scanout);
+    }
+
+    pGbm->scanout = pGbm->pending;
+    pGbm->haveScanout = 1;
+    pGbm->flipPending = 0;
+
+    if (pGbm->pBackend->pStats != NULL) {
+        AddFlipLatencySample(pGbm->pBackend->pStats,
+                             pGbm->scanout.swapEnd, flipTime);
+    }
+
+    if (pGbm->pBackend->pTelemetry != NULL) {
+        SetTelemetryFlipTime(pGbm->pBackend->pTelemetry,
+                             pGbm->scanout.frameId, flipTime);
+    }
+
+    if (pGbm->pBackend->pInputLatency != NULL) {
+        SetFrameFlipTime(pGbm->pBackend->pInputLatency,
+                         pGbm->scanout.serial, flipTime);
+    }
+
+    if ((pGbm->queueLen > 0) && (CommitNextFrame(pGbm) != 0)) {
+        pGbm->commitFailed = 1;
+    }
+}
+
+
+/*
+ * Handle any page flip events that arrive within 'timeoutMs'
+ * milliseconds (-1 to wait indefinitely).  Return -1 if that fails, or
+ * if a flip handler could not commit the next frame.
+ */
+static int DispatchFlipEvents(struct GbmBackend *pGbm, int timeoutMs)
+{
+    drmEventContext eventContext = { 0 };
+    struct pollfd pfd;
+    int ret;
+
+    eventContext.version = 2;
+    eventContext.page_flip_handler = PageFlipHandler;
+
+    pfd.fd = pGbm->drmFd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    do {
+        ret = poll(&pfd, 1, timeoutMs);
+    } while ((ret < 0) && (errno == EINTR));
+
+    if (ret < 0) {
+        SetError("poll(2) on the DRM fd failed: %s.\n", strerror(errno));
+        return -1;
+    }
+
+    if (ret > 0) {
+        drmHandleEvent(pGbm->drmFd, &eventContext);
+    }
+
+    if (pGbm->commitFailed) {
+        pGbm->commitFailed = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Block until the pending flip completes.
+ */
+static int WaitForFlip(struct GbmBackend *pGbm)
+{
+    while (pGbm->flipPending) {
+        if (DispatchFlipEvents(pGbm, -1) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int GbmPresent(struct Backend *pBackend, const struct Rect *pDamage)
+{
+    struct GbmBackend *pGbm = pBackend->priv;
+    struct GbmFrame frame;
+
+    /*
+     * A fence after the frame's rendering lets the atomic commit wait
+     * for the GPU in the kernel (IN_FENCE_FD), rather than relying on
+     * implicit synchronization.
+     */
+
+    frame.inFenceFd = -1;
+
+    if (pGbm->gpuFences) {
+        frame.inFenceFd = CreateGpuFence(&pBackend->egl, pBackend->eglDpy);
+        if (frame.inFenceFd < 0) {
+            return -1;
+        }
+    }
+
+    if (pDamage != NULL) {
+        SwapBuffersWithDamage(&pBackend->egl, pBackend->eglDpy,
+                              pBackend->eglSurface, pDamage, 1);
+        frame.hasDamage = 1;
+        frame.damage = *pDamage;
+    } else {
+        eglSwapBuffers(pBackend->eglDpy, pBackend->eglSurface);
+        frame.hasDamage = 0;
+    }
+
+    frame.bo = gbm_surface_lock_front_buffer(pGbm->gbmSurface);
+
+    if (frame.bo == NULL) {
+        SetError("Unable to lock the GBM front buffer.\n");
+        if (frame.inFenceFd >= 0) {
+            close(frame.inFenceFd);
+        }
+        return -1;
+    }
+
+    frame.fb = GetBoFb(pGbm->drmFd, frame.bo);
+    frame.swapEnd = GetMonotonicTime();
+    frame.frameId = pBackend->telemetryFrameId;
+    frame.serial = pBackend->presentSerial;
+
+    /* Catch up on flips that completed while rendering. */
+
+    if ((frame.fb == 0) || (DispatchFlipEvents(pGbm, 0) != 0)) {
+        ReleaseFrame(pGbm, &frame);
+        return -1;
+    }
+
+    if ((pGbm->maxQueued == 0) && (pGbm->queueLen > 0)) {
+
+        /*
+         * Mailbox: the new frame replaces the one waiting for the
+         * flip.  The replaced frame never reaches the screen, so its
+         * changes must be included in the new frame's damage.
+         */
+
+        struct GbmFrame *pReplaced = &pGbm->queue[0];
+
+        if (frame.hasDamage && pReplaced->hasDamage) {
+            UnionRect(&frame.damage, &pReplaced->damage);
+        } else {
+            frame.hasDamage = 0;
+        }
+
+        ReleaseFrame(pGbm, pReplaced);
+        *pReplaced = frame;
+    } else {
+        int maxQueued = (pGbm->maxQueued > 0) ? pGbm->maxQueued : 1;
+
+        while (pGbm->queueLen >= maxQueued) {
+            if (WaitForFlip(pGbm) != 0) {
+                ReleaseFrame(pGbm, &frame);
+                return -1;
+            }
+        }
+
+        pGbm->queue[pGbm->queueLen++] = frame;
+    }
+
+    if (!pGbm->flipPending && (CommitNextFrame(pGbm) != 0)) {
+        return -1;
+    }
+
+    /* Make sure EGL has a buffer to render the next frame into. */
+
+    while (!gbm_surface_has_free_buffers(pGbm->gbmSurface)) {
+        if (WaitForFlip(pGbm) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int GbmGetQueueDepth(struct Backend *pBackend)
+{
+    struct GbmBackend *pGbm = pBackend->priv;
+
+    return pGbm->queueLen + pGbm->flipPending;
+}
+
+
+static int GbmDispatchEvents(struct Backend *pBackend)
+{
+    return DispatchFlipEvents(pBackend->priv, 0);
+}
+
+
+static void GbmDestroy(struct Backend *pBackend)
+{
+    struct GbmBackend *pGbm = pBackend->priv;
+
+    /* If the DRM fd has failed, the pending flip is left behind. */
+
+    WaitForFlip(pGbm);
+
+    while (pGbm->queueLen > 0) {
+        ReleaseFrame(pGbm, &pGbm->queue[--pGbm->queueLen]);
+    }
+
+    if (pGbm->haveScanout) {
+        ReleaseFrame(pGbm, &pGbm->scanout);
+        pGbm->haveScanout = 0;
+    }
+
+    eglMakeCurrent(pBackend->eglDpy, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                   EGL_NO_CONTEXT);
+    eglDestroySurface(pBackend->eglDpy, pBackend->eglSurface);
+    eglDestroyContext(pBackend->eglDpy, pGbm->eglContext);
+    eglTerminate(pBackend->eglDpy);
+
+    /*
+     * Destroying the gbm_surface removes the fbs of its buffers,
+     * including the one on screen, which turns the CRTC off; so the
+     * next backend set up on the KmsDisplay must set the mode again.
+     */
+    gbm_surface_destroy(pGbm->gbmSurface);
+    gbm_device_destroy(pGbm->gbmDevice);
+
+    ResetKmsDisplay(pGbm->pKms);
+
+    free(pGbm);
+}
+
+
+/*
+ * Create the gbm_surface with the layout that costs the least scanout
+ * bandwidth.
+ *
+ * Try the plane's modifiers for 'format' one at a time, best first (see
+ * GetScanoutModifiers()): the plane may accept layouts, e.g.,
+ * compressed ones, that the renderer cannot produce, so the first one
+ * that GBM can allocate wins.  If none can be allocated, or the driver
+ * reports no modifiers, let GBM pick an implicit layout.
+ */
+static struct gbm_surface *CreateScanoutSurface(struct GbmBackend *pGbm,
+                                                int width, int height,
+                                                uint32_t format)
+{
+    const struct PlaneFormats *pFormats = GetKmsDisplayFormats(pGbm->pKms);
+    uint64_t modifiers[MAX_SCANOUT_MODIFIERS];
+    struct gbm_surface *gbmSurface;
+    int count, i;
+
+    count = GetScanoutModifiers(pFormats, format, modifiers,
+                                ARRAY_LEN(modifiers));
+
+    for (i = 0; i < count; i++) {
+        gbmSurface = gbm_surface_create_with_modifiers(pGbm->gbmDevice,
+                                                       width, height, format,
+                                                       &modifiers[i], 1);
+        if (gbmSurface != NULL) {
+            printf("Scanout format %.4s, modifier 0x%016llx\n",
+                   (const char *) &format, (unsigned long long) modifiers[i]);
+            return gbmSurface;
+        }
+    }
+
+    gbmSurface = gbm_surface_create(pGbm->gbmDevice, width, height, format,
+                                    GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING);
+
+    if (gbmSurface != NULL) {
+        printf("Scanout format %.4s, implicit modifier\n",
+               (const char *) &format);
+    }
+
+    return gbmSurface;
+}
+
+
+/*
+ * Set up EGL on a GBM device for the probed DRM device, and an
+ * EGLSurface for a gbm_surface the size of the mode.  The modeset
+ * happens with the first frame's commit.  Return -1 on failure, having
+ * destroyed whatever was created.
+ */
+int SetUpGbmBackend(struct Backend *pBackend, const struct Options *pOptions,
+                    const struct DisplayProbe *pProbe)
+{
+    struct GbmBackend *pGbm = calloc(1, sizeof(*pGbm));
+    PFNEGLCREATEPLATFORMWINDOWSURFACEEXTPROC pCreatePlatformWindowSurface;
+    EGLConfig eglConfig = NULL;
+    const uint32_t *scanoutFormats =
+        (pOptions->colorFormat == COLOR_FORMAT_RGB565) ?
+        rgb565ScanoutFormats : rgb888ScanoutFormats;
+    uint32_t planeID, format = 0;
+    int i;
+    const char *clientExtensionString =
+        eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+
+    if (pGbm == NULL) {
+        SetError("Memory allocation failure.\n");
+        return -1;
+    }
+
+    if (!ExtensionIsSupported(clientExtensionString,
+                              "EGL_KHR_platform_gbm") &&
+        !ExtensionIsSupported(clientExtensionString,
+                              "EGL_MESA_platform_gbm")) {
+        SetError("EGL_KHR_platform_gbm not found.\n");
+        goto failFree;
+    }
+
+    pCreatePlatformWindowSurface = (PFNEGLCREATEPLATFORMWINDOWSURFACEEXTPROC)
+        GetProcAddress("eglCreatePlatformWindowSurfaceEXT");
+
+    if (pCreatePlatformWindowSurface == NULL) {
+        goto failFree;
+    }
+
+    pGbm->drmFd = pProbe->drmFd;
+    pGbm->pKms = pProbe->pKms;
+    pGbm->pBackend = pBackend;
+
+    GetKmsDisplayInfo(pGbm->pKms, &planeID,
+                      &pBackend->width, &pBackend->height);
+
+    pGbm->gbmDevice = gbm_create_device(pGbm->drmFd);
+
+    if (pGbm->gbmDevice == NULL) {
+        SetError("Unable to create GBM device.\n");
+        goto failFree;
+    }
+
+    if (LoadEglDispatch(&pBackend->egl, EGL_NO_DISPLAY) != 0) {
+        goto failDevice;
+    }
+
+    pBackend->eglDpy = pBackend->egl.GetPlatformDisplayEXT(
+        EGL_PLATFORM_GBM_KHR, pGbm->gbmDevice, NULL);
+
+    if (pBackend->eglDpy == EGL_NO_DISPLAY) {
+        SetError("Failed to get EGLDisplay from GBM device.\n");
+        goto failDevice;
+    }
+
+    if (!eglInitialize(pBackend->eglDpy, NULL, NULL)) {
+        SetError("Failed to initialize EGLDisplay.\n");
+        goto failDevice;
+    }
+
+    if (LoadEglDispatch(&pBackend->egl, pBackend->eglDpy) != 0) {
+        goto failDisplay;
+    }
+
+    eglBindAPI(EGL_OPENGL_API);
+
+    /*
+     * Pick the first scanout format that the plane supports and EGL can
+     * render to.
+     */
+
+    for (i = 0; (scanoutFormats[i] != 0) && (eglConfig == NULL); i++) {
+        if (PlaneSupportsFormat(GetKmsDisplayFormats(pGbm->pKms),
+                                scanoutFormats[i], DRM_FORMAT_MOD_INVALID)) {
+            format = scanoutFormats[i];
+            eglConfig = ChooseConfig(pBackend->eglDpy, EGL_WINDOW_BIT,
+                                     format, pOptions, pProbe->pCache);
+        }
+    }
+
+    if (eglConfig == NULL) {
+        SetError("No EGLConfig matches a format the plane supports.\n");
+        goto failDisplay;
+    }
+
+    pGbm->gbmSurface = CreateScanoutSurface(pGbm, pBackend->width,
+                                            pBackend->height, format);
+
+    if (pGbm->gbmSurface == NULL) {
+        SetError("Unable to create GBM surface.\n");
+        goto failDisplay;
+    }
+
+    pGbm->eglContext = CreateContext(pBackend->eglDpy, eglConfig, pOptions);
+
+    if (pGbm->eglContext == EGL_NO_CONTEXT) {
+        goto failGbmSurface;
+    }
+
+    pBackend->eglSurface =
+        pCreatePlatformWindowSurface(pBackend->eglDpy, eglConfig,
+                                     pGbm->gbmSurface, NULL);
+
+    if (pBackend->eglSurface == EGL_NO_SURFACE) {
+        SetError("Unable to create EGLSurface for GBM surface.\n");
+        goto failContext;
+    }
+
+    if (!eglMakeCurrent(pBackend->eglDpy, pBackend->eglSurface,
+                        pBackend->eglSurface, pGbm->eglContext)) {
+        SetError("Unable to make context and surface current.\n");
+        goto failEglSurface;
+    }
+
+    pGbm->gpuFences = GpuFencesSupported(pBackend->eglDpy);
+
+    switch (pOptions->presentMode) {
+    case PRESENT_MODE_LATENCY:
+        pGbm->maxQueued = 0;
+        break;
+    case PRESENT_MODE_BALANCED:
+        pGbm->maxQueued = 1;
+        break;
+    case PRESENT_MODE_THROUGHPUT:
+        pGbm->maxQueued = pOptions->fifoLength;
+        break;
+    }
+
+    printf("Present mode: %s (GBM flip queue length %d)\n",
+           PresentModeName(pOptions->presentMode), pGbm->maxQueued);
+
+    pBackend->name = "gbm";
+    pBackend->drmFd = pGbm->drmFd;
+    GetKmsDisplayOutput(pGbm->pKms, &pBackend->kmsOutput);
+    pBackend->present = GbmPresent;
+    pBackend->getQueueDepth = GbmGetQueueDepth;
+    pBackend->eventFd = pGbm->drmFd;
+    pBackend->dispatchEvents = GbmDispatchEvents;
+    pBackend->destroy = GbmDestroy;
+    pBackend->pStats = NULL;
+    pBackend->pTelemetry = NULL;
+    pBackend->pInputLatency = NULL;
+    pBackend->priv = pGbm;
+
+    return 0;
+
+failEglSurface:
+    eglDestroySurface(pBackend->eglDpy, pBackend->eglSurface);
+failContext:
+    eglDestroyContext(pBackend->eglDpy, pGbm->eglContext);
+failGbmSurface:
+    gbm_surface_destroy(pGbm->gbmSurface);
+failDisplay:
+    eglTerminate(pBackend->eglDpy);
+failDevice:
+    gbm_device_destroy(pGbm->gbmDevice);
+failFree:
+    free(pGbm);
+    return -1;
+}
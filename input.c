@@ -0,0 +1,379 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Reading evdev input devices (--input) for the event loop.
+ *
+ * The gears can be turned the way glxgears lets them be: the arrow keys
+ * turn the view about the x and y axes, and z (shift+z) about the z
+ * axis.  A mouse turns the view about the x and y axes too.  Escape or
+ * q stops the render loop.
+ *
+ * The devices are read directly, rather than through a terminal or a
+ * window system, since neither is there when driving the display with
+ * KMS; the user needs read access to /dev/input/event*.
+ *
+ * For --input-latency, the kernel's timestamp of each event that turns
+ * the view is kept; see latency.c.  StartVirtualInput() creates a
+ * uinput keyboard that presses a key at a given rate, so that the
+ * latency can be measured unattended.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "input.h"
+#include "utils.h"
+
+/* How far a key press turns the view, as in glxgears. */
+#define KEY_DEGREES 5.0f
+
+/* How far one count of mouse motion turns the view. */
+#define MOUSE_DEGREES 0.25f
+
+/* How many events to read at a time. */
+#define INPUT_EVENT_BATCH 16
+
+/* How long to wait for the virtual keyboard's device node to appear. */
+#define VIRTUAL_INPUT_TIMEOUT_MS 2000
+
+struct VirtualInput {
+    int uinputFd;
+    int rate;
+    char path[64];
+    pthread_t thread;
+    volatile int stop;
+};
+
+
+/*
+ * Open the evdev device at 'path' for ReadInputEvents().  Return -1
+ * on failure.
+ */
+int OpenInputDevice(const char *path)
+{
+    char name[64] = "unknown";
+    int clockId = CLOCK_MONOTONIC;
+    int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+
+    if (fd < 0) {
+        SetError("Unable to open input device %s: %s.\n", path,
+                 strerror(errno));
+        return -1;
+    }
+
+    if (ioctl(fd, EVIOCGNAME(sizeof(name)), name) < 0) {
+        close(fd);
+        SetError("%s is not an evdev input device.\n", path);
+        return -1;
+    }
+
+    /*
+     * Timestamp events on the clock DRM timestamps page flips on,
+     * rather than the wall clock.
+     */
+    ioctl(fd, EVIOCSCLOCKID, &clockId);
+
+    printf("Reading input from %s (%s)\n", path, name);
+
+    return fd;
+}
+
+
+/*
+ * Make this process the only reader of the evdev device 'fd', e.g., so
+ * that the virtual keyboard's presses do not also reach the console.
+ */
+void GrabInputDevice(int fd)
+{
+    if (ioctl(fd, EVIOCGRAB, 1) < 0) {
+        Warning("Unable to grab an input device: %s.\n", strerror(errno));
+    }
+}
+
+
+/*
+ * Apply a key event to *pState.  Return whether it turned the view.
+ */
+static int HandleKey(struct InputState *pState, int code, int value)
+{
+    /* Act on presses and auto-repeats; shift also needs releases. */
+
+    if ((code == KEY_LEFTSHIFT) || (code == KEY_RIGHTSHIFT)) {
+        pState->shift = (value != 0);
+        return 0;
+    }
+
+    if (value == 0) {
+        return 0;
+    }
+
+    switch (code) {
+    case KEY_UP:
+        pState->rotX += KEY_DEGREES;
+        break;
+    case KEY_DOWN:
+        pState->rotX -= KEY_DEGREES;
+        break;
+    case KEY_LEFT:
+        pState->rotY += KEY_DEGREES;
+        break;
+    case KEY_RIGHT:
+        pState->rotY -= KEY_DEGREES;
+        break;
+    case KEY_Z:
+        pState->rotZ += pState->shift ? -KEY_DEGREES : KEY_DEGREES;
+        break;
+    case KEY_ESC:
+    case KEY_Q:
+        pState->quit = 1;
+        return 0;
+    default:
+        return 0;
+    }
+
+    return 1;
+}
+
+
+/*
+ * Read every pending event from the evdev device 'fd' into *pState.
+ * Return 0 if the device is gone, e.g., unplugged, and should be
+ * closed; 1 otherwise.
+ */
+int ReadInputEvents(int fd, struct InputState *pState)
+{
+    struct input_event events[INPUT_EVENT_BATCH];
+
+    while (1) {
+        ssize_t size = read(fd, events, sizeof(events));
+        int count, i;
+
+        if (size < 0) {
+            return (errno == EAGAIN) || (errno == EINTR);
+        }
+
+        count = size / sizeof(events[0]);
+
+        for (i = 0; i < count; i++) {
+            const struct input_event *pEvent = &events[i];
+            int turned = 0;
+
+            if (pEvent->type == EV_KEY) {
+                turned = HandleKey(pState, pEvent->code, pEvent->value);
+            } else if (pEvent->type == EV_REL) {
+                if (pEvent->code == REL_X) {
+                    pState->rotY += pEvent->value * MOUSE_DEGREES;
+                    turned = 1;
+                } else if (pEvent->code == REL_Y) {
+                    pState->rotX += pEvent->value * MOUSE_DEGREES;
+                    turned = 1;
+                }
+            }
+
+            if (turned && (pState->numEventTimes < MAX_INPUT_TIMES)) {
+                pState->eventTimes[pState->numEventTimes++] =
+                    pEvent->input_event_sec +
+                    pEvent->input_event_usec / 1000000.0;
+            }
+        }
+
+        if (count < INPUT_EVENT_BATCH) {
+            return 1;
+        }
+    }
+}
+
+
+static void EmitEvent(int fd, int type, int code, int value)
+{
+    struct input_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.type = type;
+    event.code = code;
+    event.value = value;
+
+    if (write(fd, &event, sizeof(event)) != sizeof(event)) {
+        Warning("Unable to write to the virtual keyboard: %s.\n",
+                strerror(errno));
+    }
+}
+
+
+/*
+ * Press and release the right arrow key about 'rate' times a second.
+ * The intervals are random, from half to one and a half times the
+ * mean, so that the presses land at every phase of the refresh cycle,
+ * as a user's would.
+ */
+static void *VirtualInputThread(void *data)
+{
+    struct VirtualInput *pVirtual = data;
+    unsigned int seed = (unsigned int) time(NULL);
+
+    while (!pVirtual->stop) {
+        double interval = (0.5 + (double) rand_r(&seed) / RAND_MAX) /
+            pVirtual->rate;
+        struct timespec delay;
+
+        delay.tv_sec = (time_t) interval;
+        delay.tv_nsec = (long) ((interval - delay.tv_sec) * 1000000000.0);
+        nanosleep(&delay, NULL);
+
+        EmitEvent(pVirtual->uinputFd, EV_KEY, KEY_RIGHT, 1);
+        EmitEvent(pVirtual->uinputFd, EV_SYN, SYN_REPORT, 0);
+        EmitEvent(pVirtual->uinputFd, EV_KEY, KEY_RIGHT, 0);
+        EmitEvent(pVirtual->uinputFd, EV_SYN, SYN_REPORT, 0);
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Find the evdev node of the uinput device, waiting for it to appear.
+ * Return whether it did.
+ */
+static int FindVirtualInputPath(struct VirtualInput *pVirtual)
+{
+    char sysName[32], sysPath[96];
+    int waitedMs, n;
+
+    if (ioctl(pVirtual->uinputFd, UI_GET_SYSNAME(sizeof(sysName)),
+              sysName) < 0) {
+        return 0;
+    }
+
+    for (waitedMs = 0; waitedMs < VIRTUAL_INPUT_TIMEOUT_MS;
+         waitedMs += 10) {
+        for (n = 0; n < 1024; n++) {
+            snprintf(sysPath, sizeof(sysPath),
+                     "/sys/devices/virtual/input/%s/event%d", sysName, n);
+
+            if (access(sysPath, F_OK) == 0) {
+                break;
+            }
+        }
+
+        if (n < 1024) {
+            snprintf(pVirtual->path, sizeof(pVirtual->path),
+                     "/dev/input/event%d", n);
+
+            if (access(pVirtual->path, R_OK) == 0) {
+                return 1;
+            }
+        }
+
+        usleep(10000);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Create a virtual keyboard with uinput that presses a key 'rate'
+ * times a second, from a thread of its own, until
+ * StopVirtualInput().  Its evdev device is to be opened like any
+ * other, from GetVirtualInputPath().  This needs write access to
+ * /dev/uinput.  Return NULL on failure.
+ */
+struct VirtualInput *StartVirtualInput(int rate)
+{
+    struct VirtualInput *pVirtual = calloc(1, sizeof(*pVirtual));
+    struct uinput_setup setup;
+
+    if (pVirtual == NULL) {
+        SetError("Memory allocation failure.\n");
+        return NULL;
+    }
+
+    pVirtual->rate = rate;
+    pVirtual->uinputFd = open("/dev/uinput", O_WRONLY | O_CLOEXEC);
+
+    if (pVirtual->uinputFd < 0) {
+        SetError("Unable to open /dev/uinput: %s.\n", strerror(errno));
+        free(pVirtual);
+        return NULL;
+    }
+
+    memset(&setup, 0, sizeof(setup));
+    setup.id.bustype = BUS_VIRTUAL;
+    snprintf(setup.name, sizeof(setup.name), "eglkms virtual keyboard");
+
+    if ((ioctl(pVirtual->uinputFd, UI_SET_EVBIT, EV_KEY) < 0) ||
+        (ioctl(pVirtual->uinputFd, UI_SET_KEYBIT, KEY_RIGHT) < 0) ||
+        (ioctl(pVirtual->uinputFd, UI_DEV_SETUP, &setup) < 0) ||
+        (ioctl(pVirtual->uinputFd, UI_DEV_CREATE) < 0)) {
+        SetError("Unable to create a uinput device: %s.\n",
+                 strerror(errno));
+        goto fail;
+    }
+
+    if (!FindVirtualInputPath(pVirtual)) {
+        SetError("The virtual keyboard's evdev device did not appear.\n");
+        goto failDevice;
+    }
+
+    if (pthread_create(&pVirtual->thread, NULL,
+                       VirtualInputThread, pVirtual) != 0) {
+        SetError("Unable to start the virtual keyboard thread.\n");
+        goto failDevice;
+    }
+
+    return pVirtual;
+
+failDevice:
+    ioctl(pVirtual->uinputFd, UI_DEV_DESTROY);
+fail:
+    close(pVirtual->uinputFd);
+    free(pVirtual);
+    return NULL;
+}
+
+
+const char *GetVirtualInputPath(const struct VirtualInput *pVirtual)
+{
+    return pVirtual->path;
+}
+
+
+void StopVirtualInput(struct VirtualInput *pVirtual)
+{
+    pVirtual->stop = 1;
+    pthread_join(pVirtual->thread, NULL);
+
+    ioctl(pVirtual->uinputFd, UI_DEV_DESTROY);
+    close(pVirtual->uinputFd);
+
+    free(pVirtual);
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#if !defined(INPUT_H)
+#define INPUT_H
+
+/* How many input events per frame are timed for --input-latency. */
+#define MAX_INPUT_TIMES 64
+
+/*
+ * What input devices asked for since the render loop last took it; see
+ * ReadInputEvents().
+ */
+struct InputState {
+    /* How far to turn the view, in degrees about each axis. */
+    float rotX;
+    float rotY;
+    float rotZ;
+
+    /* Whether a key asked to stop. */
+    int quit;
+
+    /* Whether a shift key is held. */
+    int shift;
+
+    /*
+     * The kernel's timestamps (CLOCK_MONOTONIC, in seconds) of the
+     * events that turned the view, for --input-latency.
+     */
+    double eventTimes[MAX_INPUT_TIMES];
+    int numEventTimes;
+};
+
+struct VirtualInput;
+
+int OpenInputDevice(const char *path);
+void GrabInputDevice(int fd);
+int ReadInputEvents(int fd, struct InputState *pState);
+
+struct VirtualInput *StartVirtualInput(int rate);
+const char *GetVirtualInputPath(const struct VirtualInput *pVirtual);
+void StopVirtualInput(struct VirtualInput *pVirtual);
+
+#endif /* INPUT_H */
@@ -0,0 +1,284 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE /* for accept4(2) */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "ipc.h"
+#include "utils.h"
+
+
+static int FillSocketAddress(struct sockaddr_un *pAddr, const char *path)
+{
+    memset(pAddr, 0, sizeof(*pAddr));
+
+    pAddr->sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(pAddr->sun_path)) {
+        SetError("Socket path \'%s\' is too long.\n", path);
+        return -1;
+    }
+
+    strcpy(pAddr->sun_path, path);
+
+    return 0;
+}
+
+
+/*
+ * Create a listening Unix domain socket at 'path', replacing any stale
+ * socket left there by a previous instance.
+ */
+int ListenOnSocket(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (FillSocketAddress(&addr, path) != 0) {
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd < 0) {
+        SetError("Unable to create socket: %s.\n", strerror(errno));
+        return -1;
+    }
+
+    unlink(path);
+
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        SetError("Unable to bind socket \'%s\': %s.\n",
+                 path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    if (listen(fd, 1) != 0) {
+        SetError("Unable to listen on socket \'%s\': %s.\n",
+                 path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+int AcceptConnection(int listenFd)
+{
+    int fd;
+
+    do {
+        fd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+    } while ((fd < 0) && (errno == EINTR));
+
+    if (fd < 0) {
+        SetError("Unable to accept connection: %s.\n", strerror(errno));
+    }
+
+    return fd;
+}
+
+
+int ConnectToSocket(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (FillSocketAddress(&addr, path) != 0) {
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd < 0) {
+        SetError("Unable to create socket: %s.\n", strerror(errno));
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        SetError("Unable to connect to \'%s\': %s.\n",
+                 path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+/*
+ * Send 'size' bytes of 'data'.  If 'fd' is not negative, it is passed
+ * along with the data as SCM_RIGHTS ancillary data; the receiver gets
+ * its own file descriptor for the same open file.
+ */
+int SendWithFd(int sockFd, const void *data, size_t size, int fd)
+{
+    union {
+        struct cmsghdr header;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+
+    struct iovec iov = {
+        .iov_base = (void *) data,
+        .iov_len = size,
+    };
+
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+    };
+
+    ssize_t ret;
+
+    if (fd >= 0) {
+        struct cmsghdr *pCmsg;
+
+        memset(&control, 0, sizeof(control));
+
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+
+        pCmsg = CMSG_FIRSTHDR(&msg);
+        pCmsg->cmsg_level = SOL_SOCKET;
+        pCmsg->cmsg_type = SCM_RIGHTS;
+        pCmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(pCmsg), &fd, sizeof(int));
+    }
+
+    do {
+        ret = sendmsg(sockFd, &msg, MSG_NOSIGNAL);
+    } while ((ret < 0) && (errno == EINTR));
+
+    if (ret < 0) {
+        SetError("Unable to send message: %s.\n", strerror(errno));
+        return -1;
+    }
+
+    if ((size_t) ret != size) {
+        SetError("Short message sent (%zd of %zu bytes).\n", ret, size);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Receive exactly 'size' bytes into 'data', and in *pFd the file
+ * descriptor passed along with the data, or -1 if there was none.
+ */
+int ReceiveWithFd(int sockFd, void *data, size_t size, int *pFd)
+{
+    union {
+        struct cmsghdr header;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+
+    struct iovec iov = {
+        .iov_base = data,
+        .iov_len = size,
+    };
+
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+
+    struct cmsghdr *pCmsg;
+    ssize_t ret;
+    int fd = -1;
+
+    do {
+        ret = recvmsg(sockFd, &msg, MSG_CMSG_CLOEXEC);
+    } while ((ret < 0) && (errno == EINTR));
+
+    *pFd = -1;
+
+    if (ret < 0) {
+        SetError("Unable to receive message: %s.\n", strerror(errno));
+        return -1;
+    }
+
+    for (pCmsg = CMSG_FIRSTHDR(&msg); pCmsg != NULL;
+         pCmsg = CMSG_NXTHDR(&msg, pCmsg)) {
+        if ((pCmsg->cmsg_level == SOL_SOCKET) &&
+            (pCmsg->cmsg_type == SCM_RIGHTS)) {
+            memcpy(&fd, CMSG_DATA(pCmsg), sizeof(int));
+        }
+    }
+
+    if ((size_t) ret != size) {
+        SetError("Short message received (%zd of %zu bytes).\n", ret, size);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    *pFd = fd;
+
+    return 0;
+}
+
+
+/*
+ * Block until the peer closes its end of the socket (or exits).
+ */
+int WaitForHangup(int sockFd)
+{
+    struct pollfd pfd = {
+        .fd = sockFd,
+        .events = POLLIN,
+    };
+
+    while (1) {
+        char buf[64];
+        ssize_t ret;
+
+        if ((poll(&pfd, 1, -1) < 0) && (errno != EINTR)) {
+            SetError("poll(2) failed: %s.\n", strerror(errno));
+            return -1;
+        }
+
+        if (pfd.revents & (POLLHUP | POLLERR)) {
+            return 0;
+        }
+
+        if (pfd.revents & POLLIN) {
+            ret = read(sockFd, buf, sizeof(buf));
+            if ((ret == 0) || ((ret < 0) && (errno != EINTR))) {
+                return 0;
+            }
+        }
+    }
+}
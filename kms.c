@@ -20,14 +20,21 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#include <errno.h>
+#include <math.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <xf86drmMode.h>
 #include <xf86drm.h>
+#include <drm_fourcc.h>
 
 #include "kms.h"
 #include "utils.h"
@@ -47,6 +54,10 @@ struct PropertyIDs {
     struct {
         uint32_t mode_id;
         uint32_t active;
+        uint32_t out_fence_ptr;     /* optional */
+        uint32_t degamma_lut;       /* optional */
+        uint32_t ctm;               /* optional */
+        uint32_t gamma_lut;         /* optional */
     } crtc;
 
     struct {
@@ -60,6 +71,9 @@ struct PropertyIDs {
         uint32_t crtc_h;
         uint32_t fb_id;
         uint32_t crtc_id;
+        uint32_t in_fence_fd;       /* optional */
+        uint32_t fb_damage_clips;   /* optional */
+        uint32_t rotation;          /* optional */
     } plane;
 
     struct {
@@ -67,18 +81,102 @@ struct PropertyIDs {
     } connector;
 };
 
+#define MAX_SAVED_CONNECTORS 8
+
+/* The CRTC color properties, in the order the CRTC applies them. */
+enum ColorProperty {
+    COLOR_DEGAMMA_LUT,
+    COLOR_CTM,
+    COLOR_GAMMA_LUT,
+    NUM_COLOR_PROPERTIES,
+};
+
+static const char *const colorPropertyNames[NUM_COLOR_PROPERTIES] = {
+    "DEGAMMA_LUT", "CTM", "GAMMA_LUT",
+};
+
 struct PropertyIDAddresses {
     const char *name;
     uint32_t *ptr;
 };
 
+/*
+ * What an application needs to keep to make its own atomic commits to
+ * the CRTC and plane after picking them; see CreateKmsDisplay().
+ */
+struct KmsDisplay {
+    int drmFd;
+    struct Config config;
+    struct PropertyIDs propertyIDs;
+    uint32_t modeID;
+    int modesetDone;
+    struct PlaneFormats planeFormats;
+
+    /* The blank fb that SetKmsDisplayMode() displays, once created. */
+    uint32_t blankFb;
+
+    /*
+     * The plane "rotation" value (DRM_MODE_ROTATE_* and
+     * DRM_MODE_REFLECT_* bits) from SetKmsDisplayOrientation(), or 0 to
+     * leave the property alone; and the value it had at startup.
+     */
+    uint64_t rotation;
+    uint64_t savedRotation;
+
+    /*
+     * The color correction from SetKmsDisplayColor(), its blobs, and
+     * whether the next commit must send them; see AssignColorRequest().
+     * savedColorBlobs are the values the properties had at startup.
+     */
+    int colorSet;
+    int colorPending;
+    struct ColorCorrection color;
+    uint32_t colorBlobs[NUM_COLOR_PROPERTIES];
+    uint32_t savedColorBlobs[NUM_COLOR_PROPERTIES];
+
+    /*
+     * The CRTC's state before this process changed it, and the
+     * connectors it drove, for DestroyKmsDisplay() to restore.
+     */
+    drmModeCrtcPtr pSavedCrtc;
+    uint32_t savedConnectorIDs[MAX_SAVED_CONNECTORS];
+    int numSavedConnectors;
+};
+
+
+/*
+ * Connector type names, indexed by DRM_MODE_CONNECTOR_*, as the kernel
+ * names connectors (e.g., "DP-1" for the first DisplayPort connector).
+ */
+static const char *const connectorTypeNames[] = {
+    "Unknown", "VGA", "DVI-I", "DVI-D", "DVI-A", "Composite", "SVIDEO",
+    "LVDS", "Component", "DIN", "DP", "HDMI-A", "HDMI-B", "TV", "eDP",
+    "Virtual", "DSI", "DPI", "Writeback", "SPI", "USB",
+};
+
+
+/*
+ * Write the name of the connector with the given connector_type and
+ * connector_type_id to 'name'.
+ */
+void GetConnectorName(uint32_t connectorType, uint32_t connectorTypeID,
+                      char *name, size_t size)
+{
+    const char *typeName = (connectorType < ARRAY_LEN(connectorTypeNames)) ?
+        connectorTypeNames[connectorType] : "Unknown";
+
+    snprintf(name, size, "%s-%u", typeName, connectorTypeID);
+}
+
 
 /*
  * Pick the first connected connector we find with usable modes and
- * CRTC.
+ * CRTC; if 'connectorName' is not NULL, only consider the connector
+ * with that name.  Return 0, or -1 with the reason for GetError().
  */
-static void PickConnector(int drmFd,
+static int PickConnector(int drmFd,
                           drmModeResPtr pModeRes,
+                          const char *connectorName,
                           struct Config *pConfig)
 {
     int i, j;
@@ -87,10 +185,21 @@ static void PickConnector(int drmFd,
 
         drmModeConnectorPtr pConnector =
             drmModeGetConnector(drmFd, pModeRes->connectors[i]);
+        char name[32];
 
         if (pConnector == NULL) {
-            Fatal("Unable to query DRM-KMS information for "
-                  "connector index %d\n", i);
+            SetError("Unable to query DRM-KMS information for "
+                     "connector index %d\n", i);
+            return -1;
+        }
+
+        GetConnectorName(pConnector->connector_type,
+                         pConnector->connector_type_id, name, sizeof(name));
+
+        if ((connectorName != NULL) &&
+            (strcasecmp(connectorName, name) != 0)) {
+            drmModeFreeConnector(pConnector);
+            continue;
         }
 
         if ((pConnector->connection == DRM_MODE_CONNECTED) &&
@@ -101,8 +210,10 @@ static void PickConnector(int drmFd,
                 drmModeGetEncoder(drmFd, pConnector->encoders[0]);
 
             if (pEncoder == NULL) {
-                Fatal("Unable to query DRM-KMS information for"
-                      "encoder 0x%08x\n", pConnector->encoders[0]);
+                SetError("Unable to query DRM-KMS information for"
+                         "encoder 0x%08x\n", pConnector->encoders[0]);
+                drmModeFreeConnector(pConnector);
+                return -1;
             }
 
             pConfig->connectorID = pModeRes->connectors[i];
@@ -119,53 +230,72 @@ static void PickConnector(int drmFd,
                 break;
             }
 
+            drmModeFreeEncoder(pEncoder);
+
             if (pConfig->crtcID == 0) {
-                Fatal("Unable to select a suitable CRTC.\n");
+                SetError("Unable to select a suitable CRTC.\n");
+                drmModeFreeConnector(pConnector);
+                return -1;
             }
-
-            drmModeFreeEncoder(pEncoder);
         }
 
         drmModeFreeConnector(pConnector);
     }
 
     if (pConfig->connectorID == 0) {
-        Fatal("Could not find a suitable connector.\n");
+        if (connectorName != NULL) {
+            SetError("Connector %s is not connected, or has no modes.\n",
+                     connectorName);
+        } else {
+            SetError("Could not find a suitable connector.\n");
+        }
+        return -1;
     }
 
     if (pConfig->crtcID == 0) {
-        Fatal("Could not find a suitable CRTC.\n");
+        SetError("Could not find a suitable CRTC.\n");
+        return -1;
     }
+
+    return 0;
 }
 
 
 /*
- * Search for the specified property on the given object, and return
- * its value.
+ * Search for the specified property on the given object.  If found,
+ * return its value in 'pValue' and return 1; otherwise, return 0, or
+ * -1 with the reason for GetError() if the object cannot be queried.
  */
-static uint64_t GetPropertyValue(
+static int FindPropertyValue(
     int drmFd,
     uint32_t objectID,
     uint32_t objectType,
-    const char *propName)
+    const char *propName,
+    uint64_t *pValue)
 {
     uint32_t i;
     int found = 0;
-    uint64_t value = 0;
     drmModeObjectPropertiesPtr pModeObjectProperties =
         drmModeObjectGetProperties(drmFd, objectID, objectType);
 
+    if (pModeObjectProperties == NULL) {
+        SetError("Unable to query mode object properties.\n");
+        return -1;
+    }
+
     for (i = 0; i < pModeObjectProperties->count_props; i++) {
 
         drmModePropertyPtr pProperty =
             drmModeGetProperty(drmFd, pModeObjectProperties->props[i]);
 
         if (pProperty == NULL) {
-            Fatal("Unable to query property.\n");
+            SetError("Unable to query property.\n");
+            found = -1;
+            break;
         }
 
         if (strcmp(propName, pProperty->name) == 0) {
-            value = pModeObjectProperties->prop_values[i];
+            *pValue = pModeObjectProperties->prop_values[i];
             found = 1;
         }
 
@@ -178,24 +308,69 @@ static uint64_t GetPropertyValue(
 
     drmModeFreeObjectProperties(pModeObjectProperties);
 
-    if (!found) {
-        Fatal("Unable to find value for property \'%s\'.\n", propName);
+    return found;
+}
+
+
+/*
+ * Search for the specified property on the given object, and return
+ * its value in 'pValue'.  Return 0, or -1 with the reason for
+ * GetError().
+ */
+static int GetPropertyValue(
+    int drmFd,
+    uint32_t objectID,
+    uint32_t objectType,
+    const char *propName,
+    uint64_t *pValue)
+{
+    int found = FindPropertyValue(drmFd, objectID, objectType, propName,
+                                  pValue);
+
+    if (found == 0) {
+        SetError("Unable to find value for property \'%s\'.\n", propName);
     }
 
-    return value;
+    return (found > 0) ? 0 : -1;
 }
 
 
 /*
- * Pick a primary plane that can be used by the CRTC in the Config.
+ * Return whether 'id' is one of the 'count' IDs in 'pIDs'.
+ */
+static int IdIsListed(const uint32_t *pIDs, int count, uint32_t id)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (pIDs[i] == id) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Find a primary plane that can be used by the CRTC at 'crtcIndex',
+ * skipping the 'numExcluded' planes in 'pExcludedIDs', and return it in
+ * 'pPlaneID', or 0 if there is none.  Return 0, or -1 with the reason
+ * for GetError().
  */
-static void PickPlane(int drmFd, struct Config *pConfig)
+static int FindPrimaryPlane(int drmFd, int crtcIndex,
+                            const uint32_t *pExcludedIDs, int numExcluded,
+                            uint32_t *pPlaneID)
 {
     drmModePlaneResPtr pPlaneRes = drmModeGetPlaneResources(drmFd);
     uint32_t i;
+    int ret = 0;
+
+    *pPlaneID = 0;
 
     if (pPlaneRes == NULL) {
-        Fatal("Unable to query DRM-KMS plane resources\n");
+        SetError("Unable to query DRM-KMS plane resources\n");
+        return -1;
     }
 
     for (i = 0; i < pPlaneRes->count_planes; i++) {
@@ -204,73 +379,123 @@ static void PickPlane(int drmFd, struct Config *pConfig)
         uint64_t type;
 
         if (pPlane == NULL) {
-            Fatal("Unable to query DRM-KMS plane %d\n", i);
+            SetError("Unable to query DRM-KMS plane %d\n", i);
+            ret = -1;
+            break;
         }
 
         crtcs = pPlane->possible_crtcs;
 
         drmModeFreePlane(pPlane);
 
-        if ((crtcs & (1 << pConfig->crtcIndex)) == 0) {
+        if (((crtcs & (1 << crtcIndex)) == 0) ||
+            IdIsListed(pExcludedIDs, numExcluded, pPlaneRes->planes[i])) {
             continue;
         }
 
-        type = GetPropertyValue(drmFd, pPlaneRes->planes[i],
-                                DRM_MODE_OBJECT_PLANE, "type");
+        if (GetPropertyValue(drmFd, pPlaneRes->planes[i],
+                             DRM_MODE_OBJECT_PLANE, "type", &type) != 0) {
+            ret = -1;
+            break;
+        }
 
         if (type == DRM_PLANE_TYPE_PRIMARY) {
-            pConfig->planeID = pPlaneRes->planes[i];
+            *pPlaneID = pPlaneRes->planes[i];
             break;
         }
     }
 
     drmModeFreePlaneResources(pPlaneRes);
 
+    return ret;
+}
+
+
+/*
+ * Pick a primary plane that can be used by the CRTC in the Config.
+ * Return 0, or -1 with the reason for GetError().
+ */
+static int PickPlane(int drmFd, struct Config *pConfig)
+{
+    if (FindPrimaryPlane(drmFd, pConfig->crtcIndex, NULL, 0,
+                         &pConfig->planeID) != 0) {
+        return -1;
+    }
+
     if (pConfig->planeID == 0) {
-        Fatal("Could not find a suitable plane.\n");
+        SetError("Could not find a suitable plane.\n");
+        return -1;
     }
+
+    return 0;
 }
 
 
 /*
- * Pick a connector, CRTC, and plane to use for the modeset.
+ * Ask for every plane, including primary planes, and for the atomic
+ * API.  Return 0, or -1 with the reason for GetError().
  */
-static void PickConfig(int drmFd, struct Config *pConfig)
+static int SetClientCaps(int drmFd)
 {
-    drmModeResPtr pModeRes;
     int ret;
 
     ret = drmSetClientCap(drmFd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
 
     if (ret != 0) {
-        Fatal("DRM_CLIENT_CAP_UNIVERSAL_PLANES not available.\n");
+        SetError("DRM_CLIENT_CAP_UNIVERSAL_PLANES not available.\n");
+        return -1;
     }
 
     ret = drmSetClientCap(drmFd, DRM_CLIENT_CAP_ATOMIC, 1);
 
     if (ret != 0) {
-        Fatal("DRM_CLIENT_CAP_ATOMIC not available.\n");
+        SetError("DRM_CLIENT_CAP_ATOMIC not available.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Pick a connector, CRTC, and plane to use for the modeset.  Return 0,
+ * or -1 with the reason for GetError().
+ */
+static int PickConfig(int drmFd, const char *connectorName,
+                      struct Config *pConfig)
+{
+    drmModeResPtr pModeRes;
+    int ret;
+
+    if (SetClientCaps(drmFd) != 0) {
+        return -1;
     }
 
     pModeRes = drmModeGetResources(drmFd);
 
     if (pModeRes == NULL) {
-        Fatal("Unable to query DRM-KMS resources.\n");
+        SetError("Unable to query DRM-KMS resources.\n");
+        return -1;
     }
 
-    PickConnector(drmFd, pModeRes, pConfig);
-
-    PickPlane(drmFd, pConfig);
+    ret = PickConnector(drmFd, pModeRes, connectorName, pConfig);
 
     drmModeFreeResources(pModeRes);
 
+    if ((ret != 0) || (PickPlane(drmFd, pConfig) != 0)) {
+        return -1;
+    }
+
     pConfig->width = pConfig->mode.hdisplay;
     pConfig->height = pConfig->mode.vdisplay;
+
+    return 0;
 }
 
 
 /*
- * Create an ID for the mode in the specified config.
+ * Create an ID for the mode in the specified config.  Return 0, with
+ * the reason for GetError(), on failure.
  */
 static uint32_t CreateModeID(int drmFd, const struct Config *pConfig)
 {
@@ -279,7 +504,8 @@ static uint32_t CreateModeID(int drmFd, const struct Config *pConfig)
                                         &pConfig->mode, sizeof(pConfig->mode),
                                         &modeID);
     if (ret != 0) {
-        Fatal("Failed to create mode property.\n");
+        SetError("Failed to create mode property.\n");
+        return 0;
     }
 
     return modeID;
@@ -288,65 +514,144 @@ static uint32_t CreateModeID(int drmFd, const struct Config *pConfig)
 
 /*
  * Create a blank DRM fb object.
+ *
+ * Dumb buffers are always linear, so pick a 32 bpp format that the
+ * plane can scan out linearly.  The fb is only displayed until the first
+ * real frame arrives, so its layout does not matter for bandwidth.
+ *
+ * Return the fb, or 0, with the reason for GetError(), on failure.
  */
-static uint32_t CreateFb(int drmFd, const struct Config *pConfig)
+static uint32_t CreateFb(int drmFd, uint32_t planeID,
+                         uint16_t width, uint16_t height)
 {
+    static const uint32_t formats[] = {
+        DRM_FORMAT_XRGB8888,
+        DRM_FORMAT_ARGB8888,
+        DRM_FORMAT_XBGR8888,
+        DRM_FORMAT_ABGR8888,
+    };
+
     struct drm_mode_create_dumb createRequest = { 0 };
     struct drm_mode_map_dumb mapRequest = { 0 };
+    struct drm_mode_destroy_dumb destroyRequest = { 0 };
+    struct PlaneFormats planeFormats;
+    uint32_t handles[4] = { 0 }, pitches[4] = { 0 }, offsets[4] = { 0 };
+    uint64_t modifiers[4] = { 0 };
+    uint64_t cap = 0;
+    uint32_t format = 0, flags = 0;
     uint8_t *map;
     uint32_t fb = 0;
+    size_t i;
     int ret;
 
-    createRequest.width = pConfig->width;
-    createRequest.height = pConfig->height;
+    if (GetPlaneFormats(drmFd, planeID, &planeFormats) != 0) {
+        return 0;
+    }
+
+    for (i = 0; i < ARRAY_LEN(formats); i++) {
+        if (PlaneSupportsFormat(&planeFormats, formats[i],
+                                DRM_FORMAT_MOD_LINEAR)) {
+            format = formats[i];
+            break;
+        }
+    }
+
+    FreePlaneFormats(&planeFormats);
+
+    if (format == 0) {
+        SetError("Plane 0x%08x supports no linear 32 bpp format.\n",
+                 planeID);
+        return 0;
+    }
+
+    createRequest.width = width;
+    createRequest.height = height;
     createRequest.bpp = 32;
 
     ret = drmIoctl(drmFd, DRM_IOCTL_MODE_CREATE_DUMB, &createRequest);
     if (ret < 0) {
-        Fatal("Unable to create dumb buffer.\n");
+        SetError("Unable to create dumb buffer.\n");
+        return 0;
+    }
+
+    handles[0] = createRequest.handle;
+    pitches[0] = createRequest.pitch;
+    modifiers[0] = DRM_FORMAT_MOD_LINEAR;
+
+    /*
+     * Only state the modifier explicitly if the driver accepts
+     * modifiers; otherwise, dumb buffers are implicitly linear.
+     */
+
+    if ((drmGetCap(drmFd, DRM_CAP_ADDFB2_MODIFIERS, &cap) == 0) && cap) {
+        flags |= DRM_MODE_FB_MODIFIERS;
     }
 
-    ret = drmModeAddFB(drmFd, pConfig->width, pConfig->height, 24, 32,
-                       createRequest.pitch, createRequest.handle, &fb);
+    ret = drmModeAddFB2WithModifiers(drmFd, width, height,
+                                     format, handles, pitches, offsets,
+                                     (flags != 0) ? modifiers : NULL,
+                                     &fb, flags);
     if (ret) {
-        Fatal("Unable to add fb.\n");
+        SetError("Unable to add fb.\n");
+        goto done;
     }
 
     mapRequest.handle = createRequest.handle;
 
     ret = drmIoctl(drmFd, DRM_IOCTL_MODE_MAP_DUMB, &mapRequest);
     if (ret) {
-        Fatal("Unable to map dumb buffer.\n");
+        SetError("Unable to map dumb buffer.\n");
+        drmModeRmFB(drmFd, fb);
+        fb = 0;
+        goto done;
     }
 
     map = mmap(0, createRequest.size, PROT_READ | PROT_WRITE, MAP_SHARED,
                drmFd, mapRequest.offset);
     if (map == MAP_FAILED) {
-        Fatal("Failed to mmap(2) fb.\n");
+        SetError("Failed to mmap(2) fb.\n");
+        drmModeRmFB(drmFd, fb);
+        fb = 0;
+        goto done;
     }
 
     memset(map, 0, createRequest.size);
 
+    munmap(map, createRequest.size);
+
+done:
+    /*
+     * The fb holds its own reference to the buffer, which is freed when
+     * the fb is removed; the mapping and handle are no longer needed.
+     */
+
+    destroyRequest.handle = createRequest.handle;
+    drmIoctl(drmFd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroyRequest);
+
     return fb;
 }
 
 
 /*
  * Query the properties for the specified object, and populate the IDs
- * in the given table.
+ * in the given table.  If 'required', it is an error for any of the
+ * properties to be missing; otherwise, missing properties are left 0.
+ * Return 0, or -1 with the reason for GetError().
  */
-static void AssignPropertyIDsOneType(int drmFd,
+static int AssignPropertyIDsOneType(int drmFd,
                                      uint32_t objectID,
                                      uint32_t objectType,
                                      struct PropertyIDAddresses *table,
-                                     size_t tableLen)
+                                     size_t tableLen,
+                                     int required)
 {
     uint32_t i;
     drmModeObjectPropertiesPtr pModeObjectProperties =
         drmModeObjectGetProperties(drmFd, objectID, objectType);
 
     if (pModeObjectProperties == NULL) {
-        Fatal("Unable to query mode object properties.\n");
+        SetError("Unable to query mode object properties.\n");
+        return -1;
     }
 
     for (i = 0; i < pModeObjectProperties->count_props; i++) {
@@ -356,7 +661,9 @@ static void AssignPropertyIDsOneType(int drmFd,
             drmModeGetProperty(drmFd, pModeObjectProperties->props[i]);
 
         if (pProperty == NULL) {
-            Fatal("Unable to query property.\n");
+            SetError("Unable to query property.\n");
+            drmModeFreeObjectProperties(pModeObjectProperties);
+            return -1;
         }
 
         for (j = 0; j < tableLen; j++) {
@@ -371,27 +678,25 @@ static void AssignPropertyIDsOneType(int drmFd,
 
     drmModeFreeObjectProperties(pModeObjectProperties);
 
-    for (i = 0; i < tableLen; i++) {
+    for (i = 0; required && (i < tableLen); i++) {
         if (*(table[i].ptr) == 0) {
-            Fatal("Unable to find property ID for \'%s\'.\n", table[i].name);
+            SetError("Unable to find property ID for \'%s\'.\n",
+                     table[i].name);
+            return -1;
         }
     }
+
+    return 0;
 }
 
 
 /*
- * Find the property IDs for the CRTC, plane, and connector in the
- * Config.
+ * Find the property IDs for the given plane.  Return 0, or -1 with the
+ * reason for GetError().
  */
-static void AssignPropertyIDs(int drmFd,
-                              const struct Config *pConfig,
-                              struct PropertyIDs *pPropertyIDs)
+static int AssignPlanePropertyIDs(int drmFd, uint32_t planeID,
+                                   struct PropertyIDs *pPropertyIDs)
 {
-    struct PropertyIDAddresses crtcTable[] = {
-        { "MODE_ID", &pPropertyIDs->crtc.mode_id      },
-        { "ACTIVE",  &pPropertyIDs->crtc.active       },
-    };
-
     struct PropertyIDAddresses planeTable[] = {
         { "SRC_X",   &pPropertyIDs->plane.src_x       },
         { "SRC_Y",   &pPropertyIDs->plane.src_y       },
@@ -405,50 +710,218 @@ static void AssignPropertyIDs(int drmFd,
         { "CRTC_ID", &pPropertyIDs->plane.crtc_id     },
     };
 
+    struct PropertyIDAddresses optionalPlaneTable[] = {
+        { "IN_FENCE_FD",     &pPropertyIDs->plane.in_fence_fd     },
+        { "FB_DAMAGE_CLIPS", &pPropertyIDs->plane.fb_damage_clips },
+        { "rotation",        &pPropertyIDs->plane.rotation        },
+    };
+
+    if (AssignPropertyIDsOneType(drmFd, planeID,
+                                 DRM_MODE_OBJECT_PLANE,
+                                 planeTable, ARRAY_LEN(planeTable), 1) != 0) {
+        return -1;
+    }
+
+    /*
+     * IN_FENCE_FD lets an atomic commit wait, in the kernel, for
+     * rendering to the new fb to complete.  FB_DAMAGE_CLIPS lets the
+     * driver limit the update to the parts of the fb that changed.
+     */
+
+    return AssignPropertyIDsOneType(drmFd, planeID,
+                                    DRM_MODE_OBJECT_PLANE,
+                                    optionalPlaneTable,
+                                    ARRAY_LEN(optionalPlaneTable), 0);
+}
+
+
+/*
+ * Find the property IDs for the CRTC, plane, and connector in the
+ * Config.  Return 0, or -1 with the reason for GetError().
+ */
+static int AssignPropertyIDs(int drmFd,
+                              const struct Config *pConfig,
+                              struct PropertyIDs *pPropertyIDs)
+{
+    struct PropertyIDAddresses crtcTable[] = {
+        { "MODE_ID", &pPropertyIDs->crtc.mode_id      },
+        { "ACTIVE",  &pPropertyIDs->crtc.active       },
+    };
+
+    struct PropertyIDAddresses optionalCrtcTable[] = {
+        { "OUT_FENCE_PTR", &pPropertyIDs->crtc.out_fence_ptr },
+        { "DEGAMMA_LUT",   &pPropertyIDs->crtc.degamma_lut   },
+        { "CTM",           &pPropertyIDs->crtc.ctm           },
+        { "GAMMA_LUT",     &pPropertyIDs->crtc.gamma_lut     },
+    };
+
     struct PropertyIDAddresses connectorTable[] = {
         { "CRTC_ID", &pPropertyIDs->connector.crtc_id },
     };
 
-    AssignPropertyIDsOneType(drmFd, pConfig->crtcID,
-                             DRM_MODE_OBJECT_CRTC,
-                             crtcTable, ARRAY_LEN(crtcTable));
-    AssignPropertyIDsOneType(drmFd, pConfig->planeID,
-                             DRM_MODE_OBJECT_PLANE,
-                             planeTable, ARRAY_LEN(planeTable));
-    AssignPropertyIDsOneType(drmFd, pConfig->connectorID,
-                             DRM_MODE_OBJECT_CONNECTOR,
-                             connectorTable, ARRAY_LEN(connectorTable));
+    if ((AssignPropertyIDsOneType(drmFd, pConfig->crtcID,
+                                  DRM_MODE_OBJECT_CRTC,
+                                  crtcTable, ARRAY_LEN(crtcTable), 1) != 0) ||
+        (AssignPropertyIDsOneType(drmFd, pConfig->crtcID,
+                                  DRM_MODE_OBJECT_CRTC,
+                                  optionalCrtcTable,
+                                  ARRAY_LEN(optionalCrtcTable), 0) != 0) ||
+        (AssignPlanePropertyIDs(drmFd, pConfig->planeID,
+                                pPropertyIDs) != 0)) {
+        return -1;
+    }
+
+    return AssignPropertyIDsOneType(drmFd, pConfig->connectorID,
+                                    DRM_MODE_OBJECT_CONNECTOR,
+                                    connectorTable,
+                                    ARRAY_LEN(connectorTable), 1);
 }
 
 
 /*
- * A KMS atomic request is made by "adding properties" to a
- * drmModeAtomicReqPtr object.
+ * An atomic request with room for every property this file sets in one
+ * commit.  libdrm's drmModeAtomicReq grows with realloc() and its
+ * commit allocates the ioctl's arrays, which the render loop can't
+ * afford once it must not allocate (see memlock.c); this one lives on
+ * the stack.
  *
- * Find the property IDs that we need to describe the request, then
- * add the properties to the request.
+ * Adding to a request can fail without the caller checking each step:
+ * 'error' is then a negative errno value, which CommitAtomicRequest()
+ * returns instead of committing.
  */
-static void AssignAtomicRequest(int drmFd,
-                                drmModeAtomicReqPtr pAtomic,
-                                const struct Config *pConfig,
-                                uint32_t modeID, uint32_t fb)
+#define MAX_ATOMIC_PROPERTIES 32
+
+struct AtomicRequest {
+    int error;
+    int count;
+    uint32_t objectIDs[MAX_ATOMIC_PROPERTIES];
+    uint32_t propertyIDs[MAX_ATOMIC_PROPERTIES];
+    uint64_t values[MAX_ATOMIC_PROPERTIES];
+};
+
+static void AddAtomicProperty(struct AtomicRequest *pAtomic,
+                              uint32_t objectID, uint32_t propertyID,
+                              uint64_t value)
 {
-    struct PropertyIDs propertyIDs = { 0 };
+    if (pAtomic->count >= MAX_ATOMIC_PROPERTIES) {
+        SetError("Too many properties in an atomic request.\n");
+        pAtomic->error = -ENOSPC;
+        return;
+    }
 
-    AssignPropertyIDs(drmFd, pConfig, &propertyIDs);
+    pAtomic->objectIDs[pAtomic->count] = objectID;
+    pAtomic->propertyIDs[pAtomic->count] = propertyID;
+    pAtomic->values[pAtomic->count] = value;
+    pAtomic->count++;
+}
 
 
-    /* Specify the mode to use on the CRTC, and make the CRTC active. */
+/*
+ * Commit the atomic request with DRM_IOCTL_MODE_ATOMIC, which takes the
+ * properties grouped by object.  'flags' and 'userData' are as for
+ * drmModeAtomicCommit().
+ *
+ * Return 0 on success, or a negative errno value.
+ */
+static int CommitAtomicRequest(int drmFd, const struct AtomicRequest *pAtomic,
+                               uint32_t flags, void *userData)
+{
+    uint32_t objectIDs[MAX_ATOMIC_PROPERTIES];
+    uint32_t propertyCounts[MAX_ATOMIC_PROPERTIES];
+    uint32_t propertyIDs[MAX_ATOMIC_PROPERTIES];
+    uint64_t values[MAX_ATOMIC_PROPERTIES];
+    int grouped[MAX_ATOMIC_PROPERTIES] = { 0 };
+    struct drm_mode_atomic atomic;
+    int numObjects = 0, numProperties = 0, i, j;
+
+    if (pAtomic->error != 0) {
+        return pAtomic->error;
+    }
 
-    drmModeAtomicAddProperty(pAtomic, pConfig->crtcID,
-                             propertyIDs.crtc.mode_id, modeID);
-    drmModeAtomicAddProperty(pAtomic, pConfig->crtcID,
-                             propertyIDs.crtc.active, 1);
+    for (i = 0; i < pAtomic->count; i++) {
+        if (grouped[i]) {
+            continue;
+        }
 
-    /* Tell the connector to receive pixels from the CRTC. */
+        objectIDs[numObjects] = pAtomic->objectIDs[i];
+        propertyCounts[numObjects] = 0;
+
+        for (j = i; j < pAtomic->count; j++) {
+            if (pAtomic->objectIDs[j] == objectIDs[numObjects]) {
+                propertyIDs[numProperties] = pAtomic->propertyIDs[j];
+                values[numProperties] = pAtomic->values[j];
+                numProperties++;
+                propertyCounts[numObjects]++;
+                grouped[j] = 1;
+            }
+        }
+
+        numObjects++;
+    }
+
+    memset(&atomic, 0, sizeof(atomic));
+
+    atomic.flags = flags;
+    atomic.count_objs = numObjects;
+    atomic.objs_ptr = (uint64_t) (uintptr_t) objectIDs;
+    atomic.count_props_ptr = (uint64_t) (uintptr_t) propertyCounts;
+    atomic.props_ptr = (uint64_t) (uintptr_t) propertyIDs;
+    atomic.prop_values_ptr = (uint64_t) (uintptr_t) values;
+    atomic.user_data = (uint64_t) (uintptr_t) userData;
+
+    if (drmIoctl(drmFd, DRM_IOCTL_MODE_ATOMIC, &atomic) != 0) {
+        return -errno;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Swap *pWidth and *pHeight if the plane "rotation" value 'rotation'
+ * turns the fb on its side: the fb for a 'width' x 'height' region of
+ * the CRTC is then 'height' x 'width'.
+ */
+static void RotatedSize(uint64_t rotation, uint16_t *pWidth,
+                        uint16_t *pHeight)
+{
+    if (rotation & (DRM_MODE_ROTATE_90 | DRM_MODE_ROTATE_270)) {
+        uint16_t width = *pWidth;
+
+        *pWidth = *pHeight;
+        *pHeight = width;
+    }
+}
+
+
+/*
+ * Add the properties to the atomic request that display 'fb' on the
+ * plane, scaled to cover the top left 'width' x 'height' of the CRTC.
+ *
+ * If 'rotation' is not 0, it is the plane "rotation" value to set.  A
+ * rotation of 90 or 270 degrees turns a 'height' x 'width' fb on its
+ * side to cover the 'width' x 'height' region; see RotatedSize().
+ *
+ * If 'inFenceFd' is not negative, it is a sync file that signals when
+ * rendering to 'fb' is complete.  The kernel waits for it before
+ * scanning out 'fb', so the commit can be queued without the CPU
+ * waiting for the GPU.  Without IN_FENCE_FD support, the caller must
+ * wait for the fence itself.
+ *
+ * If 'damageBlob' is not 0, it is a blob from CreateDamageClipsBlob()
+ * describing which parts of 'fb' changed since the plane's previous fb.
+ * Drivers without FB_DAMAGE_CLIPS update the whole plane.
+ */
+static void AssignPlaneRequest(struct AtomicRequest *pAtomic,
+                               const struct PropertyIDs *pPropertyIDs,
+                               uint32_t planeID, uint32_t crtcID,
+                               uint32_t fb, uint16_t width, uint16_t height,
+                               uint64_t rotation, int inFenceFd,
+                               uint32_t damageBlob)
+{
+    uint16_t srcWidth = width, srcHeight = height;
 
-    drmModeAtomicAddProperty(pAtomic, pConfig->connectorID,
-                             propertyIDs.connector.crtc_id, pConfig->crtcID);
+    RotatedSize(rotation, &srcWidth, &srcHeight);
 
     /*
      * Specify the region of source surface to display (i.e., the
@@ -456,28 +929,28 @@ static void AssignAtomicRequest(int drmFd,
      * up by 16.
      */
 
-    drmModeAtomicAddProperty(pAtomic, pConfig->planeID,
-                             propertyIDs.plane.src_x, 0);
-    drmModeAtomicAddProperty(pAtomic, pConfig->planeID,
-                             propertyIDs.plane.src_y, 0);
-    drmModeAtomicAddProperty(pAtomic, pConfig->planeID,
-                             propertyIDs.plane.src_w, pConfig->width << 16);
-    drmModeAtomicAddProperty(pAtomic, pConfig->planeID,
-                             propertyIDs.plane.src_h, pConfig->height << 16);
+    AddAtomicProperty(pAtomic, planeID,
+                      pPropertyIDs->plane.src_x, 0);
+    AddAtomicProperty(pAtomic, planeID,
+                      pPropertyIDs->plane.src_y, 0);
+    AddAtomicProperty(pAtomic, planeID,
+                      pPropertyIDs->plane.src_w, srcWidth << 16);
+    AddAtomicProperty(pAtomic, planeID,
+                      pPropertyIDs->plane.src_h, srcHeight << 16);
 
     /*
      * Specify the region within the mode where the image should be
      * displayed (i.e., the "ViewPortOut").
      */
 
-    drmModeAtomicAddProperty(pAtomic, pConfig->planeID,
-                             propertyIDs.plane.crtc_x, 0);
-    drmModeAtomicAddProperty(pAtomic, pConfig->planeID,
-                             propertyIDs.plane.crtc_y, 0);
-    drmModeAtomicAddProperty(pAtomic, pConfig->planeID,
-                             propertyIDs.plane.crtc_w, pConfig->width);
-    drmModeAtomicAddProperty(pAtomic, pConfig->planeID,
-                             propertyIDs.plane.crtc_h, pConfig->height);
+    AddAtomicProperty(pAtomic, planeID,
+                      pPropertyIDs->plane.crtc_x, 0);
+    AddAtomicProperty(pAtomic, planeID,
+                      pPropertyIDs->plane.crtc_y, 0);
+    AddAtomicProperty(pAtomic, planeID,
+                      pPropertyIDs->plane.crtc_w, width);
+    AddAtomicProperty(pAtomic, planeID,
+                      pPropertyIDs->plane.crtc_h, height);
 
     /*
      * Specify the surface to display in the plane, and connect the
@@ -489,46 +962,1730 @@ static void AssignAtomicRequest(int drmFd,
      * EGLStream.
      */
 
-    drmModeAtomicAddProperty(pAtomic, pConfig->planeID,
-                             propertyIDs.plane.fb_id, fb);
-    drmModeAtomicAddProperty(pAtomic, pConfig->planeID,
-                             propertyIDs.plane.crtc_id, pConfig->crtcID);
+    AddAtomicProperty(pAtomic, planeID,
+                      pPropertyIDs->plane.fb_id, fb);
+    AddAtomicProperty(pAtomic, planeID,
+                      pPropertyIDs->plane.crtc_id, crtcID);
+
+    if ((rotation != 0) && (pPropertyIDs->plane.rotation != 0)) {
+        AddAtomicProperty(pAtomic, planeID,
+                          pPropertyIDs->plane.rotation, rotation);
+    }
+
+    if (inFenceFd >= 0) {
+        if (pPropertyIDs->plane.in_fence_fd == 0) {
+            if (WaitForFence(inFenceFd) != 0) {
+                pAtomic->error = -EIO;
+            }
+        } else {
+            AddAtomicProperty(pAtomic, planeID,
+                              pPropertyIDs->plane.in_fence_fd,
+                              inFenceFd);
+        }
+    }
+
+    if ((damageBlob != 0) && (pPropertyIDs->plane.fb_damage_clips != 0)) {
+        AddAtomicProperty(pAtomic, planeID,
+                          pPropertyIDs->plane.fb_damage_clips,
+                          damageBlob);
+    }
+}
+
+
+/*
+ * Add the properties to the atomic request that set the Config's mode
+ * on its CRTC, and route the CRTC to its connector.
+ */
+static void AssignModesetRequest(struct AtomicRequest *pAtomic,
+                                 const struct Config *pConfig,
+                                 const struct PropertyIDs *pPropertyIDs,
+                                 uint32_t modeID)
+{
+    /* Specify the mode to use on the CRTC, and make the CRTC active. */
+
+    AddAtomicProperty(pAtomic, pConfig->crtcID,
+                      pPropertyIDs->crtc.mode_id, modeID);
+    AddAtomicProperty(pAtomic, pConfig->crtcID,
+                      pPropertyIDs->crtc.active, 1);
+
+    /* Tell the connector to receive pixels from the CRTC. */
+
+    AddAtomicProperty(pAtomic, pConfig->connectorID,
+                      pPropertyIDs->connector.crtc_id, pConfig->crtcID);
+}
+
+
+/*
+ * Return the ID of a CRTC color property, or 0 if the CRTC lacks it.
+ */
+static uint32_t ColorPropertyID(const struct PropertyIDs *pPropertyIDs,
+                                enum ColorProperty property)
+{
+    switch (property) {
+    case COLOR_DEGAMMA_LUT:
+        return pPropertyIDs->crtc.degamma_lut;
+    case COLOR_CTM:
+        return pPropertyIDs->crtc.ctm;
+    case COLOR_GAMMA_LUT:
+        return pPropertyIDs->crtc.gamma_lut;
+    default:
+        return 0;
+    }
+}
+
+
+/*
+ * Add the CRTC color properties that the CRTC has to the atomic
+ * request, set to 'pBlobs' (0 for a bypassed stage).
+ *
+ * The CRTC keeps these until they are changed, so color correction
+ * costs nothing per frame: they are only sent with a modeset, or with
+ * the first commit after SetKmsDisplayColor() changes them.
+ */
+static void AssignColorRequest(struct AtomicRequest *pAtomic,
+                               const struct KmsDisplay *pKms,
+                               const uint32_t *pBlobs)
+{
+    int i;
+
+    for (i = 0; i < NUM_COLOR_PROPERTIES; i++) {
+        uint32_t propertyID = ColorPropertyID(&pKms->propertyIDs, i);
+
+        if (propertyID != 0) {
+            AddAtomicProperty(pAtomic, pKms->config.crtcID,
+                              propertyID, pBlobs[i]);
+        }
+    }
 }
 
 
 /*
- * Use the atomic DRM KMS API to set a mode on a CRTC.
+ * A KMS atomic request is made by "adding properties" to a
+ * struct AtomicRequest.
  *
- * On success, return the non-zero ID of a DRM plane to which to
- * present, and its dimensions.  On failure, exit with a fatal error
- * message.
+ * Add the properties for a modeset that displays 'fb' to the request,
+ * with the plane "rotation" value 'rotation' (0 to leave it alone).
+ * Return whether an out fence was requested.
  */
-void SetMode(int drmFd, uint32_t *pPlaneID, int *pWidth, int *pHeight)
+static int AssignAtomicRequest(struct AtomicRequest *pAtomic,
+                               const struct Config *pConfig,
+                               const struct PropertyIDs *pPropertyIDs,
+                               uint32_t modeID, uint32_t fb,
+                               uint64_t rotation, int *pOutFenceFd)
 {
-    struct Config config = { 0 };
-    drmModeAtomicReqPtr pAtomic;
-    uint32_t modeID, fb;
-    int ret;
-    const uint32_t flags = DRM_MODE_ATOMIC_ALLOW_MODESET;
+    AssignModesetRequest(pAtomic, pConfig, pPropertyIDs, modeID);
+
+    AssignPlaneRequest(pAtomic, pPropertyIDs, pConfig->planeID,
+                       pConfig->crtcID, fb, pConfig->width, pConfig->height,
+                       rotation, -1 /* inFenceFd */, 0 /* damageBlob */);
+
+    /*
+     * If the CRTC supports OUT_FENCE_PTR, ask the kernel for a sync
+     * file that signals when the commit has taken effect.  That lets the
+     * commit be nonblocking: the caller continues with other setup, and
+     * waits for the fence only when it needs the new state on screen.
+     */
+
+    *pOutFenceFd = -1;
+
+    if (pPropertyIDs->crtc.out_fence_ptr != 0) {
+        AddAtomicProperty(pAtomic, pConfig->crtcID,
+                          pPropertyIDs->crtc.out_fence_ptr,
+                          (uint64_t) (uintptr_t) pOutFenceFd);
+        return 1;
+    }
+
+    return 0;
+}
+
 
-    PickConfig(drmFd, &config);
+/*
+ * Create the blank fb for SetKmsDisplayMode(), if it does not exist:
+ * the size of the surface that GetKmsDisplayInfo() reports.  Return 0,
+ * or -1 with the reason for GetError().
+ */
+static int CreateBlankFb(struct KmsDisplay *pKms)
+{
+    uint16_t width = pKms->config.width, height = pKms->config.height;
 
-    modeID = CreateModeID(drmFd, &config);
-    fb = CreateFb(drmFd, &config);
+    if (pKms->blankFb != 0) {
+        return 0;
+    }
 
-    pAtomic = drmModeAtomicAlloc();
+    RotatedSize(pKms->rotation, &width, &height);
 
-    AssignAtomicRequest(drmFd, pAtomic, &config, modeID, fb);
+    pKms->blankFb = CreateFb(pKms->drmFd, pKms->config.planeID,
+                             width, height);
 
-    ret = drmModeAtomicCommit(drmFd, pAtomic, flags, NULL /* user_data */);
+    return (pKms->blankFb != 0) ? 0 : -1;
+}
 
-    drmModeAtomicFree(pAtomic);
 
-    if (ret != 0) {
-        Fatal("Failed to set mode.\n");
+/*
+ * Return whether the driver would accept SetKmsDisplayMode() now, by
+ * making the same commit with DRM_MODE_ATOMIC_TEST_ONLY.  The blank fb
+ * is kept for the real modeset.
+ */
+static int TestKmsDisplayMode(struct KmsDisplay *pKms)
+{
+    struct AtomicRequest atomic = { 0 };
+    int outFenceFd = -1, ret;
+
+    if (CreateBlankFb(pKms) != 0) {
+        return 0;
+    }
+
+    AssignAtomicRequest(&atomic, &pKms->config, &pKms->propertyIDs,
+                        pKms->modeID, pKms->blankFb, pKms->rotation,
+                        &outFenceFd);
+
+    ret = CommitAtomicRequest(pKms->drmFd, &atomic,
+                              DRM_MODE_ATOMIC_TEST_ONLY |
+                              DRM_MODE_ATOMIC_ALLOW_MODESET,
+                              NULL /* user_data */);
+
+    if (outFenceFd >= 0) {
+        close(outFenceFd);
+    }
+
+    return ret == 0;
+}
+
+
+/*
+ * Use the atomic DRM KMS API to set the KmsDisplay's mode on its CRTC,
+ * displaying a blank fb on its plane until the first frame arrives.
+ *
+ * If the driver can provide an out fence for the modeset, the modeset
+ * is committed without blocking, and *pOutFenceFd is a sync file that
+ * signals once it is complete; the caller must wait for it (see
+ * WaitForFence()) before presenting to the plane, and close it.
+ * Otherwise, the modeset is complete on return, and *pOutFenceFd is -1.
+ *
+ * Return 0, or -1 with the reason for GetError().
+ */
+int SetKmsDisplayMode(struct KmsDisplay *pKms, int *pOutFenceFd)
+{
+    const struct Config *pConfig = &pKms->config;
+    struct AtomicRequest atomic = { 0 };
+    int ret;
+    uint32_t flags = DRM_MODE_ATOMIC_ALLOW_MODESET;
+
+    *pOutFenceFd = -1;
+
+    if (CreateBlankFb(pKms) != 0) {
+        return -1;
+    }
+
+    if (AssignAtomicRequest(&atomic, pConfig, &pKms->propertyIDs,
+                            pKms->modeID, pKms->blankFb, pKms->rotation,
+                            pOutFenceFd)) {
+        flags |= DRM_MODE_ATOMIC_NONBLOCK;
+    }
+
+    if (pKms->colorSet) {
+        AssignColorRequest(&atomic, pKms, pKms->colorBlobs);
+    }
+
+    ret = CommitAtomicRequest(pKms->drmFd, &atomic, flags,
+                              NULL /* user_data */);
+
+    if (ret != 0) {
+        SetError("Failed to set mode: %s.\n", strerror(-ret));
+        return -1;
+    }
+
+    pKms->modesetDone = 1;
+    pKms->colorPending = 0;
+
+    return 0;
+}
+
+
+/*
+ * Return the CRTC that the given plane is currently displaying on, and
+ * the index of that CRTC in the DRM KMS resources; or 0, with the
+ * reason for GetError(), if there is none.
+ */
+static uint32_t GetPlaneCrtc(int drmFd, uint32_t planeID, int *pCrtcIndex)
+{
+    drmModePlanePtr pPlane = drmModeGetPlane(drmFd, planeID);
+    drmModeResPtr pModeRes;
+    uint32_t crtcID;
+    int i;
+
+    if (pPlane == NULL) {
+        SetError("Unable to query DRM-KMS plane 0x%08x\n", planeID);
+        return 0;
+    }
+
+    crtcID = pPlane->crtc_id;
+
+    drmModeFreePlane(pPlane);
+
+    pModeRes = drmModeGetResources(drmFd);
+
+    if (pModeRes == NULL) {
+        SetError("Unable to query DRM-KMS resources.\n");
+        return 0;
+    }
+
+    *pCrtcIndex = -1;
+
+    for (i = 0; i < pModeRes->count_crtcs; i++) {
+        if (pModeRes->crtcs[i] == crtcID) {
+            *pCrtcIndex = i;
+            break;
+        }
+    }
+
+    drmModeFreeResources(pModeRes);
+
+    if ((crtcID == 0) || (*pCrtcIndex < 0)) {
+        SetError("Plane 0x%08x is not displaying on a CRTC.\n", planeID);
+        return 0;
+    }
+
+    return crtcID;
+}
+
+
+/*
+ * Find up to 'maxPlanes' overlay planes that can be used with the CRTC
+ * that 'primaryPlaneID' is displaying on.  Return the number found, or
+ * -1 with the reason for GetError().
+ */
+int GetOverlayPlanes(int drmFd, uint32_t primaryPlaneID,
+                     uint32_t *pPlaneIDs, int maxPlanes)
+{
+    drmModePlaneResPtr pPlaneRes;
+    uint32_t i;
+    int crtcIndex, count = 0;
+
+    if (GetPlaneCrtc(drmFd, primaryPlaneID, &crtcIndex) == 0) {
+        return -1;
+    }
+
+    pPlaneRes = drmModeGetPlaneResources(drmFd);
+
+    if (pPlaneRes == NULL) {
+        SetError("Unable to query DRM-KMS plane resources\n");
+        return -1;
+    }
+
+    for (i = 0; (i < pPlaneRes->count_planes) && (count < maxPlanes); i++) {
+        drmModePlanePtr pPlane = drmModeGetPlane(drmFd, pPlaneRes->planes[i]);
+        uint32_t crtcs;
+        uint64_t type;
+
+        if (pPlane == NULL) {
+            SetError("Unable to query DRM-KMS plane %d\n", i);
+            count = -1;
+            break;
+        }
+
+        crtcs = pPlane->possible_crtcs;
+
+        drmModeFreePlane(pPlane);
+
+        if ((crtcs & (1 << crtcIndex)) == 0) {
+            continue;
+        }
+
+        if (GetPropertyValue(drmFd, pPlaneRes->planes[i],
+                             DRM_MODE_OBJECT_PLANE, "type", &type) != 0) {
+            count = -1;
+            break;
+        }
+
+        if (type == DRM_PLANE_TYPE_OVERLAY) {
+            pPlaneIDs[count++] = pPlaneRes->planes[i];
+        }
+    }
+
+    drmModeFreePlaneResources(pPlaneRes);
+
+    return count;
+}
+
+
+/*
+ * Connect an overlay plane to the CRTC that 'primaryPlaneID' is
+ * displaying on, covering the whole mode.  As with the primary plane in
+ * SetMode(), the plane needs an fb before an EGLOutputLayer can
+ * consume to it, so a blank one is used until the first frame arrives.
+ * The blank fb is returned in 'pBlankFb', for DisableOverlayPlane() to
+ * remove.  Return 0, or -1 with the reason for GetError().
+ */
+int EnableOverlayPlane(int drmFd, uint32_t primaryPlaneID,
+                       uint32_t overlayPlaneID, uint32_t *pBlankFb)
+{
+    struct Config config = { 0 };
+    struct PropertyIDs propertyIDs = { 0 };
+    struct AtomicRequest atomic = { 0 };
+    drmModeCrtcPtr pCrtc;
+    uint32_t fb;
+    int ret;
+
+    config.crtcID = GetPlaneCrtc(drmFd, primaryPlaneID, &config.crtcIndex);
+    config.planeID = overlayPlaneID;
+
+    if (config.crtcID == 0) {
+        return -1;
+    }
+
+    pCrtc = drmModeGetCrtc(drmFd, config.crtcID);
+
+    if (pCrtc == NULL) {
+        SetError("Unable to query DRM-KMS CRTC 0x%08x\n", config.crtcID);
+        return -1;
+    }
+
+    config.width = pCrtc->mode.hdisplay;
+    config.height = pCrtc->mode.vdisplay;
+
+    drmModeFreeCrtc(pCrtc);
+
+    if (AssignPlanePropertyIDs(drmFd, overlayPlaneID, &propertyIDs) != 0) {
+        return -1;
+    }
+
+    fb = CreateFb(drmFd, overlayPlaneID, config.width, config.height);
+
+    if (fb == 0) {
+        return -1;
+    }
+
+    AssignPlaneRequest(&atomic, &propertyIDs, overlayPlaneID,
+                       config.crtcID, fb, config.width, config.height,
+                       0 /* rotation */, -1 /* inFenceFd */,
+                       0 /* damageBlob */);
+
+    ret = CommitAtomicRequest(drmFd, &atomic, 0, NULL /* user_data */);
+
+    if (ret != 0) {
+        SetError("Failed to enable overlay plane 0x%08x.\n",
+                 overlayPlaneID);
+        drmModeRmFB(drmFd, fb);
+        return -1;
+    }
+
+    *pBlankFb = fb;
+
+    return 0;
+}
+
+
+/*
+ * Disconnect an overlay plane from its CRTC, and remove the blank fb
+ * that EnableOverlayPlane() created for it.  The fb is removed even if
+ * the commit fails; the kernel then disables the plane itself.  Return
+ * 0, or -1 with the reason for GetError().
+ */
+int DisableOverlayPlane(int drmFd, uint32_t overlayPlaneID,
+                        uint32_t blankFb)
+{
+    struct PropertyIDs propertyIDs = { 0 };
+    struct AtomicRequest atomic = { 0 };
+    int ret;
+
+    if (AssignPlanePropertyIDs(drmFd, overlayPlaneID, &propertyIDs) != 0) {
+        drmModeRmFB(drmFd, blankFb);
+        return -1;
+    }
+
+    AddAtomicProperty(&atomic, overlayPlaneID,
+                      propertyIDs.plane.fb_id, 0);
+    AddAtomicProperty(&atomic, overlayPlaneID,
+                      propertyIDs.plane.crtc_id, 0);
+
+    ret = CommitAtomicRequest(drmFd, &atomic, 0, NULL /* user_data */);
+
+    drmModeRmFB(drmFd, blankFb);
+
+    if (ret != 0) {
+        SetError("Failed to disable overlay plane 0x%08x.\n",
+                 overlayPlaneID);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Find up to 'maxOutputs' connected connectors that, each with a CRTC
+ * and primary plane, could be driven independently of the connectors,
+ * CRTCs, and planes in 'pUsedIDs'.  No two of the outputs returned
+ * share a CRTC or plane.  Return the number found, or -1 with the
+ * reason for GetError().
+ */
+int GetFreeOutputs(int drmFd, const uint32_t *pUsedIDs, int numUsedIDs,
+                   struct KmsOutput *pOutputs, int maxOutputs)
+{
+    drmModeResPtr pModeRes = drmModeGetResources(drmFd);
+    uint32_t *pExcludedIDs;
+    int numExcluded = numUsedIDs;
+    int count = 0, i, j, k;
+
+    if (pModeRes == NULL) {
+        SetError("Unable to query DRM-KMS resources.\n");
+        return -1;
+    }
+
+    /* The used IDs, followed by the CRTCs and planes picked so far. */
+    pExcludedIDs = malloc(sizeof(uint32_t) * (numUsedIDs + 2 * maxOutputs));
+
+    if (pExcludedIDs == NULL) {
+        SetError("Memory allocation failure.\n");
+        drmModeFreeResources(pModeRes);
+        return -1;
+    }
+
+    if (numUsedIDs > 0) {
+        memcpy(pExcludedIDs, pUsedIDs, sizeof(uint32_t) * numUsedIDs);
+    }
+
+    for (i = 0; (i < pModeRes->count_connectors) && (count < maxOutputs);
+         i++) {
+
+        struct KmsOutput *pOutput = &pOutputs[count];
+        drmModeConnectorPtr pConnector;
+        int failed = 0;
+
+        if (IdIsListed(pUsedIDs, numUsedIDs, pModeRes->connectors[i])) {
+            continue;
+        }
+
+        pConnector = drmModeGetConnector(drmFd, pModeRes->connectors[i]);
+
+        if (pConnector == NULL) {
+            SetError("Unable to query DRM-KMS information for "
+                     "connector index %d\n", i);
+            count = -1;
+            break;
+        }
+
+        if ((pConnector->connection != DRM_MODE_CONNECTED) ||
+            (pConnector->count_modes == 0)) {
+            drmModeFreeConnector(pConnector);
+            continue;
+        }
+
+        memset(pOutput, 0, sizeof(*pOutput));
+
+        for (j = 0; (j < pConnector->count_encoders) &&
+                    (pOutput->planeID == 0) && !failed; j++) {
+
+            drmModeEncoderPtr pEncoder =
+                drmModeGetEncoder(drmFd, pConnector->encoders[j]);
+
+            if (pEncoder == NULL) {
+                continue;
+            }
+
+            for (k = 0; k < pModeRes->count_crtcs; k++) {
+
+                if (((pEncoder->possible_crtcs & (1 << k)) == 0) ||
+                    IdIsListed(pExcludedIDs, numExcluded,
+                               pModeRes->crtcs[k])) {
+                    continue;
+                }
+
+                if (FindPrimaryPlane(drmFd, k, pExcludedIDs, numExcluded,
+                                     &pOutput->planeID) != 0) {
+                    failed = 1;
+                    break;
+                }
+
+                if (pOutput->planeID != 0) {
+                    pOutput->crtcID = pModeRes->crtcs[k];
+                    break;
+                }
+            }
+
+            drmModeFreeEncoder(pEncoder);
+        }
+
+        if (failed) {
+            drmModeFreeConnector(pConnector);
+            count = -1;
+            break;
+        }
+
+        if (pOutput->planeID != 0) {
+            pOutput->connectorID = pModeRes->connectors[i];
+            GetConnectorName(pConnector->connector_type,
+                             pConnector->connector_type_id,
+                             pOutput->name, sizeof(pOutput->name));
+
+            pExcludedIDs[numExcluded++] = pOutput->crtcID;
+            pExcludedIDs[numExcluded++] = pOutput->planeID;
+            count++;
+        }
+
+        drmModeFreeConnector(pConnector);
+    }
+
+    free(pExcludedIDs);
+    drmModeFreeResources(pModeRes);
+
+    return count;
+}
+
+
+/*
+ * Create a property blob for a plane's FB_DAMAGE_CLIPS property from
+ * 'count' rectangles in GL window coordinates (origin at the bottom
+ * left) of an fb 'fbHeight' pixels high.  KMS damage clips have their
+ * origin at the top left, and are given as x1,y1 inclusive to x2,y2
+ * exclusive.
+ *
+ * Return the blob ID, or 0 if the blob could not be created; the caller
+ * should destroy the blob with drmModeDestroyPropertyBlob() once the
+ * commit that uses it has been made.
+ */
+uint32_t CreateDamageClipsBlob(int drmFd, const struct Rect *pRects,
+                               int count, int fbHeight)
+{
+    struct drm_mode_rect clips[8];
+    uint32_t blobID = 0;
+    int i;
+
+    if ((count <= 0) || (count > (int) ARRAY_LEN(clips))) {
+        return 0;
+    }
+
+    for (i = 0; i < count; i++) {
+        clips[i].x1 = pRects[i].x;
+        clips[i].y1 = fbHeight - (pRects[i].y + pRects[i].height);
+        clips[i].x2 = pRects[i].x + pRects[i].width;
+        clips[i].y2 = fbHeight - pRects[i].y;
+    }
+
+    if (drmModeCreatePropertyBlob(drmFd, clips,
+                                  sizeof(clips[0]) * count, &blobID) != 0) {
+        return 0;
+    }
+
+    return blobID;
+}
+
+
+/*
+ * Record the CRTC's current state, and the connectors it drives, for
+ * RestoreCrtcState().  What cannot be queried is not restored.  Return
+ * 0, or -1 with the reason for GetError().
+ */
+static int SaveCrtcState(struct KmsDisplay *pKms)
+{
+    drmModeResPtr pModeRes = drmModeGetResources(pKms->drmFd);
+    int i;
+
+    if (pModeRes == NULL) {
+        SetError("Unable to query DRM-KMS resources.\n");
+        return -1;
+    }
+
+    pKms->pSavedCrtc = drmModeGetCrtc(pKms->drmFd, pKms->config.crtcID);
+
+    pKms->savedRotation = DRM_MODE_ROTATE_0;
+    FindPropertyValue(pKms->drmFd, pKms->config.planeID,
+                      DRM_MODE_OBJECT_PLANE, "rotation", &pKms->savedRotation);
+
+    for (i = 0; i < NUM_COLOR_PROPERTIES; i++) {
+        uint64_t blobID = 0;
+
+        FindPropertyValue(pKms->drmFd, pKms->config.crtcID,
+                          DRM_MODE_OBJECT_CRTC, colorPropertyNames[i],
+                          &blobID);
+        pKms->savedColorBlobs[i] = (uint32_t) blobID;
+    }
+
+    for (i = 0; (i < pModeRes->count_connectors) &&
+                (pKms->numSavedConnectors < MAX_SAVED_CONNECTORS); i++) {
+        uint64_t crtcID = 0;
+
+        if ((FindPropertyValue(pKms->drmFd, pModeRes->connectors[i],
+                               DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID",
+                               &crtcID) > 0) &&
+            (crtcID == pKms->config.crtcID)) {
+            pKms->savedConnectorIDs[pKms->numSavedConnectors++] =
+                pModeRes->connectors[i];
+        }
+    }
+
+    drmModeFreeResources(pModeRes);
+
+    return 0;
+}
+
+
+/*
+ * Put the CRTC back the way SaveCrtcState() found it: showing the same
+ * fb (e.g., the console's) in the same mode, or off.
+ */
+static void RestoreCrtcState(struct KmsDisplay *pKms)
+{
+    drmModeCrtcPtr pCrtc = pKms->pSavedCrtc;
+    int ret;
+
+    if (pCrtc == NULL) {
+        return;
+    }
+
+    if (pCrtc->mode_valid && (pCrtc->buffer_id != 0) &&
+        (pKms->numSavedConnectors > 0)) {
+        ret = drmModeSetCrtc(pKms->drmFd, pCrtc->crtc_id, pCrtc->buffer_id,
+                             pCrtc->x, pCrtc->y, pKms->savedConnectorIDs,
+                             pKms->numSavedConnectors, &pCrtc->mode);
+    } else {
+        ret = drmModeSetCrtc(pKms->drmFd, pCrtc->crtc_id, 0, 0, 0,
+                             NULL, 0, NULL);
+    }
+
+    if (ret != 0) {
+        Warning("Unable to restore the state of CRTC 0x%08x.\n",
+                pCrtc->crtc_id);
+    }
+}
+
+
+/*
+ * Put back the color properties that SaveCrtcState() found, if
+ * SetKmsDisplayColor() changed them.
+ */
+static void RestoreColorState(struct KmsDisplay *pKms)
+{
+    struct AtomicRequest atomic = { 0 };
+
+    if (!pKms->colorSet) {
+        return;
+    }
+
+    AssignColorRequest(&atomic, pKms, pKms->savedColorBlobs);
+
+    if (CommitAtomicRequest(pKms->drmFd, &atomic, 0,
+                            NULL /* user_data */) != 0) {
+        Warning("Unable to restore the color correction of CRTC 0x%08x.\n",
+                pKms->config.crtcID);
+    }
+}
+
+
+/*
+ * Put back the plane rotation that SaveCrtcState() found, if
+ * SetKmsDisplayOrientation() changed it.  The old fb may not fit the
+ * plane at either rotation, so turn the CRTC off along the way, and let
+ * RestoreCrtcState() turn it back on.
+ */
+static void RestoreRotation(struct KmsDisplay *pKms)
+{
+    const struct Config *pConfig = &pKms->config;
+    const struct PropertyIDs *pPropertyIDs = &pKms->propertyIDs;
+    struct AtomicRequest atomic = { 0 };
+
+    if ((pKms->rotation == 0) || (pKms->rotation == pKms->savedRotation)) {
+        return;
+    }
+
+    AddAtomicProperty(&atomic, pConfig->crtcID,
+                      pPropertyIDs->crtc.mode_id, 0);
+    AddAtomicProperty(&atomic, pConfig->crtcID,
+                      pPropertyIDs->crtc.active, 0);
+    AddAtomicProperty(&atomic, pConfig->connectorID,
+                      pPropertyIDs->connector.crtc_id, 0);
+    AddAtomicProperty(&atomic, pConfig->planeID,
+                      pPropertyIDs->plane.fb_id, 0);
+    AddAtomicProperty(&atomic, pConfig->planeID,
+                      pPropertyIDs->plane.crtc_id, 0);
+    AddAtomicProperty(&atomic, pConfig->planeID,
+                      pPropertyIDs->plane.rotation,
+                      pKms->savedRotation);
+
+    if (CommitAtomicRequest(pKms->drmFd, &atomic,
+                            DRM_MODE_ATOMIC_ALLOW_MODESET,
+                            NULL /* user_data */) != 0) {
+        Warning("Unable to restore the rotation of plane 0x%08x.\n",
+                pConfig->planeID);
+    }
+}
+
+
+static uint16_t LutEntry(double x, double exponent)
+{
+    return (uint16_t) (pow(x, exponent) * 0xffff + 0.5);
+}
+
+
+/*
+ * Create a DEGAMMA_LUT or GAMMA_LUT blob, of the size the CRTC reports
+ * in 'sizeName', mapping each channel value x to x^exponent, and return
+ * it in 'pBlobID': 0 if the CRTC does not report a size.  Return 0, or
+ * -1 with the reason for GetError().
+ */
+static int CreateLutBlob(const struct KmsDisplay *pKms,
+                         const char *sizeName, const double *pExponents,
+                         uint32_t *pBlobID)
+{
+    struct drm_color_lut *pLut;
+    uint64_t size = 0, i;
+    int ret;
+
+    *pBlobID = 0;
+
+    if ((FindPropertyValue(pKms->drmFd, pKms->config.crtcID,
+                           DRM_MODE_OBJECT_CRTC, sizeName, &size) <= 0) ||
+        (size < 2)) {
+        return 0;
+    }
+
+    pLut = calloc(size, sizeof(*pLut));
+
+    if (pLut == NULL) {
+        SetError("Memory allocation failure.\n");
+        return -1;
+    }
+
+    for (i = 0; i < size; i++) {
+        double x = (double) i / (size - 1);
+
+        pLut[i].red = LutEntry(x, pExponents[0]);
+        pLut[i].green = LutEntry(x, pExponents[1]);
+        pLut[i].blue = LutEntry(x, pExponents[2]);
+    }
+
+    ret = drmModeCreatePropertyBlob(pKms->drmFd, pLut, size * sizeof(*pLut),
+                                    pBlobID);
+
+    free(pLut);
+
+    if (ret != 0) {
+        SetError("Unable to create a color LUT property blob.\n");
+        *pBlobID = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Create a CTM blob.  The kernel takes the coefficients in S31.32
+ * sign-magnitude fixed point.  Return 0, with the reason for
+ * GetError(), on failure.
+ */
+static uint32_t CreateCtmBlob(int drmFd, const double *pMatrix)
+{
+    struct drm_color_ctm ctm;
+    uint32_t blobID = 0;
+    int i;
+
+    for (i = 0; i < 9; i++) {
+        uint64_t magnitude =
+            (uint64_t) (fabs(pMatrix[i]) * 4294967296.0 + 0.5);
+
+        ctm.matrix[i] = (magnitude & ~(1ULL << 63)) |
+                        ((pMatrix[i] < 0.0) ? (1ULL << 63) : 0);
+    }
+
+    if (drmModeCreatePropertyBlob(drmFd, &ctm, sizeof(ctm), &blobID) != 0) {
+        SetError("Unable to create a CTM property blob.\n");
+        return 0;
+    }
+
+    return blobID;
+}
+
+
+static void DestroyColorBlobs(struct KmsDisplay *pKms)
+{
+    int i;
+
+    for (i = 0; i < NUM_COLOR_PROPERTIES; i++) {
+        if (pKms->colorBlobs[i] != 0) {
+            drmModeDestroyPropertyBlob(pKms->drmFd, pKms->colorBlobs[i]);
+            pKms->colorBlobs[i] = 0;
+        }
+    }
+}
+
+
+static int ColorCorrectionsEqual(const struct ColorCorrection *pA,
+                                 const struct ColorCorrection *pB)
+{
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        if ((pA->degamma[i] != pB->degamma[i]) ||
+            (pA->gamma[i] != pB->gamma[i])) {
+            return 0;
+        }
+    }
+
+    if (pA->ctmSet != pB->ctmSet) {
+        return 0;
+    }
+
+    for (i = 0; pA->ctmSet && (i < 9); i++) {
+        if (pA->ctm[i] != pB->ctm[i]) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+/*
+ * Have the CRTC apply 'pColor', starting with the next commit, instead
+ * of the application correcting colors in a full-screen shader pass.
+ *
+ * The property blobs are created here, once, and kept with the
+ * KmsDisplay: setting the same correction again, or setting the mode
+ * again (e.g., after a restart), reuses them.  Stages the CRTC does not
+ * support are skipped, with a warning.
+ *
+ * Return 0, or -1 with the reason for GetError(); the CRTC then
+ * bypasses color correction from the next commit.
+ */
+int SetKmsDisplayColor(struct KmsDisplay *pKms,
+                       const struct ColorCorrection *pColor)
+{
+    const struct PropertyIDs *pPropertyIDs = &pKms->propertyIDs;
+
+    if (pKms->colorSet && ColorCorrectionsEqual(&pKms->color, pColor)) {
+        return 0;
+    }
+
+    DestroyColorBlobs(pKms);
+
+    /* Until this succeeds, the blobs are all 0: bypass. */
+    memset(&pKms->color, 0, sizeof(pKms->color));
+    pKms->colorSet = 1;
+    pKms->colorPending = 1;
+
+    if (pColor->degamma[0] > 0.0) {
+        if ((pPropertyIDs->crtc.degamma_lut != 0) &&
+            (CreateLutBlob(pKms, "DEGAMMA_LUT_SIZE", pColor->degamma,
+                           &pKms->colorBlobs[COLOR_DEGAMMA_LUT]) != 0)) {
+            goto fail;
+        }
+        if (pKms->colorBlobs[COLOR_DEGAMMA_LUT] == 0) {
+            Warning("CRTC 0x%08x has no DEGAMMA_LUT; ignoring --degamma.\n",
+                    pKms->config.crtcID);
+        }
+    }
+
+    if (pColor->ctmSet) {
+        if (pPropertyIDs->crtc.ctm != 0) {
+            pKms->colorBlobs[COLOR_CTM] = CreateCtmBlob(pKms->drmFd,
+                                                        pColor->ctm);
+            if (pKms->colorBlobs[COLOR_CTM] == 0) {
+                goto fail;
+            }
+        } else {
+            Warning("CRTC 0x%08x has no CTM; ignoring --ctm.\n",
+                    pKms->config.crtcID);
+        }
+    }
+
+    if (pColor->gamma[0] > 0.0) {
+        if ((pPropertyIDs->crtc.gamma_lut != 0) &&
+            (CreateLutBlob(pKms, "GAMMA_LUT_SIZE", pColor->gamma,
+                           &pKms->colorBlobs[COLOR_GAMMA_LUT]) != 0)) {
+            goto fail;
+        }
+        if (pKms->colorBlobs[COLOR_GAMMA_LUT] == 0) {
+            Warning("CRTC 0x%08x has no GAMMA_LUT; ignoring --gamma.\n",
+                    pKms->config.crtcID);
+        }
+    }
+
+    pKms->color = *pColor;
+
+    return 0;
+
+fail:
+    DestroyColorBlobs(pKms);
+    return -1;
+}
+
+
+/*
+ * Convert an Orientation to a plane "rotation" value.
+ */
+static uint64_t OrientationToRotation(const struct Orientation *pOrientation)
+{
+    uint64_t rotation;
+
+    switch (pOrientation->degrees) {
+    case 90:
+        rotation = DRM_MODE_ROTATE_90;
+        break;
+    case 180:
+        rotation = DRM_MODE_ROTATE_180;
+        break;
+    case 270:
+        rotation = DRM_MODE_ROTATE_270;
+        break;
+    default:
+        rotation = DRM_MODE_ROTATE_0;
+        break;
+    }
+
+    if (pOrientation->reflectX) {
+        rotation |= DRM_MODE_REFLECT_X;
+    }
+
+    if (pOrientation->reflectY) {
+        rotation |= DRM_MODE_REFLECT_Y;
+    }
+
+    return rotation;
+}
+
+
+/*
+ * Have the primary plane rotate and reflect frames for a panel mounted
+ * as 'pOrientation' describes, starting with the next modeset, instead
+ * of the renderer.  The surface to render for the plane is then the
+ * size GetKmsDisplayInfo() reports: portrait, for a landscape mode
+ * rotated by 90 or 270 degrees.
+ *
+ * Drivers support different subsets of rotations and reflections,
+ * often depending on the format and layout of the fb, so ask with a
+ * TEST_ONLY modeset.  Return whether the plane can do it; if not, the
+ * plane is left unrotated, and the renderer must apply 'pOrientation'
+ * itself.  Call this before setting the mode.
+ */
+int SetKmsDisplayOrientation(struct KmsDisplay *pKms,
+                             const struct Orientation *pOrientation)
+{
+    uint64_t rotation = OrientationToRotation(pOrientation);
+
+    if (rotation == pKms->rotation) {
+        return 1;
+    }
+
+    /* The blank fb must match the new surface size. */
+    if (pKms->blankFb != 0) {
+        drmModeRmFB(pKms->drmFd, pKms->blankFb);
+        pKms->blankFb = 0;
+    }
+
+    if (rotation == DRM_MODE_ROTATE_0) {
+        pKms->rotation = (pKms->savedRotation != DRM_MODE_ROTATE_0) ?
+                         rotation : 0;
+        return 1;
+    }
+
+    if (pKms->propertyIDs.plane.rotation == 0) {
+        pKms->rotation = 0;
+        return 0;
+    }
+
+    pKms->rotation = rotation;
+
+    if (!TestKmsDisplayMode(pKms)) {
+        drmModeRmFB(pKms->drmFd, pKms->blankFb);
+        pKms->blankFb = 0;
+        pKms->rotation = 0;
+        return 0;
+    }
+
+    return 1;
+}
+
+
+/*
+ * Probe the display: pick a connector, CRTC, and primary plane, and
+ * look up everything needed to program them (the mode blob, property
+ * IDs, and scanout formats), without changing what is displayed.
+ *
+ * The KmsDisplay can then be displayed on with SetKmsDisplayMode() and
+ * an EGLStream, or by an application that allocates its own scanout
+ * buffers and flips them with CommitKmsFrame(), which sets the mode
+ * with the first commit.  It stays valid across any number of such
+ * uses; see ResetKmsDisplay().
+ *
+ * Return NULL, with the reason for GetError(), on failure.
+ */
+struct KmsDisplay *CreateKmsDisplay(int drmFd, const char *connectorName)
+{
+    struct KmsDisplay *pKms = calloc(1, sizeof(*pKms));
+
+    if (pKms == NULL) {
+        SetError("Memory allocation failure.\n");
+        return NULL;
+    }
+
+    pKms->drmFd = drmFd;
+
+    if ((PickConfig(drmFd, connectorName, &pKms->config) != 0) ||
+        (AssignPropertyIDs(drmFd, &pKms->config, &pKms->propertyIDs) != 0)) {
+        goto fail;
+    }
+
+    pKms->modeID = CreateModeID(drmFd, &pKms->config);
+
+    if (pKms->modeID == 0) {
+        goto fail;
+    }
+
+    if (GetPlaneFormats(drmFd, pKms->config.planeID,
+                        &pKms->planeFormats) != 0) {
+        goto failModeID;
+    }
+
+    if (SaveCrtcState(pKms) != 0) {
+        FreePlaneFormats(&pKms->planeFormats);
+        goto failModeID;
+    }
+
+    return pKms;
+
+failModeID:
+    drmModeDestroyPropertyBlob(drmFd, pKms->modeID);
+fail:
+    free(pKms);
+    return NULL;
+}
+
+
+/*
+ * The part of a KmsDisplay that CreateKmsDisplay() probes for, as
+ * SaveKmsDisplay() stores it.
+ */
+struct KmsDisplayCache {
+    struct Config config;
+    struct PropertyIDs propertyIDs;
+};
+
+
+/*
+ * Fold the "EDID" blob of a connector into 'hash', if it has one.
+ */
+static uint64_t HashConnectorEdid(int drmFd,
+                                  const drmModeConnector *pConnector,
+                                  uint64_t hash)
+{
+    int i;
+
+    for (i = 0; i < pConnector->count_props; i++) {
+        drmModePropertyPtr pProperty =
+            drmModeGetProperty(drmFd, pConnector->props[i]);
+        drmModePropertyBlobPtr pBlob = NULL;
+
+        if (pProperty == NULL) {
+            continue;
+        }
+
+        if ((strcmp(pProperty->name, "EDID") == 0) &&
+            (pConnector->prop_values[i] != 0)) {
+            pBlob = drmModeGetPropertyBlob(drmFd,
+                                           pConnector->prop_values[i]);
+        }
+
+        drmModeFreeProperty(pProperty);
+
+        if (pBlob != NULL) {
+            hash = HashBytes(hash, pBlob->data, pBlob->length);
+            drmModeFreePropertyBlob(pBlob);
+            break;
+        }
+    }
+
+    return hash;
+}
+
+
+/*
+ * Return a hash of what CreateKmsDisplay() would find on 'drmFd': the
+ * device, its CRTCs and planes, and its connectors, with whether each
+ * is connected and the EDID of the display on it.
+ *
+ * This uses drmModeGetConnectorCurrent(), which reports what the kernel
+ * last found, rather than drmModeGetConnector(), which probes each
+ * connector again (reading EDIDs over DDC, tens of milliseconds each).
+ * The kernel probes on hotplug, so a changed display still changes the
+ * hash.
+ *
+ * The hash is folded into *pHash.  Return 0, or -1 with the reason for
+ * GetError().
+ */
+int HashKmsTopology(int drmFd, uint64_t *pHash)
+{
+    drmModeResPtr pModeRes;
+    drmModePlaneResPtr pPlaneRes;
+    uint64_t hash = *pHash;
+    struct stat st;
+    uint32_t i;
+    int j;
+
+    if (SetClientCaps(drmFd) != 0) {
+        return -1;
+    }
+
+    if (fstat(drmFd, &st) == 0) {
+        hash = HashBytes(hash, &st.st_rdev, sizeof(st.st_rdev));
+    }
+
+    pModeRes = drmModeGetResources(drmFd);
+
+    if (pModeRes == NULL) {
+        SetError("Unable to query DRM-KMS resources.\n");
+        return -1;
+    }
+
+    hash = HashBytes(hash, pModeRes->crtcs,
+                     pModeRes->count_crtcs * sizeof(pModeRes->crtcs[0]));
+
+    for (j = 0; j < pModeRes->count_connectors; j++) {
+        drmModeConnectorPtr pConnector =
+            drmModeGetConnectorCurrent(drmFd, pModeRes->connectors[j]);
+
+        if (pConnector == NULL) {
+            continue;
+        }
+
+        hash = HashBytes(hash, &pConnector->connector_id,
+                         sizeof(pConnector->connector_id));
+        hash = HashBytes(hash, &pConnector->connection,
+                         sizeof(pConnector->connection));
+
+        if (pConnector->connection == DRM_MODE_CONNECTED) {
+            hash = HashConnectorEdid(drmFd, pConnector, hash);
+        }
+
+        drmModeFreeConnector(pConnector);
+    }
+
+    drmModeFreeResources(pModeRes);
+
+    pPlaneRes = drmModeGetPlaneResources(drmFd);
+
+    if (pPlaneRes == NULL) {
+        SetError("Unable to query DRM-KMS plane resources\n");
+        return -1;
+    }
+
+    for (i = 0; i < pPlaneRes->count_planes; i++) {
+        drmModePlanePtr pPlane = drmModeGetPlane(drmFd, pPlaneRes->planes[i]);
+
+        if (pPlane == NULL) {
+            continue;
+        }
+
+        hash = HashBytes(hash, &pPlane->plane_id, sizeof(pPlane->plane_id));
+        hash = HashBytes(hash, &pPlane->possible_crtcs,
+                         sizeof(pPlane->possible_crtcs));
+
+        drmModeFreePlane(pPlane);
+    }
+
+    drmModeFreePlaneResources(pPlaneRes);
+
+    *pHash = hash;
+
+    return 0;
+}
+
+
+/*
+ * Copy what probing found for the KmsDisplay into 'pData', if 'size'
+ * bytes are enough, for RestoreKmsDisplay() to use in a later process.
+ * Return the size needed.
+ */
+size_t SaveKmsDisplay(const struct KmsDisplay *pKms, void *pData, size_t size)
+{
+    struct KmsDisplayCache cache;
+
+    if (size >= sizeof(cache)) {
+        memset(&cache, 0, sizeof(cache));
+        cache.config = pKms->config;
+        cache.propertyIDs = pKms->propertyIDs;
+        memcpy(pData, &cache, sizeof(cache));
+    }
+
+    return sizeof(cache);
+}
+
+
+/*
+ * Create a KmsDisplay from what SaveKmsDisplay() stored, instead of
+ * probing.  The IDs may be stale (e.g., after a driver update), so
+ * check them all with one TEST_ONLY modeset; return NULL if the driver
+ * rejects it, for the caller to fall back to CreateKmsDisplay().
+ */
+struct KmsDisplay *RestoreKmsDisplay(int drmFd, const void *pData,
+                                     size_t size)
+{
+    struct KmsDisplayCache cache;
+    struct KmsDisplay *pKms;
+    drmModePlanePtr pPlane;
+
+    if (size != sizeof(cache)) {
+        return NULL;
+    }
+
+    memcpy(&cache, pData, sizeof(cache));
+
+    if (SetClientCaps(drmFd) != 0) {
+        return NULL;
+    }
+
+    /* The plane must exist for its formats to be queried. */
+    pPlane = drmModeGetPlane(drmFd, cache.config.planeID);
+
+    if (pPlane == NULL) {
+        return NULL;
+    }
+
+    drmModeFreePlane(pPlane);
+
+    pKms = calloc(1, sizeof(*pKms));
+
+    if (pKms == NULL) {
+        return NULL;
+    }
+
+    pKms->drmFd = drmFd;
+    pKms->config = cache.config;
+    pKms->propertyIDs = cache.propertyIDs;
+
+    if (drmModeCreatePropertyBlob(drmFd, &pKms->config.mode,
+                                  sizeof(pKms->config.mode),
+                                  &pKms->modeID) != 0) {
+        free(pKms);
+        return NULL;
+    }
+
+    if (GetPlaneFormats(drmFd, pKms->config.planeID,
+                        &pKms->planeFormats) != 0) {
+        drmModeDestroyPropertyBlob(drmFd, pKms->modeID);
+        free(pKms);
+        return NULL;
+    }
+
+    if (!TestKmsDisplayMode(pKms) || (SaveCrtcState(pKms) != 0)) {
+        if (pKms->blankFb != 0) {
+            drmModeRmFB(drmFd, pKms->blankFb);
+        }
+        drmModeDestroyPropertyBlob(drmFd, pKms->modeID);
+        FreePlaneFormats(&pKms->planeFormats);
+        free(pKms);
+        return NULL;
+    }
+
+    return pKms;
+}
+
+
+/*
+ * Forget that the mode has been set, so that the next CommitKmsFrame()
+ * sets it again.  Call this when the fb on screen has been removed,
+ * which turns the CRTC off.
+ */
+void ResetKmsDisplay(struct KmsDisplay *pKms)
+{
+    pKms->modesetDone = 0;
+}
+
+
+/*
+ * Restore the CRTC, including its color correction and its plane's
+ * rotation, to its state
+ * before CreateKmsDisplay(), and free the KmsDisplay and its KMS
+ * objects.  The DRM fd stays open.
+ */
+void DestroyKmsDisplay(struct KmsDisplay *pKms)
+{
+    RestoreRotation(pKms);
+    RestoreCrtcState(pKms);
+    RestoreColorState(pKms);
+    DestroyColorBlobs(pKms);
+
+    if (pKms->blankFb != 0) {
+        drmModeRmFB(pKms->drmFd, pKms->blankFb);
+    }
+
+    drmModeDestroyPropertyBlob(pKms->drmFd, pKms->modeID);
+
+    FreePlaneFormats(&pKms->planeFormats);
+
+    if (pKms->pSavedCrtc != NULL) {
+        drmModeFreeCrtc(pKms->pSavedCrtc);
+    }
+
+    free(pKms);
+}
+
+
+/*
+ * Return the plane, and the size of the surface to render for it: the
+ * mode's size, turned on its side if the plane rotates by 90 or 270
+ * degrees.
+ */
+void GetKmsDisplayInfo(const struct KmsDisplay *pKms,
+                       uint32_t *pPlaneID, int *pWidth, int *pHeight)
+{
+    uint16_t width = pKms->config.width, height = pKms->config.height;
+
+    RotatedSize(pKms->rotation, &width, &height);
+
+    *pPlaneID = pKms->config.planeID;
+    *pWidth = width;
+    *pHeight = height;
+}
+
+
+/*
+ * Return the refresh rate of the KmsDisplay's mode, in Hz, from its
+ * pixel clock and timings (the mode's 'vrefresh' is rounded).
+ */
+double GetKmsDisplayRefresh(const struct KmsDisplay *pKms)
+{
+    const drmModeModeInfo *pMode = &pKms->config.mode;
+    double refresh;
+
+    if ((pMode->htotal == 0) || (pMode->vtotal == 0)) {
+        return pMode->vrefresh;
+    }
+
+    refresh = (pMode->clock * 1000.0) / pMode->htotal / pMode->vtotal;
+
+    if (pMode->flags & DRM_MODE_FLAG_INTERLACE) {
+        refresh *= 2.0;
+    }
+
+    if (pMode->flags & DRM_MODE_FLAG_DBLSCAN) {
+        refresh /= 2.0;
+    }
+
+    if (pMode->vscan > 1) {
+        refresh /= pMode->vscan;
+    }
+
+    return refresh;
+}
+
+
+/*
+ * Describe the connector, CRTC, and plane that the KmsDisplay drives.
+ * Only the connector's name is needed, so it is not probed again.
+ */
+void GetKmsDisplayOutput(const struct KmsDisplay *pKms,
+                         struct KmsOutput *pOutput)
+{
+    drmModeConnectorPtr pConnector =
+        drmModeGetConnectorCurrent(pKms->drmFd, pKms->config.connectorID);
+
+    memset(pOutput, 0, sizeof(*pOutput));
+
+    if (pConnector != NULL) {
+        GetConnectorName(pConnector->connector_type,
+                         pConnector->connector_type_id,
+                         pOutput->name, sizeof(pOutput->name));
+        drmModeFreeConnector(pConnector);
+    }
+
+    pOutput->connectorID = pKms->config.connectorID;
+    pOutput->crtcID = pKms->config.crtcID;
+    pOutput->planeID = pKms->config.planeID;
+}
+
+
+/*
+ * Return the formats and modifiers that the KmsDisplay's plane can scan
+ * out.
+ */
+const struct PlaneFormats *GetKmsDisplayFormats(const struct KmsDisplay *pKms)
+{
+    return &pKms->planeFormats;
+}
+
+
+/*
+ * Queue a nonblocking atomic commit that displays 'fb' on the plane.
+ * The first commit also sets the mode.
+ *
+ * 'inFenceFd' and 'damageBlob' are as for AssignPlaneRequest(); the
+ * caller keeps ownership of both.  The kernel delivers a page flip
+ * event with 'userData' once the commit takes effect (see
+ * drmHandleEvent()); until then, the CRTC accepts no further commits
+ * and 'fb' must not be destroyed.
+ *
+ * Return 0 on success, or a negative errno value.
+ */
+int CommitKmsFrame(struct KmsDisplay *pKms, uint32_t fb, int inFenceFd,
+                   uint32_t damageBlob, void *userData)
+{
+    const struct Config *pConfig = &pKms->config;
+    struct AtomicRequest atomic = { 0 };
+    uint32_t flags = DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT;
+    int ret;
+
+    if (!pKms->modesetDone) {
+        AssignModesetRequest(&atomic, pConfig, &pKms->propertyIDs,
+                             pKms->modeID);
+        flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+    }
+
+    if (pKms->colorSet && (!pKms->modesetDone || pKms->colorPending)) {
+        AssignColorRequest(&atomic, pKms, pKms->colorBlobs);
+    }
+
+    AssignPlaneRequest(&atomic, &pKms->propertyIDs, pConfig->planeID,
+                       pConfig->crtcID, fb, pConfig->width, pConfig->height,
+                       pKms->rotation, inFenceFd, damageBlob);
+
+    ret = CommitAtomicRequest(pKms->drmFd, &atomic, flags, userData);
+
+    if (ret == 0) {
+        pKms->modesetDone = 1;
+        pKms->colorPending = 0;
+    }
+
+    return ret;
+}
+
+
+static int AddPlaneFormat(struct PlaneFormats *pFormats, int *pAllocated,
+                          uint32_t format, uint64_t modifier)
+{
+    if (pFormats->count == *pAllocated) {
+        int allocated = (*pAllocated > 0) ? (*pAllocated * 2) : 32;
+        struct FormatModifier *pEntries =
+            realloc(pFormats->pEntries,
+                    allocated * sizeof(pFormats->pEntries[0]));
+
+        if (pEntries == NULL) {
+            SetError("Memory allocation failure.\n");
+            return -1;
+        }
+
+        pFormats->pEntries = pEntries;
+        *pAllocated = allocated;
+    }
+
+    pFormats->pEntries[pFormats->count].format = format;
+    pFormats->pEntries[pFormats->count].modifier = modifier;
+    pFormats->count++;
+
+    return 0;
+}
+
+
+/*
+ * Build the table of format/modifier pairs that the plane can scan out.
+ *
+ * The IN_FORMATS blob is a drm_format_modifier_blob: an array of
+ * formats, and an array of drm_format_modifier entries, each of which
+ * names a modifier and, as a bitmask over a window of 64 formats
+ * starting at 'offset', the formats it applies to.
+ *
+ * Drivers without IN_FORMATS only report formats, with the layout
+ * implied by the buffer; those are entered with
+ * DRM_FORMAT_MOD_INVALID.
+ *
+ * Return 0, or -1 with the reason for GetError(), with the table empty.
+ */
+int GetPlaneFormats(int drmFd, uint32_t planeID,
+                    struct PlaneFormats *pFormats)
+{
+    drmModePropertyBlobPtr pBlob = NULL;
+    uint64_t blobID = 0;
+    int allocated = 0, ret = 0;
+    uint32_t i;
+
+    pFormats->count = 0;
+    pFormats->pEntries = NULL;
+
+    if ((FindPropertyValue(drmFd, planeID, DRM_MODE_OBJECT_PLANE,
+                           "IN_FORMATS", &blobID) > 0) && (blobID != 0)) {
+        pBlob = drmModeGetPropertyBlob(drmFd, blobID);
+    }
+
+    if (pBlob != NULL) {
+        const struct drm_format_modifier_blob *pHeader = pBlob->data;
+        const uint32_t *pFormatList = (const uint32_t *)
+            ((const uint8_t *) pBlob->data + pHeader->formats_offset);
+        const struct drm_format_modifier *pModifiers =
+            (const struct drm_format_modifier *)
+            ((const uint8_t *) pBlob->data + pHeader->modifiers_offset);
+
+        for (i = 0; (i < pHeader->count_modifiers) && (ret == 0); i++) {
+            uint32_t bit;
+
+            for (bit = 0; (bit < 64) && (ret == 0); bit++) {
+                uint32_t index = pModifiers[i].offset + bit;
+
+                if (((pModifiers[i].formats >> bit) & 1) == 0) {
+                    continue;
+                }
+
+                if (index >= pHeader->count_formats) {
+                    break;
+                }
+
+                ret = AddPlaneFormat(pFormats, &allocated,
+                                     pFormatList[index],
+                                     pModifiers[i].modifier);
+            }
+        }
+
+        drmModeFreePropertyBlob(pBlob);
+    } else {
+        drmModePlanePtr pPlane = drmModeGetPlane(drmFd, planeID);
+
+        if (pPlane == NULL) {
+            SetError("Unable to query DRM-KMS plane 0x%08x\n", planeID);
+            return -1;
+        }
+
+        for (i = 0; (i < pPlane->count_formats) && (ret == 0); i++) {
+            ret = AddPlaneFormat(pFormats, &allocated, pPlane->formats[i],
+                                 DRM_FORMAT_MOD_INVALID);
+        }
+
+        drmModeFreePlane(pPlane);
+    }
+
+    if (ret != 0) {
+        FreePlaneFormats(pFormats);
+    }
+
+    return ret;
+}
+
+
+void FreePlaneFormats(struct PlaneFormats *pFormats)
+{
+    free(pFormats->pEntries);
+    pFormats->pEntries = NULL;
+    pFormats->count = 0;
+}
+
+
+/*
+ * Return whether the plane can scan out 'format' with 'modifier', or
+ * with any layout if 'modifier' is DRM_FORMAT_MOD_INVALID.  A table
+ * without modifier information (DRM_FORMAT_MOD_INVALID entries) is
+ * taken to allow linear layouts.
+ */
+int PlaneSupportsFormat(const struct PlaneFormats *pFormats,
+                        uint32_t format, uint64_t modifier)
+{
+    int i;
+
+    for (i = 0; i < pFormats->count; i++) {
+        const struct FormatModifier *pEntry = &pFormats->pEntries[i];
+
+        if (pEntry->format != format) {
+            continue;
+        }
+
+        if ((modifier == DRM_FORMAT_MOD_INVALID) ||
+            (pEntry->modifier == modifier) ||
+            ((pEntry->modifier == DRM_FORMAT_MOD_INVALID) &&
+             (modifier == DRM_FORMAT_MOD_LINEAR))) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Return whether 'modifier' describes a compressed layout, for the
+ * vendors whose modifiers encode that.
+ */
+static int ModifierIsCompressed(uint64_t modifier)
+{
+    uint64_t value = modifier & 0x00ffffffffffffffULL;
+
+    switch (modifier >> 56) {
+#if defined(DRM_FORMAT_MOD_VENDOR_INTEL)
+    case DRM_FORMAT_MOD_VENDOR_INTEL:
+        /*
+         * The color control surface (CCS) modifiers: Y/Yf tiled CCS (4,
+         * 5), the Gen12 render/media compression variants (6-8), and
+         * the tile 4 variants of DG2 and later (10-17).
+         */
+        return ((value >= 4) && (value <= 8)) ||
+               ((value >= 10) && (value <= 17));
+#endif
+#if defined(DRM_FORMAT_MOD_VENDOR_AMD) && defined(AMD_FMT_MOD_GET)
+    case DRM_FORMAT_MOD_VENDOR_AMD:
+        /* Delta color compression. */
+        return AMD_FMT_MOD_GET(DCC, modifier) != 0;
+#endif
+#if defined(DRM_FORMAT_MOD_VENDOR_NVIDIA)
+    case DRM_FORMAT_MOD_VENDOR_NVIDIA:
+        /*
+         * Block-linear modifiers (bit 4 set) have a compression type in
+         * bits 23-25; 0 is uncompressed.
+         */
+        return ((value & 0x10) != 0) && (((value >> 23) & 0x7) != 0);
+#endif
+    default:
+        return 0;
+    }
+}
+
+
+/*
+ * Rank a modifier by how little memory bandwidth scanning it out
+ * costs.  Linear layouts fetch whole rows of pixels; tiled layouts
+ * fetch blocks that suit the memory system; compressed layouts fetch
+ * less data again.  An implicit layout (DRM_FORMAT_MOD_INVALID) is
+ * unknown, so it ranks lowest.
+ */
+static int ModifierRank(uint64_t modifier)
+{
+    if (modifier == DRM_FORMAT_MOD_INVALID) {
+        return 0;
+    }
+
+    if (modifier == DRM_FORMAT_MOD_LINEAR) {
+        return 1;
+    }
+
+    return ModifierIsCompressed(modifier) ? 3 : 2;
+}
+
+
+/*
+ * Fill 'pModifiers' with up to 'maxModifiers' explicit modifiers that
+ * the plane can scan out 'format' with, best first (see
+ * ModifierRank()), and return how many there are.
+ */
+int GetScanoutModifiers(const struct PlaneFormats *pFormats, uint32_t format,
+                        uint64_t *pModifiers, int maxModifiers)
+{
+    int i, j, count = 0;
+
+    for (i = 0; (i < pFormats->count) && (count < maxModifiers); i++) {
+        const struct FormatModifier *pEntry = &pFormats->pEntries[i];
+        int rank = ModifierRank(pEntry->modifier);
+
+        if ((pEntry->format != format) ||
+            (pEntry->modifier == DRM_FORMAT_MOD_INVALID)) {
+            continue;
+        }
+
+        /* Insertion sort, keeping the driver's order within a rank. */
+
+        for (j = count; (j > 0) && (ModifierRank(pModifiers[j - 1]) < rank);
+             j--) {
+            pModifiers[j] = pModifiers[j - 1];
+        }
+
+        pModifiers[j] = pEntry->modifier;
+        count++;
     }
 
-    *pPlaneID = config.planeID;
-    *pWidth = config.width;
-    *pHeight = config.height;
+    return count;
 }
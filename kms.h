@@ -23,6 +23,99 @@
 #if !defined(KMS_H)
 #define KMS_H
 
-void SetMode(int drmFd, uint32_t *pPlaneID, int *pWidth, int *pHeight);
+#include <stddef.h>
+#include <stdint.h>
+
+#include "options.h"
+#include "utils.h"
+
+/*
+ * A pixel format (DRM_FORMAT_*) and a layout modifier
+ * (DRM_FORMAT_MOD_*) that a plane can scan out.
+ */
+struct FormatModifier {
+    uint32_t format;
+    uint64_t modifier;
+};
+
+struct PlaneFormats {
+    int count;
+    struct FormatModifier *pEntries;
+};
+
+/*
+ * A connector, and a CRTC and primary plane that can drive it.
+ */
+struct KmsOutput {
+    char name[32];
+    uint32_t connectorID;
+    uint32_t crtcID;
+    uint32_t planeID;
+};
+
+void GetConnectorName(uint32_t connectorType, uint32_t connectorTypeID,
+                      char *name, size_t size);
+
+int GetFreeOutputs(int drmFd, const uint32_t *pUsedIDs, int numUsedIDs,
+                   struct KmsOutput *pOutputs, int maxOutputs);
+
+int GetOverlayPlanes(int drmFd, uint32_t primaryPlaneID,
+                     uint32_t *pPlaneIDs, int maxPlanes);
+
+int EnableOverlayPlane(int drmFd, uint32_t primaryPlaneID,
+                       uint32_t overlayPlaneID, uint32_t *pBlankFb);
+
+int DisableOverlayPlane(int drmFd, uint32_t overlayPlaneID,
+                        uint32_t blankFb);
+
+int GetPlaneFormats(int drmFd, uint32_t planeID,
+                    struct PlaneFormats *pFormats);
+
+void FreePlaneFormats(struct PlaneFormats *pFormats);
+
+int PlaneSupportsFormat(const struct PlaneFormats *pFormats,
+                        uint32_t format, uint64_t modifier);
+
+int GetScanoutModifiers(const struct PlaneFormats *pFormats, uint32_t format,
+                        uint64_t *pModifiers, int maxModifiers);
+
+struct KmsDisplay;
+
+struct KmsDisplay *CreateKmsDisplay(int drmFd, const char *connectorName);
+
+int HashKmsTopology(int drmFd, uint64_t *pHash);
+
+size_t SaveKmsDisplay(const struct KmsDisplay *pKms, void *pData, size_t size);
+
+struct KmsDisplay *RestoreKmsDisplay(int drmFd, const void *pData,
+                                     size_t size);
+
+int SetKmsDisplayMode(struct KmsDisplay *pKms, int *pOutFenceFd);
+
+int SetKmsDisplayColor(struct KmsDisplay *pKms,
+                       const struct ColorCorrection *pColor);
+
+int SetKmsDisplayOrientation(struct KmsDisplay *pKms,
+                             const struct Orientation *pOrientation);
+
+void ResetKmsDisplay(struct KmsDisplay *pKms);
+
+void DestroyKmsDisplay(struct KmsDisplay *pKms);
+
+void GetKmsDisplayInfo(const struct KmsDisplay *pKms,
+                       uint32_t *pPlaneID, int *pWidth, int *pHeight);
+
+double GetKmsDisplayRefresh(const struct KmsDisplay *pKms);
+
+void GetKmsDisplayOutput(const struct KmsDisplay *pKms,
+                         struct KmsOutput *pOutput);
+
+const struct PlaneFormats *GetKmsDisplayFormats(const struct KmsDisplay *pKms);
+
+int CommitKmsFrame(struct KmsDisplay *pKms, uint32_t fb, int inFenceFd,
+                   uint32_t damageBlob, void *userData);
+
+uint32_t CreateDamageClipsBlob(int drmFd, const struct Rect *pRects,
+                               int count, int fbHeight);
 
 #endif /* KMS_H */
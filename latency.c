@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Input-to-photon latency measurement (--input-latency).
+ *
+ * The latency that matters to a user is from their input to the first
+ * frame on screen that reflects it.  Both ends are timestamped by the
+ * kernel, on CLOCK_MONOTONIC:
+ *
+ * - evdev stamps each input event when the driver reports it (with
+ *   EVIOCSCLOCKID; see OpenInputDevice());
+ * - DRM stamps each page flip event with the vblank that completed the
+ *   flip, from the GBM backend's atomic commits or, for the EGLStream
+ *   backend, the EGLOutputLayer's flips with
+ *   EGL_NV_output_drm_flip_event.
+ *
+ * The render loop gives every frame a serial, and hands the timestamps
+ * of the inputs it applies to a frame to AddFrameInputs() with that
+ * frame's serial.  When the backend sees a frame's flip complete, it
+ * calls SetFrameFlipTime() with the frame's serial, which resolves
+ * every input applied to that frame or before.  Inputs applied to a
+ * frame that is never displayed (one replaced in the mailbox present
+ * mode) are resolved by the next frame that is, which reflects them
+ * too.
+ *
+ * So the latency includes waiting for the next frame to start, drawing
+ * it, queueing, and the flip, but not the panel's own response time,
+ * which needs a photodiode to measure.  With --late-latch, inputs that
+ * arrive after a frame's draw calls were submitted, but before the GPU
+ * reached them, make it into that frame instead of the next; the
+ * report counts them.
+ */
+
+#include <stdio.h>
+
+#include "latency.h"
+#include "utils.h"
+
+
+void ResetInputLatency(struct InputLatency *pLatency)
+{
+    int i;
+
+    pLatency->first = 0;
+    pLatency->count = 0;
+    pLatency->dropped = 0;
+    pLatency->inputs = 0;
+    pLatency->lateLatched = 0;
+    ResetStat(&pLatency->latency);
+
+    for (i = 0; i <= LATENCY_BUCKETS; i++) {
+        pLatency->buckets[i] = 0;
+    }
+}
+
+
+/*
+ * Record that the inputs with the given timestamps (CLOCK_MONOTONIC,
+ * in seconds) are first reflected by the frame presented with
+ * 'serial', and whether they were late-latched into it.  Serials must
+ * not decrease from call to call.
+ */
+void AddFrameInputs(struct InputLatency *pLatency, uint64_t serial,
+                    const double *pInputTimes, int count, int lateLatched)
+{
+    int i;
+
+    pLatency->inputs += count;
+    if (lateLatched) {
+        pLatency->lateLatched += count;
+    }
+
+    for (i = 0; i < count; i++) {
+        struct PendingInput *pInput;
+
+        if (pLatency->count == MAX_PENDING_INPUTS) {
+            pLatency->dropped++;
+            continue;
+        }
+
+        pInput = &pLatency->pending[(pLatency->first + pLatency->count) %
+                                    MAX_PENDING_INPUTS];
+        pInput->inputTime = pInputTimes[i];
+        pInput->serial = serial;
+        pLatency->count++;
+    }
+}
+
+
+/*
+ * Record that the frame presented with 'serial' reached the screen at
+ * 'flipTime' (CLOCK_MONOTONIC, in seconds).
+ */
+void SetFrameFlipTime(struct InputLatency *pLatency, uint64_t serial,
+                      double flipTime)
+{
+    while (pLatency->count > 0) {
+        const struct PendingInput *pInput =
+            &pLatency->pending[pLatency->first];
+        double ms = (flipTime - pInput->inputTime) * 1000.0;
+        int bucket;
+
+        if (pInput->serial > serial) {
+            break;
+        }
+
+        AddStatSample(&pLatency->latency, ms);
+
+        bucket = (int) (ms / LATENCY_BUCKET_MS);
+        if ((bucket < 0) || (bucket > LATENCY_BUCKETS)) {
+            bucket = LATENCY_BUCKETS;
+        }
+        pLatency->buckets[bucket]++;
+
+        pLatency->first = (pLatency->first + 1) % MAX_PENDING_INPUTS;
+        pLatency->count--;
+    }
+}
+
+
+/*
+ * Return the latency, in ms, that 'percent' percent of the inputs
+ * were within, to the resolution of the histogram.
+ */
+static double Percentile(const struct InputLatency *pLatency,
+                         double percent)
+{
+    int target = (int) (pLatency->latency.count * percent / 100.0 + 0.5);
+    int sum = 0, i;
+
+    for (i = 0; i < LATENCY_BUCKETS; i++) {
+        sum += pLatency->buckets[i];
+        if (sum >= target) {
+            return (i + 1) * LATENCY_BUCKET_MS;
+        }
+    }
+
+    return pLatency->latency.max;
+}
+
+
+void PrintInputLatency(const struct InputLatency *pLatency)
+{
+    if (pLatency->latency.count == 0) {
+        printf("  %-24s no inputs reached the screen\n",
+               "input-to-photon");
+        return;
+    }
+
+    PrintStat("input-to-photon", &pLatency->latency, "ms");
+    printf("  %-24s p50 %8.3f  p90 %8.3f  p99 %8.3f ms (%d inputs)\n",
+           "", Percentile(pLatency, 50.0), Percentile(pLatency, 90.0),
+           Percentile(pLatency, 99.0), pLatency->latency.count);
+
+    if (pLatency->lateLatched > 0) {
+        printf("  %-24s %d of %d inputs late-latched\n", "",
+               pLatency->lateLatched, pLatency->inputs);
+    }
+
+    if (pLatency->dropped > 0) {
+        printf("  %-24s %d not timed: too many pending\n", "",
+               pLatency->dropped);
+    }
+
+    fflush(stdout);
+}
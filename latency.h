@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#if !defined(LATENCY_H)
+#define LATENCY_H
+
+#include <stdint.h>
+
+#include "stats.h"
+
+/* How many inputs can wait for the frame that shows them. */
+#define MAX_PENDING_INPUTS 256
+
+/* The input-to-photon latency histogram: 0.5 ms buckets up to 200 ms. */
+#define LATENCY_BUCKET_MS 0.5
+#define LATENCY_BUCKETS 400
+
+/*
+ * An input that changed what is drawn, waiting for the flip of the
+ * first frame that reflects it: the frame presented with 'serial'.
+ */
+struct PendingInput {
+    double inputTime;
+    uint64_t serial;
+};
+
+/*
+ * Input-to-photon latency, for --input-latency; see latency.c.
+ */
+struct InputLatency {
+    struct PendingInput pending[MAX_PENDING_INPUTS];
+    int first;
+    int count;
+
+    /* Inputs not timed because too many were pending. */
+    int dropped;
+
+    /*
+     * Inputs added, and how many of them were late-latched, i.e.,
+     * arrived after the frame's draw calls were submitted, and still
+     * made it in; see GearsFrameStarted().
+     */
+    int inputs;
+    int lateLatched;
+
+    struct Stat latency;
+    int buckets[LATENCY_BUCKETS + 1];
+};
+
+void ResetInputLatency(struct InputLatency *pLatency);
+void AddFrameInputs(struct InputLatency *pLatency, uint64_t serial,
+                    const double *pInputTimes, int count, int lateLatched);
+void SetFrameFlipTime(struct InputLatency *pLatency, uint64_t serial,
+                      double flipTime);
+void PrintInputLatency(const struct InputLatency *pLatency);
+
+#endif /* LATENCY_H */
@@ -0,0 +1,487 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * A DRM lease manager, and its client.
+ *
+ * The manager keeps the output this process displays on (the "head"),
+ * and listens on a Unix socket.  A lessee connects and sends a
+ * LeaseRequest; the manager picks a connected output other than the
+ * head, and not already leased, with a free CRTC and primary plane,
+ * leases the three objects, and replies with a LeaseReply and the
+ * lessee's DRM fd.  The lease lasts until the lessee closes the socket
+ * (or exits), at which point the manager revokes it.
+ *
+ * The manager runs on its own thread, so leases are served while the
+ * render loop keeps presenting to the head.  StopLeaseManager() wakes
+ * the thread through an eventfd, joins it, and revokes the leases,
+ * before the caller closes the DRM fd.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "ipc.h"
+#include "kms.h"
+#include "lease.h"
+#include "utils.h"
+
+#define MAX_LEASES 8
+
+/* Objects in each lease: a connector, a CRTC, and a plane. */
+#define LEASE_OBJECTS 3
+
+struct LeaseRequest {
+    /* The connector to lease (e.g., "DP-2"), or "" for any. */
+    char connectorName[32];
+};
+
+struct LeaseReply {
+    /* The connector leased, if the reply carries a lease fd. */
+    char connectorName[32];
+    uint32_t lesseeID;
+};
+
+struct Lease {
+    int clientFd;               /* -1 if this slot is unused */
+    uint32_t lesseeID;
+    struct KmsOutput output;
+};
+
+struct LeaseManager {
+    int drmFd;
+    int listenFd;
+
+    /* Written by StopLeaseManager() to stop the thread. */
+    int stopFd;
+    pthread_t thread;
+
+    /* Guards 'head', which SetLeaseManagerHead() changes. */
+    pthread_mutex_t mutex;
+    struct KmsOutput head;
+
+    struct Lease leases[MAX_LEASES];
+};
+
+
+static void AddOutputIDs(const struct KmsOutput *pOutput,
+                         uint32_t *pIDs, int *pCount)
+{
+    pIDs[(*pCount)++] = pOutput->connectorID;
+    pIDs[(*pCount)++] = pOutput->crtcID;
+    pIDs[(*pCount)++] = pOutput->planeID;
+}
+
+
+/*
+ * Find up to 'maxOutputs' outputs that could be leased: connected, and
+ * using none of the head's or the current leases' objects.  Return -1
+ * on failure.
+ */
+static int GetLeasableOutputs(const struct LeaseManager *pManager,
+                              struct KmsOutput *pOutputs, int maxOutputs)
+{
+    uint32_t usedIDs[LEASE_OBJECTS * (MAX_LEASES + 1)];
+    int numUsedIDs = 0;
+    int i;
+
+    AddOutputIDs(&pManager->head, usedIDs, &numUsedIDs);
+
+    for (i = 0; i < MAX_LEASES; i++) {
+        if (pManager->leases[i].clientFd >= 0) {
+            AddOutputIDs(&pManager->leases[i].output, usedIDs, &numUsedIDs);
+        }
+    }
+
+    return GetFreeOutputs(pManager->drmFd, usedIDs, numUsedIDs,
+                          pOutputs, maxOutputs);
+}
+
+
+/*
+ * Serve the request of a lessee that just connected.  If an output can
+ * be leased, the connection is kept until the lessee hangs up;
+ * otherwise, the reply carries no fd, and the connection is closed.
+ */
+static void GrantLease(struct LeaseManager *pManager, int clientFd)
+{
+    struct LeaseRequest request;
+    struct LeaseReply reply;
+    struct KmsOutput outputs[MAX_LEASES];
+    struct Lease *pLease = NULL;
+    const struct KmsOutput *pOutput = NULL;
+    int count, fd, i;
+    int leaseFd = -1;
+
+    if (ReceiveWithFd(clientFd, &request, sizeof(request), &fd) != 0) {
+        Warning("Dropped a lessee: %s", GetError());
+        close(clientFd);
+        return;
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    request.connectorName[sizeof(request.connectorName) - 1] = '\0';
+
+    memset(&reply, 0, sizeof(reply));
+
+    for (i = 0; i < MAX_LEASES; i++) {
+        if (pManager->leases[i].clientFd < 0) {
+            pLease = &pManager->leases[i];
+            break;
+        }
+    }
+
+    count = (pLease != NULL) ?
+        GetLeasableOutputs(pManager, outputs, ARRAY_LEN(outputs)) : 0;
+
+    if (count < 0) {
+        Warning("%s", GetError());
+        count = 0;
+    }
+
+    for (i = 0; i < count; i++) {
+        if ((request.connectorName[0] == '\0') ||
+            (strcasecmp(request.connectorName, outputs[i].name) == 0)) {
+            pOutput = &outputs[i];
+            break;
+        }
+    }
+
+    if (pOutput != NULL) {
+        uint32_t objects[LEASE_OBJECTS];
+        int numObjects = 0;
+
+        AddOutputIDs(pOutput, objects, &numObjects);
+
+        leaseFd = drmModeCreateLease(pManager->drmFd, objects, numObjects,
+                                     O_CLOEXEC, &reply.lesseeID);
+
+        if (leaseFd < 0) {
+            Warning("Unable to lease %s: %s.\n", pOutput->name,
+                    strerror(-leaseFd));
+        } else {
+            snprintf(reply.connectorName, sizeof(reply.connectorName),
+                     "%s", pOutput->name);
+        }
+    }
+
+    if (SendWithFd(clientFd, &reply, sizeof(reply), leaseFd) != 0) {
+        Warning("Dropped a lessee: %s", GetError());
+        if (leaseFd >= 0) {
+            drmModeRevokeLease(pManager->drmFd, reply.lesseeID);
+            close(leaseFd);
+        }
+        close(clientFd);
+        return;
+    }
+
+    if (leaseFd < 0) {
+        printf("Refused a lease of %s.\n",
+               request.connectorName[0] ? request.connectorName :
+               "any output");
+        close(clientFd);
+        return;
+    }
+
+    /* The lessee has its own fd for the lease now. */
+    close(leaseFd);
+
+    pLease->clientFd = clientFd;
+    pLease->lesseeID = reply.lesseeID;
+    pLease->output = *pOutput;
+
+    printf("Leased %s (CRTC 0x%08x, plane 0x%08x) to lessee %u.\n",
+           pOutput->name, pOutput->crtcID, pOutput->planeID,
+           reply.lesseeID);
+    fflush(stdout);
+}
+
+
+static void EndLease(struct LeaseManager *pManager, struct Lease *pLease)
+{
+    /*
+     * If the lessee exited, closing its last fd for the lease already
+     * ended it, and this fails harmlessly.
+     */
+    drmModeRevokeLease(pManager->drmFd, pLease->lesseeID);
+
+    close(pLease->clientFd);
+    pLease->clientFd = -1;
+
+    printf("Lease of %s to lessee %u ended.\n",
+           pLease->output.name, pLease->lesseeID);
+    fflush(stdout);
+}
+
+
+static void *LeaseManagerThread(void *data)
+{
+    struct LeaseManager *pManager = data;
+
+    while (1) {
+        struct pollfd pfds[2 + MAX_LEASES];
+        struct Lease *pLeases[2 + MAX_LEASES];
+        int count = 0, i;
+
+        pfds[count].fd = pManager->stopFd;
+        pfds[count].events = POLLIN;
+        pLeases[count++] = NULL;
+
+        pfds[count].fd = pManager->listenFd;
+        pfds[count].events = POLLIN;
+        pLeases[count++] = NULL;
+
+        for (i = 0; i < MAX_LEASES; i++) {
+            if (pManager->leases[i].clientFd >= 0) {
+                pfds[count].fd = pManager->leases[i].clientFd;
+                pfds[count].events = POLLIN;
+                pLeases[count++] = &pManager->leases[i];
+            }
+        }
+
+        if (poll(pfds, count, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            Warning("poll(2) failed: %s; no longer leasing outputs.\n",
+                    strerror(errno));
+            break;
+        }
+
+        if (pfds[0].revents != 0) {
+            break;
+        }
+
+        pthread_mutex_lock(&pManager->mutex);
+
+        /*
+         * Lessees send nothing after their request, so a lessee's socket
+         * becoming readable means it hung up.
+         */
+        for (i = 2; i < count; i++) {
+            if (pfds[i].revents != 0) {
+                EndLease(pManager, pLeases[i]);
+            }
+        }
+
+        if (pfds[1].revents & POLLIN) {
+            int clientFd = AcceptConnection(pManager->listenFd);
+
+            if (clientFd >= 0) {
+                GrantLease(pManager, clientFd);
+            } else {
+                Warning("%s", GetError());
+            }
+        }
+
+        pthread_mutex_unlock(&pManager->mutex);
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Lease the outputs of 'drmFd' other than 'pHead' to processes that
+ * connect to 'socketPath', from a background thread, until
+ * StopLeaseManager().  Return NULL on failure.
+ */
+struct LeaseManager *StartLeaseManager(int drmFd,
+                                       const struct KmsOutput *pHead,
+                                       const char *socketPath)
+{
+    struct LeaseManager *pManager = calloc(1, sizeof(*pManager));
+    struct KmsOutput outputs[MAX_LEASES];
+    int count, i;
+
+    if (pManager == NULL) {
+        SetError("Memory allocation failure.\n");
+        return NULL;
+    }
+
+    if (drmFd < 0) {
+        SetError("Leasing outputs requires DRM access.\n");
+        free(pManager);
+        return NULL;
+    }
+
+    pManager->drmFd = drmFd;
+    pManager->head = *pHead;
+
+    pManager->stopFd = eventfd(0, EFD_CLOEXEC);
+
+    if (pManager->stopFd < 0) {
+        SetError("Unable to create an eventfd: %s.\n", strerror(errno));
+        goto fail;
+    }
+
+    for (i = 0; i < MAX_LEASES; i++) {
+        pManager->leases[i].clientFd = -1;
+    }
+
+    pManager->listenFd = ListenOnSocket(socketPath);
+
+    if (pManager->listenFd < 0) {
+        goto failStopFd;
+    }
+
+    count = GetLeasableOutputs(pManager, outputs, ARRAY_LEN(outputs));
+
+    if (count < 0) {
+        goto failListenFd;
+    }
+
+    printf("Keeping %s; leasing on %s:", pHead->name, socketPath);
+    for (i = 0; i < count; i++) {
+        printf(" %s", outputs[i].name);
+    }
+    printf("%s\n", (count == 0) ? " (no other outputs connected)" : "");
+    fflush(stdout);
+
+    pthread_mutex_init(&pManager->mutex, NULL);
+
+    if (pthread_create(&pManager->thread, NULL, LeaseManagerThread,
+                       pManager) != 0) {
+        SetError("Unable to start the lease manager thread.\n");
+        pthread_mutex_destroy(&pManager->mutex);
+        goto failListenFd;
+    }
+
+    return pManager;
+
+failListenFd:
+    close(pManager->listenFd);
+failStopFd:
+    close(pManager->stopFd);
+fail:
+    free(pManager);
+    return NULL;
+}
+
+
+/*
+ * Keep 'pHead' from being leased, instead of the head given before,
+ * e.g., once the display pipeline has restarted on a new CRTC.
+ */
+void SetLeaseManagerHead(struct LeaseManager *pManager,
+                         const struct KmsOutput *pHead)
+{
+    pthread_mutex_lock(&pManager->mutex);
+    pManager->head = *pHead;
+    pthread_mutex_unlock(&pManager->mutex);
+}
+
+
+/*
+ * Stop the lease manager thread, revoke every lease, and free the
+ * manager.  The DRM fd is left open.
+ */
+void StopLeaseManager(struct LeaseManager *pManager)
+{
+    uint64_t one = 1;
+    int i;
+
+    if (write(pManager->stopFd, &one, sizeof(one)) != sizeof(one)) {
+        Warning("Unable to stop the lease manager: %s.\n", strerror(errno));
+    }
+
+    pthread_join(pManager->thread, NULL);
+
+    for (i = 0; i < MAX_LEASES; i++) {
+        if (pManager->leases[i].clientFd >= 0) {
+            EndLease(pManager, &pManager->leases[i]);
+        }
+    }
+
+    close(pManager->listenFd);
+    close(pManager->stopFd);
+    pthread_mutex_destroy(&pManager->mutex);
+    free(pManager);
+}
+
+
+/*
+ * Lease an output from the manager listening on 'socketPath': the
+ * connector named 'connectorName', or any if it is NULL.  Return a DRM
+ * fd that is master of just that connector, a CRTC, and a primary
+ * plane, or -1 on failure.
+ *
+ * The lease lasts as long as the connection, so the socket is left
+ * open until the process exits.
+ */
+int AcquireLease(const char *socketPath, const char *connectorName)
+{
+    struct LeaseRequest request;
+    struct LeaseReply reply;
+    int sockFd, leaseFd;
+
+    memset(&request, 0, sizeof(request));
+
+    if (connectorName != NULL) {
+        snprintf(request.connectorName, sizeof(request.connectorName),
+                 "%s", connectorName);
+    }
+
+    sockFd = ConnectToSocket(socketPath);
+
+    if (sockFd < 0) {
+        return -1;
+    }
+
+    if ((SendWithFd(sockFd, &request, sizeof(request), -1) != 0) ||
+        (ReceiveWithFd(sockFd, &reply, sizeof(reply), &leaseFd) != 0)) {
+        close(sockFd);
+        return -1;
+    }
+
+    if (leaseFd < 0) {
+        if (connectorName != NULL) {
+            SetError("Output %s is not available for lease from %s.\n",
+                     connectorName, socketPath);
+        } else {
+            SetError("No output is available for lease from %s.\n",
+                     socketPath);
+        }
+        close(sockFd);
+        return -1;
+    }
+
+    reply.connectorName[sizeof(reply.connectorName) - 1] = '\0';
+
+    printf("Leased %s as lessee %u.\n", reply.connectorName, reply.lesseeID);
+
+    return leaseFd;
+}
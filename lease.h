@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#if !defined(LEASE_H)
+#define LEASE_H
+
+#include "kms.h"
+
+/*
+ * DRM leases (drmModeCreateLease()) let the DRM master hand a set of
+ * connectors, CRTCs, and planes to another process, which becomes DRM
+ * master of just those objects: e.g., a VR runtime driving a headset
+ * directly, with no compositor in the path.
+ */
+
+struct LeaseManager;
+
+struct LeaseManager *StartLeaseManager(int drmFd,
+                                       const struct KmsOutput *pHead,
+                                       const char *socketPath);
+void SetLeaseManagerHead(struct LeaseManager *pManager,
+                         const struct KmsOutput *pHead);
+void StopLeaseManager(struct LeaseManager *pManager);
+
+int AcquireLease(const char *socketPath, const char *connectorName);
+
+#endif /* LEASE_H */
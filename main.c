@@ -20,42 +20,1213 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
 #include "utils.h"
+#include "options.h"
+#include "stats.h"
+#include "ipc.h"
+#include "lease.h"
+#include "backend.h"
+#include "capture.h"
+#include "device.h"
 #include "egl.h"
 #include "kms.h"
 #include "eglgears.h"
+#include "output.h"
+#include "realtime.h"
+#include "memlock.h"
+#include "eventloop.h"
+#include "input.h"
+#include "latency.h"
+
+#if defined(HAVE_WAYLAND)
+#include "compositor.h"
+#endif
 
 /*
- * Example code demonstrating how to connect EGL to DRM KMS using
- * EGLStreams.
+ * Frames to render before the benchmark starts recording, so that
+ * one-time costs (shader compilation, the first modeset, filling the
+ * stream's FIFO) are not counted.
+ */
+#define BENCHMARK_WARMUP_FRAMES 60
+
+/*
+ * With --lock-memory, how many over-budget frames to report one by one
+ * before only counting them.
+ */
+#define MAX_REPORTED_OVER_BUDGET_FRAMES 10
+
+/* How long to wait before trying again to start a failed pipeline. */
+#define RESTART_RETRY_SECONDS 1
+
+/*
+ * Why RenderLoop() returned: it rendered all the benchmark frames or
+ * was asked to stop, the display pipeline must be set up again, or the
+ * loop could not start, with the reason in GetError().
+ */
+enum LoopExit {
+    LOOP_DONE,
+    LOOP_RESTART,
+    LOOP_FAILED,
+};
+
+/*
+ * Set by the signal handlers; see InstallSignalHandlers().  With
+ * --event-loop, set from the signalfd instead, and by the Escape and q
+ * keys of the --input devices.
+ */
+static volatile sig_atomic_t stopRequested = 0;
+static volatile sig_atomic_t restartRequested = 0;
+
+/*
+ * With --event-loop, the signalfd that SIGINT, SIGTERM, and SIGHUP
+ * arrive on, and the --input devices (-1 for a device that went away).
+ */
+static int signalFd = -1;
+static int inputFds[MAX_INPUT_DEVICES];
+
+/*
+ * With --event-loop, the render loop's event sources, and what they
+ * have reported since the last frame; see WaitForFrame().
+ */
+struct FrameEvents {
+    struct EventLoop *pLoop;
+    struct Backend *pBackend;
+    int timerFd;
+
+    /* Set when the frame timer expires; cleared when a frame starts. */
+    int frameDue;
+
+    /* Set when dispatching the backend's events failed. */
+    int backendFailed;
+
+    struct InputState input;
+};
+
+/*
+ * The message a server sends to a render client, along with the file
+ * descriptor of the EGLStream the client should produce frames for.
+ */
+struct StreamAnnouncement {
+    uint32_t width;
+    uint32_t height;
+
+    /* How the client must turn frames that the plane does not. */
+    struct Orientation renderOrientation;
+
+    /* The display's refresh rate in Hz, for --sched=deadline. */
+    double refreshRate;
+};
+
+
+static void HandleStopSignal(int sig)
+{
+    (void) sig;
+    stopRequested = 1;
+}
+
+
+static void HandleRestartSignal(int sig)
+{
+    (void) sig;
+    restartRequested = 1;
+}
+
+
+/*
+ * Make SIGINT and SIGTERM end the render loop, so that the display
+ * pipeline is torn down and the display restored before exiting, and
+ * SIGHUP restart the display pipeline.
+ */
+static void InstallSignalHandlers(void)
+{
+    struct sigaction action;
+
+    memset(&action, 0, sizeof(action));
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+
+    action.sa_handler = HandleStopSignal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    action.sa_handler = HandleRestartSignal;
+    sigaction(SIGHUP, &action, NULL);
+}
+
+
+static void HandleSignalEvent(int fd, void *data)
+{
+    int sig;
+
+    (void) data;
+
+    while ((sig = ReadSignalFd(fd)) != 0) {
+        if (sig == SIGHUP) {
+            restartRequested = 1;
+        } else {
+            stopRequested = 1;
+        }
+    }
+}
+
+
+static void HandleFrameTimer(int fd, void *data)
+{
+    struct FrameEvents *pEvents = data;
+
+    if (ReadFrameTimer(fd) > 0) {
+        pEvents->frameDue = 1;
+    }
+}
+
+
+static void HandleBackendEvents(int fd, void *data)
+{
+    struct FrameEvents *pEvents = data;
+    struct Backend *pBackend = pEvents->pBackend;
+
+    (void) fd;
+
+    if (pBackend->dispatchEvents(pBackend) != 0) {
+        pEvents->backendFailed = 1;
+    }
+}
+
+
+static void HandleInputEvents(int fd, void *data)
+{
+    struct FrameEvents *pEvents = data;
+    int i;
+
+    if (ReadInputEvents(fd, &pEvents->input)) {
+        if (pEvents->input.quit) {
+            stopRequested = 1;
+        }
+        return;
+    }
+
+    Warning("An input device went away; no longer reading it.\n");
+
+    RemoveEventSource(pEvents->pLoop, fd);
+    close(fd);
+
+    for (i = 0; i < MAX_INPUT_DEVICES; i++) {
+        if (inputFds[i] == fd) {
+            inputFds[i] = -1;
+        }
+    }
+}
+
+
+static void StopFrameEvents(struct FrameEvents *pEvents)
+{
+    DestroyEventLoop(pEvents->pLoop);
+    close(pEvents->timerFd);
+}
+
+
+/*
+ * Set up the event loop for a run of the render loop on 'pBackend':
+ * a frame timer at 'refreshRate', the signalfd, the backend's events,
+ * and the input devices.  Return -1 on failure.
+ */
+static int StartFrameEvents(struct FrameEvents *pEvents,
+                            struct Backend *pBackend,
+                            const struct Options *pOptions,
+                            double refreshRate)
+{
+    int i;
+
+    memset(pEvents, 0, sizeof(*pEvents));
+
+    pEvents->pLoop = CreateEventLoop();
+    pEvents->pBackend = pBackend;
+
+    if (pEvents->pLoop == NULL) {
+        return -1;
+    }
+
+    pEvents->timerFd = CreateFrameTimer(refreshRate);
+
+    if (pEvents->timerFd < 0) {
+        DestroyEventLoop(pEvents->pLoop);
+        return -1;
+    }
+
+    if ((AddEventSource(pEvents->pLoop, signalFd,
+                        HandleSignalEvent, NULL) != 0) ||
+        (AddEventSource(pEvents->pLoop, pEvents->timerFd,
+                        HandleFrameTimer, pEvents) != 0)) {
+        goto fail;
+    }
+
+    if ((pBackend->dispatchEvents != NULL) &&
+        (AddEventSource(pEvents->pLoop, pBackend->eventFd,
+                        HandleBackendEvents, pEvents) != 0)) {
+        goto fail;
+    }
+
+    for (i = 0; i < pOptions->numInputs; i++) {
+        if ((inputFds[i] >= 0) &&
+            (AddEventSource(pEvents->pLoop, inputFds[i],
+                            HandleInputEvents, pEvents) != 0)) {
+            goto fail;
+        }
+    }
+
+    return 0;
+
+fail:
+    StopFrameEvents(pEvents);
+    return -1;
+}
+
+
+/*
+ * With --event-loop, sleep until the next frame is worth rendering,
+ * handling DRM events, signals, and input meanwhile: until the frame
+ * timer has expired since the last frame started, and, with 'mailbox',
+ * the display holds no frame waiting behind the one it is flipping to
+ * (the next frame would only replace it).  Return early if asked to
+ * stop or restart.  Return -1 if dispatching the events failed, with
+ * the reason in GetError().
+ */
+static int WaitForFrame(struct FrameEvents *pEvents, int mailbox)
+{
+    struct Backend *pBackend = pEvents->pBackend;
+
+    while (!stopRequested && !restartRequested) {
+        if (pEvents->frameDue &&
+            (!mailbox || (pBackend->getQueueDepth(pBackend) <= 1))) {
+            pEvents->frameDue = 0;
+            return 0;
+        }
+
+        if ((DispatchEvents(pEvents->pLoop, -1) < 0) ||
+            pEvents->backendFailed) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Turn the view as the input devices asked since the last frame, or
+ * since the last call, for the frame presented with 'serial'.  If
+ * 'pLatency' is not NULL, the inputs are timed until that frame
+ * reaches the screen, and counted as 'lateLatched' or not.
+ */
+static void TakeInput(struct InputState *pInput, struct Gears *pGears,
+                      struct InputLatency *pLatency, uint64_t serial,
+                      int lateLatched)
+{
+    if ((pInput->rotX != 0.0f) || (pInput->rotY != 0.0f) ||
+        (pInput->rotZ != 0.0f)) {
+        RotateGearsView(pGears, pInput->rotX, pInput->rotY, pInput->rotZ);
+        pInput->rotX = 0.0f;
+        pInput->rotY = 0.0f;
+        pInput->rotZ = 0.0f;
+    }
+
+    if (pLatency != NULL) {
+        AddFrameInputs(pLatency, serial, pInput->eventTimes,
+                       pInput->numEventTimes, lateLatched);
+    }
+
+    pInput->numEventTimes = 0;
+}
+
+
+/*
+ * With --late-latch, once the frame's draw calls are submitted, keep
+ * turning the view as input arrives, until the GPU reaches the frame
+ * and copies the view (see GearsFrameStarted()), or for at most
+ * 'maxWait' seconds, if the GPU is that far behind.  Input that arrives
+ * after the GPU has started the frame is left for the next one.
+ * Return -1 if dispatching the events failed.
+ */
+static int LatchInput(struct FrameEvents *pEvents, struct Gears *pGears,
+                      struct InputLatency *pLatency, uint64_t serial,
+                      double maxWait)
+{
+    double deadline = GetTime() + maxWait;
+
+    while (!GearsFrameStarted(pGears) && (GetTime() < deadline) &&
+           !stopRequested && !restartRequested) {
+        if ((DispatchEvents(pEvents->pLoop, 1) < 0) ||
+            pEvents->backendFailed) {
+            return -1;
+        }
+
+        if (!GearsFrameStarted(pGears)) {
+            TakeInput(&pEvents->input, pGears, pLatency, serial, 1);
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Replace the thread counters in *pCounters, read at the start of a
+ * frame, with how much each has grown since.
  */
+static void EndFrameCounters(struct ThreadCounters *pCounters)
+{
+    struct ThreadCounters end;
+
+    ReadThreadCounters(&end);
+
+    pCounters->preemptions = end.preemptions - pCounters->preemptions;
+    pCounters->minorFaults = end.minorFaults - pCounters->minorFaults;
+    pCounters->majorFaults = end.majorFaults - pCounters->majorFaults;
+
+    if (pCounters->allocations >= 0) {
+        pCounters->allocations = end.allocations - pCounters->allocations;
+    }
+}
+
 
-int main(void)
+/*
+ * With --lock-memory, report a frame that allocated memory or took a
+ * page fault, and count it in *pOverBudgetFrames.
+ */
+static void CheckFrameBudget(int frame, const struct ThreadCounters *pCounters,
+                             int *pOverBudgetFrames)
 {
+    if ((pCounters->allocations <= 0) &&
+        (pCounters->minorFaults == 0) &&
+        (pCounters->majorFaults == 0)) {
+        return;
+    }
+
+    (*pOverBudgetFrames)++;
+
+    if (*pOverBudgetFrames <= MAX_REPORTED_OVER_BUDGET_FRAMES) {
+        Warning("Frame %d is over budget: %ld allocations, %ld minor and "
+                "%ld major page faults.\n", frame,
+                (pCounters->allocations > 0) ? pCounters->allocations : 0,
+                pCounters->minorFaults, pCounters->majorFaults);
+    }
+
+    if (*pOverBudgetFrames == MAX_REPORTED_OVER_BUDGET_FRAMES) {
+        Warning("Counting further over-budget frames without reporting "
+                "them.\n");
+    }
+}
+
+
+/*
+ * Report why presenting a frame failed; the pipeline is then restarted.
+ */
+static enum LoopExit PipelineFailed(void)
+{
+    Warning("%s", GetError());
+    Warning("The display pipeline failed; restarting.\n");
+
+    return LOOP_RESTART;
+}
+
+
+/*
+ * Render frames and present them through the backend, either until
+ * stopped or, when benchmarking, for a fixed number of frames.
+ *
+ * Return LOOP_RESTART if a restart was requested (SIGHUP), the
+ * rendering context was lost, e.g., to a GPU reset, or presenting
+ * failed, e.g., because the connector went away; the caller should then
+ * tear down the display pipeline and set it up again.  Return
+ * LOOP_FAILED if the --event-loop sources could not be set up.
+ *
+ * With --frames-in-flight=N, each frame's rendering is followed by a
+ * GPU fence, and before starting a frame the CPU waits for the fence of
+ * the frame N frames earlier.  That bounds how far the CPU can run
+ * ahead of the GPU without relying on eglSwapBuffers() to block, which
+ * in the mailbox present mode it never does.  The CPU only stalls when
+ * the GPU is actually N frames behind.
+ *
+ * With --partial-updates, each frame repaints only what changed since
+ * the back buffer's contents were drawn, and passes the changed area
+ * to the backend so the display side can limit its update to it.
+ *
+ * With --capture, 'pCapture' reads frames back as they are presented.
+ * With --telemetry, each frame is published to 'pTelemetry'.
+ *
+ * With --lock-memory, every frame after warm-up must neither allocate
+ * memory nor take a page fault; each one that does is reported.
+ *
+ * With --event-loop, the loop sleeps between frames, and starts one
+ * per refresh period of the display ('refreshRate' Hz, 0 if unknown);
+ * see WaitForFrame().
+ *
+ * With --input-latency, each frame gets a serial, passed to the backend
+ * with the frame, and the inputs first applied to a frame are timed
+ * until its page flip; see latency.c.
+ *
+ * With --late-latch, the input that arrives after the frame's draw
+ * calls are submitted still turns that frame, until the GPU reaches
+ * them; see LatchInput().
+ */
+static enum LoopExit RenderLoop(struct Backend *pBackend,
+                                struct Gears *pGears,
+                                const struct Options *pOptions,
+                                struct Capture *pCapture,
+                                struct Telemetry *pTelemetry,
+                                const char *title, double refreshRate)
+{
+    enum LoopExit loopExit = LOOP_DONE;
+    const struct EglDispatch *pEgl = &pBackend->egl;
+    EGLDisplay eglDpy = pBackend->eglDpy;
+    EGLSurface eglSurface = pBackend->eglSurface;
+    struct PresentStats presentStats;
+    struct PartialUpdates partial;
+    struct FpsCounter fps;
+    struct FrameEvents events;
+    struct InputLatency inputLatency;
+    int fenceFds[MAX_FRAMES_IN_FLIGHT];
+    int framesInFlight = pOptions->framesInFlight;
+    int partialUpdates = pOptions->partialUpdates;
+    int lateLatch = pOptions->lateLatch;
+    int countFrames = (pOptions->benchmarkFrames > 0) || pOptions->lockMemory;
+    int mailbox = (pOptions->presentMode == PRESENT_MODE_LATENCY);
+    double latchWait = 1.0 / ((refreshRate > 0.0) ? refreshRate : 60.0);
+    int overBudgetFrames = 0;
+    int frame, i;
+
+    if (pOptions->eventLoop &&
+        (StartFrameEvents(&events, pBackend, pOptions, refreshRate) != 0)) {
+        return LOOP_FAILED;
+    }
+
+    ResetPresentStats(&presentStats);
+    ResetFpsCounter(&fps);
+    ResetInputLatency(&inputLatency);
+
+    for (i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        fenceFds[i] = -1;
+    }
+
+    if ((framesInFlight > 0) && !GpuFencesSupported(eglDpy)) {
+        Warning("EGL_ANDROID_native_fence_sync not found; "
+                "not limiting frames in flight.\n");
+        framesInFlight = 0;
+    }
+
+    if (partialUpdates &&
+        !SetUpPartialUpdates(pEgl, eglDpy, eglSurface, &partial)) {
+        partialUpdates = 0;
+    }
+
+    if (lateLatch && !EnableGearsLateLatch(pGears)) {
+        lateLatch = 0;
+    }
+
+    if (pCapture != NULL) {
+        AttachCapture(pCapture, pBackend->width, pBackend->height);
+    }
+
+    if (pTelemetry != NULL) {
+        AttachTelemetry(pTelemetry);
+        pBackend->pTelemetry = pTelemetry;
+    }
+
+    if (pOptions->lockMemory) {
+        PrefaultStack();
+    }
+
+    /*
+     * A failure while rendering or presenting, e.g., a commit the
+     * kernel rejects after a hot-unplug, ends the loop rather than the
+     * process, so that the pipeline can be set up again.
+     */
+    for (frame = 0;
+         (pOptions->benchmarkFrames == 0) ||
+         (frame < pOptions->benchmarkFrames + BENCHMARK_WARMUP_FRAMES);
+         frame++) {
+
+        double drawStart, drawEnd, swapStart, swapEnd;
+        struct Rect damage;
+        int *pFenceFd = NULL;
+        uint64_t frameId = 0;
+        struct ThreadCounters frameCounters;
+
+        if (pOptions->eventLoop && (WaitForFrame(&events, mailbox) != 0)) {
+            loopExit = PipelineFailed();
+            break;
+        }
+
+        if (stopRequested) {
+            break;
+        }
+
+        if (restartRequested) {
+            restartRequested = 0;
+            loopExit = LOOP_RESTART;
+            break;
+        }
+
+        if ((pOptions->benchmarkFrames > 0) &&
+            (frame == BENCHMARK_WARMUP_FRAMES)) {
+            pBackend->pStats = &presentStats;
+
+            if (pOptions->inputLatency) {
+                pBackend->pInputLatency = &inputLatency;
+            }
+        }
+
+        if (countFrames) {
+            ReadThreadCounters(&frameCounters);
+        }
+
+        if (framesInFlight > 0) {
+            pFenceFd = &fenceFds[frame % framesInFlight];
+
+            if (*pFenceFd >= 0) {
+                double waitStart = GetTime();
+                int waited = WaitForFence(*pFenceFd);
+
+                close(*pFenceFd);
+                *pFenceFd = -1;
+
+                if (waited != 0) {
+                    loopExit = PipelineFailed();
+                    break;
+                }
+
+                if (frame >= BENCHMARK_WARMUP_FRAMES) {
+                    AddFenceWaitSample(&presentStats, waitStart, GetTime());
+                }
+            }
+        }
+
+        if (pTelemetry != NULL) {
+            frameId = BeginTelemetryFrame(pTelemetry);
+        }
+
+        if (pOptions->eventLoop) {
+            TakeInput(&events.input, pGears, pBackend->pInputLatency,
+                      frame + 1, 0);
+        }
+
+        drawStart = GetTime();
+
+        if (partialUpdates) {
+            DrawGearsPartial(pGears,
+                             QueryBufferAge(eglDpy, eglSurface, &partial),
+                             &damage);
+        } else {
+            DrawGears(pGears);
+        }
+
+        drawEnd = GetTime();
+
+        if (pTelemetry != NULL) {
+            EndTelemetryDraw(pTelemetry);
+        }
+
+        if (lateLatch &&
+            (LatchInput(&events, pGears, pBackend->pInputLatency,
+                        frame + 1, latchWait) != 0)) {
+            loopExit = PipelineFailed();
+            break;
+        }
+
+        if (pCapture != NULL) {
+            CaptureFrame(pCapture, frame);
+        }
+
+        if (framesInFlight > 0) {
+            *pFenceFd = CreateGpuFence(pEgl, eglDpy);
+
+            if (*pFenceFd < 0) {
+                loopExit = PipelineFailed();
+                break;
+            }
+        }
+
+        swapStart = GetTime();
+        pBackend->telemetryFrameId = frameId;
+        pBackend->presentSerial = frame + 1;
+
+        if (pBackend->present(pBackend,
+                              partialUpdates ? &damage : NULL) != 0) {
+            loopExit = PipelineFailed();
+            break;
+        }
+
+        swapEnd = GetTime();
+
+        if (pTelemetry != NULL) {
+            PublishTelemetryFrame(pTelemetry, frameId,
+                                  drawStart, drawEnd, swapEnd);
+        }
+
+        if (countFrames) {
+            EndFrameCounters(&frameCounters);
+        }
+
+        if (pOptions->lockMemory && (frame >= BENCHMARK_WARMUP_FRAMES)) {
+            CheckFrameBudget(frame, &frameCounters, &overBudgetFrames);
+        }
+
+        if (eglGetError() == EGL_CONTEXT_LOST) {
+            Warning("The rendering context was lost; restarting.\n");
+            loopExit = LOOP_RESTART;
+            break;
+        }
+
+        if (pOptions->benchmarkFrames == 0) {
+            PrintFps(&fps);
+        } else if (frame >= BENCHMARK_WARMUP_FRAMES) {
+            AddDrawSample(&presentStats, drawStart, drawEnd);
+            AddPresentSample(&presentStats, swapStart, swapEnd,
+                             pBackend->getQueueDepth(pBackend));
+            AddPreemptionSample(&presentStats, frameCounters.preemptions);
+            AddMemorySample(&presentStats, frameCounters.allocations,
+                            frameCounters.minorFaults,
+                            frameCounters.majorFaults);
+        }
+    }
+
+    if (pOptions->benchmarkFrames > 0) {
+        PrintPresentStats(&presentStats, title);
+
+        if (pOptions->inputLatency) {
+            PrintInputLatency(&inputLatency);
+        }
+    } else if (overBudgetFrames > 0) {
+        Warning("%d frames were over budget.\n", overBudgetFrames);
+    }
+
+    pBackend->pStats = NULL;
+    pBackend->pInputLatency = NULL;
+
+    if (pOptions->eventLoop) {
+        StopFrameEvents(&events);
+    }
+
+    if (pCapture != NULL) {
+        DetachCapture(pCapture);
+    }
+
+    if (pTelemetry != NULL) {
+        DetachTelemetry(pTelemetry);
+        pBackend->pTelemetry = NULL;
+    }
+
+    for (i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        if (fenceFds[i] >= 0) {
+            close(fenceFds[i]);
+        }
+    }
+
+    return loopExit;
+}
+
+
+/*
+ * Start the output, retrying until it starts or a stop is requested.
+ * Return whether it started.
+ */
+static int RestartOutput(struct Output *pOutput)
+{
+    char error[256];
+
+    while (StartOutput(pOutput, error, sizeof(error)) != 0) {
+        Warning("%s", error);
+        Warning("Unable to restart the display pipeline; retrying.\n");
+
+        sleep(RESTART_RETRY_SECONDS);
+
+        if (signalFd >= 0) {
+            HandleSignalEvent(signalFd, NULL);
+        }
+
+        if (stopRequested) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+/*
+ * Render until stopped.  On a restart, tear down everything but the
+ * probe of the display, and set it up again: that skips GPU discovery
+ * and output probing, which take most of the startup time.  A pipeline
+ * that fails to come back is retried rather than ending the process.
+ */
+static void RunStandalone(const struct Options *pOptions)
+{
+    struct Output *pOutput;
+    struct Backend *pBackend;
+    struct Capture *pCapture = NULL;
+    struct Telemetry *pTelemetry = NULL;
+    struct LeaseManager *pLeaseManager = NULL;
+    struct Realtime *pRealtime;
+    enum LoopExit loopExit;
+    double restartStart = 0.0;
+    char error[256];
+    char title[96];
+
+    pOutput = CreateOutput(pOptions, error, sizeof(error));
+
+    if ((pOutput == NULL) ||
+        (StartOutput(pOutput, error, sizeof(error)) != 0)) {
+        Fatal("%s", error);
+    }
+
+    pBackend = GetOutputBackend(pOutput);
+
+    loopExit = LOOP_FAILED;
+
+    if (pOptions->capturePath != NULL) {
+        pCapture = StartCapture(pOptions->capturePath,
+                                pOptions->captureInterval);
+
+        if (pCapture == NULL) {
+            snprintf(error, sizeof(error), "%s", GetError());
+            goto done;
+        }
+    }
+
+    if (pOptions->telemetryName != NULL) {
+        pTelemetry = StartTelemetry(pOptions->telemetryName);
+
+        if (pTelemetry == NULL) {
+            snprintf(error, sizeof(error), "%s", GetError());
+            goto done;
+        }
+    }
+
+    if (pOptions->leaseServerPath != NULL) {
+        pLeaseManager = StartLeaseManager(pBackend->drmFd,
+                                          &pBackend->kmsOutput,
+                                          pOptions->leaseServerPath);
+
+        if (pLeaseManager == NULL) {
+            snprintf(error, sizeof(error), "%s", GetError());
+            goto done;
+        }
+    }
+
+    while (1) {
+        snprintf(title, sizeof(title), "%s %s", pBackend->name,
+                 PresentModeName(pOptions->presentMode));
+
+        pRealtime = EnterRealtime(pOptions, GetOutputRefresh(pOutput));
+        loopExit = RenderLoop(pBackend, GetOutputGears(pOutput), pOptions,
+                              pCapture, pTelemetry, title,
+                              GetOutputRefresh(pOutput));
+
+        if (loopExit == LOOP_FAILED) {
+            snprintf(error, sizeof(error), "%s", GetError());
+        }
+
+        LeaveRealtime(pRealtime);
+
+        restartStart = GetTime();
+
+        StopOutput(pOutput);
+
+        if ((loopExit != LOOP_RESTART) || !RestartOutput(pOutput)) {
+            break;
+        }
+
+        printf("Restarted the display pipeline in %.3f ms\n",
+               (GetTime() - restartStart) * 1000.0);
+
+        if (pLeaseManager != NULL) {
+            SetLeaseManagerHead(pLeaseManager, &pBackend->kmsOutput);
+        }
+    }
+
+done:
+    if (pCapture != NULL) {
+        StopCapture(pCapture);
+    }
+
+    if (pTelemetry != NULL) {
+        StopTelemetry(pTelemetry);
+    }
+
+    /* The lease manager uses the DRM fd that DestroyOutput() closes. */
+    if (pLeaseManager != NULL) {
+        StopLeaseManager(pLeaseManager);
+    }
+
+    DestroyOutput(pOutput);
+
+    if (loopExit == LOOP_FAILED) {
+        Fatal("%s", error);
+    }
+}
+
+
+/*
+ * Own the display, and serve one render client at a time.
+ *
+ * For each client, create an EGLStream consumed by the plane, and send
+ * the client the stream's file descriptor; the client connects itself
+ * as the producer.  If the client exits, cleanly or not, the plane
+ * keeps showing its last frame until the next client connects.  A
+ * client that cannot be served is dropped with a warning.
+ */
+static void RunServer(const struct Options *pOptions)
+{
+    struct DisplayProbe probe;
+    struct EglDispatch egl;
     EGLDisplay eglDpy;
-    EGLDeviceEXT eglDevice;
-    int drmFd, width, height;
+    int width, height, listenFd;
     uint32_t planeID = 0;
+
+    if (ProbeDisplay(&probe, pOptions) != 0) {
+        Fatal("%s", GetError());
+    }
+
+    eglDpy = SetUpDisplay(&probe, &egl, &planeID, &width, &height);
+
+    if (eglDpy == EGL_NO_DISPLAY) {
+        Fatal("%s", GetError());
+    }
+
+    listenFd = ListenOnSocket(pOptions->socketPath);
+
+    if (listenFd < 0) {
+        Fatal("%s", GetError());
+    }
+
+    while (1) {
+        struct StreamAnnouncement announcement;
+        EGLStreamKHR eglStream;
+        int clientFd, streamFd;
+
+        printf("Waiting for a render client on %s\n", pOptions->socketPath);
+        fflush(stdout);
+
+        clientFd = AcceptConnection(listenFd);
+
+        if (clientFd < 0) {
+            Warning("%s", GetError());
+            continue;
+        }
+
+        eglStream = CreateOutputStream(&egl, eglDpy, planeID, pOptions);
+
+        if (eglStream == EGL_NO_STREAM_KHR) {
+            Warning("%s", GetError());
+            close(clientFd);
+            continue;
+        }
+
+        streamFd = GetStreamFd(&egl, eglDpy, eglStream);
+
+        announcement.width = width;
+        announcement.height = height;
+        announcement.renderOrientation = probe.renderOrientation;
+        announcement.refreshRate = GetKmsDisplayRefresh(probe.pKms);
+
+        if ((streamFd < 0) ||
+            (SendWithFd(clientFd, &announcement, sizeof(announcement),
+                        streamFd) != 0)) {
+            Warning("%s", GetError());
+        } else {
+            printf("Render client connected.\n");
+            fflush(stdout);
+
+            if (WaitForHangup(clientFd) != 0) {
+                Warning("%s", GetError());
+            }
+
+            printf("Render client disconnected.\n");
+        }
+
+        if (streamFd >= 0) {
+            close(streamFd);
+        }
+
+        close(clientFd);
+
+        egl.DestroyStreamKHR(eglDpy, eglStream);
+    }
+}
+
+
+/*
+ * Render into the EGLStream provided by a server.  The client needs no
+ * DRM access at all: the EGLDisplay is created without a DRM fd.
+ *
+ * The client reports the same present statistics as a standalone
+ * process, so running the benchmark both ways measures the latency
+ * added by the process split.
+ */
+static void RunClient(const struct Options *pOptions)
+{
+    struct StreamAnnouncement announcement;
+    struct Backend backend;
+    struct Capture *pCapture = NULL;
+    struct Telemetry *pTelemetry = NULL;
+    struct Realtime *pRealtime;
+    struct Gears *pGears;
+    struct EglDispatch egl;
+    EGLDeviceEXT eglDevice;
+    EGLDisplay eglDpy;
     EGLSurface eglSurface;
+    EGLStreamKHR eglStream;
+    int sockFd, streamFd;
+    double startTime = GetTime();
+    enum LoopExit loopExit;
+    char error[256];
+
+    /*
+     * A client has nothing to restore on failure: the server keeps the
+     * display, and the process' exit releases the rest.
+     */
+    eglDevice = GetEglDevice(&pOptions->device);
+
+    if (eglDevice == EGL_NO_DEVICE_EXT) {
+        Fatal("%s", GetError());
+    }
+
+    eglDpy = GetEglDisplay(eglDevice, -1, &egl);
+
+    if (eglDpy == EGL_NO_DISPLAY) {
+        Fatal("%s", GetError());
+    }
+
+    sockFd = ConnectToSocket(pOptions->socketPath);
+
+    if ((sockFd < 0) ||
+        (ReceiveWithFd(sockFd, &announcement, sizeof(announcement),
+                       &streamFd) != 0)) {
+        Fatal("%s", GetError());
+    }
+
+    if (streamFd < 0) {
+        Fatal("Server did not send an EGLStream.\n");
+    }
+
+    eglStream = CreateStreamFromFd(&egl, eglDpy, streamFd);
+
+    close(streamFd);
+
+    if (eglStream == EGL_NO_STREAM_KHR) {
+        Fatal("%s", GetError());
+    }
+
+    eglSurface = CreateProducerSurface(&egl, eglDpy, eglStream,
+                                       announcement.width,
+                                       announcement.height, pOptions, NULL);
+
+    if (eglSurface == EGL_NO_SURFACE) {
+        Fatal("%s", GetError());
+    }
+
+    pGears = CreateGears();
+
+    if ((pGears == NULL) ||
+        (InitGears(pGears, announcement.width, announcement.height,
+                   pOptions->gpuAnimation,
+                   &announcement.renderOrientation) != 0)) {
+        Fatal("%s", GetError());
+    }
+
+    printf("Attached to server in %.3f ms\n",
+           (GetTime() - startTime) * 1000.0);
+
+    if (InitEglStreamBackend(&backend, &egl, eglDpy, eglSurface, eglStream,
+                             announcement.width,
+                             announcement.height) != 0) {
+        Fatal("%s", GetError());
+    }
+
+    if (pOptions->capturePath != NULL) {
+        pCapture = StartCapture(pOptions->capturePath,
+                                pOptions->captureInterval);
+
+        if (pCapture == NULL) {
+            Fatal("%s", GetError());
+        }
+    }
+
+    if (pOptions->telemetryName != NULL) {
+        pTelemetry = StartTelemetry(pOptions->telemetryName);
+
+        if (pTelemetry == NULL) {
+            Fatal("%s", GetError());
+        }
+    }
+
+    pRealtime = EnterRealtime(pOptions, announcement.refreshRate);
+
+    loopExit = RenderLoop(&backend, pGears, pOptions, pCapture, pTelemetry,
+                          "cross-process", announcement.refreshRate);
+
+    if (loopExit == LOOP_FAILED) {
+        snprintf(error, sizeof(error), "%s", GetError());
+    } else if (loopExit == LOOP_RESTART) {
+        Warning("A render client cannot restart its stream; exiting.\n");
+    }
 
-    GetEglExtensionFunctionPointers();
+    LeaveRealtime(pRealtime);
 
-    eglDevice = GetEglDevice();
+    if (pCapture != NULL) {
+        StopCapture(pCapture);
+    }
+
+    if (pTelemetry != NULL) {
+        StopTelemetry(pTelemetry);
+    }
+
+    DestroyGears(pGears);
+    FreeGears(pGears);
+    backend.destroy(&backend);
+
+    close(sockFd);
+
+    if (loopExit == LOOP_FAILED) {
+        Fatal("%s", error);
+    }
+}
+
+
+static void RunWaylandCompositor(const struct Options *pOptions)
+{
+#if defined(HAVE_WAYLAND)
+    struct DisplayProbe probe;
+    struct EglDispatch egl;
+    EGLDisplay eglDpy;
+    int width, height;
+    uint32_t planeID = 0;
 
-    drmFd = GetDrmFd(eglDevice);
+    if (ProbeDisplay(&probe, pOptions) != 0) {
+        Fatal("%s", GetError());
+    }
+
+    eglDpy = SetUpDisplay(&probe, &egl, &planeID, &width, &height);
 
-    SetMode(drmFd, &planeID, &width, &height);
+    if (eglDpy == EGL_NO_DISPLAY) {
+        Fatal("%s", GetError());
+    }
 
-    eglDpy = GetEglDisplay(eglDevice, drmFd);
+    if (!OrientationIsIdentity(&probe.renderOrientation)) {
+        Warning("The compositor cannot turn client buffers itself; "
+                "they are displayed unrotated.\n");
+    }
+
+    RunCompositor(pOptions, probe.drmFd, probe.pCache, eglDpy, &egl, planeID,
+                  width, height);
+#else
+    (void) pOptions;
+
+    Fatal("Wayland support not built; rebuild with WAYLAND=1.\n");
+#endif
+}
 
-    eglSurface = SetUpEgl(eglDpy, planeID, width, height);
 
-    InitGears(width, height);
+/*
+ * Example code demonstrating how to connect EGL to DRM KMS using
+ * EGLStreams.
+ */
+
+int main(int argc, char *argv[])
+{
+    struct Options options;
+    struct VirtualInput *pVirtualInput = NULL;
+    int i;
+
+    ParseOptions(argc, argv, &options);
+
+    /*
+     * With --event-loop, the signals are blocked before any thread is
+     * created, so that they only arrive through the signalfd.
+     */
+    if (options.eventLoop) {
+        if (BlockLoopSignals() != 0) {
+            Fatal("%s", GetError());
+        }
+
+        signalFd = CreateSignalFd();
+
+        if (signalFd < 0) {
+            Fatal("%s", GetError());
+        }
+    } else if ((options.role == ROLE_STANDALONE) ||
+               (options.role == ROLE_CLIENT)) {
+        InstallSignalHandlers();
+    }
+
+    PinHelperThreads(&options);
+
+    if (options.lockMemory) {
+        LockMemory();
+    }
+
+    if (options.listDevices) {
+        ListGpuDevices(&options);
+        return 0;
+    }
+
+    if (options.leaseClientPath != NULL) {
+        options.leaseFd = AcquireLease(options.leaseClientPath,
+                                       options.device.connectorName);
+
+        if (options.leaseFd < 0) {
+            Fatal("%s", GetError());
+        }
+
+        SelectDeviceOfFd(options.leaseFd, &options.device);
+    }
+
+    if (options.virtualInputRate > 0) {
+        pVirtualInput = StartVirtualInput(options.virtualInputRate);
+
+        if (pVirtualInput == NULL) {
+            Fatal("%s", GetError());
+        }
+
+        options.inputPaths[options.numInputs++] =
+            GetVirtualInputPath(pVirtualInput);
+    }
+
+    for (i = 0; i < options.numInputs; i++) {
+        inputFds[i] = OpenInputDevice(options.inputPaths[i]);
+
+        if (inputFds[i] < 0) {
+            Fatal("%s", GetError());
+        }
+    }
+
+    if (pVirtualInput != NULL) {
+        GrabInputDevice(inputFds[options.numInputs - 1]);
+    }
+
+    switch (options.role) {
+    case ROLE_STANDALONE:
+        RunStandalone(&options);
+        break;
+    case ROLE_SERVER:
+        RunServer(&options);
+        break;
+    case ROLE_CLIENT:
+        RunClient(&options);
+        break;
+    case ROLE_COMPOSITOR:
+        RunWaylandCompositor(&options);
+        break;
+    }
 
-    while(1) {
-        DrawGears();
-        eglSwapBuffers(eglDpy, eglSurface);
-        PrintFps();
+    if (pVirtualInput != NULL) {
+        StopVirtualInput(pVirtualInput);
     }
 
     return 0;
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Keeping the render loop free of allocations and page faults.
+ *
+ * A frame that calls malloc() can take the allocator's locks, grow the
+ * heap with a system call, or fault in fresh pages; a frame that
+ * touches a page that was never touched, or was swapped out, waits for
+ * the kernel to fault it in (from disk, for a major fault).  Either can
+ * cost more than a refresh period.  So, with --lock-memory:
+ *
+ * - LockMemory(), called at startup before anything else allocates,
+ *   stops malloc() from returning memory to the kernel or serving
+ *   large allocations with their own mmap(), pre-faults a heap reserve
+ *   for later allocations to come from, and calls mlockall() so that
+ *   every mapping, current and future (including the driver's buffer
+ *   mappings), is faulted in once and never paged out.
+ *
+ * - PrefaultStack(), called by the render thread before its loop,
+ *   touches the stack it will grow into.
+ *
+ * To check that the loop holds to this, the executable links
+ * alloccount.c, which interposes on malloc() and friends to count each
+ * thread's allocations for GetThreadAllocations().  It is not part of
+ * libeglkms.a, so that other programs linking the library keep their
+ * allocator untouched.
+ */
+
+#include <errno.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "memlock.h"
+#include "utils.h"
+
+/*
+ * How much heap to pre-fault for allocations made after warm-up, and
+ * how much stack the render thread may use (the EGL driver's deepest
+ * calls included).
+ */
+#define HEAP_RESERVE_SIZE (16 * 1024 * 1024)
+#define STACK_RESERVE_SIZE (512 * 1024)
+
+/*
+ * Return how many times the calling thread has allocated memory, or -1
+ * if allocations are not counted: the default, for programs that do
+ * not link alloccount.o, whose definition takes precedence.
+ */
+long __attribute__((weak)) GetThreadAllocations(void)
+{
+    return -1;
+}
+
+
+/*
+ * Configure the allocator to keep the memory it gets, pre-fault a heap
+ * reserve, and lock all of the process's memory.
+ *
+ * mlockall() needs CAP_IPC_LOCK or a large enough RLIMIT_MEMLOCK; if it
+ * fails, warn and carry on unlocked.
+ *
+ * The mallopt() settings and the heap reserve only cover glibc's main
+ * arena.  Threads that allocate from arenas of their own, e.g., the
+ * driver's, can still have memory trimmed or mapped afresh, and fault
+ * on it; GetThreadAllocations() and the fault counters catch that.
+ */
+void LockMemory(void)
+{
+    char *pReserve;
+
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        Warning("Unable to lock memory: %s.  Raise RLIMIT_MEMLOCK "
+                "(ulimit -l) or run with CAP_IPC_LOCK.\n", strerror(errno));
+    }
+
+    /*
+     * Grow the heap by the reserve and hand it back to the allocator;
+     * with trimming disabled, it stays mapped (and locked) for later
+     * allocations.
+     */
+    pReserve = malloc(HEAP_RESERVE_SIZE);
+
+    if (pReserve == NULL) {
+        Warning("Unable to reserve heap for the render loop.\n");
+        return;
+    }
+
+    memset(pReserve, 0, HEAP_RESERVE_SIZE);
+    free(pReserve);
+}
+
+
+/*
+ * Touch STACK_RESERVE_SIZE bytes of the calling thread's stack, below
+ * the caller's frame, so that the stack has grown into them before the
+ * render loop needs them.
+ */
+void __attribute__((noinline)) PrefaultStack(void)
+{
+    volatile char stack[STACK_RESERVE_SIZE];
+    size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    size_t i;
+
+    for (i = 0; i < sizeof(stack); i += pageSize) {
+        stack[i] = 0;
+    }
+}
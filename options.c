@@ -0,0 +1,916 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <getopt.h>
+
+#include "options.h"
+#include "utils.h"
+
+#define DEFAULT_THROUGHPUT_FIFO_LENGTH 3
+
+/*
+ * The gears need a depth buffer; 16 bits resolves them, at half the
+ * depth bandwidth of the usual 24 (plus 8 stencil) bits.
+ */
+#define DEFAULT_DEPTH_BITS 16
+
+static const struct {
+    const char *name;
+    enum PresentMode presentMode;
+} presentModeNames[] = {
+    { "latency",    PRESENT_MODE_LATENCY    },
+    { "balanced",   PRESENT_MODE_BALANCED   },
+    { "throughput", PRESENT_MODE_THROUGHPUT },
+};
+
+static const struct {
+    const char *name;
+    enum BackendType backendType;
+} backendTypeNames[] = {
+    { "eglstream", BACKEND_EGLSTREAM },
+    { "gbm",       BACKEND_GBM       },
+};
+
+static const struct {
+    const char *name;
+    enum ColorFormat colorFormat;
+} colorFormatNames[] = {
+    { "rgb888", COLOR_FORMAT_RGB888 },
+    { "rgb565", COLOR_FORMAT_RGB565 },
+};
+
+static const struct {
+    const char *name;
+    enum ContextPriority contextPriority;
+} contextPriorityNames[] = {
+    { "default", CONTEXT_PRIORITY_DEFAULT },
+    { "low",     CONTEXT_PRIORITY_LOW     },
+    { "medium",  CONTEXT_PRIORITY_MEDIUM  },
+    { "high",    CONTEXT_PRIORITY_HIGH    },
+};
+
+
+static void PrintUsage(const char *program)
+{
+    printf("Usage: %s [options]\n"
+           "\n"
+           "  -B, --backend=BACKEND     How frames reach the display: eglstream\n"
+           "                            or gbm (requires a GBM=1 build).\n"
+           "                            Default: eglstream.\n"
+           "  -D, --device=POLICY       Which GPU to use: display (the first\n"
+           "                            with a connected output), fastest\n"
+           "                            (measured), connector:NAME (the GPU\n"
+           "                            driving output NAME, e.g., DP-1; also\n"
+           "                            drive that output), or bus:BUSID (e.g.,\n"
+           "                            bus:0000:01:00.0 or bus:PCI:1:0:0).\n"
+           "                            Default: display.\n"
+           "  -R, --render-device=POLICY\n"
+           "                            Render on another GPU than the one\n"
+           "                            selected by --device, and copy each\n"
+           "                            frame to it.  POLICY is as for --device.\n"
+           "  -L, --list-devices        Print the GPUs, their nodes, PCI bus\n"
+           "                            IDs, and connected outputs, and the GPU\n"
+           "                            that --device selects, and exit.\n"
+           "  -N, --no-probe-cache      Probe the display from scratch, instead\n"
+           "                            of trusting what the last launch on\n"
+           "                            the same hardware found.\n"
+           "  -p, --present-mode=MODE   EGLStream present mode: latency (mailbox),\n"
+           "                            balanced (FIFO of 1), or throughput\n"
+           "                            (deeper FIFO).  Default: latency.\n"
+           "  -f, --fifo-length=N       FIFO length for the throughput present\n"
+           "                            mode.  Default: %d.\n"
+           "  -F, --frames-in-flight=N  Wait for the GPU to finish the frame N\n"
+           "                            frames back before starting a new one.\n"
+           "                            Default: no limit.\n"
+           "  -b, --benchmark=FRAMES    Render FRAMES frames, print present\n"
+           "                            statistics, and exit.\n"
+           "  -C, --color-format=FORMAT Color buffer format: rgb888 or rgb565.\n"
+           "                            Default: rgb888.\n"
+           "  -d, --depth-bits=N        Minimum depth buffer size; 0 for none.\n"
+           "                            Default: %d.\n"
+           "  -m, --msaa=N              Minimum multisample count.  Default: 0.\n"
+           "  -P, --context-priority=PRIORITY\n"
+           "                            Request a low, medium, or high GPU\n"
+           "                            scheduling priority for rendering.\n"
+           "  -E, --no-error            Create a no-error context, without\n"
+           "                            OpenGL error checking.\n"
+           "  -V, --gl-version=MAJOR.MINOR\n"
+           "                            Request at least this OpenGL version.\n"
+           "  -K, --core-profile        Request a core profile context.  Implies\n"
+           "                            --gpu-animation.\n"
+           "  -G, --gpu-animation       Animate the gears in a vertex shader,\n"
+           "                            from one vertex buffer.\n"
+           "  -u, --partial-updates     Repaint and present only the part of\n"
+           "                            the frame that changed.\n"
+           "  -e, --degamma=E[,E,E]     Have the CRTC linearize colors with\n"
+           "                            DEGAMMA_LUT, mapping each channel x to\n"
+           "                            x^E (one exponent, or one per R,G,B).\n"
+           "  -M, --ctm=M00,M01,...,M22 Have the CRTC apply this row-major 3x3\n"
+           "                            color transformation matrix (CTM).\n"
+           "  -g, --gamma=E[,E,E]       Have the CRTC encode colors with\n"
+           "                            GAMMA_LUT, mapping each channel x to\n"
+           "                            x^E.\n"
+           "  -r, --rotation=DEGREES    Rotate frames 0, 90, 180, or 270 degrees\n"
+           "                            counter-clockwise for the panel, on\n"
+           "                            the plane if it can.\n"
+           "  -z, --reflect=x|y|xy      Flip frames left to right (x), top to\n"
+           "                            bottom (y), or both, before rotating.\n"
+           "  -x, --capture=FILE        Record displayed frames to FILE, read\n"
+           "                            back asynchronously.\n"
+           "  -X, --capture-interval=N  Record every Nth frame.  Default: 1.\n"
+           "  -T, --telemetry=NAME      Publish per-frame telemetry to the\n"
+           "                            shared memory object NAME, for\n"
+           "                            eglkms-telemetry to read.\n"
+           "  -a, --render-cpus=LIST    Pin the render loop to these CPUs, e.g.,\n"
+           "                            2,3 or 2-3 (ideally isolated ones).\n"
+           "  -H, --helper-cpus=LIST    Pin every other thread, including driver\n"
+           "                            threads, to these CPUs.\n"
+           "  -Q, --sched=POLICY        Schedule the render loop with fifo[:PRIO]\n"
+           "                            (SCHED_FIFO, default priority 50),\n"
+           "                            deadline[:PERCENT] (SCHED_DEADLINE, a\n"
+           "                            budget of PERCENT of each refresh,\n"
+           "                            default 50), or other (SCHED_OTHER,\n"
+           "                            the default).\n"
+           "  -k, --lock-memory         Lock and pre-fault all memory, and flag\n"
+           "                            frames that allocate or page fault.\n"
+           "  -O, --event-loop          Sleep between frames, in an epoll loop\n"
+           "                            that renders once per refresh, when\n"
+           "                            the display has taken the last frame.\n"
+           "  -i, --input=DEVICE        Turn the gears with the evdev DEVICE,\n"
+           "                            e.g., /dev/input/event0: arrow keys,\n"
+           "                            z, and the mouse; Esc or q to quit.\n"
+           "                            Repeatable.  Implies --event-loop.\n"
+           "  -j, --input-latency       Measure the latency from each --input\n"
+           "                            event to the page flip showing it,\n"
+           "                            and report it with --benchmark.\n"
+           "  -U, --virtual-input=RATE  Measure --input-latency unattended, with\n"
+           "                            a uinput keyboard pressing a key RATE\n"
+           "                            times a second.\n"
+           "  -Y, --late-latch          Keep taking input after a frame's draw\n"
+           "                            calls are submitted, until the GPU\n"
+           "                            reaches them.  Implies --core-profile\n"
+           "                            and --event-loop.\n"
+           "  -s, --server=SOCKET       Own the display, and present frames\n"
+           "                            rendered by clients connecting to\n"
+           "                            SOCKET.  Does not render.\n"
+           "  -c, --client=SOCKET       Render into the EGLStream provided by\n"
+           "                            the server listening on SOCKET.\n"
+           "  -S, --lease-server=SOCKET Lease the connected outputs other than\n"
+           "                            the one displayed on to processes\n"
+           "                            connecting to SOCKET.\n"
+           "  -l, --lease=SOCKET        Display on an output leased from the\n"
+           "                            lease server on SOCKET: the --device\n"
+           "                            connector if given, else any.\n"
+           "  -w, --wayland             Run a Wayland compositor for EGLStream\n"
+           "                            clients (requires a WAYLAND=1 build).\n"
+           "  -h, --help                Print this help and exit.\n",
+           program, DEFAULT_THROUGHPUT_FIFO_LENGTH, DEFAULT_DEPTH_BITS);
+}
+
+
+static int ParseInt(const char *option, const char *arg, int min, int max)
+{
+    char *end;
+    long value = strtol(arg, &end, 0);
+
+    if ((*arg == '\0') || (*end != '\0') || (value < min) || (value > max)) {
+        Fatal("Invalid value \'%s\' for option %s.\n", arg, option);
+    }
+
+    return (int) value;
+}
+
+
+static int ParsePositiveInt(const char *option, const char *arg, int max)
+{
+    return ParseInt(option, arg, 1, max);
+}
+
+
+/*
+ * Parse up to 'max' comma-separated numbers into 'pValues', and return
+ * how many there were.
+ */
+static int ParseDoubles(const char *option, const char *arg,
+                        double *pValues, int max)
+{
+    const char *p = arg;
+    int count = 0;
+
+    while (1) {
+        char *end;
+
+        if (count == max) {
+            Fatal("Invalid value \'%s\' for option %s.\n", arg, option);
+        }
+
+        pValues[count++] = strtod(p, &end);
+
+        if ((end == p) || ((*end != ',') && (*end != '\0'))) {
+            Fatal("Invalid value \'%s\' for option %s.\n", arg, option);
+        }
+
+        if (*end == '\0') {
+            return count;
+        }
+
+        p = end + 1;
+    }
+}
+
+
+/*
+ * Parse a --degamma or --gamma curve: one positive exponent for all
+ * three channels, or one each for red, green, and blue.
+ */
+static void ParseExponents(const char *option, const char *arg,
+                           double *pExponents)
+{
+    int i, count = ParseDoubles(option, arg, pExponents, 3);
+
+    if (count == 1) {
+        pExponents[1] = pExponents[2] = pExponents[0];
+    } else if (count != 3) {
+        Fatal("Invalid value \'%s\' for option %s.\n", arg, option);
+    }
+
+    for (i = 0; i < 3; i++) {
+        if (pExponents[i] <= 0.0) {
+            Fatal("Invalid value \'%s\' for option %s.\n", arg, option);
+        }
+    }
+}
+
+
+static int ParseRotation(const char *arg)
+{
+    int degrees = ParseInt("--rotation", arg, 0, 270);
+
+    if ((degrees % 90) != 0) {
+        Fatal("Invalid value \'%s\' for option --rotation.\n", arg);
+    }
+
+    return degrees;
+}
+
+
+static void ParseReflection(const char *arg, struct Orientation *pOrientation)
+{
+    if (strcmp(arg, "x") == 0) {
+        pOrientation->reflectX = 1;
+    } else if (strcmp(arg, "y") == 0) {
+        pOrientation->reflectY = 1;
+    } else if ((strcmp(arg, "xy") == 0) || (strcmp(arg, "yx") == 0)) {
+        pOrientation->reflectX = 1;
+        pOrientation->reflectY = 1;
+    } else {
+        Fatal("Invalid value \'%s\' for option --reflect.\n", arg);
+    }
+}
+
+
+/*
+ * Parse a CPU list: comma-separated CPU numbers and ranges, as in
+ * taskset(1) and isolcpus=.
+ */
+static void ParseCpuSet(const char *option, const char *arg,
+                        struct CpuSet *pSet)
+{
+    const char *p = arg;
+
+    memset(pSet, 0, sizeof(*pSet));
+
+    while (1) {
+        char *end;
+        long first, last, cpu;
+
+        first = strtol(p, &end, 10);
+        last = first;
+
+        if ((end != p) && (*end == '-')) {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+        }
+
+        if ((end == p) || (first < 0) || (last < first) ||
+            (last >= MAX_CPUS) || ((*end != ',') && (*end != '\0'))) {
+            Fatal("Invalid value \'%s\' for option %s.\n", arg, option);
+        }
+
+        for (cpu = first; cpu <= last; cpu++) {
+            if ((pSet->bits[cpu / 64] & (1ull << (cpu % 64))) == 0) {
+                pSet->bits[cpu / 64] |= 1ull << (cpu % 64);
+                pSet->count++;
+            }
+        }
+
+        if (*end == '\0') {
+            return;
+        }
+
+        p = end + 1;
+    }
+}
+
+
+/*
+ * Parse --sched: a policy name, optionally followed by ':' and its
+ * parameter.
+ */
+static void ParseSchedPolicy(const char *arg, struct Options *pOptions)
+{
+    const char *param = strchr(arg, ':');
+    size_t len = (param != NULL) ? (size_t) (param - arg) : strlen(arg);
+
+    if ((len == 5) && (strncmp(arg, "other", len) == 0) && (param == NULL)) {
+        pOptions->schedPolicy = SCHED_POLICY_DEFAULT;
+    } else if ((len == 4) && (strncmp(arg, "fifo", len) == 0)) {
+        pOptions->schedPolicy = SCHED_POLICY_FIFO;
+        if (param != NULL) {
+            pOptions->schedPriority = ParseInt("--sched", param + 1, 1, 99);
+        }
+    } else if ((len == 8) && (strncmp(arg, "deadline", len) == 0)) {
+        pOptions->schedPolicy = SCHED_POLICY_DEADLINE;
+        if (param != NULL) {
+            pOptions->deadlinePercent =
+                ParseInt("--sched", param + 1, 1, 100);
+        }
+    } else {
+        Fatal("Invalid value \'%s\' for option --sched.\n", arg);
+    }
+}
+
+
+static enum ContextPriority ParseContextPriority(const char *arg)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_LEN(contextPriorityNames); i++) {
+        if (strcmp(arg, contextPriorityNames[i].name) == 0) {
+            return contextPriorityNames[i].contextPriority;
+        }
+    }
+
+    Fatal("Unknown context priority \'%s\'.\n", arg);
+
+    return CONTEXT_PRIORITY_DEFAULT;
+}
+
+
+const char *ContextPriorityName(enum ContextPriority contextPriority)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_LEN(contextPriorityNames); i++) {
+        if (contextPriorityNames[i].contextPriority == contextPriority) {
+            return contextPriorityNames[i].name;
+        }
+    }
+
+    return "unknown";
+}
+
+
+static void ParseGlVersion(const char *arg, int *pMajor, int *pMinor)
+{
+    char extra;
+
+    if ((sscanf(arg, "%d.%d%c", pMajor, pMinor, &extra) != 2) ||
+        (*pMajor < 1) || (*pMinor < 0)) {
+        Fatal("Invalid value \'%s\' for option --gl-version.\n", arg);
+    }
+}
+
+
+static enum ColorFormat ParseColorFormat(const char *arg)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_LEN(colorFormatNames); i++) {
+        if (strcmp(arg, colorFormatNames[i].name) == 0) {
+            return colorFormatNames[i].colorFormat;
+        }
+    }
+
+    Fatal("Unknown color format \'%s\'.\n", arg);
+
+    return COLOR_FORMAT_RGB888;
+}
+
+
+const char *ColorFormatName(enum ColorFormat colorFormat)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_LEN(colorFormatNames); i++) {
+        if (colorFormatNames[i].colorFormat == colorFormat) {
+            return colorFormatNames[i].name;
+        }
+    }
+
+    return "unknown";
+}
+
+
+static enum PresentMode ParsePresentMode(const char *arg)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_LEN(presentModeNames); i++) {
+        if (strcmp(arg, presentModeNames[i].name) == 0) {
+            return presentModeNames[i].presentMode;
+        }
+    }
+
+    Fatal("Unknown present mode \'%s\'.\n", arg);
+
+    return PRESENT_MODE_LATENCY;
+}
+
+
+/*
+ * Parse a --device or --render-device policy: display, fastest, connector:NAME, or
+ * bus:BUSID.  BUSID is a PCI bus ID as lspci prints it, in hex
+ * ([DOMAIN:]BUS:DEVICE.FUNCTION), or as X configurations write it, in
+ * decimal (PCI:BUS:DEVICE:FUNCTION).
+ */
+static void ParseDeviceSelection(const char *option, const char *arg,
+                                 struct DeviceSelection *pSelection)
+{
+    unsigned int domain = 0, bus, dev, func;
+    const char *busId;
+    char extra;
+    int valid;
+
+    if (strcmp(arg, "display") == 0) {
+        pSelection->policy = DEVICE_POLICY_DISPLAY;
+        return;
+    }
+
+    if (strcmp(arg, "fastest") == 0) {
+        pSelection->policy = DEVICE_POLICY_FASTEST;
+        return;
+    }
+
+    if ((strncmp(arg, "connector:", 10) == 0) && (arg[10] != '\0')) {
+        pSelection->policy = DEVICE_POLICY_CONNECTOR;
+        pSelection->connectorName = arg + 10;
+        return;
+    }
+
+    if (strncmp(arg, "bus:", 4) == 0) {
+        busId = arg + 4;
+
+        if (strncmp(busId, "PCI:", 4) == 0) {
+            valid = (sscanf(busId, "PCI:%u:%u:%u%c",
+                            &bus, &dev, &func, &extra) == 3);
+        } else if (strchr(busId, ':') != strrchr(busId, ':')) {
+            valid = (sscanf(busId, "%x:%x:%x.%x%c",
+                            &domain, &bus, &dev, &func, &extra) == 4);
+        } else {
+            valid = (sscanf(busId, "%x:%x.%x%c",
+                            &bus, &dev, &func, &extra) == 3);
+        }
+
+        if (valid && (domain <= 0xffff) && (bus <= 0xff) &&
+            (dev <= 0x1f) && (func <= 0x7)) {
+            pSelection->policy = DEVICE_POLICY_BUS_ID;
+            snprintf(pSelection->busId, sizeof(pSelection->busId),
+                     "%04x:%02x:%02x.%x", domain, bus, dev, func);
+            return;
+        }
+    }
+
+    Fatal("Invalid value \'%s\' for option %s.\n", arg, option);
+}
+
+
+static enum BackendType ParseBackendType(const char *arg)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_LEN(backendTypeNames); i++) {
+        if (strcmp(arg, backendTypeNames[i].name) == 0) {
+            return backendTypeNames[i].backendType;
+        }
+    }
+
+    Fatal("Unknown backend \'%s\'.\n", arg);
+
+    return BACKEND_EGLSTREAM;
+}
+
+
+const char *BackendTypeName(enum BackendType backendType)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_LEN(backendTypeNames); i++) {
+        if (backendTypeNames[i].backendType == backendType) {
+            return backendTypeNames[i].name;
+        }
+    }
+
+    return "unknown";
+}
+
+
+const char *PresentModeName(enum PresentMode presentMode)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_LEN(presentModeNames); i++) {
+        if (presentModeNames[i].presentMode == presentMode) {
+            return presentModeNames[i].name;
+        }
+    }
+
+    return "unknown";
+}
+
+
+/*
+ * Parse the command line into 'pOptions'.  Invalid options are fatal.
+ */
+void ParseOptions(int argc, char *argv[], struct Options *pOptions)
+{
+    static const struct option longOptions[] = {
+        { "backend",      required_argument, NULL, 'B' },
+        { "device",       required_argument, NULL, 'D' },
+        { "render-device", required_argument, NULL, 'R' },
+        { "list-devices", no_argument,       NULL, 'L' },
+        { "no-probe-cache", no_argument,     NULL, 'N' },
+        { "present-mode", required_argument, NULL, 'p' },
+        { "fifo-length",  required_argument, NULL, 'f' },
+        { "frames-in-flight", required_argument, NULL, 'F' },
+        { "benchmark",    required_argument, NULL, 'b' },
+        { "color-format", required_argument, NULL, 'C' },
+        { "depth-bits",   required_argument, NULL, 'd' },
+        { "msaa",         required_argument, NULL, 'm' },
+        { "context-priority", required_argument, NULL, 'P' },
+        { "no-error",     no_argument,       NULL, 'E' },
+        { "gl-version",   required_argument, NULL, 'V' },
+        { "core-profile", no_argument,       NULL, 'K' },
+        { "gpu-animation", no_argument,      NULL, 'G' },
+        { "partial-updates", no_argument,    NULL, 'u' },
+        { "degamma",      required_argument, NULL, 'e' },
+        { "ctm",          required_argument, NULL, 'M' },
+        { "gamma",        required_argument, NULL, 'g' },
+        { "rotation",     required_argument, NULL, 'r' },
+        { "reflect",      required_argument, NULL, 'z' },
+        { "capture",      required_argument, NULL, 'x' },
+        { "capture-interval", required_argument, NULL, 'X' },
+        { "telemetry",    required_argument, NULL, 'T' },
+        { "render-cpus",  required_argument, NULL, 'a' },
+        { "helper-cpus",  required_argument, NULL, 'H' },
+        { "sched",        required_argument, NULL, 'Q' },
+        { "lock-memory",  no_argument,       NULL, 'k' },
+        { "event-loop",   no_argument,       NULL, 'O' },
+        { "input",        required_argument, NULL, 'i' },
+        { "input-latency", no_argument,      NULL, 'j' },
+        { "virtual-input", required_argument, NULL, 'U' },
+        { "late-latch",   no_argument,       NULL, 'Y' },
+        { "server",       required_argument, NULL, 's' },
+        { "client",       required_argument, NULL, 'c' },
+        { "lease-server", required_argument, NULL, 'S' },
+        { "lease",        required_argument, NULL, 'l' },
+        { "wayland",      no_argument,       NULL, 'w' },
+        { "help",         no_argument,       NULL, 'h' },
+        { NULL,           0,                 NULL, 0   },
+    };
+
+    int c;
+
+    memset(pOptions, 0, sizeof(*pOptions));
+
+    pOptions->role = ROLE_STANDALONE;
+    pOptions->backendType = BACKEND_EGLSTREAM;
+    pOptions->device.policy = DEVICE_POLICY_DISPLAY;
+    pOptions->presentMode = PRESENT_MODE_LATENCY;
+    pOptions->fifoLength = DEFAULT_THROUGHPUT_FIFO_LENGTH;
+    pOptions->colorFormat = COLOR_FORMAT_RGB888;
+    pOptions->depthBits = DEFAULT_DEPTH_BITS;
+    pOptions->leaseFd = -1;
+    pOptions->captureInterval = 1;
+    pOptions->schedPriority = 50;
+    pOptions->deadlinePercent = 50;
+
+    while ((c = getopt_long(argc, argv, "B:D:R:LNp:f:F:b:C:d:m:P:EV:KGue:M:g:r:z:x:X:T:a:H:Q:kOi:jU:Ys:c:S:l:wh", longOptions, NULL)) != -1) {
+        switch (c) {
+        case 'B':
+            pOptions->backendType = ParseBackendType(optarg);
+            break;
+        case 'D':
+            ParseDeviceSelection("--device", optarg, &pOptions->device);
+            break;
+        case 'R':
+            ParseDeviceSelection("--render-device", optarg,
+                                 &pOptions->renderDevice);
+            pOptions->renderDeviceSet = 1;
+            break;
+        case 'L':
+            pOptions->listDevices = 1;
+            break;
+        case 'N':
+            pOptions->noProbeCache = 1;
+            break;
+        case 'p':
+            pOptions->presentMode = ParsePresentMode(optarg);
+            break;
+        case 'f':
+            pOptions->fifoLength = ParsePositiveInt("--fifo-length", optarg,
+                                                  MAX_FIFO_LENGTH);
+            break;
+        case 'F':
+            pOptions->framesInFlight =
+                ParsePositiveInt("--frames-in-flight", optarg,
+                                 MAX_FRAMES_IN_FLIGHT);
+            break;
+        case 'b':
+            pOptions->benchmarkFrames = ParsePositiveInt("--benchmark", optarg,
+                                                       INT_MAX);
+            break;
+        case 'C':
+            pOptions->colorFormat = ParseColorFormat(optarg);
+            break;
+        case 'd':
+            pOptions->depthBits = ParseInt("--depth-bits", optarg, 0, 32);
+            break;
+        case 'm':
+            pOptions->msaaSamples = ParseInt("--msaa", optarg, 0, 64);
+            break;
+        case 'P':
+            pOptions->contextPriority = ParseContextPriority(optarg);
+            break;
+        case 'E':
+            pOptions->noError = 1;
+            break;
+        case 'V':
+            ParseGlVersion(optarg, &pOptions->glMajor, &pOptions->glMinor);
+            break;
+        case 'K':
+            pOptions->coreProfile = 1;
+            break;
+        case 'G':
+            pOptions->gpuAnimation = 1;
+            break;
+        case 'u':
+            pOptions->partialUpdates = 1;
+            break;
+        case 'e':
+            ParseExponents("--degamma", optarg,
+                           pOptions->colorCorrection.degamma);
+            pOptions->colorCorrection.set = 1;
+            break;
+        case 'M':
+            if (ParseDoubles("--ctm", optarg,
+                             pOptions->colorCorrection.ctm, 9) != 9) {
+                Fatal("--ctm needs 9 comma-separated values.\n");
+            }
+            pOptions->colorCorrection.ctmSet = 1;
+            pOptions->colorCorrection.set = 1;
+            break;
+        case 'g':
+            ParseExponents("--gamma", optarg,
+                           pOptions->colorCorrection.gamma);
+            pOptions->colorCorrection.set = 1;
+            break;
+        case 'r':
+            pOptions->orientation.degrees = ParseRotation(optarg);
+            break;
+        case 'z':
+            ParseReflection(optarg, &pOptions->orientation);
+            break;
+        case 'x':
+            pOptions->capturePath = optarg;
+            break;
+        case 'X':
+            pOptions->captureInterval =
+                ParsePositiveInt("--capture-interval", optarg, INT_MAX);
+            break;
+        case 'T':
+            pOptions->telemetryName = optarg;
+            break;
+        case 'a':
+            ParseCpuSet("--render-cpus", optarg, &pOptions->renderCpus);
+            break;
+        case 'H':
+            ParseCpuSet("--helper-cpus", optarg, &pOptions->helperCpus);
+            break;
+        case 'Q':
+            ParseSchedPolicy(optarg, pOptions);
+            break;
+        case 'k':
+            pOptions->lockMemory = 1;
+            break;
+        case 'O':
+            pOptions->eventLoop = 1;
+            break;
+        case 'i':
+            if (pOptions->numInputs == MAX_INPUT_DEVICES) {
+                Fatal("Too many --input devices (the maximum is %d).\n",
+                      MAX_INPUT_DEVICES);
+            }
+            pOptions->inputPaths[pOptions->numInputs++] = optarg;
+            pOptions->eventLoop = 1;
+            break;
+        case 'j':
+            pOptions->inputLatency = 1;
+            pOptions->eventLoop = 1;
+            break;
+        case 'U':
+            pOptions->virtualInputRate =
+                ParsePositiveInt("--virtual-input", optarg,
+                                 MAX_VIRTUAL_INPUT_RATE);
+            pOptions->inputLatency = 1;
+            pOptions->eventLoop = 1;
+            break;
+        case 'Y':
+            pOptions->lateLatch = 1;
+            pOptions->coreProfile = 1;
+            pOptions->eventLoop = 1;
+            break;
+        case 's':
+            pOptions->role = ROLE_SERVER;
+            pOptions->socketPath = optarg;
+            break;
+        case 'c':
+            pOptions->role = ROLE_CLIENT;
+            pOptions->socketPath = optarg;
+            break;
+        case 'S':
+            pOptions->leaseServerPath = optarg;
+            break;
+        case 'l':
+            pOptions->leaseClientPath = optarg;
+            break;
+        case 'w':
+            pOptions->role = ROLE_COMPOSITOR;
+            break;
+        case 'h':
+            PrintUsage(argv[0]);
+            exit(0);
+        default:
+            PrintUsage(argv[0]);
+            exit(1);
+        }
+    }
+
+    if (optind < argc) {
+        Fatal("Unexpected argument \'%s\'.\n", argv[optind]);
+    }
+
+    /*
+     * Core profiles start at OpenGL 3.2, and lack the fixed-function
+     * pipeline, so the gears must be drawn with shaders.
+     */
+    if (pOptions->coreProfile) {
+        if ((pOptions->glMajor < 3) ||
+            ((pOptions->glMajor == 3) && (pOptions->glMinor < 2))) {
+            pOptions->glMajor = 3;
+            pOptions->glMinor = 2;
+        }
+
+        pOptions->gpuAnimation = 1;
+    }
+
+    if (pOptions->renderDeviceSet) {
+        if (pOptions->role != ROLE_STANDALONE) {
+            Fatal("--render-device is only supported when rendering "
+                  "standalone.\n");
+        }
+        if (pOptions->partialUpdates) {
+            Fatal("--render-device does not support --partial-updates.\n");
+        }
+    }
+
+    if (pOptions->leaseServerPath != NULL) {
+        if (pOptions->role != ROLE_STANDALONE) {
+            Fatal("--lease-server is only supported when rendering "
+                  "standalone.\n");
+        }
+        if (pOptions->leaseClientPath != NULL) {
+            Fatal("A lessee cannot lease its outputs further.\n");
+        }
+    }
+
+    if (pOptions->colorCorrection.set && (pOptions->role == ROLE_CLIENT)) {
+        Fatal("--degamma, --ctm, and --gamma are for the process that "
+              "owns the display, not --client.\n");
+    }
+
+    if (!OrientationIsIdentity(&pOptions->orientation) &&
+        (pOptions->role == ROLE_CLIENT)) {
+        Fatal("--rotation and --reflect are for the process that owns the "
+              "display, not --client.\n");
+    }
+
+    if ((pOptions->capturePath != NULL) &&
+        (pOptions->role != ROLE_STANDALONE) &&
+        (pOptions->role != ROLE_CLIENT)) {
+        Fatal("--capture needs a role that renders: standalone or "
+              "--client.\n");
+    }
+
+    if (((pOptions->renderCpus.count > 0) ||
+         (pOptions->schedPolicy != SCHED_POLICY_DEFAULT)) &&
+        (pOptions->role != ROLE_STANDALONE) &&
+        (pOptions->role != ROLE_CLIENT)) {
+        Fatal("--render-cpus and --sched need a role that renders: "
+              "standalone or --client.\n");
+    }
+
+    if (pOptions->lockMemory &&
+        (pOptions->role != ROLE_STANDALONE) &&
+        (pOptions->role != ROLE_CLIENT)) {
+        Fatal("--lock-memory needs a role that renders: standalone or "
+              "--client.\n");
+    }
+
+    if ((pOptions->telemetryName != NULL) &&
+        (pOptions->role != ROLE_STANDALONE) &&
+        (pOptions->role != ROLE_CLIENT)) {
+        Fatal("--telemetry needs a role that renders: standalone or "
+              "--client.\n");
+    }
+
+    if (pOptions->eventLoop &&
+        (pOptions->role != ROLE_STANDALONE) &&
+        (pOptions->role != ROLE_CLIENT)) {
+        Fatal("--event-loop and --input need a role that renders: "
+              "standalone or --client.\n");
+    }
+
+    /*
+     * Input-to-photon latency needs the page flips, which a render
+     * client does not see, and is reported with the benchmark.
+     */
+    if (pOptions->inputLatency) {
+        if (pOptions->role != ROLE_STANDALONE) {
+            Fatal("--input-latency is only supported when rendering "
+                  "standalone.\n");
+        }
+        if (pOptions->benchmarkFrames == 0) {
+            Fatal("--input-latency is reported by --benchmark.\n");
+        }
+        if ((pOptions->numInputs == 0) &&
+            (pOptions->virtualInputRate == 0)) {
+            Fatal("--input-latency needs --input or --virtual-input.\n");
+        }
+        if ((pOptions->virtualInputRate > 0) &&
+            (pOptions->numInputs == MAX_INPUT_DEVICES)) {
+            Fatal("Too many --input devices for --virtual-input "
+                  "(the maximum is %d).\n", MAX_INPUT_DEVICES - 1);
+        }
+    }
+
+    /* Late latching applies input. */
+    if (pOptions->lateLatch && (pOptions->numInputs == 0) &&
+        (pOptions->virtualInputRate == 0)) {
+        Fatal("--late-latch needs --input or --virtual-input.\n");
+    }
+
+    /* A late-latched view can turn after the frame's damage is known. */
+    if (pOptions->lateLatch && pOptions->partialUpdates) {
+        Fatal("--late-latch does not support --partial-updates.\n");
+    }
+
+    if ((pOptions->leaseClientPath != NULL) &&
+        (pOptions->role == ROLE_CLIENT)) {
+        Fatal("--lease is not supported with --client, which needs no "
+              "DRM access.\n");
+    }
+
+    /*
+     * The server, client, and compositor roles hand EGLStreams between
+     * processes, so only make sense with the EGLStream backend.
+     */
+    if ((pOptions->backendType != BACKEND_EGLSTREAM) &&
+        (pOptions->role != ROLE_STANDALONE)) {
+        Fatal("--backend=%s is only supported when rendering standalone.\n",
+              BackendTypeName(pOptions->backendType));
+    }
+}
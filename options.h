@@ -0,0 +1,350 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#if !defined(OPTIONS_H)
+#define OPTIONS_H
+
+#include <stdint.h>
+
+#include "utils.h"
+
+/* Upper bound for --fifo-length. */
+#define MAX_FIFO_LENGTH 16
+
+/* Upper bound for --frames-in-flight. */
+#define MAX_FRAMES_IN_FLIGHT 16
+
+/* Upper bound for the number of --input devices. */
+#define MAX_INPUT_DEVICES 8
+
+/* Upper bound for --virtual-input, in key presses per second. */
+#define MAX_VIRTUAL_INPUT_RATE 1000
+
+/* Upper bound for the CPU numbers in --render-cpus and --helper-cpus. */
+#define MAX_CPUS 1024
+
+/*
+ * How the EGLStream between the EGLSurface producer and the
+ * EGLOutputLayer consumer should queue frames.
+ */
+enum PresentMode {
+    /* Mailbox: each new frame replaces any frame not yet displayed. */
+    PRESENT_MODE_LATENCY,
+    /* FIFO of length 1: the producer may run one frame ahead. */
+    PRESENT_MODE_BALANCED,
+    /* Deeper FIFO: the producer may queue several frames ahead. */
+    PRESENT_MODE_THROUGHPUT,
+};
+
+/*
+ * The color buffer layout to render in; see ChooseConfig().
+ */
+enum ColorFormat {
+    /* 8 bits per channel, no alpha: full quality. */
+    COLOR_FORMAT_RGB888,
+    /* 5/6/5 bits: half the color bandwidth, with some banding. */
+    COLOR_FORMAT_RGB565,
+};
+
+/*
+ * The scheduling priority to request for the rendering context, with
+ * EGL_IMG_context_priority.
+ */
+enum ContextPriority {
+    CONTEXT_PRIORITY_DEFAULT,
+    CONTEXT_PRIORITY_LOW,
+    CONTEXT_PRIORITY_MEDIUM,
+    CONTEXT_PRIORITY_HIGH,
+};
+
+/*
+ * How frames get from the EGLSurface to the display.
+ */
+/*
+ * How to choose the GPU; see SelectGpuDevice().
+ */
+enum DevicePolicy {
+    /* The first GPU with a connected output. */
+    DEVICE_POLICY_DISPLAY,
+    /* The GPU whose connected outputs include a named connector. */
+    DEVICE_POLICY_CONNECTOR,
+    /* The GPU at a PCI bus ID. */
+    DEVICE_POLICY_BUS_ID,
+    /* The GPU that renders a short benchmark the fastest. */
+    DEVICE_POLICY_FASTEST,
+};
+
+/*
+ * A --device or --render-device policy.  For DEVICE_POLICY_CONNECTOR,
+ * 'connectorName' is also the connector to drive; 'busId' is
+ * normalized to the form 0000:01:00.0.
+ */
+struct DeviceSelection {
+    enum DevicePolicy policy;
+    const char *connectorName;
+    char busId[16];
+};
+
+/*
+ * Color correction for the CRTC to apply, e.g., to calibrate a panel;
+ * see SetKmsDisplayColor().  The CRTC applies DEGAMMA_LUT, then CTM,
+ * then GAMMA_LUT.  Each LUT maps a channel value x in [0, 1] to
+ * x^exponent, with an exponent per red, green, and blue; an exponent of
+ * 0 leaves that LUT out.  The CTM, if set, is a row-major 3x3 matrix
+ * that maps linear RGB to linear RGB.  'set' is whether any of them is
+ * given.
+ */
+struct ColorCorrection {
+    int set;
+    double degamma[3];
+    double gamma[3];
+    int ctmSet;
+    double ctm[9];
+};
+
+enum BackendType {
+    /*
+     * An EGLStream consumed by the EGLOutputLayer for the plane; the
+     * EGL implementation performs the page flips.
+     */
+    BACKEND_EGLSTREAM,
+    /*
+     * A GBM surface, whose buffers the application adds as DRM fbs and
+     * flips with atomic commits (requires a GBM=1 build).
+     */
+    BACKEND_GBM,
+};
+
+/*
+ * A set of CPUs, parsed from a list such as "2,4-7"; see realtime.c.
+ */
+struct CpuSet {
+    int count;
+    uint64_t bits[MAX_CPUS / 64];
+};
+
+/*
+ * How the kernel should schedule the render thread; see
+ * EnterRealtime().
+ */
+enum SchedPolicy {
+    /* The default time-sharing policy (SCHED_OTHER). */
+    SCHED_POLICY_DEFAULT,
+    /* SCHED_FIFO, at a fixed real-time priority. */
+    SCHED_POLICY_FIFO,
+    /* SCHED_DEADLINE, with a CPU budget in every refresh period. */
+    SCHED_POLICY_DEADLINE,
+};
+
+/*
+ * Which parts of the pipeline this process runs.
+ */
+enum Role {
+    /* Own the display and render to it, in one process. */
+    ROLE_STANDALONE,
+    /*
+     * Own the display (DRM master and the EGLOutputLayer consumer),
+     * and hand EGLStreams to render clients over a Unix socket.
+     */
+    ROLE_SERVER,
+    /* Render into an EGLStream received from a server. */
+    ROLE_CLIENT,
+    /*
+     * Own the display, and present the EGLStreams of Wayland clients,
+     * on KMS planes directly or by compositing.
+     */
+    ROLE_COMPOSITOR,
+};
+
+struct Options {
+    enum Role role;
+
+    enum BackendType backendType;
+
+    /* The GPU that drives the display. */
+    struct DeviceSelection device;
+
+    /*
+     * If set, render on this GPU instead, and copy each frame to the
+     * display GPU; see InitCrossGpuBackend().
+     */
+    int renderDeviceSet;
+    struct DeviceSelection renderDevice;
+
+    /* Print the GPUs in the system, and exit. */
+    int listDevices;
+
+    /* Always probe the display, ignoring the probe cache. */
+    int noProbeCache;
+
+    /*
+     * The CPUs to run the render loop on, and the CPUs for every other
+     * thread (driver threads, the capture writer, the lease manager);
+     * empty to leave either to the kernel.
+     */
+    struct CpuSet renderCpus;
+    struct CpuSet helperCpus;
+
+    /*
+     * The render thread's scheduling policy; for SCHED_POLICY_FIFO,
+     * its priority, and for SCHED_POLICY_DEADLINE, the percentage of
+     * each refresh period it may run for.
+     */
+    enum SchedPolicy schedPolicy;
+    int schedPriority;
+    int deadlinePercent;
+
+    /*
+     * Lock and pre-fault the process's memory, and flag every frame
+     * after warm-up that allocates memory or takes a page fault.
+     */
+    int lockMemory;
+
+    /*
+     * Sleep between frames in an epoll loop that paces rendering to the
+     * refresh rate and handles DRM events, signals, and input; see
+     * eventloop.c.
+     */
+    int eventLoop;
+
+    /* The evdev devices to turn the gears with; see input.c. */
+    const char *inputPaths[MAX_INPUT_DEVICES];
+    int numInputs;
+
+    /*
+     * Measure the latency from each input that turns the gears to the
+     * page flip that shows it; see latency.c.  If virtualInputRate is
+     * non-zero, the input is a uinput keyboard that presses a key that
+     * many times a second.
+     */
+    int inputLatency;
+    int virtualInputRate;
+
+    /*
+     * Keep taking input after a frame's draw calls are submitted, until
+     * the GPU reaches the frame and copies its view from a persistently
+     * mapped buffer; see GearsFrameStarted().
+     */
+    int lateLatch;
+
+    /* Unix socket path for ROLE_SERVER and ROLE_CLIENT. */
+    const char *socketPath;
+
+    /*
+     * If not NULL, lease the outputs this process does not display on
+     * to processes that connect to this Unix socket; see
+     * StartLeaseManager().
+     */
+    const char *leaseServerPath;
+
+    /*
+     * If not NULL, display on an output leased from the lease manager
+     * listening on this Unix socket, instead of opening the GPU.  The
+     * lease is acquired at startup, into leaseFd; otherwise, leaseFd is
+     * -1.
+     */
+    const char *leaseClientPath;
+    int leaseFd;
+
+    enum PresentMode presentMode;
+
+    /* FIFO length used by PRESENT_MODE_THROUGHPUT. */
+    int fifoLength;
+
+    /*
+     * If non-zero, limit how many frames the GPU may be behind the CPU,
+     * using native fence syncs.
+     */
+    int framesInFlight;
+
+    /*
+     * If non-zero, render this many frames, print a summary of the
+     * present statistics, and exit.
+     */
+    int benchmarkFrames;
+
+    /*
+     * EGLConfig policy: the exact color format, the minimum depth
+     * buffer size (0 for none), and the minimum MSAA sample count (0
+     * for none).
+     */
+    enum ColorFormat colorFormat;
+    int depthBits;
+    int msaaSamples;
+
+    /*
+     * Rendering context options; see CreateContext().  A glMajor of 0
+     * leaves the OpenGL version to the implementation.
+     */
+    enum ContextPriority contextPriority;
+    int noError;
+    int glMajor;
+    int glMinor;
+    int coreProfile;
+
+    /*
+     * Draw the gears from one vertex buffer, turned by a vertex shader
+     * given the time, instead of fixed-function display lists.
+     */
+    int gpuAnimation;
+
+    /*
+     * Repaint only the area around the gears each frame, and report
+     * that area as damage when presenting.
+     */
+    int partialUpdates;
+
+    /* Color correction for the CRTC to apply; see ColorCorrection. */
+    struct ColorCorrection colorCorrection;
+
+    /*
+     * How the panel is mounted; see Orientation.  The primary plane
+     * rotates and reflects frames if it can, and the renderer
+     * otherwise.
+     */
+    struct Orientation orientation;
+
+    /*
+     * If not NULL, record every captureInterval-th frame to this file;
+     * see capture.c.
+     */
+    const char *capturePath;
+    int captureInterval;
+
+    /*
+     * If not NULL, publish per-frame telemetry to the shared memory
+     * object of this name; see telemetry.h.
+     */
+    const char *telemetryName;
+};
+
+void ParseOptions(int argc, char *argv[], struct Options *pOptions);
+
+const char *PresentModeName(enum PresentMode presentMode);
+
+const char *BackendTypeName(enum BackendType backendType);
+
+const char *ColorFormatName(enum ColorFormat colorFormat);
+
+const char *ContextPriorityName(enum ContextPriority contextPriority);
+
+#endif /* OPTIONS_H */
@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * An output pipeline: the display probed for it, the backend that
+ * presents to it, and the gears drawn for it, behind one handle.
+ *
+ * Nothing about a pipeline lives in globals: each backend keeps the
+ * extension functions of its own EGLDisplays (see LoadEglDispatch()),
+ * and each pipeline its own gears.  So a process can run several
+ * pipelines, e.g., one per head, each on its own thread.
+ *
+ * Each step of setting up a pipeline returns its failures, with the
+ * reason in GetError(), after releasing what it had set up.  The
+ * functions here pass them on in an error buffer, so that a caller can
+ * retry a pipeline, or give up on it, and keep the others running.
+ *
+ * The life of a pipeline:
+ *
+ *   CreateOutput()    probe the display: find the GPU and the connector,
+ *                     CRTC, and plane; slow, so done once
+ *   StartOutput()     set the mode, set up the backend, and upload the
+ *                     gears; the EGLSurface is then current
+ *   StopOutput()      tear down what StartOutput() set up
+ *   DestroyOutput()   restore the display and close the DRM fd
+ *
+ * StartOutput() and StopOutput() can alternate any number of times,
+ * e.g., to recover from a GPU reset.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "output.h"
+#include "egl.h"
+#include "kms.h"
+#include "utils.h"
+
+struct Output {
+    const struct Options *pOptions;
+    struct DisplayProbe probe;
+
+    /*
+     * The backend the render loop presents through, and, with
+     * --render-device, the backend on the display GPU that it copies
+     * frames to.  The latter is owned by the former once that is set
+     * up.
+     */
+    struct Backend backend;
+    struct Backend displayBackend;
+    int backendSetUp;
+
+    struct Gears *pGears;
+};
+
+
+/*
+ * Set a mode, and set up EGL to present to it through the backend
+ * selected by the options.  Return -1 on failure, having destroyed what
+ * was set up.
+ */
+static int SetUpBackend(struct Backend *pBackend,
+                        const struct Options *pOptions,
+                        const struct DisplayProbe *pProbe)
+{
+    EGLDisplay eglDpy;
+    struct EglDispatch egl;
+    int width, height;
+    uint32_t planeID = 0;
+    EGLSurface eglSurface;
+    EGLStreamKHR eglStream;
+
+    switch (pOptions->backendType) {
+    case BACKEND_GBM:
+        return SetUpGbmBackend(pBackend, pOptions, pProbe);
+    case BACKEND_EGLSTREAM:
+        eglDpy = SetUpDisplay(pProbe, &egl, &planeID, &width, &height);
+
+        if (eglDpy == EGL_NO_DISPLAY) {
+            return -1;
+        }
+
+        eglSurface = SetUpEgl(&egl, eglDpy, planeID, width, height,
+                              pOptions, pProbe->pCache, &eglStream);
+
+        if (eglSurface == EGL_NO_SURFACE) {
+            eglTerminate(eglDpy);
+            return -1;
+        }
+
+        if (InitEglStreamBackend(pBackend, &egl, eglDpy, eglSurface,
+                                 eglStream, width, height) != 0) {
+            EGLContext eglContext = eglGetCurrentContext();
+
+            eglMakeCurrent(eglDpy, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                           EGL_NO_CONTEXT);
+            eglDestroySurface(eglDpy, eglSurface);
+            egl.DestroyStreamKHR(eglDpy, eglStream);
+            eglDestroyContext(eglDpy, eglContext);
+            eglTerminate(eglDpy);
+            return -1;
+        }
+
+        pBackend->drmFd = pProbe->drmFd;
+        GetKmsDisplayOutput(pProbe->pKms, &pBackend->kmsOutput);
+
+        if (StreamFlipEventsSupported(eglQueryString(eglDpy,
+                                                     EGL_EXTENSIONS),
+                                      pOptions)) {
+            EnableEglStreamFlipEvents(pBackend, pProbe->drmFd);
+        } else if (pOptions->inputLatency) {
+            Warning("EGL_EXT_stream_acquire_mode or "
+                    "EGL_NV_output_drm_flip_event not found; "
+                    "input-to-photon latency cannot be measured.\n");
+        }
+        break;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Probe the display, and allocate the gears, for a new Output.  Return
+ * 0 on success, or -1 with the reason in 'error', having released what
+ * was set up.
+ */
+static int ProbeOutput(struct Output *pOutput, char *error, size_t errorSize)
+{
+    if (ProbeDisplay(&pOutput->probe, pOutput->pOptions) != 0) {
+        snprintf(error, errorSize, "%s", GetError());
+        return -1;
+    }
+
+    pOutput->pGears = CreateGears();
+
+    if (pOutput->pGears == NULL) {
+        snprintf(error, errorSize, "%s", GetError());
+        ReleaseDisplayProbe(&pOutput->probe);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Probe the display selected by 'pOptions', which must outlive the
+ * Output.  Return NULL on failure, with the reason in 'error'.
+ */
+struct Output *CreateOutput(const struct Options *pOptions,
+                            char *error, size_t errorSize)
+{
+    struct Output *pOutput = calloc(1, sizeof(*pOutput));
+
+    if (pOutput == NULL) {
+        snprintf(error, errorSize, "Memory allocation failure.\n");
+        return NULL;
+    }
+
+    pOutput->pOptions = pOptions;
+    pOutput->probe.drmFd = -1;
+    pOutput->probe.pKms = NULL;
+
+    if (ProbeOutput(pOutput, error, errorSize) != 0) {
+        free(pOutput);
+        return NULL;
+    }
+
+    return pOutput;
+}
+
+
+/*
+ * Set the output up for rendering.  Return 0 on success, or -1 with the
+ * reason in 'error', having torn down what was set up; the Output can
+ * then be started again or destroyed.
+ */
+int StartOutput(struct Output *pOutput, char *error, size_t errorSize)
+{
+    const struct Options *pOptions = pOutput->pOptions;
+
+    if (pOptions->renderDeviceSet) {
+        /*
+         * The display GPU only copies finished frames into its
+         * EGLSurface, which needs neither multisampling nor depth.
+         */
+        struct Options displayOptions = *pOptions;
+
+        displayOptions.msaaSamples = 0;
+        displayOptions.depthBits = 0;
+
+        if (SetUpBackend(&pOutput->displayBackend, &displayOptions,
+                         &pOutput->probe) != 0) {
+            goto fail;
+        }
+
+        if (InitCrossGpuBackend(&pOutput->backend, &pOutput->displayBackend,
+                                pOptions) != 0) {
+            pOutput->displayBackend.destroy(&pOutput->displayBackend);
+            goto fail;
+        }
+    } else if (SetUpBackend(&pOutput->backend, pOptions,
+                            &pOutput->probe) != 0) {
+        goto fail;
+    }
+
+    if (InitGears(pOutput->pGears, pOutput->backend.width,
+                  pOutput->backend.height, pOptions->gpuAnimation,
+                  &pOutput->probe.renderOrientation) != 0) {
+        pOutput->backend.destroy(&pOutput->backend);
+        goto fail;
+    }
+
+    pOutput->backendSetUp = 1;
+
+    return 0;
+
+fail:
+    snprintf(error, errorSize, "%s", GetError());
+    return -1;
+}
+
+
+/*
+ * Tear down what StartOutput() set up.  The gears keep their place in
+ * the animation, and continue from it when the Output is started again.
+ */
+void StopOutput(struct Output *pOutput)
+{
+    if (!pOutput->backendSetUp) {
+        return;
+    }
+
+    DestroyGears(pOutput->pGears);
+    pOutput->backend.destroy(&pOutput->backend);
+    pOutput->backendSetUp = 0;
+}
+
+
+/*
+ * Stop the Output if it is started, restore the display, and free the
+ * Output.
+ */
+void DestroyOutput(struct Output *pOutput)
+{
+    StopOutput(pOutput);
+    FreeGears(pOutput->pGears);
+    ReleaseDisplayProbe(&pOutput->probe);
+    free(pOutput);
+}
+
+
+/* The backend to present through; only valid while started. */
+struct Backend *GetOutputBackend(struct Output *pOutput)
+{
+    return &pOutput->backend;
+}
+
+
+struct Gears *GetOutputGears(struct Output *pOutput)
+{
+    return pOutput->pGears;
+}
+
+
+/* The refresh rate of the output's mode, in Hz. */
+double GetOutputRefresh(const struct Output *pOutput)
+{
+    return GetKmsDisplayRefresh(pOutput->probe.pKms);
+}
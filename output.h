@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#if !defined(OUTPUT_H)
+#define OUTPUT_H
+
+#include <stddef.h>
+
+#include "backend.h"
+#include "eglgears.h"
+#include "options.h"
+
+struct Output;
+
+struct Output *CreateOutput(const struct Options *pOptions,
+                            char *error, size_t errorSize);
+int StartOutput(struct Output *pOutput, char *error, size_t errorSize);
+void StopOutput(struct Output *pOutput);
+void DestroyOutput(struct Output *pOutput);
+
+struct Backend *GetOutputBackend(struct Output *pOutput);
+struct Gears *GetOutputGears(struct Output *pOutput);
+double GetOutputRefresh(const struct Output *pOutput);
+
+#endif /* OUTPUT_H */
@@ -0,0 +1,393 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The probe cache.
+ *
+ * Finding the connector, CRTC, and plane to display on, and the
+ * property IDs to program them with, queries every KMS object, and
+ * querying a connector makes the kernel probe it again, reading the
+ * display's EDID over DDC.  Choosing an EGLConfig queries every config.
+ * On fixed hardware, every launch finds the same answers.
+ *
+ * So the answers are kept in a file, named by a hash of the KMS
+ * topology (the device, its CRTCs and planes, and each connector with
+ * the EDID of its display; see HashKmsTopology()) and of the options
+ * that steer the probe.  Hashing uses only state the kernel already
+ * has.  On a hit, the saved KmsDisplay is checked with one TEST_ONLY
+ * modeset (see RestoreKmsDisplay()), and the saved EGLConfig IDs are
+ * checked against the config policy when they are used; anything that
+ * fails falls back to the full probe, which then replaces the file.
+ *
+ * The file lives in $XDG_CACHE_HOME/eglstreams-kms-example/ (or
+ * ~/.cache/eglstreams-kms-example/), and is replaced atomically, with
+ * rename(2), whenever something new is learned, so that processes
+ * sharing it (e.g., a lease manager and its lessees) never read a torn
+ * file.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "probecache.h"
+#include "utils.h"
+
+#define PROBE_CACHE_MAGIC "EKPC"
+
+/* Bump this when the layout of the file, or of a KmsDisplayCache, changes. */
+#define PROBE_CACHE_VERSION 1
+
+#define MAX_CACHED_CONFIGS 4
+#define MAX_KMS_CACHE_SIZE 512
+
+/* The EGLConfig that ChooseConfig() chose for a surface type and visual. */
+struct CachedConfig {
+    EGLint surfaceType;
+    EGLint nativeVisualID;
+    EGLint configID;
+};
+
+struct ProbeCacheFile {
+    char magic[4];              /* PROBE_CACHE_MAGIC */
+    uint32_t version;           /* PROBE_CACHE_VERSION */
+    uint64_t key;               /* see OpenProbeCache() */
+    uint32_t kmsSize;           /* bytes of 'kms' in use, 0 if none */
+    uint32_t numConfigs;
+    struct CachedConfig configs[MAX_CACHED_CONFIGS];
+    uint8_t kms[MAX_KMS_CACHE_SIZE];    /* from SaveKmsDisplay() */
+};
+
+/*
+ * One display probe's handle on its cache file, from OpenProbeCache().
+ * Pipelines on different threads each have their own; see
+ * WriteCacheFile() for how they share the file.
+ */
+struct ProbeCache {
+    int enabled;
+    char path[PATH_MAX];
+    struct ProbeCacheFile file;
+};
+
+
+static uint64_t HashString(uint64_t hash, const char *str)
+{
+    return (str != NULL) ? HashBytes(hash, str, strlen(str) + 1) :
+                           HashBytes(hash, "", 1);
+}
+
+
+static uint64_t HashDeviceSelection(uint64_t hash,
+                                    const struct DeviceSelection *pSelection)
+{
+    hash = HashBytes(hash, &pSelection->policy, sizeof(pSelection->policy));
+    hash = HashString(hash, pSelection->connectorName);
+    return HashString(hash, pSelection->busId);
+}
+
+
+/*
+ * Return a hash of the options that change what the probe picks.
+ */
+static uint64_t HashOptions(const struct Options *pOptions)
+{
+    uint32_t version = PROBE_CACHE_VERSION;
+    uint64_t hash = HashBytes(HASH_INIT, &version, sizeof(version));
+
+    hash = HashBytes(hash, &pOptions->backendType,
+                     sizeof(pOptions->backendType));
+    hash = HashDeviceSelection(hash, &pOptions->device);
+    hash = HashBytes(hash, &pOptions->renderDeviceSet,
+                     sizeof(pOptions->renderDeviceSet));
+    if (pOptions->renderDeviceSet) {
+        hash = HashDeviceSelection(hash, &pOptions->renderDevice);
+    }
+    hash = HashBytes(hash, &pOptions->colorFormat,
+                     sizeof(pOptions->colorFormat));
+    hash = HashBytes(hash, &pOptions->depthBits, sizeof(pOptions->depthBits));
+    return HashBytes(hash, &pOptions->msaaSamples,
+                     sizeof(pOptions->msaaSamples));
+}
+
+
+/*
+ * Set pCache->path to the cache file for 'key', creating its directory
+ * as needed.  Return whether there is a usable directory.
+ */
+static int SetCachePath(struct ProbeCache *pCache, uint64_t key)
+{
+    const char *base = getenv("XDG_CACHE_HOME");
+    char dir[PATH_MAX];
+    int len;
+
+    if ((base != NULL) && (base[0] != '\0')) {
+        len = snprintf(dir, sizeof(dir), "%s", base);
+    } else if (((base = getenv("HOME")) != NULL) && (base[0] != '\0')) {
+        len = snprintf(dir, sizeof(dir), "%s/.cache", base);
+    } else {
+        return 0;
+    }
+
+    if ((len < 0) || ((size_t) len >= sizeof(dir))) {
+        return 0;
+    }
+
+    if ((mkdir(dir, 0755) != 0) && (errno != EEXIST)) {
+        return 0;
+    }
+
+    len = snprintf(pCache->path, sizeof(pCache->path),
+                   "%s/eglstreams-kms-example", dir);
+    if ((len < 0) || ((size_t) len >= sizeof(pCache->path))) {
+        return 0;
+    }
+
+    if ((mkdir(pCache->path, 0755) != 0) && (errno != EEXIST)) {
+        return 0;
+    }
+
+    len = snprintf(pCache->path, sizeof(pCache->path),
+                   "%s/eglstreams-kms-example/probe-%016" PRIx64, dir, key);
+
+    return (len > 0) && ((size_t) len < sizeof(pCache->path));
+}
+
+
+/*
+ * Read the cache file into pCache->file.  Return whether it exists and
+ * is for 'key'.
+ */
+static int ReadCacheFile(struct ProbeCache *pCache, uint64_t key)
+{
+    struct ProbeCacheFile *pFile = &pCache->file;
+    int fd = open(pCache->path, O_RDONLY | O_CLOEXEC);
+    ssize_t size;
+
+    if (fd < 0) {
+        return 0;
+    }
+
+    size = read(fd, pFile, sizeof(*pFile));
+    close(fd);
+
+    return (size == (ssize_t) sizeof(*pFile)) &&
+           (memcmp(pFile->magic, PROBE_CACHE_MAGIC, 4) == 0) &&
+           (pFile->version == PROBE_CACHE_VERSION) &&
+           (pFile->key == key) &&
+           (pFile->kmsSize <= sizeof(pFile->kms)) &&
+           (pFile->numConfigs <= MAX_CACHED_CONFIGS);
+}
+
+
+/*
+ * Replace the cache file with pCache->file.  A failure only costs the
+ * next launch a full probe, so it is a warning, after which the cache
+ * stops writing.  The temporary file is named by the writing thread,
+ * so that handles on the same file in other threads or processes
+ * never write into each other's.
+ */
+static void WriteCacheFile(struct ProbeCache *pCache)
+{
+    char tmpPath[PATH_MAX + 32];
+    int fd;
+
+    snprintf(tmpPath, sizeof(tmpPath), "%s.%ld.tmp", pCache->path,
+             (long) syscall(SYS_gettid));
+
+    fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd >= 0) {
+        ssize_t size = write(fd, &pCache->file, sizeof(pCache->file));
+
+        if ((close(fd) == 0) && (size == (ssize_t) sizeof(pCache->file)) &&
+            (rename(tmpPath, pCache->path) == 0)) {
+            return;
+        }
+
+        unlink(tmpPath);
+    }
+
+    Warning("Unable to write the probe cache %s.\n", pCache->path);
+    pCache->enabled = 0;
+}
+
+
+/*
+ * Look up the cache for the display on 'drmFd', as steered by the
+ * options.  Set *ppKms to the KmsDisplay it describes, if there is one
+ * and the driver accepts it; otherwise to NULL, and the caller should
+ * probe with CreateKmsDisplay() and store the result.
+ *
+ * Return the handle for StoreProbeCacheDisplay() and the config cache,
+ * to close with CloseProbeCache(), or NULL if there is no usable cache;
+ * the other functions here take a NULL handle as an empty cache.
+ */
+struct ProbeCache *OpenProbeCache(int drmFd, const struct Options *pOptions,
+                                  struct KmsDisplay **ppKms)
+{
+    struct ProbeCache *pCache;
+    struct ProbeCacheFile *pFile;
+    uint64_t key = HashOptions(pOptions);
+
+    *ppKms = NULL;
+
+    if (HashKmsTopology(drmFd, &key) != 0) {
+        Warning("%s", GetError());
+        Warning("Not using the probe cache.\n");
+        return NULL;
+    }
+
+    pCache = calloc(1, sizeof(*pCache));
+
+    if (pCache == NULL) {
+        return NULL;
+    }
+
+    if (!SetCachePath(pCache, key)) {
+        free(pCache);
+        return NULL;
+    }
+
+    pCache->enabled = 1;
+    pFile = &pCache->file;
+
+    if (ReadCacheFile(pCache, key) && (pFile->kmsSize > 0)) {
+        *ppKms = RestoreKmsDisplay(drmFd, pFile->kms, pFile->kmsSize);
+    }
+
+    if (*ppKms == NULL) {
+        memset(pFile, 0, sizeof(*pFile));
+        memcpy(pFile->magic, PROBE_CACHE_MAGIC, 4);
+        pFile->version = PROBE_CACHE_VERSION;
+        pFile->key = key;
+    }
+
+    return pCache;
+}
+
+
+void CloseProbeCache(struct ProbeCache *pCache)
+{
+    free(pCache);
+}
+
+
+/*
+ * Save what CreateKmsDisplay() found, after OpenProbeCache() missed.
+ */
+void StoreProbeCacheDisplay(struct ProbeCache *pCache,
+                            const struct KmsDisplay *pKms)
+{
+    struct ProbeCacheFile *pFile;
+    size_t size;
+
+    if ((pCache == NULL) || !pCache->enabled) {
+        return;
+    }
+
+    pFile = &pCache->file;
+    size = SaveKmsDisplay(pKms, pFile->kms, sizeof(pFile->kms));
+
+    if (size > sizeof(pFile->kms)) {
+        Warning("The KmsDisplay does not fit in the probe cache.\n");
+        pCache->enabled = 0;
+        return;
+    }
+
+    pFile->kmsSize = size;
+
+    WriteCacheFile(pCache);
+}
+
+
+/*
+ * Return the ID of the EGLConfig chosen for this surface type and
+ * native visual in an earlier launch, or 0 if there is none.  The
+ * caller must check that the config still qualifies.
+ */
+EGLint LookUpCachedConfig(const struct ProbeCache *pCache,
+                          EGLint surfaceType, EGLint nativeVisualID)
+{
+    const struct ProbeCacheFile *pFile;
+    uint32_t i;
+
+    if ((pCache == NULL) || !pCache->enabled) {
+        return 0;
+    }
+
+    pFile = &pCache->file;
+
+    for (i = 0; i < pFile->numConfigs; i++) {
+        if ((pFile->configs[i].surfaceType == surfaceType) &&
+            (pFile->configs[i].nativeVisualID == nativeVisualID)) {
+            return pFile->configs[i].configID;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Save the EGLConfig chosen for this surface type and native visual.
+ */
+void StoreCachedConfig(struct ProbeCache *pCache, EGLint surfaceType,
+                       EGLint nativeVisualID, EGLint configID)
+{
+    struct ProbeCacheFile *pFile;
+    struct CachedConfig *pConfig = NULL;
+    uint32_t i;
+
+    if ((pCache == NULL) || !pCache->enabled) {
+        return;
+    }
+
+    pFile = &pCache->file;
+
+    for (i = 0; i < pFile->numConfigs; i++) {
+        if ((pFile->configs[i].surfaceType == surfaceType) &&
+            (pFile->configs[i].nativeVisualID == nativeVisualID)) {
+            pConfig = &pFile->configs[i];
+            break;
+        }
+    }
+
+    if (pConfig == NULL) {
+        if (pFile->numConfigs == MAX_CACHED_CONFIGS) {
+            return;
+        }
+        pConfig = &pFile->configs[pFile->numConfigs++];
+    }
+
+    pConfig->surfaceType = surfaceType;
+    pConfig->nativeVisualID = nativeVisualID;
+    pConfig->configID = configID;
+
+    WriteCacheFile(pCache);
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#if !defined(PROBECACHE_H)
+#define PROBECACHE_H
+
+#include <EGL/egl.h>
+
+#include "kms.h"
+#include "options.h"
+
+/*
+ * What probing the display found, kept on disk so that the next launch
+ * on the same hardware can skip the probe; see probecache.c.
+ */
+
+struct ProbeCache;
+
+struct ProbeCache *OpenProbeCache(int drmFd, const struct Options *pOptions,
+                                  struct KmsDisplay **ppKms);
+void CloseProbeCache(struct ProbeCache *pCache);
+void StoreProbeCacheDisplay(struct ProbeCache *pCache,
+                            const struct KmsDisplay *pKms);
+EGLint LookUpCachedConfig(const struct ProbeCache *pCache,
+                          EGLint surfaceType, EGLint nativeVisualID);
+void StoreCachedConfig(struct ProbeCache *pCache, EGLint surfaceType,
+                       EGLint nativeVisualID, EGLint configID);
+
+#endif /* PROBECACHE_H */
@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Real-time scheduling and CPU pinning for the render loop.
+ *
+ * At normal priority, the render thread shares its CPU with whatever
+ * else the kernel puts there, and a background job that runs when a
+ * frame is due makes the frame miss its vblank.  So:
+ *
+ * - --helper-cpus pins the main thread at startup, before anything
+ *   else starts; every thread created later, including the EGL
+ *   driver's, the capture writer, and the lease manager, inherits that
+ *   affinity.
+ *
+ * - While the render loop runs, --render-cpus pins the render thread to
+ *   its own CPUs (ideally ones kept free of other work with isolcpus=
+ *   or a cpuset), and --sched gives it a real-time policy: SCHED_FIFO,
+ *   which runs it ahead of every normal thread on its CPU, or
+ *   SCHED_DEADLINE, which guarantees it a CPU budget in every refresh
+ *   period.
+ *
+ * Both policies are set with SCHED_RESET_ON_FORK, so that nothing the
+ * render thread starts inherits them.  Between render loops (e.g.,
+ * while restarting the display pipeline), the thread goes back to its
+ * normal policy and CPUs.
+ */
+
+#define _GNU_SOURCE /* for CPU_SET(3), RUSAGE_THREAD */
+
+#include <errno.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "memlock.h"
+#include "realtime.h"
+#include "utils.h"
+
+#if !defined(SCHED_DEADLINE)
+#define SCHED_DEADLINE 6
+#endif
+
+#if !defined(SCHED_RESET_ON_FORK)
+#define SCHED_RESET_ON_FORK 0x40000000
+#endif
+
+#define SCHED_FLAG_RESET_ON_FORK 0x01
+
+/* The refresh rate to budget for when the display's is unknown. */
+#define DEFAULT_REFRESH_RATE 60.0
+
+/* The argument of sched_setattr(2), which glibc does not wrap. */
+struct SchedAttr {
+    uint32_t size;
+    uint32_t schedPolicy;
+    uint64_t schedFlags;
+    int32_t schedNice;
+    uint32_t schedPriority;
+    uint64_t schedRuntime;      /* ns */
+    uint64_t schedDeadline;     /* ns */
+    uint64_t schedPeriod;       /* ns */
+};
+
+/* What EnterRealtime() changed, for LeaveRealtime() to undo. */
+struct Realtime {
+    int policySet;
+
+    /* The render thread's CPUs before EnterRealtime() pinned it. */
+    int affinitySaved;
+    cpu_set_t savedAffinity;
+};
+
+
+/*
+ * Pin the calling thread to the CPUs in 'pSet'.  'what' names the
+ * thread for the warning if that fails.
+ */
+static void PinThread(const struct CpuSet *pSet, const char *what)
+{
+    cpu_set_t cpus;
+    int cpu;
+
+    CPU_ZERO(&cpus);
+
+    for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (pSet->bits[cpu / 64] & (1ull << (cpu % 64))) {
+            CPU_SET(cpu, &cpus);
+        }
+    }
+
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+        Warning("Unable to pin the %s to the given CPUs: %s.\n",
+                what, strerror(errno));
+    }
+}
+
+
+/*
+ * Pin the process's threads to --helper-cpus.  Call this first thing,
+ * from the main thread, so that every thread created later inherits
+ * it.
+ */
+void PinHelperThreads(const struct Options *pOptions)
+{
+    if (pOptions->helperCpus.count > 0) {
+        PinThread(&pOptions->helperCpus, "helper threads");
+    }
+}
+
+
+static int SetFifo(int priority)
+{
+    struct sched_param param = { 0 };
+
+    param.sched_priority = priority;
+
+    if (sched_setscheduler(0, SCHED_FIFO | SCHED_RESET_ON_FORK,
+                           &param) != 0) {
+        Warning("Unable to use SCHED_FIFO priority %d: %s.  This needs "
+                "CAP_SYS_NICE, or an RLIMIT_RTPRIO (ulimit -r) of at "
+                "least %d.\n", priority, strerror(errno), priority);
+        return 0;
+    }
+
+    printf("Render loop: SCHED_FIFO, priority %d\n", priority);
+
+    return 1;
+}
+
+
+/*
+ * Give the render thread 'percent' of every refresh period, by the
+ * end of that period.  The kernel admits the thread only if the CPUs
+ * of its root domain have that much bandwidth to spare, and only if
+ * its affinity spans the whole root domain: pinning it within a
+ * shared root domain makes this fail with EPERM.
+ */
+static int SetDeadline(double refreshRate, int percent)
+{
+    struct SchedAttr attr;
+    uint64_t periodNs;
+
+    if (refreshRate <= 0.0) {
+        Warning("The refresh rate is unknown; budgeting for %.0f Hz.\n",
+                DEFAULT_REFRESH_RATE);
+        refreshRate = DEFAULT_REFRESH_RATE;
+    }
+
+    periodNs = (uint64_t) (1000000000.0 / refreshRate);
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.schedPolicy = SCHED_DEADLINE;
+    attr.schedFlags = SCHED_FLAG_RESET_ON_FORK;
+    attr.schedPeriod = periodNs;
+    attr.schedDeadline = periodNs;
+    attr.schedRuntime = periodNs * percent / 100;
+
+    if (syscall(SYS_sched_setattr, 0, &attr, 0) != 0) {
+        Warning("Unable to use SCHED_DEADLINE: %s.%s\n", strerror(errno),
+                (errno == EPERM) ?
+                "  This needs CAP_SYS_NICE, and an affinity spanning the "
+                "thread's root domain (use an exclusive cpuset rather than "
+                "--render-cpus)." : "");
+        return 0;
+    }
+
+    printf("Render loop: SCHED_DEADLINE, %.3f ms of every %.3f ms\n",
+           attr.schedRuntime / 1000000.0, periodNs / 1000000.0);
+
+    return 1;
+}
+
+
+/*
+ * Pin the calling (render) thread to --render-cpus, and give it the
+ * --sched policy, budgeting SCHED_DEADLINE by 'refreshRate' (in Hz; 0
+ * if unknown).  If SCHED_DEADLINE is refused, fall back to SCHED_FIFO.
+ *
+ * Return what to pass to LeaveRealtime(), from the same thread.  If
+ * even that cannot be allocated, warn and leave the thread as it is.
+ */
+struct Realtime *EnterRealtime(const struct Options *pOptions,
+                               double refreshRate)
+{
+    struct Realtime *pRealtime = calloc(1, sizeof(*pRealtime));
+
+    if (pRealtime == NULL) {
+        Warning("Memory allocation failure; not entering real time.\n");
+        return NULL;
+    }
+
+    if (pOptions->renderCpus.count > 0) {
+        pRealtime->affinitySaved =
+            (sched_getaffinity(0, sizeof(pRealtime->savedAffinity),
+                               &pRealtime->savedAffinity) == 0);
+        PinThread(&pOptions->renderCpus, "render loop");
+    }
+
+    pRealtime->policySet = (pOptions->schedPolicy != SCHED_POLICY_DEFAULT);
+
+    switch (pOptions->schedPolicy) {
+    case SCHED_POLICY_DEFAULT:
+        break;
+    case SCHED_POLICY_FIFO:
+        SetFifo(pOptions->schedPriority);
+        break;
+    case SCHED_POLICY_DEADLINE:
+        if (!SetDeadline(refreshRate, pOptions->deadlinePercent)) {
+            SetFifo(pOptions->schedPriority);
+        }
+        break;
+    }
+
+    return pRealtime;
+}
+
+
+/*
+ * Undo EnterRealtime(), and free 'pRealtime'.
+ */
+void LeaveRealtime(struct Realtime *pRealtime)
+{
+    if (pRealtime == NULL) {
+        return;
+    }
+
+    if (pRealtime->policySet) {
+        struct sched_param param = { 0 };
+
+        sched_setscheduler(0, SCHED_OTHER, &param);
+    }
+
+    if (pRealtime->affinitySaved) {
+        sched_setaffinity(0, sizeof(pRealtime->savedAffinity),
+                          &pRealtime->savedAffinity);
+    }
+
+    free(pRealtime);
+}
+
+
+/*
+ * Read the calling thread's counters: how many times the kernel has
+ * preempted it (switched it out while it could still run, for a
+ * higher-priority thread or at the end of its time slice), the page
+ * faults it has taken, and its allocations (see memlock.c).  The render
+ * loop reads them at the start and end of each frame.
+ */
+void ReadThreadCounters(struct ThreadCounters *pCounters)
+{
+    struct rusage usage;
+
+    memset(pCounters, 0, sizeof(*pCounters));
+
+    if (getrusage(RUSAGE_THREAD, &usage) == 0) {
+        pCounters->preemptions = usage.ru_nivcsw;
+        pCounters->minorFaults = usage.ru_minflt;
+        pCounters->majorFaults = usage.ru_majflt;
+    }
+
+    pCounters->allocations = GetThreadAllocations();
+}
@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+
+#include "stats.h"
+#include "utils.h"
+
+
+void ResetStat(struct Stat *pStat)
+{
+    pStat->count = 0;
+    pStat->sum = 0.0;
+    pStat->min = 0.0;
+    pStat->max = 0.0;
+}
+
+
+void AddStatSample(struct Stat *pStat, double value)
+{
+    if ((pStat->count == 0) || (value < pStat->min)) {
+        pStat->min = value;
+    }
+
+    if ((pStat->count == 0) || (value > pStat->max)) {
+        pStat->max = value;
+    }
+
+    pStat->sum += value;
+    pStat->count++;
+}
+
+
+double StatAverage(const struct Stat *pStat)
+{
+    return (pStat->count > 0) ? (pStat->sum / pStat->count) : 0.0;
+}
+
+
+void PrintStat(const char *name, const struct Stat *pStat, const char *unit)
+{
+    printf("  %-24s min %8.3f  avg %8.3f  max %8.3f %s\n",
+           name, pStat->min, StatAverage(pStat), pStat->max, unit);
+}
+
+
+void ResetPresentStats(struct PresentStats *pStats)
+{
+    ResetStat(&pStats->drawTime);
+    ResetStat(&pStats->swapTime);
+    ResetStat(&pStats->frameInterval);
+    ResetStat(&pStats->queueDepth);
+    ResetStat(&pStats->latency);
+    ResetStat(&pStats->fenceWait);
+    ResetStat(&pStats->flipLatency);
+    ResetStat(&pStats->transferTime);
+    ResetStat(&pStats->preemptions);
+    pStats->preemptedFrames = 0;
+    ResetStat(&pStats->allocations);
+    ResetStat(&pStats->minorFaults);
+    ResetStat(&pStats->majorFaults);
+    pStats->overBudgetFrames = 0;
+    pStats->startTime = -1.0;
+    pStats->startCpuTime = 0.0;
+    pStats->lastSwapEnd = -1.0;
+}
+
+
+/*
+ * Record one eglSwapBuffers() call.  Times are in seconds, as returned
+ * by GetTime().
+ *
+ * The display consumes at most one frame per refresh, so a frame that
+ * enters the stream behind 'queueDepth' others is displayed roughly
+ * (queueDepth + 1) frame intervals after eglSwapBuffers() returns.
+ * This is only an estimate, but it is the quantity that the FIFO
+ * length trades against throughput.
+ */
+void AddPresentSample(struct PresentStats *pStats,
+                      double swapStart, double swapEnd, int queueDepth)
+{
+    if (pStats->startTime < 0.0) {
+        pStats->startTime = swapStart;
+        pStats->startCpuTime = GetCpuTime();
+    }
+
+    AddStatSample(&pStats->swapTime, (swapEnd - swapStart) * 1000.0);
+    AddStatSample(&pStats->queueDepth, queueDepth);
+
+    if (pStats->lastSwapEnd >= 0.0) {
+        double interval = (swapEnd - pStats->lastSwapEnd) * 1000.0;
+
+        AddStatSample(&pStats->frameInterval, interval);
+        AddStatSample(&pStats->latency, (queueDepth + 1) * interval);
+    }
+
+    pStats->lastSwapEnd = swapEnd;
+}
+
+
+/*
+ * Record the time spent issuing one frame's OpenGL commands.  The GPU
+ * runs asynchronously, so this is the CPU-side cost of the driver:
+ * state validation, error checking, and command buffer construction.
+ */
+void AddDrawSample(struct PresentStats *pStats,
+                   double drawStart, double drawEnd)
+{
+    AddStatSample(&pStats->drawTime, (drawEnd - drawStart) * 1000.0);
+}
+
+
+void AddFenceWaitSample(struct PresentStats *pStats,
+                        double waitStart, double waitEnd)
+{
+    AddStatSample(&pStats->fenceWait, (waitEnd - waitStart) * 1000.0);
+}
+
+
+/*
+ * Record the time from a frame's presentation to the page flip event
+ * that put it on screen, for backends that perform the flips
+ * themselves and so can measure it.  Both times are on
+ * CLOCK_MONOTONIC, the clock of the flip event's timestamp.
+ */
+void AddFlipLatencySample(struct PresentStats *pStats,
+                          double swapEnd, double flipTime)
+{
+    AddStatSample(&pStats->flipLatency, (flipTime - swapEnd) * 1000.0);
+}
+
+
+/*
+ * Record the time spent copying a frame from the render GPU to the
+ * display GPU, for --render-device.
+ */
+void AddTransferSample(struct PresentStats *pStats,
+                       double transferStart, double transferEnd)
+{
+    AddStatSample(&pStats->transferTime,
+                  (transferEnd - transferStart) * 1000.0);
+}
+
+
+/*
+ * Record how many times the kernel preempted the render thread during
+ * one frame (see ReadThreadCounters()).  Each preemption
+ * delays the frame by at least a scheduler time slice, so on a
+ * well-isolated render CPU this stays at 0.
+ */
+void AddPreemptionSample(struct PresentStats *pStats, long preemptions)
+{
+    AddStatSample(&pStats->preemptions, preemptions);
+
+    if (preemptions > 0) {
+        pStats->preemptedFrames++;
+    }
+}
+
+
+/*
+ * Record the render thread's allocations (or -1 if they aren't
+ * counted) and page faults during one frame.  With --lock-memory,
+ * every one of these is over budget.
+ */
+void AddMemorySample(struct PresentStats *pStats, long allocations,
+                     long minorFaults, long majorFaults)
+{
+    if (allocations >= 0) {
+        AddStatSample(&pStats->allocations, allocations);
+    }
+
+    AddStatSample(&pStats->minorFaults, minorFaults);
+    AddStatSample(&pStats->majorFaults, majorFaults);
+
+    if ((allocations > 0) || (minorFaults > 0) || (majorFaults > 0)) {
+        pStats->overBudgetFrames++;
+    }
+}
+
+
+/*
+ * Print the statistics.  Call this as soon as the last frame is
+ * presented, since it also reports the CPU time the process has used
+ * since the first sample.
+ */
+void PrintPresentStats(const struct PresentStats *pStats, const char *title)
+{
+    double seconds = pStats->lastSwapEnd - pStats->startTime;
+    double cpuSeconds = GetCpuTime() - pStats->startCpuTime;
+    int frames = pStats->swapTime.count;
+
+    printf("%s: %d frames in %.3f seconds = %.3f FPS\n",
+           title, pStats->swapTime.count, seconds,
+           (seconds > 0.0) ? (pStats->swapTime.count / seconds) : 0.0);
+
+    PrintStat("OpenGL commands", &pStats->drawTime, "ms");
+    PrintStat("eglSwapBuffers()", &pStats->swapTime, "ms");
+    PrintStat("frame interval", &pStats->frameInterval, "ms");
+    PrintStat("queue depth", &pStats->queueDepth, "frames");
+    PrintStat("estimated latency", &pStats->latency, "ms");
+
+    if (pStats->flipLatency.count > 0) {
+        PrintStat("measured flip latency", &pStats->flipLatency, "ms");
+    }
+
+    if (pStats->fenceWait.count > 0) {
+        PrintStat("GPU fence wait", &pStats->fenceWait, "ms");
+    }
+
+    if (pStats->transferTime.count > 0) {
+        PrintStat("cross-GPU transfer", &pStats->transferTime, "ms");
+    }
+
+    if (pStats->preemptions.count > 0) {
+        PrintStat("involuntary ctx switches", &pStats->preemptions,
+                  "per frame");
+        printf("  %-24s %d of %d (%.2f%%)\n", "preempted frames",
+               pStats->preemptedFrames, pStats->preemptions.count,
+               pStats->preemptedFrames * 100.0 / pStats->preemptions.count);
+    }
+
+    if (pStats->minorFaults.count > 0) {
+        if (pStats->allocations.count > 0) {
+            PrintStat("allocations", &pStats->allocations, "per frame");
+        }
+        PrintStat("minor page faults", &pStats->minorFaults, "per frame");
+        PrintStat("major page faults", &pStats->majorFaults, "per frame");
+        printf("  %-24s %d of %d (%.2f%%)\n", "over-budget frames",
+               pStats->overBudgetFrames, pStats->minorFaults.count,
+               pStats->overBudgetFrames * 100.0 / pStats->minorFaults.count);
+    }
+
+    if ((frames > 0) && (seconds > 0.0)) {
+        printf("  %-24s %.3f ms/frame (%.1f%% of one CPU)\n",
+               "CPU time", cpuSeconds * 1000.0 / frames,
+               cpuSeconds * 100.0 / seconds);
+    }
+    fflush(stdout);
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#if !defined(STATS_H)
+#define STATS_H
+
+/*
+ * Running minimum/average/maximum of a per-frame measurement.
+ */
+struct Stat {
+    int count;
+    double sum;
+    double min;
+    double max;
+};
+
+void ResetStat(struct Stat *pStat);
+void AddStatSample(struct Stat *pStat, double value);
+double StatAverage(const struct Stat *pStat);
+void PrintStat(const char *name, const struct Stat *pStat, const char *unit);
+
+/*
+ * Statistics describing how frames move from the renderer to the
+ * display.
+ */
+struct PresentStats {
+    struct Stat drawTime;       /* CPU time issuing OpenGL commands, in ms */
+    struct Stat swapTime;       /* time spent in eglSwapBuffers(), in ms */
+    struct Stat frameInterval;  /* time between eglSwapBuffers() returns */
+    struct Stat queueDepth;     /* frames queued in the stream */
+    struct Stat latency;        /* estimated swap-to-scanout latency */
+    struct Stat fenceWait;      /* time the CPU waited for GPU fences */
+    struct Stat flipLatency;    /* measured swap-to-page-flip latency */
+    struct Stat transferTime;   /* time copying frames to the display GPU */
+    struct Stat preemptions;    /* involuntary context switches per frame */
+    int preemptedFrames;        /* frames with at least one */
+    struct Stat allocations;    /* malloc() and friends per frame */
+    struct Stat minorFaults;    /* page faults per frame */
+    struct Stat majorFaults;    /* page faults that read from disk */
+    int overBudgetFrames;       /* frames that allocated or faulted */
+    double startTime;
+    double startCpuTime;
+    double lastSwapEnd;
+};
+
+void ResetPresentStats(struct PresentStats *pStats);
+void AddPresentSample(struct PresentStats *pStats,
+                      double swapStart, double swapEnd, int queueDepth);
+void AddDrawSample(struct PresentStats *pStats,
+                   double drawStart, double drawEnd);
+void AddFenceWaitSample(struct PresentStats *pStats,
+                        double waitStart, double waitEnd);
+void AddFlipLatencySample(struct PresentStats *pStats,
+                          double swapEnd, double flipTime);
+void AddTransferSample(struct PresentStats *pStats,
+                       double transferStart, double transferEnd);
+void AddPreemptionSample(struct PresentStats *pStats, long preemptions);
+void AddMemorySample(struct PresentStats *pStats, long allocations,
+                     long minorFaults, long majorFaults);
+void PrintPresentStats(const struct PresentStats *pStats, const char *title);
+
+#endif /* STATS_H */
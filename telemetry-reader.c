@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * eglkms-telemetry: read the telemetry ring that eglstreams-kms-example
+ * publishes with --telemetry=NAME; see telemetry.h.
+ *
+ *   eglkms-telemetry NAME            print a summary of recent frames,
+ *                                    as key=value lines, and exit
+ *   eglkms-telemetry --follow NAME   print each frame's record as it
+ *                                    completes
+ *
+ * The ring is mapped read-only, and read without locks: the render
+ * process never waits for this tool, however it is scheduled.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "telemetry.h"
+
+/* Frames summarized, at most. */
+#define SUMMARY_FRAMES 120
+
+/*
+ * Frames a record is left to complete, i.e., for its GPU time and page
+ * flip to be filled in, before --follow prints it.
+ */
+#define FOLLOW_LAG 8
+
+#define FOLLOW_POLL_US 10000
+
+struct Range {
+    int count;
+    double sum;
+    double max;
+};
+
+
+static void Usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [--follow] NAME\n", program);
+    exit(1);
+}
+
+
+static const struct TelemetryRing *MapRing(const char *name)
+{
+    const struct TelemetryRing *pRing;
+    char path[64];
+    int fd;
+
+    snprintf(path, sizeof(path), "%s%s", (name[0] == '/') ? "" : "/", name);
+
+    fd = shm_open(path, O_RDONLY, 0);
+
+    if (fd < 0) {
+        fprintf(stderr, "Unable to open shared memory object %s: %s.\n",
+                path, strerror(errno));
+        exit(1);
+    }
+
+    pRing = mmap(NULL, sizeof(*pRing), PROT_READ, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (pRing == MAP_FAILED) {
+        fprintf(stderr, "Unable to map shared memory object %s: %s.\n",
+                path, strerror(errno));
+        exit(1);
+    }
+
+    if ((__atomic_load_n(&pRing->magic, __ATOMIC_ACQUIRE) !=
+         TELEMETRY_MAGIC) ||
+        (pRing->version != TELEMETRY_VERSION) ||
+        (pRing->numSlots != TELEMETRY_RING_SIZE) ||
+        (pRing->slotSize != sizeof(struct TelemetrySlot))) {
+        fprintf(stderr, "%s is not a telemetry ring of version %d.\n",
+                path, TELEMETRY_VERSION);
+        exit(1);
+    }
+
+    return pRing;
+}
+
+
+/*
+ * Copy the record of 'frameId' out of its slot's sequence lock.  Fail
+ * if the writer has moved on to a later frame in that slot.
+ */
+static int ReadRecord(const struct TelemetryRing *pRing, uint64_t frameId,
+                      struct TelemetryRecord *pRecord)
+{
+    const struct TelemetrySlot *pSlot =
+        &pRing->slots[frameId % TELEMETRY_RING_SIZE];
+
+    while (1) {
+        uint64_t before, after;
+
+        before = __atomic_load_n(&pSlot->sequence, __ATOMIC_ACQUIRE);
+
+        if (before & 1) {
+            continue;
+        }
+
+        memcpy(pRecord, (const void *) &pSlot->record, sizeof(*pRecord));
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&pSlot->sequence, __ATOMIC_RELAXED);
+
+        if (before == after) {
+            return pRecord->frameId == frameId;
+        }
+    }
+}
+
+
+static double NsToMs(uint64_t ns)
+{
+    return ns / 1000000.0;
+}
+
+
+static void AddToRange(struct Range *pRange, double value)
+{
+    if ((pRange->count == 0) || (value > pRange->max)) {
+        pRange->max = value;
+    }
+    pRange->sum += value;
+    pRange->count++;
+}
+
+
+static void PrintRange(const char *name, const struct Range *pRange)
+{
+    if (pRange->count > 0) {
+        printf("%s_avg_ms=%.3f\n", name, pRange->sum / pRange->count);
+        printf("%s_max_ms=%.3f\n", name, pRange->max);
+    }
+}
+
+
+static void PrintSummary(const struct TelemetryRing *pRing)
+{
+    uint64_t published = __atomic_load_n(&pRing->published,
+                                         __ATOMIC_ACQUIRE);
+    uint64_t first = (published > SUMMARY_FRAMES) ?
+        (published - SUMMARY_FRAMES) : 0;
+    struct Range interval = { 0 }, cpu = { 0 }, gpu = { 0 }, flip = { 0 };
+    struct TelemetryRecord record, previous;
+    int havePrevious = 0;
+    struct timeval now;
+    uint64_t id;
+
+    printf("writer_pid=%llu\n", (unsigned long long)
+           __atomic_load_n(&pRing->writerPid, __ATOMIC_ACQUIRE));
+    printf("frames=%llu\n", (unsigned long long) published);
+
+    for (id = first; id < published; id++) {
+        if (!ReadRecord(pRing, id, &record)) {
+            havePrevious = 0;
+            continue;
+        }
+
+        AddToRange(&cpu, NsToMs(record.cpuEndNs - record.cpuStartNs));
+
+        if (record.gpuTimeNs != 0) {
+            AddToRange(&gpu, NsToMs(record.gpuTimeNs));
+        }
+
+        if (record.flipNs != 0) {
+            AddToRange(&flip, NsToMs(record.flipNs - record.swapReturnNs));
+        }
+
+        if (havePrevious) {
+            AddToRange(&interval, NsToMs(record.swapReturnNs -
+                                         previous.swapReturnNs));
+        }
+
+        previous = record;
+        havePrevious = 1;
+    }
+
+    if (havePrevious) {
+        gettimeofday(&now, NULL);
+        printf("last_frame_age_ms=%.3f\n",
+               (now.tv_sec * 1000.0 + now.tv_usec / 1000.0) -
+               NsToMs(previous.swapReturnNs));
+    }
+
+    PrintRange("frame_interval", &interval);
+    PrintRange("cpu_time", &cpu);
+    PrintRange("gpu_time", &gpu);
+    PrintRange("flip_latency", &flip);
+}
+
+
+static void Follow(const struct TelemetryRing *pRing)
+{
+    uint64_t next = __atomic_load_n(&pRing->published, __ATOMIC_ACQUIRE);
+
+    printf("%10s %10s %10s %10s %10s\n",
+           "frame", "cpu_ms", "swap_ms", "flip_ms", "gpu_ms");
+
+    while (__atomic_load_n(&pRing->writerPid, __ATOMIC_ACQUIRE) != 0) {
+        uint64_t published = __atomic_load_n(&pRing->published,
+                                             __ATOMIC_ACQUIRE);
+
+        for (; next + FOLLOW_LAG < published; next++) {
+            struct TelemetryRecord record;
+
+            if (!ReadRecord(pRing, next, &record)) {
+                printf("%10llu (overwritten)\n", (unsigned long long) next);
+                continue;
+            }
+
+            printf("%10llu %10.3f %10.3f %10.3f %10.3f\n",
+                   (unsigned long long) record.frameId,
+                   NsToMs(record.cpuEndNs - record.cpuStartNs),
+                   NsToMs(record.swapReturnNs - record.cpuEndNs),
+                   record.flipNs ?
+                   NsToMs(record.flipNs - record.swapReturnNs) : 0.0,
+                   NsToMs(record.gpuTimeNs));
+        }
+
+        fflush(stdout);
+        usleep(FOLLOW_POLL_US);
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    const struct TelemetryRing *pRing;
+    int follow = 0;
+
+    if ((argc == 3) && (strcmp(argv[1], "--follow") == 0)) {
+        follow = 1;
+    } else if (argc != 2) {
+        Usage(argv[0]);
+    }
+
+    pRing = MapRing(argv[argc - 1]);
+
+    if (follow) {
+        Follow(pRing);
+    } else {
+        PrintSummary(pRing);
+    }
+
+    return 0;
+}
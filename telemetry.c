@@ -0,0 +1,397 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The writer side of the telemetry ring described in telemetry.h.
+ *
+ * Everything here runs on the render thread, including the page flip
+ * handlers that report flip times, so there is a single writer.
+ * Publishing a record is a few stores to shared memory: no system
+ * calls, no locks, and nothing a reader can delay.
+ *
+ * GPU times come from GL_TIME_ELAPSED queries around each frame's
+ * drawing.  Like the capture ring, the queries are kept in a ring and
+ * polled without blocking on later frames; when every query is still
+ * pending, the frame is not timed.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Timer queries are OpenGL 3.3 entry points, which libOpenGL exports. */
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include "telemetry.h"
+#include "utils.h"
+
+/* Frames whose GPU time may be measured at once. */
+#define TELEMETRY_GPU_QUERIES 8
+
+struct GpuTimer {
+    GLuint query;
+    uint64_t frameId;
+};
+
+struct Telemetry {
+    char name[64];
+    struct TelemetryRing *pRing;
+    uint64_t nextFrameId;
+
+    /* GPU timer queries, for the current context; see AttachTelemetry(). */
+    int gpuTimers;
+    struct GpuTimer timers[TELEMETRY_GPU_QUERIES];
+    int oldestTimer;
+    int timersPending;
+    struct GpuTimer *pActiveTimer;
+};
+
+
+static uint64_t TimeToNs(double time)
+{
+    return (uint64_t) (time * 1e9);
+}
+
+
+/*
+ * Update a slot under its sequence lock.
+ */
+static void WriteSlot(struct TelemetrySlot *pSlot,
+                      const struct TelemetryRecord *pRecord)
+{
+    uint64_t sequence = pSlot->sequence;
+
+    __atomic_store_n(&pSlot->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    pSlot->record = *pRecord;
+
+    __atomic_store_n(&pSlot->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Return the slot holding a published record for 'frameId', or NULL if
+ * it has been overwritten or is not yet published.
+ */
+static struct TelemetrySlot *FindSlot(struct Telemetry *pTelemetry,
+                                      uint64_t frameId)
+{
+    struct TelemetrySlot *pSlot =
+        &pTelemetry->pRing->slots[frameId % TELEMETRY_RING_SIZE];
+
+    if ((frameId >= pTelemetry->pRing->published) ||
+        (pSlot->record.frameId != frameId)) {
+        return NULL;
+    }
+
+    return pSlot;
+}
+
+
+/*
+ * Create the shared memory object 'name' (e.g., "/eglkms"), and map the
+ * ring into it.  Return NULL on failure.
+ */
+struct Telemetry *StartTelemetry(const char *name)
+{
+    struct Telemetry *pTelemetry = calloc(1, sizeof(*pTelemetry));
+    struct TelemetryRing *pRing;
+    int fd;
+
+    if (pTelemetry == NULL) {
+        SetError("Memory allocation failure.\n");
+        return NULL;
+    }
+
+    snprintf(pTelemetry->name, sizeof(pTelemetry->name), "%s%s",
+             (name[0] == '/') ? "" : "/", name);
+
+    fd = shm_open(pTelemetry->name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0) {
+        SetError("Unable to create shared memory object %s: %s.\n",
+                 pTelemetry->name, strerror(errno));
+        free(pTelemetry);
+        return NULL;
+    }
+
+    if (ftruncate(fd, sizeof(*pRing)) != 0) {
+        SetError("Unable to size shared memory object %s: %s.\n",
+                 pTelemetry->name, strerror(errno));
+        goto fail;
+    }
+
+    pRing = mmap(NULL, sizeof(*pRing), PROT_READ | PROT_WRITE, MAP_SHARED,
+                 fd, 0);
+
+    if (pRing == MAP_FAILED) {
+        SetError("Unable to map shared memory object %s: %s.\n",
+                 pTelemetry->name, strerror(errno));
+        goto fail;
+    }
+
+    close(fd);
+
+    pRing->numSlots = TELEMETRY_RING_SIZE;
+    pRing->slotSize = sizeof(struct TelemetrySlot);
+    pRing->version = TELEMETRY_VERSION;
+    pRing->writerPid = getpid();
+    __atomic_store_n(&pRing->magic, TELEMETRY_MAGIC, __ATOMIC_RELEASE);
+
+    pTelemetry->pRing = pRing;
+
+    return pTelemetry;
+
+fail:
+    close(fd);
+    shm_unlink(pTelemetry->name);
+    free(pTelemetry);
+    return NULL;
+}
+
+
+/*
+ * Mark the ring as abandoned, and remove its name.  Readers that have
+ * it mapped can still read the last records.
+ */
+void StopTelemetry(struct Telemetry *pTelemetry)
+{
+    __atomic_store_n(&pTelemetry->pRing->writerPid, 0, __ATOMIC_RELEASE);
+
+    munmap(pTelemetry->pRing, sizeof(*pTelemetry->pRing));
+    shm_unlink(pTelemetry->name);
+
+    free(pTelemetry);
+}
+
+
+/*
+ * Timer queries need OpenGL 3.3, or ARB_timer_query; without them,
+ * records carry no GPU time.  From OpenGL 3.0, extensions are listed
+ * by glGetStringi(), as core profiles lack glGetString(GL_EXTENSIONS).
+ */
+static int GpuTimersSupported(void)
+{
+    const char *version = (const char *) glGetString(GL_VERSION);
+    int major, minor;
+    GLint count = 0, i;
+
+    if ((version == NULL) || (sscanf(version, "%d.%d", &major, &minor) != 2)) {
+        return 0;
+    }
+
+    if ((major > 3) || ((major == 3) && (minor >= 3))) {
+        return 1;
+    }
+
+    if (major < 3) {
+        return ExtensionIsSupported(
+            (const char *) glGetString(GL_EXTENSIONS), "GL_ARB_timer_query");
+    }
+
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+
+    for (i = 0; i < count; i++) {
+        if (strcmp((const char *) glGetStringi(GL_EXTENSIONS, i),
+                   "GL_ARB_timer_query") == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Create the GPU timer queries in the current context.
+ */
+void AttachTelemetry(struct Telemetry *pTelemetry)
+{
+    int i;
+
+    pTelemetry->gpuTimers = GpuTimersSupported();
+    pTelemetry->oldestTimer = 0;
+    pTelemetry->timersPending = 0;
+    pTelemetry->pActiveTimer = NULL;
+
+    if (!pTelemetry->gpuTimers) {
+        return;
+    }
+
+    for (i = 0; i < TELEMETRY_GPU_QUERIES; i++) {
+        glGenQueries(1, &pTelemetry->timers[i].query);
+    }
+}
+
+
+/*
+ * Delete the GPU timer queries; frames whose GPU time is still pending
+ * keep a GPU time of 0.  Call with the context passed to
+ * AttachTelemetry() current.
+ */
+void DetachTelemetry(struct Telemetry *pTelemetry)
+{
+    int i;
+
+    if (!pTelemetry->gpuTimers) {
+        return;
+    }
+
+    for (i = 0; i < TELEMETRY_GPU_QUERIES; i++) {
+        glDeleteQueries(1, &pTelemetry->timers[i].query);
+    }
+
+    pTelemetry->gpuTimers = 0;
+}
+
+
+/*
+ * Record the GPU times that have become available, oldest first.
+ */
+static void PollGpuTimers(struct Telemetry *pTelemetry)
+{
+    while (pTelemetry->timersPending > 0) {
+        struct GpuTimer *pTimer =
+            &pTelemetry->timers[pTelemetry->oldestTimer];
+        struct TelemetrySlot *pSlot;
+        GLint available = 0;
+        GLuint64 elapsed;
+
+        glGetQueryObjectiv(pTimer->query, GL_QUERY_RESULT_AVAILABLE,
+                           &available);
+
+        if (!available) {
+            break;
+        }
+
+        glGetQueryObjectui64v(pTimer->query, GL_QUERY_RESULT, &elapsed);
+
+        pSlot = FindSlot(pTelemetry, pTimer->frameId);
+
+        if (pSlot != NULL) {
+            struct TelemetryRecord record = pSlot->record;
+
+            record.gpuTimeNs = elapsed;
+            WriteSlot(pSlot, &record);
+        }
+
+        pTelemetry->oldestTimer =
+            (pTelemetry->oldestTimer + 1) % TELEMETRY_GPU_QUERIES;
+        pTelemetry->timersPending--;
+    }
+}
+
+
+/*
+ * Start a frame: return its ID, and start timing its drawing on the
+ * GPU, if a timer query is free.
+ */
+uint64_t BeginTelemetryFrame(struct Telemetry *pTelemetry)
+{
+    uint64_t frameId = pTelemetry->nextFrameId++;
+
+    if (pTelemetry->gpuTimers) {
+        PollGpuTimers(pTelemetry);
+
+        if (pTelemetry->timersPending < TELEMETRY_GPU_QUERIES) {
+            struct GpuTimer *pTimer =
+                &pTelemetry->timers[(pTelemetry->oldestTimer +
+                                     pTelemetry->timersPending) %
+                                    TELEMETRY_GPU_QUERIES];
+
+            glBeginQuery(GL_TIME_ELAPSED, pTimer->query);
+
+            pTimer->frameId = frameId;
+            pTelemetry->pActiveTimer = pTimer;
+        }
+    }
+
+    return frameId;
+}
+
+
+/*
+ * Stop timing the frame's drawing.  Call after its OpenGL commands are
+ * issued, before presenting it.
+ */
+void EndTelemetryDraw(struct Telemetry *pTelemetry)
+{
+    if (pTelemetry->pActiveTimer != NULL) {
+        glEndQuery(GL_TIME_ELAPSED);
+
+        pTelemetry->pActiveTimer = NULL;
+        pTelemetry->timersPending++;
+    }
+}
+
+
+/*
+ * Publish the record for a frame once it is presented.  Times are in
+ * seconds, as returned by GetTime().
+ */
+void PublishTelemetryFrame(struct Telemetry *pTelemetry, uint64_t frameId,
+                           double cpuStart, double cpuEnd, double swapReturn)
+{
+    struct TelemetryRing *pRing = pTelemetry->pRing;
+    struct TelemetryRecord record;
+
+    memset(&record, 0, sizeof(record));
+
+    record.frameId = frameId;
+    record.cpuStartNs = TimeToNs(cpuStart);
+    record.cpuEndNs = TimeToNs(cpuEnd);
+    record.swapReturnNs = TimeToNs(swapReturn);
+
+    WriteSlot(&pRing->slots[frameId % TELEMETRY_RING_SIZE], &record);
+
+    __atomic_store_n(&pRing->published, frameId + 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Record when a published frame's page flip completed, for backends
+ * that perform the flips.  Frames replaced before reaching the screen
+ * keep a flip time of 0.
+ *
+ * 'flipTime' is the page flip event's timestamp, in seconds on
+ * CLOCK_MONOTONIC; it is moved onto GetTime()'s clock, which the rest
+ * of the record uses.
+ */
+void SetTelemetryFlipTime(struct Telemetry *pTelemetry, uint64_t frameId,
+                          double flipTime)
+{
+    struct TelemetrySlot *pSlot = FindSlot(pTelemetry, frameId);
+
+    if (pSlot != NULL) {
+        struct TelemetryRecord record = pSlot->record;
+
+        record.flipNs = TimeToNs(flipTime + GetTime() - GetMonotonicTime());
+        WriteSlot(pSlot, &record);
+    }
+}
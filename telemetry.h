@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#if !defined(TELEMETRY_H)
+#define TELEMETRY_H
+
+#include <stdint.h>
+
+/*
+ * Per-frame telemetry, published to a POSIX shared memory object that
+ * other processes can map and read without locks and without
+ * affecting the render thread; see telemetry.c, and
+ * telemetry-reader.c for a reader.
+ *
+ * The object holds a TelemetryRing.  Record N is stored in slot
+ * N % numSlots; 'published' is the number of records published so far.
+ * Each slot is a sequence lock: its 'sequence' is odd while the writer
+ * updates the record, and the writer never waits for readers.  A
+ * reader copies a record, and keeps the copy only if 'sequence' was
+ * the same even value before and after.
+ *
+ * A record is updated after it is published, when the frame's GPU time
+ * and page flip become known; fields that are not known are 0.  Times
+ * are in nanoseconds since the epoch, from GetTime().
+ */
+
+#define TELEMETRY_MAGIC 0x4b4c4754      /* "TGLK" */
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_RING_SIZE 1024
+
+struct TelemetryRecord {
+    uint64_t frameId;
+    uint64_t cpuStartNs;        /* the render thread started the frame */
+    uint64_t cpuEndNs;          /* its OpenGL commands were issued */
+    uint64_t swapReturnNs;      /* presenting it returned */
+    uint64_t flipNs;            /* its page flip completed */
+    uint64_t gpuTimeNs;         /* GPU time spent rendering it */
+};
+
+struct TelemetrySlot {
+    uint64_t sequence;
+    struct TelemetryRecord record;
+};
+
+struct TelemetryRing {
+    uint32_t magic;             /* TELEMETRY_MAGIC */
+    uint32_t version;           /* TELEMETRY_VERSION */
+    uint32_t numSlots;          /* TELEMETRY_RING_SIZE */
+    uint32_t slotSize;          /* sizeof(struct TelemetrySlot) */
+    uint64_t writerPid;         /* 0 once the writer has exited */
+    uint64_t published;
+    struct TelemetrySlot slots[TELEMETRY_RING_SIZE];
+};
+
+struct Telemetry;
+
+struct Telemetry *StartTelemetry(const char *name);
+void StopTelemetry(struct Telemetry *pTelemetry);
+
+void AttachTelemetry(struct Telemetry *pTelemetry);
+void DetachTelemetry(struct Telemetry *pTelemetry);
+
+uint64_t BeginTelemetryFrame(struct Telemetry *pTelemetry);
+void EndTelemetryDraw(struct Telemetry *pTelemetry);
+void PublishTelemetryFrame(struct Telemetry *pTelemetry, uint64_t frameId,
+                           double cpuStart, double cpuEnd, double swapReturn);
+void SetTelemetryFlipTime(struct Telemetry *pTelemetry, uint64_t frameId,
+                          double flipTime);
+
+#endif /* TELEMETRY_H */
@@ -28,7 +28,47 @@
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/time.h>
+#include <sys/resource.h>
+
+
+/*
+ * Why the last function on this thread to fail failed; see SetError().
+ */
+static __thread char errorMessage[256];
+
+
+/*
+ * Record why a function is returning failure, for its caller to report
+ * with GetError().  Like eglGetError(), this is per thread, and is only
+ * meaningful right after a function has returned failure.
+ *
+ * Only the executable (main.c and options.c) and the compositor it runs
+ * end the process with Fatal(); everything else returns failure, having
+ * released what it set up, so that a library caller can retry a
+ * pipeline, or give up on it, and keep its other pipelines running.
+ */
+void SetError(const char *format, ...)
+{
+    char message[sizeof(errorMessage)];
+    va_list ap;
+
+    /* 'format' may be "...%s..." with GetError(). */
+    va_start(ap, format);
+    vsnprintf(message, sizeof(message), format, ap);
+    va_end(ap);
+
+    memcpy(errorMessage, message, sizeof(errorMessage));
+}
+
+
+const char *GetError(void)
+{
+    return errorMessage;
+}
 
 
 void Fatal(const char *format, ...)
@@ -45,6 +85,84 @@ void Fatal(const char *format, ...)
 }
 
 
+void Warning(const char *format, ...)
+{
+    va_list ap;
+
+    fprintf(stderr, "WARNING: ");
+
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+}
+
+
+int OrientationIsIdentity(const struct Orientation *pOrientation)
+{
+    return (pOrientation->degrees == 0) &&
+           !pOrientation->reflectX && !pOrientation->reflectY;
+}
+
+
+/*
+ * Grow 'pDst' to the bounding box of 'pDst' and 'pSrc'.
+ */
+void UnionRect(struct Rect *pDst, const struct Rect *pSrc)
+{
+    int x1, y1;
+
+    if ((pSrc->width <= 0) || (pSrc->height <= 0)) {
+        return;
+    }
+
+    if ((pDst->width <= 0) || (pDst->height <= 0)) {
+        *pDst = *pSrc;
+        return;
+    }
+
+    x1 = pDst->x + pDst->width;
+    y1 = pDst->y + pDst->height;
+
+    if (pSrc->x + pSrc->width > x1) {
+        x1 = pSrc->x + pSrc->width;
+    }
+
+    if (pSrc->y + pSrc->height > y1) {
+        y1 = pSrc->y + pSrc->height;
+    }
+
+    if (pSrc->x < pDst->x) {
+        pDst->x = pSrc->x;
+    }
+
+    if (pSrc->y < pDst->y) {
+        pDst->y = pSrc->y;
+    }
+
+    pDst->width = x1 - pDst->x;
+    pDst->height = y1 - pDst->y;
+}
+
+
+/*
+ * Fold 'size' bytes into 'hash' (start with HASH_INIT), with 64-bit
+ * FNV-1a.  Not cryptographic: it only needs to tell apart the inputs
+ * that one machine sees.
+ */
+uint64_t HashBytes(uint64_t hash, const void *pData, size_t size)
+{
+    const uint8_t *pBytes = pData;
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        hash ^= pBytes[i];
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+
 double GetTime(void)
 {
     struct timeval tv;
@@ -55,27 +173,91 @@ double GetTime(void)
 }
 
 
-void PrintFps(void)
+/*
+ * Return CLOCK_MONOTONIC in seconds: the clock of DRM page flip and
+ * evdev timestamps.
+ */
+double GetMonotonicTime(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1000000000.0);
+}
+
+
+/*
+ * Return the user plus system CPU time consumed by this process so far,
+ * in seconds.
+ */
+double GetCpuTime(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+           ((usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0);
+}
+
+
+/*
+ * Block until the given sync file (e.g., a GPU fence from
+ * EGL_ANDROID_native_fence_sync, or a KMS out fence) signals.  Return
+ * 0, or -1 if it cannot be waited for.
+ */
+int WaitForFence(int fenceFd)
+{
+    struct pollfd pfd = {
+        .fd = fenceFd,
+        .events = POLLIN,
+    };
+
+    while (1) {
+        int ret = poll(&pfd, 1, -1);
+
+        if (ret > 0) {
+            if (pfd.revents & (POLLERR | POLLNVAL)) {
+                SetError("Error waiting for fence.\n");
+                return -1;
+            }
+            return 0;
+        }
+
+        if ((ret < 0) && (errno != EINTR) && (errno != EAGAIN)) {
+            SetError("poll(2) on fence failed: %s.\n", strerror(errno));
+            return -1;
+        }
+    }
+}
+
+
+void ResetFpsCounter(struct FpsCounter *pFps)
+{
+    pFps->frames = 0;
+    pFps->startTime = -1;
+}
+
+
+void PrintFps(struct FpsCounter *pFps)
 {
-    static int frames = 0;
-    static double startTime = -1;
     double seconds, currentTime = GetTime();
 
-    if (startTime < 0) {
-        startTime = currentTime;
+    if (pFps->startTime < 0) {
+        pFps->startTime = currentTime;
     }
 
-    frames++;
+    pFps->frames++;
 
-    seconds = currentTime - startTime;
+    seconds = currentTime - pFps->startTime;
 
     if (seconds > 5.0) {
-        double fps = frames / seconds;
+        double fps = pFps->frames / seconds;
         printf("%d frames in %3.1f seconds = %6.3f FPS\n",
-               frames, seconds, fps);
+               pFps->frames, seconds, fps);
         fflush(stdout);
-        startTime = currentTime;
-        frames = 0;
+        pFps->startTime = currentTime;
+        pFps->frames = 0;
     }
 }
 
@@ -114,46 +296,139 @@ EGLBoolean ExtensionIsSupported(const char *extensionString,
 }
 
 
-static void *GetProcAddress(const char *functionName)
+/*
+ * Return NULL, with the reason for GetError(), if 'functionName' is
+ * not found.
+ */
+void *GetProcAddress(const char *functionName)
 {
     void *ptr = (void *) eglGetProcAddress(functionName);
 
     if (ptr == NULL) {
-        Fatal("eglGetProcAddress(%s) failed.\n", functionName);
+        SetError("eglGetProcAddress(%s) failed.\n", functionName);
     }
 
     return ptr;
 }
 
 
-PFNEGLQUERYDEVICESEXTPROC pEglQueryDevicesEXT = NULL;
-PFNEGLQUERYDEVICESTRINGEXTPROC pEglQueryDeviceStringEXT = NULL;
-PFNEGLGETPLATFORMDISPLAYEXTPROC pEglGetPlatformDisplayEXT = NULL;
-PFNEGLGETOUTPUTLAYERSEXTPROC pEglGetOutputLayersEXT = NULL;
-PFNEGLCREATESTREAMKHRPROC pEglCreateStreamKHR = NULL;
-PFNEGLSTREAMCONSUMEROUTPUTEXTPROC pEglStreamConsumerOutputEXT = NULL;
-PFNEGLCREATESTREAMPRODUCERSURFACEKHRPROC pEglCreateStreamProducerSurfaceKHR = NULL;
+/*
+ * GetProcAddress(), counting the functions not found in '*pMissing'.
+ */
+static void *LoadProc(const char *functionName, int *pMissing)
+{
+    void *ptr = GetProcAddress(functionName);
 
-void GetEglExtensionFunctionPointers(void)
+    if (ptr == NULL) {
+        (*pMissing)++;
+    }
+
+    return ptr;
+}
+
+
+/*
+ * Fill in 'pEgl' for 'eglDpy': the client extension functions always,
+ * and, unless 'eglDpy' is EGL_NO_DISPLAY, the functions of each display
+ * extension that 'eglDpy' supports.  The functions of extensions that
+ * are missing are NULL; callers check for the extension before calling
+ * them, as they did before there was more than one display to check.
+ * Return -1, with the reason for GetError(), if an extension that
+ * 'eglDpy' supports lacks a function.
+ */
+int LoadEglDispatch(struct EglDispatch *pEgl, EGLDisplay eglDpy)
 {
-    pEglQueryDevicesEXT = (PFNEGLQUERYDEVICESEXTPROC)
-        GetProcAddress("eglQueryDevicesEXT");
+    const char *extensionString;
+    int missing = 0;
+
+    memset(pEgl, 0, sizeof(*pEgl));
+
+    pEgl->QueryDevicesEXT = (PFNEGLQUERYDEVICESEXTPROC)
+        eglGetProcAddress("eglQueryDevicesEXT");
+
+    pEgl->QueryDeviceStringEXT = (PFNEGLQUERYDEVICESTRINGEXTPROC)
+        eglGetProcAddress("eglQueryDeviceStringEXT");
+
+    pEgl->GetPlatformDisplayEXT = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+        eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+    if (eglDpy == EGL_NO_DISPLAY) {
+        return 0;
+    }
+
+    extensionString = eglQueryString(eglDpy, EGL_EXTENSIONS);
+
+    if (ExtensionIsSupported(extensionString, "EGL_EXT_output_base")) {
+        pEgl->GetOutputLayersEXT = (PFNEGLGETOUTPUTLAYERSEXTPROC)
+            LoadProc("eglGetOutputLayersEXT", &missing);
+    }
+
+    if (ExtensionIsSupported(extensionString, "EGL_KHR_stream")) {
+        pEgl->CreateStreamKHR = (PFNEGLCREATESTREAMKHRPROC)
+            LoadProc("eglCreateStreamKHR", &missing);
+
+        pEgl->DestroyStreamKHR = (PFNEGLDESTROYSTREAMKHRPROC)
+            LoadProc("eglDestroyStreamKHR", &missing);
+
+        pEgl->QueryStreamKHR = (PFNEGLQUERYSTREAMKHRPROC)
+            LoadProc("eglQueryStreamKHR", &missing);
+
+        pEgl->QueryStreamu64KHR = (PFNEGLQUERYSTREAMU64KHRPROC)
+            LoadProc("eglQueryStreamu64KHR", &missing);
+    }
+
+    if (ExtensionIsSupported(extensionString,
+                             "EGL_EXT_stream_acquire_mode")) {
+        pEgl->StreamConsumerAcquireAttribEXT =
+            (PFNEGLSTREAMCONSUMERACQUIREATTRIBEXTPROC)
+            LoadProc("eglStreamConsumerAcquireAttribEXT", &missing);
+    }
 
-    pEglQueryDeviceStringEXT = (PFNEGLQUERYDEVICESTRINGEXTPROC)
-        GetProcAddress("eglQueryDeviceStringEXT");
+    if (ExtensionIsSupported(extensionString,
+                             "EGL_EXT_stream_consumer_egloutput")) {
+        pEgl->StreamConsumerOutputEXT = (PFNEGLSTREAMCONSUMEROUTPUTEXTPROC)
+            LoadProc("eglStreamConsumerOutputEXT", &missing);
+    }
+
+    if (ExtensionIsSupported(extensionString,
+                             "EGL_KHR_stream_producer_eglsurface")) {
+        pEgl->CreateStreamProducerSurfaceKHR =
+            (PFNEGLCREATESTREAMPRODUCERSURFACEKHRPROC)
+            LoadProc("eglCreateStreamProducerSurfaceKHR", &missing);
+    }
+
+    if (ExtensionIsSupported(extensionString,
+                             "EGL_KHR_stream_cross_process_fd")) {
+        pEgl->GetStreamFileDescriptorKHR =
+            (PFNEGLGETSTREAMFILEDESCRIPTORKHRPROC)
+            LoadProc("eglGetStreamFileDescriptorKHR", &missing);
 
-    pEglGetPlatformDisplayEXT = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
-        GetProcAddress("eglGetPlatformDisplayEXT");
+        pEgl->CreateStreamFromFileDescriptorKHR =
+            (PFNEGLCREATESTREAMFROMFILEDESCRIPTORKHRPROC)
+            LoadProc("eglCreateStreamFromFileDescriptorKHR", &missing);
+    }
+
+    if (ExtensionIsSupported(extensionString,
+                             "EGL_ANDROID_native_fence_sync")) {
+        pEgl->CreateSyncKHR = (PFNEGLCREATESYNCKHRPROC)
+            LoadProc("eglCreateSyncKHR", &missing);
 
-    pEglGetOutputLayersEXT = (PFNEGLGETOUTPUTLAYERSEXTPROC)
-        GetProcAddress("eglGetOutputLayersEXT");
+        pEgl->DestroySyncKHR = (PFNEGLDESTROYSYNCKHRPROC)
+            LoadProc("eglDestroySyncKHR", &missing);
 
-    pEglCreateStreamKHR = (PFNEGLCREATESTREAMKHRPROC)
-        GetProcAddress("eglCreateStreamKHR");
+        pEgl->DupNativeFenceFDANDROID = (PFNEGLDUPNATIVEFENCEFDANDROIDPROC)
+            LoadProc("eglDupNativeFenceFDANDROID", &missing);
+    }
 
-    pEglStreamConsumerOutputEXT = (PFNEGLSTREAMCONSUMEROUTPUTEXTPROC)
-        GetProcAddress("eglStreamConsumerOutputEXT");
+    if (ExtensionIsSupported(extensionString,
+                             "EGL_KHR_swap_buffers_with_damage")) {
+        pEgl->SwapBuffersWithDamage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)
+            LoadProc("eglSwapBuffersWithDamageKHR", &missing);
+    } else if (ExtensionIsSupported(extensionString,
+                                    "EGL_EXT_swap_buffers_with_damage")) {
+        pEgl->SwapBuffersWithDamage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)
+            LoadProc("eglSwapBuffersWithDamageEXT", &missing);
+    }
 
-    pEglCreateStreamProducerSurfaceKHR = (PFNEGLCREATESTREAMPRODUCERSURFACEKHRPROC)
-        GetProcAddress("eglCreateStreamProducerSurfaceKHR");
+    return (missing > 0) ? -1 : 0;
 }
@@ -23,28 +23,117 @@
 #if !defined(UTILS_H)
 #define UTILS_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 
+/* XXX khronos eglext.h does not yet have EGL_EXT_stream_acquire_mode */
+#if !defined(EGL_EXT_stream_acquire_mode)
+#define EGL_CONSUMER_AUTO_ACQUIRE_EXT           0x332B
+#define EGL_RESOURCE_BUSY_EXT                   0x3353
+typedef EGLBoolean (EGLAPIENTRYP PFNEGLSTREAMCONSUMERACQUIREATTRIBEXTPROC)
+    (EGLDisplay dpy, EGLStreamKHR stream, const EGLAttrib *attrib_list);
+#endif
+
+/* XXX khronos eglext.h does not yet have EGL_NV_output_drm_flip_event */
+#if !defined(EGL_NV_output_drm_flip_event)
+#define EGL_DRM_FLIP_EVENT_DATA_NV              0x333E
+#endif
+
 #define ARRAY_LEN(_arr) (sizeof(_arr) / sizeof(_arr[0]))
 
+/*
+ * A rectangle in framebuffer pixels, with the origin at the bottom
+ * left (as in OpenGL and EGL_KHR_swap_buffers_with_damage).  A rectangle
+ * with zero width or height is empty.
+ */
+struct Rect {
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+/*
+ * How a display is mounted, and so how to turn each frame before
+ * scanning it out: reflect it across the x axis (flipping it left to
+ * right) if reflectX, and across the y axis (top to bottom) if
+ * reflectY, then rotate it 'degrees' counter-clockwise, one of 0, 90,
+ * 180, or 270.  All zero is the identity.
+ */
+struct Orientation {
+    int degrees;
+    int reflectX;
+    int reflectY;
+};
+
+int OrientationIsIdentity(const struct Orientation *pOrientation);
+
+void UnionRect(struct Rect *pDst, const struct Rect *pSrc);
+
+void SetError(const char *format, ...);
+const char *GetError(void);
+
 void Fatal(const char *format, ...);
+void Warning(const char *format, ...);
+
+/* The starting value for HashBytes(). */
+#define HASH_INIT 0xcbf29ce484222325ull
+
+uint64_t HashBytes(uint64_t hash, const void *pData, size_t size);
 
 double GetTime(void);
-void PrintFps(void);
+double GetMonotonicTime(void);
+double GetCpuTime(void);
+int WaitForFence(int fenceFd);
+
+/* The frames counted by PrintFps() since it last printed. */
+struct FpsCounter {
+    int frames;
+    double startTime;
+};
+
+void ResetFpsCounter(struct FpsCounter *pFps);
+void PrintFps(struct FpsCounter *pFps);
 
 EGLBoolean ExtensionIsSupported(
     const char *extensionString,
     const char *extension);
 
-void GetEglExtensionFunctionPointers(void);
+void *GetProcAddress(const char *functionName);
+
+/*
+ * The EGL extension functions this program calls, for one EGLDisplay;
+ * see LoadEglDispatch().  Each pipeline keeps the table of each
+ * EGLDisplay it uses, so that nothing about one display is assumed of
+ * another.
+ */
+struct EglDispatch {
+    /* Client extensions: usable before, and without, an EGLDisplay. */
+    PFNEGLQUERYDEVICESEXTPROC QueryDevicesEXT;
+    PFNEGLQUERYDEVICESTRINGEXTPROC QueryDeviceStringEXT;
+    PFNEGLGETPLATFORMDISPLAYEXTPROC GetPlatformDisplayEXT;
+
+    /* Display extensions: NULL unless the EGLDisplay supports them. */
+    PFNEGLGETOUTPUTLAYERSEXTPROC GetOutputLayersEXT;
+    PFNEGLCREATESTREAMKHRPROC CreateStreamKHR;
+    PFNEGLDESTROYSTREAMKHRPROC DestroyStreamKHR;
+    PFNEGLQUERYSTREAMKHRPROC QueryStreamKHR;
+    PFNEGLQUERYSTREAMU64KHRPROC QueryStreamu64KHR;
+    PFNEGLSTREAMCONSUMERACQUIREATTRIBEXTPROC StreamConsumerAcquireAttribEXT;
+    PFNEGLSTREAMCONSUMEROUTPUTEXTPROC StreamConsumerOutputEXT;
+    PFNEGLCREATESTREAMPRODUCERSURFACEKHRPROC CreateStreamProducerSurfaceKHR;
+    PFNEGLGETSTREAMFILEDESCRIPTORKHRPROC GetStreamFileDescriptorKHR;
+    PFNEGLCREATESTREAMFROMFILEDESCRIPTORKHRPROC
+        CreateStreamFromFileDescriptorKHR;
+    PFNEGLCREATESYNCKHRPROC CreateSyncKHR;
+    PFNEGLDESTROYSYNCKHRPROC DestroySyncKHR;
+    PFNEGLDUPNATIVEFENCEFDANDROIDPROC DupNativeFenceFDANDROID;
+    PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC SwapBuffersWithDamage;
+};
 
-extern PFNEGLQUERYDEVICESEXTPROC pEglQueryDevicesEXT;
-extern PFNEGLQUERYDEVICESTRINGEXTPROC pEglQueryDeviceStringEXT;
-extern PFNEGLGETPLATFORMDISPLAYEXTPROC pEglGetPlatformDisplayEXT;
-extern PFNEGLGETOUTPUTLAYERSEXTPROC pEglGetOutputLayersEXT;
-extern PFNEGLCREATESTREAMKHRPROC pEglCreateStreamKHR;
-extern PFNEGLSTREAMCONSUMEROUTPUTEXTPROC pEglStreamConsumerOutputEXT;
-extern PFNEGLCREATESTREAMPRODUCERSURFACEKHRPROC pEglCreateStreamProducerSurfaceKHR;
+int LoadEglDispatch(struct EglDispatch *pEgl, EGLDisplay eglDpy);
 
 #endif /* UTILS_H */